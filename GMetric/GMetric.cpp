@@ -12,6 +12,10 @@
 #include <iolocks>
 
 #include "GMetric.hpp"
+#include "IOGraphicsDiagnose.h"
+#if ENABLE_TELEMETRY
+#include "IOGraphicsKTrace.h"  // *_FID_* of the latency slots
+#endif
 
 #include <mach/mach_time.h>
 #include <IOKit/IOLib.h>
@@ -22,12 +26,20 @@
 __BEGIN_DECLS
 #include <machine/cpu_number.h>
 __END_DECLS
+#include <kern/clock.h>
+#include <sys/sysctl.h>
 #include <IOKit/graphics/IOGraphicsPrivate.h>  // Debug logging macros
 
 #else  // !KERNEL
 
 #include <pthread.h>
+#include <unistd.h>
+#if __linux__
+#include <sched.h>
+#define cpu_number() sched_getcpu()  // Exercises latency slices off target
+#else
 #define cpu_number() (-1)
+#endif
 
 #define D(categ, name, args...) do{}while(0)  // Not needed in userland
 
@@ -44,6 +56,8 @@ using iog::LockGuard;
 namespace {
 
 const uint64_t kThreadIDMask = 0xffffff;  // 24 bits
+constexpr uint32_t kMaximumCPUSlices = 256;
+constexpr uint32_t kMinimumSliceLines = 64;
 
 struct Globals {
     IOLock *fLock;
@@ -52,6 +66,17 @@ struct Globals {
 } sGlobals;
 
 constexpr bool isPowerOf2(const uint64_t x) { return 0 == (x & (x-1)); }
+
+// The header is the first word of an entry and is published last
+_Atomic(uint64_t)* headerWord(gmetric_entry_t& metric)
+{
+    static_assert(sizeof(gmetric_header_t) == sizeof(uint64_t),
+                  "Header is not a word");
+    static_assert(offsetof(gmetric_entry_t, header) == 0,
+                  "Header is not first");
+    return reinterpret_cast<_Atomic(uint64_t)*>(&metric.header);
+}
+
 uint32_t nextPowerOf2(uint32_t x)
 {
     const uint64_t max32bit = UINT64_C(1) << 32;
@@ -59,11 +84,35 @@ uint32_t nextPowerOf2(uint32_t x)
     const auto shift = __builtin_clz(x-1);
     return (x <= 2) ? x : static_cast<uint32_t>(max32bit >> shift);
 }
+
+// Slices for per-CPU state. A power of 2 no smaller than the CPU count, so
+// that cpu_number() & (slices - 1) gives every CPU a slice of its own.
+uint32_t cpuSliceCount()
+{
+    int cpus = 0;
+#if KERNEL
+    size_t len = sizeof(cpus);
+    if (sysctlbyname("hw.logicalcpu_max", &cpus, &len, nullptr, 0))
+        cpus = 0;
+#else
+    cpus = static_cast<int>(sysconf(_SC_NPROCESSORS_CONF));
+#endif
+    if (cpus < 1)
+        cpus = 1;
+    return nextPowerOf2((static_cast<uint32_t>(cpus) < kMaximumCPUSlices)
+                        ? static_cast<uint32_t>(cpus) : kMaximumCPUSlices);
+}
 };  // namespace
 
 // GMetricsRecorder static variables
-/* static */ GMetricsRecorder*
+/* static */ _Atomic(GMetricsRecorder*)
     GMetricsRecorder::sRecorder;
+/* static */ _Atomic(GMetricsRecorder::Writers*)
+    GMetricsRecorder::sWriters;
+/* static */ uint32_t
+    GMetricsRecorder::sWritersMask;
+/* static */ atomic_uint_fast32_t
+    GMetricsRecorder::sEpoch;
 /* static */ _Atomic(gmetric_domain_t)
     GMetricsRecorder::sDomains = kGMETRICS_DOMAIN_NONE;
 
@@ -86,15 +135,29 @@ GMetricsRecorder::prepareForRecording(const uint64_t userClientEntries)
                 : kGMetricDefaultLineCount));
 
     LockGuard<IOLock> locked(sGlobals.fLock);
+    if (!static_cast<bool>(atomic_load(&sWriters))) {
+        const uint32_t slices = cpuSliceCount();
+        Writers* writers = IONew(Writers, slices);
+        if (!static_cast<bool>(writers))
+            return kIOReturnNoMemory;
+        for (uint32_t i = 0; i < slices; ++i) {
+            atomic_init(&writers[i].fCount[0], 0);
+            atomic_init(&writers[i].fCount[1], 0);
+        }
+        sWritersMask = slices - 1;
+        atomic_store(&sWriters, writers);  // Never released
+    }
     if (isReady()) {
-        if (entriesCount == sRecorder->fLineCount)
+        GMetricsRecorder* old = atomic_load(&sRecorder);
+        if (entriesCount == old->fLineCount)
             return kIOReturnSuccess;
-        OSSafeReleaseNULL(sRecorder);
+        old = quiesceLocked();
+        OSSafeReleaseNULL(old);
     }
     GMetricsRecorder* me = new GMetricsRecorder;
     if (me && (err = me->initWithCount(entriesCount)))
         OSSafeReleaseNULL(me);
-    sRecorder = me;
+    atomic_store(&sRecorder, me);
     DGM("(e=%lld) {re=%u} -> %x\n",
         userClientEntries, entriesCount, err);
     return err;
@@ -107,19 +170,68 @@ GMetricsRecorder::prepareForRecording(const uint64_t userClientEntries)
         const bool isEnabled = isDomainActive(kGMETRICS_DOMAIN_ENABLED);
         DGM(" cleanup with %s\n", isEnabled ? "reset" : "release");
         if (isEnabled)
-            sRecorder->resetLocked();
-        else
-            OSSafeReleaseNULL(sRecorder);
+            atomic_load(&sRecorder)->resetLocked();
+        else {
+            GMetricsRecorder* me = quiesceLocked();
+            OSSafeReleaseNULL(me);
+        }
     }
 }
 
+// Lock free, may be called from any context. The recorder can't be released
+// while a writer count is held, see quiesceLocked(). Only the current CPU's
+// count and line cursor are written, so CPUs don't contend for cache lines.
 /* static */ void
 GMetricsRecorder::record(const gmetric_domain_t domain,
                          const gmetric_event_t type, const uint64_t arg)
 {
-    LockGuard<IOLock> locked(sGlobals.fLock);
-    if (isReady())
-        sRecorder->recordLocked(domain, type, arg);
+    Writers* const cpuWriters = atomic_load(&sWriters);
+    if (!static_cast<bool>(cpuWriters))
+        return;  // Never prepared
+
+    // Only count in the slot of an epoch that is still current once counted,
+    // else a quiesce that flipped sEpoch in between would not wait for us.
+    // The count is released on the same CPU's slot even if we moved meanwhile.
+    atomic_uint_fast32_t* writers;
+    for (;;) {
+        const auto epoch = atomic_load(&sEpoch);
+        writers = &cpuWriters[cpu_number() & sWritersMask].fCount[epoch & 1];
+        atomic_fetch_add(writers, 1);
+        if (epoch == atomic_load(&sEpoch))
+            break;
+        atomic_fetch_sub(writers, 1);
+    }
+    GMetricsRecorder* me = atomic_load(&sRecorder);
+    if (static_cast<bool>(me))
+        me->recordEntry(domain, type, arg);
+    atomic_fetch_sub(writers, 1);
+}
+
+// Detach the recorder from record() and wait for writers that may still be
+// using it. The caller owns the returned recorder, if any.
+// Flipping sEpoch moves new writers to the other counters, so only the
+// writers already in flight are waited for. record() rechecks sEpoch after
+// counting itself, so a writer that counted in an old slot either is seen
+// here or backs out and counts again in a new one. Each CPU's count only
+// holds writers that counted there, so the old counts are summed after the
+// flip, and only reach zero once every one of those writers is done.
+/* static */ GMetricsRecorder* GMetricsRecorder::quiesceLocked()
+{
+    iog::locking_primitives::assertLocked(sGlobals.fLock);
+    GMetricsRecorder* me = atomic_exchange(&sRecorder, nullptr);
+    const auto epoch = atomic_fetch_add(&sEpoch, 1);
+    Writers* const cpuWriters = atomic_load(&sWriters);
+    if (!static_cast<bool>(cpuWriters))
+        return me;
+    for (;;) {
+        uint64_t inFlight = 0;
+        for (uint32_t i = 0; i <= sWritersMask; ++i)
+            inFlight += atomic_load(&cpuWriters[i].fCount[epoch & 1]);
+        if (!inFlight)
+            break;
+        IOSleep(1);
+    }
+    return me;
 }
 
 // Setting domain to kGMETRICS_DOMAIN_NONE will halt further data collection
@@ -137,6 +249,8 @@ void GMetricsRecorder::free()
     // Can't be in use as free will only be called if sRecorder is empty
     if (fBuffer)
         IODelete(fBuffer, gmetric_entry_t, fLineCount);
+    if (fSlices)
+        IODelete(fSlices, Slice, fSliceCount);
     super::free();
 }
 
@@ -151,8 +265,22 @@ IOReturn GMetricsRecorder::initWithCount(const uint32_t lineCount)
     ||  !isPowerOf2(lineCount))
         return kIOReturnInternalError;  // prepareForRecording screwed up
 
-    // Enforce power of 2-ness for '&' masked modulo
+    // Enforce power of 2-ness for '&' masked modulo. Each CPU gets its own
+    // slice of the buffer, unless that would make slices tiny.
+    const uint32_t maxSlices = lineCount / kMinimumSliceLines;
+    const uint32_t cpuSlices = sWritersMask + 1;
     fLineCount = lineCount;
+    fSliceCount = maxSlices ? ((cpuSlices < maxSlices) ? cpuSlices : maxSlices)
+                            : 1;
+    fSliceLines = fLineCount / fSliceCount;
+
+    fSlices = IONew(Slice, fSliceCount);
+    if (!static_cast<bool>(fSlices)) {
+        fSliceCount = 0;
+        return kIOReturnNoMemory;
+    }
+    for (uint32_t i = 0; i < fSliceCount; ++i)
+        atomic_init(&fSlices[i].fNextLine, 0);
 
     fBuffer = IONew(gmetric_entry_t, fLineCount);
     if (static_cast<bool>(fBuffer)) {
@@ -164,8 +292,10 @@ IOReturn GMetricsRecorder::initWithCount(const uint32_t lineCount)
 }
 
 
-// Must be called with the global lock held
-void GMetricsRecorder::recordLocked(
+// Lock free. Each caller claims its own slot in its CPU's slice, fills it and
+// then publishes it by storing the header word, which is never zero for a
+// recorded metric, last. A full slice drops metrics even if others have room.
+void GMetricsRecorder::recordEntry(
         const gmetric_domain_t domain, const gmetric_event_t type,
         const uint64_t arg1)
 {
@@ -174,30 +304,43 @@ void GMetricsRecorder::recordLocked(
         uint64_t tid;
 #if KERNEL
         tid = thread_tid(current_thread());
-#else
+#elif __APPLE__
         pthread_threadid_np(NULL, &tid);
+#else
+        tid = static_cast<uint64_t>(gettid());
 #endif
         return tid;
     };
 
-    iog::locking_primitives::assertLocked(sGlobals.fLock);
-    const auto i = fNextLine++;
-    if (i < fLineCount) {
-        gmetric_entry_t& metric = fBuffer[i];
-        metric.header.type = type;
-        metric.header.domain = domain;
-        metric.header.cpu = cpu_number();
+    const uint32_t cpu = static_cast<uint32_t>(cpu_number());
+    const uint32_t slice = cpu & (fSliceCount - 1);
+    const auto i = atomic_fetch_add(&fSlices[slice].fNextLine, 1);
+    if (i < fSliceLines) {
+        gmetric_entry_t& metric = fBuffer[slice * fSliceLines + i];
+        gmetric_header_t header;
+        uint64_t headerBits;
+        header.type = type;
+        header.domain = domain;
+        header.cpu = cpu;
+        memcpy(&headerBits, &header, sizeof(headerBits));
         metric.tid = threadID() & kThreadIDMask;
         metric.timestamp = mach_continuous_time();
         metric.data = arg1;
+        atomic_store_explicit(headerWord(metric), headerBits,
+                              memory_order_release);
     }
 }
 
 IOReturn GMetricsRecorder::resetLocked()
 {
     iog::locking_primitives::assertLocked(sGlobals.fLock);
+    // Writers must be out of the buffer before the slots can be reused
+    GMetricsRecorder* me = quiesceLocked();
+    assert(me == this);
     bzero(fBuffer, fBufferSize);
-    fNextLine = 0;
+    for (uint32_t i = 0; i < fSliceCount; ++i)
+        atomic_store(&fSlices[i].fNextLine, 0);
+    atomic_store(&sRecorder, me);
     return kIOReturnSuccess;
 }
 
@@ -215,17 +358,56 @@ IOReturn GMetricsRecorder::copyOutLocked(IOMemoryDescriptor* outDesc)
     if (len < dataOffset)
         return kIOReturnBadArgument;  // Out buffer is too small for header
 
-    const IOByteCount filledLen = fNextLine * sizeof(*fBuffer);
-    const IOByteCount bufferLen
-        = (filledLen < fBufferSize) ? filledLen : fBufferSize;
-    const IOByteCount copyLen   = (dataLen < bufferLen) ? dataLen : bufferLen;
-    if (copyLen)
-        (void) outDesc->writeBytes(dataOffset, fBuffer, copyLen);
+    // Writers are still active, only copy each slice's prefix of published
+    // slots. A published slot is never written again until resetLocked().
+    // The slices are merged oldest first.
+    uint32_t* const heads = IONew(uint32_t, 2 * fSliceCount);
+    if (!static_cast<bool>(heads))
+        return kIOReturnNoMemory;
+    uint32_t* const ends = heads + fSliceCount;
+    uint64_t nextLine = 0;
+    for (uint32_t s = 0; s < fSliceCount; ++s) {
+        const uint32_t next
+            = static_cast<uint32_t>(atomic_load(&fSlices[s].fNextLine));
+        const uint32_t claimed = (next < fSliceLines) ? next : fSliceLines;
+        gmetric_entry_t* const base = &fBuffer[s * fSliceLines];
+        uint32_t published = 0;
+        while (published < claimed
+           &&  atomic_load_explicit(headerWord(base[published]),
+                                    memory_order_acquire))
+            ++published;
+        heads[s] = 0;
+        ends[s] = published;
+        nextLine += next;
+    }
+
+    const IOByteCount room = dataLen / sizeof(*fBuffer);
+    uint32_t copied = 0;
+    while (copied < room) {
+        const gmetric_entry_t* oldest = nullptr;
+        uint32_t oldestSlice = 0;
+        for (uint32_t s = 0; s < fSliceCount; ++s) {
+            if (heads[s] == ends[s])
+                continue;
+            const gmetric_entry_t* head = &fBuffer[s * fSliceLines + heads[s]];
+            if (!oldest || head->timestamp < oldest->timestamp) {
+                oldest = head;
+                oldestSlice = s;
+            }
+        }
+        if (!oldest)
+            break;
+        (void) outDesc->writeBytes(dataOffset + copied * sizeof(*fBuffer),
+                                   oldest, sizeof(*fBuffer));
+        ++heads[oldestSlice];
+        ++copied;
+    }
+    IODelete(heads, uint32_t, 2 * fSliceCount);
 
     bzero(&metricBuffer, sizeof(metricBuffer));
-    metricBuffer.fHeader.fEntriesCount = fNextLine;
-    metricBuffer.fHeader.fCopiedCount
-        = static_cast<uint32_t>(copyLen / sizeof(gmetric_entry_t));
+    metricBuffer.fHeader.fEntriesCount = (nextLine < UINT32_MAX)
+        ? static_cast<uint32_t>(nextLine) : UINT32_MAX;
+    metricBuffer.fHeader.fCopiedCount = copied;
     (void) outDesc->writeBytes(hdrOffset, &metricBuffer, sizeof(metricBuffer));
 
     return kIOReturnSuccess;
@@ -287,7 +469,7 @@ IOReturn GMetricsRecorder::copyOutLocked(IOMemoryDescriptor* outDesc)
     if (isDomainActive(kGMETRICS_DOMAIN_ENABLED)) {
         LockGuard<IOLock> locked(sGlobals.fLock);
         if (isReady())
-            err = sRecorder->resetLocked();
+            err = atomic_load(&sRecorder)->resetLocked();
     }
     DGM(" -> %x\n", err);
     return err;
@@ -299,10 +481,414 @@ IOReturn GMetricsRecorder::copyOutLocked(IOMemoryDescriptor* outDesc)
     if ( GMetricsRecorder::isDomainActive(kGMETRICS_DOMAIN_ENABLED)) {
         LockGuard<IOLock> locked(sGlobals.fLock);
         if (isReady())
-            err = sRecorder->copyOutLocked(outDesc);
+            err = atomic_load(&sRecorder)->copyOutLocked(outDesc);
     }
     DGM("(mdl=%llu) -> %x\n", outDesc->getLength(), err);
     return err;
 }
 
+#pragma mark - GLatencyRecorder
+
+#if ENABLE_TELEMETRY
+
+namespace {
+
+constexpr uint32_t kLatencyStarts = 128;  // Power of 2, STARTs in flight
+constexpr uint32_t kLatencyProbes = 8;
+constexpr uint32_t kLatencyStaleSeconds = 60;  // START without END, reusable
+constexpr uint32_t kLatencyTracked = IOGRAPHICS_LATENCY_FUNCTIONS;
+constexpr uint8_t  kLatencyUntracked = 0xff;  // Latency::fIndex, no room left
+static_assert(kLatencyTracked < kLatencyUntracked, "Tracked index overflow");
+
+// Function slots for each Ariadne class, indexed by *_TELEMETRY_START / 2.
+// Rounded up from the largest *_FID_*, see the static_asserts below.
+constexpr uint16_t kLatencyClassFunctions[] = {
+     24,  // IODISPLAYWRANGLER
+     32,  // IODISPLAY
+      8,  // IODISPLAYCONNECT
+     24,  // IOFBCONTROLLER
+    256,  // IOFRAMEBUFFER
+      8,  // IOFRAMEBUFFERPARAMETERHANDLER
+     48,  // FRAMEBUFFER
+     24,  // APPLEBACKLIGHT
+     24,  // IOFBUSERCLIENT
+     16,  // IOFBSHAREDUSERCLIENT
+     24,  // IOI2INTERFACEUSERCLIENT
+      8,  // IOI2INTERFACE
+     16,  // IOFBI2INTERFACE
+     16,  // IOBOOTFRAMEBUFFER
+      0,  // IONDRVFRAMEBUFFER, separate kext
+      8,  // IOACCELERATOR
+     16,  // IOACCELERATORUSERCLIENT
+     16,  // IOGDIAGNOSTICUSERCLIENT
+};
+constexpr uint32_t kLatencyClasses = sizeof(kLatencyClassFunctions)
+                                   / sizeof(kLatencyClassFunctions[0]);
+
+// The largest *_FID_* of each class must have a slot, update both together
+#define LATENCY_COVERS(_class_, _fid_) \
+    static_assert((_fid_) < kLatencyClassFunctions[(_class_) / 2], \
+                  #_fid_ " has no latency slot")
+LATENCY_COVERS(IODISPLAYWRANGLER_TELEMETRY_START, IODW_FID_setProperties);
+LATENCY_COVERS(IODISPLAY_TELEMETRY_START, IOD_FID_powerStateForDomainState);
+LATENCY_COVERS(IODISPLAYCONNECT_TELEMETRY_START, IODC_FID_joinPMtree);
+LATENCY_COVERS(IOFBCONTROLLER_TELEMETRY_START,
+               IOFBC_FID_messageConnectionChange);
+LATENCY_COVERS(IOFRAMEBUFFER_TELEMETRY_START, IOFB_FID_restoreTimer);
+LATENCY_COVERS(IOFRAMEBUFFERPARAMETERHANDLER_TELEMETRY_START,
+               IOFBPH_FID_doUpdate);
+LATENCY_COVERS(FRAMEBUFFER_TELEMETRY_START, FB_FID_setGammaTableRanges);
+LATENCY_COVERS(APPLEBACKLIGHT_TELEMETRY_START, ABL_FID_framebufferEvent);
+LATENCY_COVERS(IOFBUSERCLIENT_TELEMETRY_START, IOFBUC_FID_free);
+LATENCY_COVERS(IOFBSHAREDUSERCLIENT_TELEMETRY_START, IOFBSUC_FID_stop);
+LATENCY_COVERS(IOI2INTERFACEUSERCLIENT_TELEMETRY_START, IOI2CUC_FID_free);
+LATENCY_COVERS(IOI2INTERFACE_TELEMETRY_START, IOI2C_FID_newUserClient);
+LATENCY_COVERS(IOFBI2INTERFACE_TELEMETRY_START, IOFBI2C_FID_free);
+LATENCY_COVERS(IOBOOTFRAMEBUFFER_TELEMETRY_START, IOBFB_FID_setCLUTWithEntries);
+LATENCY_COVERS(IOACCELERATOR_TELEMETRY_START, IOA_FID_releaseAccelID);
+LATENCY_COVERS(IOACCELERATORUSERCLIENT_TELEMETRY_START, IOAUC_FID_extDestroy);
+LATENCY_COVERS(IOGDIAGNOSTICUSERCLIENT_TELEMETRY_START, IOGDUC_FID_metrics);
+static_assert(IOGDIAGNOSTICUSERCLIENT_TELEMETRY_START / 2 + 1
+              == kLatencyClasses, "Ariadne class without latency slots");
+#undef LATENCY_COVERS
+
+constexpr uint32_t latencyClassBase(const uint32_t classIndex)
+{
+    return classIndex
+        ? latencyClassBase(classIndex - 1)
+            + kLatencyClassFunctions[classIndex - 1]
+        : 0;
+}
+constexpr uint32_t kLatencyFunctions = latencyClassBase(kLatencyClasses);
+static_assert(kLatencyFunctions < UINT16_MAX, "Slot overflow");
+
+// Slot of a function or kLatencyFunctions if it isn't recorded
+uint32_t latencySlot(const uint16_t classID, const uint16_t functionID)
+{
+    const uint32_t classIndex = classID / 2u;
+    if (!(classID & 1) || classIndex >= kLatencyClasses
+    ||  functionID >= kLatencyClassFunctions[classIndex])
+        return kLatencyFunctions;
+    return latencyClassBase(classIndex) + functionID;
+}
+
+uint32_t latencyBucket(const uint64_t duration)
+{
+    if (duration < (UINT64_C(1) << IOGRAPHICS_LATENCY_BUCKET_SHIFT))
+        return 0;
+    const uint32_t log2 = 63 - __builtin_clzll(duration);
+    const uint32_t bucket = log2 - IOGRAPHICS_LATENCY_BUCKET_SHIFT + 1;
+    return (bucket < IOGRAPHICS_LATENCY_BUCKETS)
+        ? bucket : IOGRAPHICS_LATENCY_BUCKETS - 1;
+}
+
+uint64_t latencyThreadID()
+{
+    uint64_t tid;
+#if KERNEL
+    tid = thread_tid(current_thread());
+#elif __APPLE__
+    pthread_threadid_np(NULL, &tid);
+#else
+    tid = static_cast<uint64_t>(gettid());
+#endif
+    return tid;
+}
+
+// Start table key of the current thread, never 0
+uint64_t latencyKey(const uint32_t slot)
+    { return (latencyThreadID() << 16) | (slot + 1); }
+uint32_t latencyHash(const uint64_t key)
+    { return static_cast<uint32_t>(key * UINT64_C(0x9e3779b97f4a7c15) >> 32); }
+};  // namespace
+
+// Starts are an open addressed table keyed by thread and slot. Only the
+// owning thread writes fTime, the key is claimed with acquire and released,
+// with a compare and swap, only after fTime has been read. A START that is
+// older than fStaleTime, its END was skipped or its thread is gone, may be
+// taken over by another thread's START, or dropped by reset(). The owner's
+// END then fails to release the key and counts as unpaired.
+//
+// Only the first kLatencyTracked functions to complete get histograms, a
+// traced session touches a few dozen of the ~600 slots. fSlotOf[i] is claimed
+// once, in order, by the first END of a function and never released, so two
+// ENDs racing for the same function agree on its index. fIndex caches the
+// index + 1 for end(), 0 until it is looked up.
+struct GLatencyRecorder::Latency {
+    struct Start {
+        _Atomic(uint64_t) fKey;   // thread id << 16 | slot + 1, 0 is empty
+        _Atomic(uint64_t) fTime;
+    };
+    struct Histogram {
+        _Atomic(uint32_t) fBuckets[IOGRAPHICS_LATENCY_BUCKETS];
+        _Atomic(uint64_t) fTotal;
+    };
+
+    Start             fStarts[kLatencyStarts];
+    _Atomic(uint16_t) fSlotOf[kLatencyTracked];    // kLatencyFunctions is free
+    _Atomic(uint8_t)  fIndex[kLatencyFunctions];
+    Histogram*        fHistograms;  // [fSliceCount][kLatencyTracked]
+    uint32_t          fSliceCount;  // Power of 2, by cpu_number()
+    _Atomic(uint32_t) fDroppedStarts;
+    _Atomic(uint32_t) fUnpairedEnds;
+    _Atomic(uint32_t) fStaleStarts;
+    _Atomic(uint32_t) fUntrackedEnds;
+    uint64_t          fStaleTime;   // kLatencyStaleSeconds in absolute time
+
+    // Histogram index of slot or kLatencyTracked if all have been taken
+    uint32_t index(const uint32_t slot);
+};
+
+uint32_t GLatencyRecorder::Latency::index(const uint32_t slot)
+{
+    const uint8_t cached = atomic_load_explicit(&fIndex[slot],
+                                                memory_order_relaxed);
+    if (cached)
+        return (cached == kLatencyUntracked) ? kLatencyTracked : cached - 1u;
+
+    uint32_t i = 0;
+    for (; i < kLatencyTracked; ++i) {
+        uint16_t owner = atomic_load_explicit(&fSlotOf[i],
+                                              memory_order_relaxed);
+        if (owner == kLatencyFunctions
+        &&  atomic_compare_exchange_strong_explicit(
+                    &fSlotOf[i], &owner, static_cast<uint16_t>(slot),
+                    memory_order_relaxed, memory_order_relaxed))
+            break;
+        if (owner == slot)
+            break;  // Claimed by a racing END, or cached meanwhile
+    }
+    atomic_store_explicit(&fIndex[slot], (i < kLatencyTracked)
+                          ? static_cast<uint8_t>(i + 1) : kLatencyUntracked,
+                          memory_order_relaxed);
+    return i;
+}
+
+/* static */ _Atomic(GLatencyRecorder::Latency*) GLatencyRecorder::sLatency;
+
+/* static */ IOReturn GLatencyRecorder::prepareForRecording()
+{
+    LockGuard<IOLock> locked(sGlobals.fLock);
+    if (isActive())
+        return kIOReturnSuccess;
+
+    Latency* latency = IONew(Latency, 1);
+    if (!static_cast<bool>(latency))
+        return kIOReturnNoMemory;
+    bzero(latency, sizeof(*latency));
+    latency->fSliceCount = cpuSliceCount();
+    const uint32_t histograms = latency->fSliceCount * kLatencyTracked;
+    latency->fHistograms = IONew(Latency::Histogram, histograms);
+    if (!static_cast<bool>(latency->fHistograms)) {
+        IODelete(latency, Latency, 1);
+        return kIOReturnNoMemory;
+    }
+    bzero(latency->fHistograms, histograms * sizeof(Latency::Histogram));
+    for (auto& owner : latency->fSlotOf)
+        atomic_init(&owner, static_cast<uint16_t>(kLatencyFunctions));
+    nanoseconds_to_absolutetime(
+            static_cast<uint64_t>(kLatencyStaleSeconds) * kSecondScale,
+            &latency->fStaleTime);
+    atomic_store(&sLatency, latency);
+    DGM(" %lu bytes\n", static_cast<unsigned long>(
+            sizeof(*latency) + histograms * sizeof(Latency::Histogram)));
+    return kIOReturnSuccess;
+}
+
+// Lock free, may be called from any thread context.
+/* static */ void
+GLatencyRecorder::start(const uint16_t classID, const uint16_t functionID)
+{
+    Latency* latency = atomic_load(&sLatency);
+    const uint32_t slot = latencySlot(classID, functionID);
+    if (!static_cast<bool>(latency) || slot == kLatencyFunctions)
+        return;
+
+    const uint64_t now = mach_absolute_time();
+    const uint64_t key = latencyKey(slot);
+    const uint32_t hash = latencyHash(key);
+    Latency::Start* stale = nullptr;
+    uint64_t staleKey = 0;
+    for (uint32_t i = 0; i < kLatencyProbes; ++i) {
+        auto& start = latency->fStarts[(hash + i) & (kLatencyStarts - 1)];
+        uint64_t expected = atomic_load_explicit(&start.fKey,
+                                                 memory_order_relaxed);
+        // A recursive START of a running function restarts its clock
+        if (expected == key
+        || (!expected && atomic_compare_exchange_strong_explicit(
+                    &start.fKey, &expected, key,
+                    memory_order_acquire, memory_order_relaxed))) {
+            atomic_store_explicit(&start.fTime, now, memory_order_relaxed);
+            return;
+        }
+        if (!stale && expected
+        &&  (now - atomic_load_explicit(&start.fTime, memory_order_relaxed)
+                > latency->fStaleTime)) {
+            stale = &start;
+            staleKey = expected;
+        }
+    }
+    // No free entry, take over the first stale one
+    if (stale && atomic_compare_exchange_strong_explicit(
+                &stale->fKey, &staleKey, key,
+                memory_order_acquire, memory_order_relaxed)) {
+        atomic_store_explicit(&stale->fTime, now, memory_order_relaxed);
+        atomic_fetch_add_explicit(&latency->fStaleStarts, 1,
+                                  memory_order_relaxed);
+        return;
+    }
+    atomic_fetch_add_explicit(&latency->fDroppedStarts, 1,
+                              memory_order_relaxed);
+}
+
+// Lock free, may be called from any thread context.
+/* static */ void
+GLatencyRecorder::end(const uint16_t classID, const uint16_t functionID)
+{
+    const uint64_t now = mach_absolute_time();
+    Latency* latency = atomic_load(&sLatency);
+    const uint32_t slot = latencySlot(classID, functionID);
+    if (!static_cast<bool>(latency) || slot == kLatencyFunctions)
+        return;
+
+    const uint64_t key = latencyKey(slot);
+    const uint32_t hash = latencyHash(key);
+    for (uint32_t i = 0; i < kLatencyProbes; ++i) {
+        auto& start = latency->fStarts[(hash + i) & (kLatencyStarts - 1)];
+        uint64_t expected = atomic_load_explicit(&start.fKey,
+                                                 memory_order_relaxed);
+        if (expected != key)
+            continue;
+        const uint64_t then = atomic_load_explicit(&start.fTime,
+                                                   memory_order_relaxed);
+        // Fails if the START went stale and was taken over meanwhile
+        if (!atomic_compare_exchange_strong_explicit(
+                    &start.fKey, &expected, 0,
+                    memory_order_release, memory_order_relaxed))
+            break;
+
+        const uint32_t index = latency->index(slot);
+        if (index == kLatencyTracked) {
+            atomic_fetch_add_explicit(&latency->fUntrackedEnds, 1,
+                                      memory_order_relaxed);
+            return;
+        }
+        const uint64_t duration = now - then;
+        const uint32_t s = static_cast<uint32_t>(cpu_number())
+                         & (latency->fSliceCount - 1);
+        auto& histogram = latency->fHistograms[s * kLatencyTracked + index];
+        atomic_fetch_add_explicit(&histogram.fBuckets[latencyBucket(duration)],
+                                  1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&histogram.fTotal, duration,
+                                  memory_order_relaxed);
+        return;
+    }
+    atomic_fetch_add_explicit(&latency->fUnpairedEnds, 1,
+                              memory_order_relaxed);
+}
+
+// Counters are read while they are being updated, each is exact but a
+// function's buckets and total may be a few durations apart.
+/* static */ IOReturn GLatencyRecorder::fetch(IOMemoryDescriptor* outDesc)
+{
+    Latency* latency = atomic_load(&sLatency);
+    if (!static_cast<bool>(latency))
+        return kIOReturnNotReady;
+
+    const IOByteCount dataOffset = offsetof(IOGLatencyReport, functions);
+    const IOByteCount len = outDesc->getLength();
+    if (len < dataOffset)
+        return kIOReturnBadArgument;  // Out buffer is too small for header
+
+    LockGuard<IOLock> locked(sGlobals.fLock);
+    IOGLatencyReport report;
+    bzero(&report, sizeof(report));
+    report.version = IOGRAPHICS_LATENCY_VERSION;
+    IOByteCount offset = dataOffset;
+    for (uint32_t index = 0; index < kLatencyTracked; ++index) {
+        const uint32_t slot = atomic_load_explicit(&latency->fSlotOf[index],
+                                                   memory_order_relaxed);
+        if (slot == kLatencyFunctions)
+            break;  // Claimed in order
+
+        IOGLatency function;
+        bzero(&function, sizeof(function));
+        for (uint32_t s = 0; s < latency->fSliceCount; ++s) {
+            const auto& histogram
+                = latency->fHistograms[s * kLatencyTracked + index];
+            for (uint32_t b = 0; b < IOGRAPHICS_LATENCY_BUCKETS; ++b) {
+                const uint32_t count = atomic_load_explicit(
+                        &histogram.fBuckets[b], memory_order_relaxed);
+                function.buckets[b] += count;
+                function.count += count;
+            }
+            function.total += atomic_load_explicit(&histogram.fTotal,
+                                                   memory_order_relaxed);
+        }
+        if (!function.count)
+            continue;  // Claimed, but its END has yet to land or was reset
+
+        ++report.functionCount;
+        if (offset + sizeof(function) > len)
+            continue;  // Keep counting, see IOGLatencyReport
+        uint32_t classIndex = 0;
+        while (slot >= latencyClassBase(classIndex + 1))
+            ++classIndex;
+        function.classID = static_cast<uint16_t>(2 * classIndex + 1);
+        function.functionID
+            = static_cast<uint16_t>(slot - latencyClassBase(classIndex));
+        (void) outDesc->writeBytes(offset, &function, sizeof(function));
+        offset += sizeof(function);
+        ++report.copiedCount;
+    }
+    report.droppedStarts
+        = atomic_load_explicit(&latency->fDroppedStarts, memory_order_relaxed);
+    report.unpairedEnds
+        = atomic_load_explicit(&latency->fUnpairedEnds, memory_order_relaxed);
+    report.staleStarts
+        = atomic_load_explicit(&latency->fStaleStarts, memory_order_relaxed);
+    report.untrackedEnds
+        = atomic_load_explicit(&latency->fUntrackedEnds, memory_order_relaxed);
+    (void) outDesc->writeBytes(0, &report, dataOffset);
+
+    DGM("(mdl=%llu) {f=%u c=%u}\n", len,
+        report.functionCount, report.copiedCount);
+    return kIOReturnSuccess;
+}
+
+// STARTs in flight are dropped too, leaked ones would otherwise keep their
+// entries until they went stale. A function running across the reset counts
+// its END as unpaired. Functions keep their histograms.
+/* static */ IOReturn GLatencyRecorder::reset()
+{
+    Latency* latency = atomic_load(&sLatency);
+    if (!static_cast<bool>(latency))
+        return kIOReturnNotReady;
+
+    LockGuard<IOLock> locked(sGlobals.fLock);
+    for (auto& start : latency->fStarts) {
+        uint64_t expected = atomic_load_explicit(&start.fKey,
+                                                 memory_order_relaxed);
+        if (expected)
+            (void) atomic_compare_exchange_strong_explicit(
+                    &start.fKey, &expected, 0,
+                    memory_order_release, memory_order_relaxed);
+    }
+    const uint32_t histograms = latency->fSliceCount * kLatencyTracked;
+    for (uint32_t h = 0; h < histograms; ++h) {
+        auto& histogram = latency->fHistograms[h];
+        for (auto& bucket : histogram.fBuckets)
+            atomic_store_explicit(&bucket, 0, memory_order_relaxed);
+        atomic_store_explicit(&histogram.fTotal, 0, memory_order_relaxed);
+    }
+    atomic_store_explicit(&latency->fDroppedStarts, 0, memory_order_relaxed);
+    atomic_store_explicit(&latency->fUnpairedEnds, 0, memory_order_relaxed);
+    atomic_store_explicit(&latency->fStaleStarts, 0, memory_order_relaxed);
+    atomic_store_explicit(&latency->fUntrackedEnds, 0, memory_order_relaxed);
+    DGM("\n");
+    return kIOReturnSuccess;
+}
+
+#endif // ENABLE_TELEMETRY
+
 #endif // TARGET_CPU_X86_64
@@ -39,6 +39,19 @@
 
 #endif // IOG_GMETRIC
 
+#if ENABLE_TELEMETRY
+// Used by the Ariadne START/END macros in IOGraphicsKTrace.h, class is the
+// *_TELEMETRY_START code and fid the *_FID_* of the traced function.
+#define GMETRIC_LATENCY_START(_class_, _fid_) do{ \
+    if (GLatencyRecorder::isActive()) \
+        GLatencyRecorder::start(_class_, _fid_); \
+} while(0)
+#define GMETRIC_LATENCY_END(_class_, _fid_) do{ \
+    if (GLatencyRecorder::isActive()) \
+        GLatencyRecorder::end(_class_, _fid_); \
+} while(0)
+#endif // ENABLE_TELEMETRY
+
 #pragma mark - GMetricsRecorder Class
 
 class IODisplayWranglerUserClient;
@@ -52,7 +65,24 @@ private:
 
     static _Atomic(gmetric_domain_t) sDomains;
 
-    static GMetricsRecorder* sRecorder;  // Used for recording data
+    // Per-CPU writer counts, padded so that no two CPUs share a cache line
+    struct Writers {
+        atomic_uint_fast32_t fCount[2];  // By sEpoch & 1
+        uint8_t              fPad[64 - 2 * sizeof(atomic_uint_fast32_t)];
+    };
+    // One line cursor per slice of fBuffer, padded likewise
+    struct Slice {
+        atomic_uint_fast32_t fNextLine;
+        uint8_t              fPad[64 - sizeof(atomic_uint_fast32_t)];
+    };
+
+    // Used for recording data, record() counts itself in its CPU's sWriters
+    // for the current sEpoch while it holds a reference, see quiesceLocked().
+    // sWriters is allocated by the first prepareForRecording() and kept.
+    static _Atomic(GMetricsRecorder*) sRecorder;
+    static _Atomic(Writers*) sWriters;
+    static uint32_t sWritersMask;
+    static atomic_uint_fast32_t sEpoch;
 
     static IOReturn prepareForRecording();
     static IOReturn prepareForRecording(const uint64_t userClientEntries);
@@ -75,7 +105,7 @@ public:
     // isDomainActive is on the fast path, make as lightweight as possible
     static bool isDomainActive(const gmetric_domain_t domain)
         { return static_cast<bool>(atomic_load(&sDomains) & domain); }
-    static bool isReady() { return static_cast<bool>(sRecorder); }
+    static bool isReady() { return static_cast<bool>(atomic_load(&sRecorder)); }
     static void record(const gmetric_domain_t domain,
                        const gmetric_event_t type, const uint64_t arg);
 
@@ -83,17 +113,61 @@ protected:
     void free() override;
 
     IOReturn initWithCount(const uint32_t lineCount);
-    void recordLocked(const gmetric_domain_t domain,
-                      const gmetric_event_t type, const uint64_t arg);
+    void recordEntry(const gmetric_domain_t domain,
+                     const gmetric_event_t type, const uint64_t arg);
     IOReturn copyOutLocked(IOMemoryDescriptor* outDesc);
     IOReturn resetLocked();
+    static GMetricsRecorder* quiesceLocked();
 
 private:
-    uint32_t         fLineCount = 0;
-    uint32_t         fNextLine = 0;
+    uint32_t             fLineCount = 0;
+    uint32_t             fSliceCount = 0;  // Power of 2, by cpu_number()
+    uint32_t             fSliceLines = 0;
+    Slice*               fSlices = nullptr;
 
-    gmetric_entry_t* fBuffer = nullptr;
-    uint32_t         fBufferSize = 0;
+    gmetric_entry_t*     fBuffer = nullptr;
+    uint32_t             fBufferSize = 0;
 };
 
+#pragma mark - GLatencyRecorder Class
+
+#if ENABLE_TELEMETRY
+
+/*!
+ @class GLatencyRecorder
+
+ @abstract
+ Log2 latency histogram per Ariadne traced function.
+
+ @discussion
+ start() remembers the time for the calling thread and function, end() adds
+ the duration to the function's histogram on the current CPU's slice. Slices
+ are merged by fetch(). Both are lock free. Only the first
+ IOGRAPHICS_LATENCY_FUNCTIONS functions to complete get a histogram. They are
+ allocated once by prepareForRecording(), a slice per CPU at about 6.5KiB
+ each, and never released.
+ */
+class GLatencyRecorder
+{
+public:
+    // Boot-arg iog=0x40000, see kIOGDbgLatency
+    static IOReturn prepareForRecording();
+
+    // isActive is on the fast path, make as lightweight as possible
+    static bool isActive() { return static_cast<bool>(atomic_load(&sLatency)); }
+    static void start(const uint16_t classID, const uint16_t functionID);
+    static void end(const uint16_t classID, const uint16_t functionID);
+
+private:
+    struct Latency;
+    static _Atomic(Latency*) sLatency;
+
+    // APIs for IODisplayWranglerUserClients.cpp
+    friend class IOGDiagnosticUserClient;
+    static IOReturn fetch(IOMemoryDescriptor* preparedWritableDescriptor);
+    static IOReturn reset();
+};
+
+#endif // ENABLE_TELEMETRY
+
 #endif /* GMetric_hpp */
@@ -0,0 +1,353 @@
+//
+//  GTraceDecoder.cpp
+//  IOGraphics
+//
+
+#include "GTraceDecoder.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+namespace {
+
+// START/END pairing key, see GTraceDecoder::pairSpans()
+struct SpanKey {
+    uint64_t fComponent;
+    uint32_t fThreadID;
+    uint16_t fFunction;
+
+    bool operator==(const SpanKey& o) const
+    {
+        return fComponent == o.fComponent && fThreadID == o.fThreadID
+            && fFunction == o.fFunction;
+    }
+};
+
+struct SpanKeyHash {
+    size_t operator()(const SpanKey& k) const
+    {
+        uint64_t h = k.fComponent * UINT64_C(0x9e3779b97f4a7c15);
+        h ^= (static_cast<uint64_t>(k.fThreadID) << 10) | k.fFunction;
+        return static_cast<size_t>(h * UINT64_C(0xff51afd7ed558ccd));
+    }
+};
+
+std::string errorString(const char* what, const char* filename)
+{
+    return std::string(what) + " " + filename + ": " + strerror(errno);
+}
+
+}; // namespace
+
+GTraceDecoder::~GTraceDecoder()
+{
+    unmap();
+}
+
+// Also drops everything indexed, which points into the image
+void GTraceDecoder::unmap()
+{
+    if (fMapped)
+        munmap(const_cast<uint8_t*>(fData), fSize);
+    fData = nullptr;
+    fSize = 0;
+    fMapped = false;
+
+    fBuffers.clear();
+    fTokens.clear();
+    fTimes.clear();
+    fByComponent.clear();
+    fByRegistryID.clear();
+    fByFunction.clear();
+    fSpans.clear();
+    fSpanOf.clear();
+}
+
+bool GTraceDecoder::open(const char* filename, std::string* errorP)
+{
+    unmap();
+
+    const int fd = ::open(filename, O_RDONLY);
+    if (fd < 0) {
+        *errorP = errorString("Can't open", filename);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st)) {
+        *errorP = errorString("Can't stat", filename);
+        close(fd);
+        return false;
+    }
+    const size_t size = static_cast<size_t>(st.st_size);
+    void* data = (size) ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0)
+                        : MAP_FAILED;
+    close(fd);  // Mapping holds its own reference
+    if (data == MAP_FAILED) {
+        *errorP = (size) ? errorString("Can't map", filename)
+                         : std::string("Empty file ") + filename;
+        return false;
+    }
+    // Tokens are read front to back while indexing
+    (void) madvise(data, size, MADV_SEQUENTIAL);
+
+    fData = static_cast<const uint8_t*>(data);
+    fSize = size;
+    fMapped = true;
+    if (!parse(errorP)) {
+        unmap();
+        return false;
+    }
+    buildIndexes();
+    pairSpans();
+    return true;
+}
+
+bool GTraceDecoder::load(const void* data, size_t size, std::string* errorP)
+{
+    unmap();
+    if (reinterpret_cast<uintptr_t>(data) % alignof(uint64_t)) {
+        *errorP = "GTrace image is not 8 byte aligned";
+        return false;
+    }
+    fData = static_cast<const uint8_t*>(data);
+    fSize = size;
+    if (!parse(errorP)) {
+        unmap();
+        return false;
+    }
+    buildIndexes();
+    pairSpans();
+    return true;
+}
+
+// Layout from iogdiagnose's writeGTraceBinary(): a magic GTraceEntry with a
+// timestamp of -1 whose line is the buffer count and whose component is the
+// GTRACE_REVISION, then each buffer as copied out of the kernel, that is the
+// GTraceHeader, breadcrumb and tokens, fBufferSize bytes in all.
+bool GTraceDecoder::parse(std::string* errorP)
+{
+    fBuffers.clear();
+    fTokens.clear();
+
+    const auto* magic = reinterpret_cast<const GTraceEntry*>(fData);
+    if (fSize < sizeof(*magic) || magic->timestamp() != UINT64_MAX) {
+        *errorP = "Not a GTrace binary, missing the multi buffer marker";
+        return false;
+    }
+    if (magic->component() != GTRACE_REVISION) {
+        *errorP = "Unsupported GTrace revision "
+                + std::to_string(magic->component());
+        return false;
+    }
+
+    const size_t numBuffers = magic->line();
+    size_t offset = sizeof(*magic);
+    size_t numTokens = 0;
+    for (size_t i = 0; i < numBuffers; ++i) {
+        const auto* header
+            = reinterpret_cast<const GTraceHeader*>(fData + offset);
+        if (fSize - offset < kGTraceHeaderSize
+        ||  header->fBufferSize < kGTraceHeaderSize
+        ||  header->fBufferSize % kGTraceEntrySize
+        ||  header->fBufferSize > fSize - offset) {
+            *errorP = "Truncated or corrupt GTrace buffer "
+                    + std::to_string(i);
+            return false;
+        }
+        const size_t entries = header->fBufferSize / kGTraceEntrySize;
+        const auto* first = reinterpret_cast<const GTraceEntry*>(fData + offset)
+                          + kGTraceHeaderEntries;
+        const size_t bct = std::min<size_t>(header->fBreadcrumbTokens,
+                                            entries - kGTraceHeaderEntries);
+        fBuffers.push_back(Buffer{header, first, bct});
+        numTokens += entries - kGTraceHeaderEntries - bct;
+        offset += header->fBufferSize;
+    }
+    if (numTokens >= kNoPos) {
+        *errorP = "Too many tokens to index";
+        return false;
+    }
+
+    // Sort on a copy of the timestamps, keeps the compares in cache. Equal
+    // timestamps stay in file order as the entry addresses break the tie.
+    std::vector<std::pair<uint64_t, const GTraceEntry*>> order;
+    order.reserve(numTokens);
+    for (const Buffer& buffer : fBuffers) {
+        const auto* const end = reinterpret_cast<const GTraceEntry*>(
+                reinterpret_cast<const uint8_t*>(buffer.fHeader)
+                + buffer.fHeader->fBufferSize);
+        for (auto* entry = buffer.fBreadcrumb + buffer.fBreadcrumbTokens;
+             entry < end; ++entry) {
+            if (entry->timestamp())  // Unused slots are zeroed
+                order.emplace_back(entry->timestamp(), entry);
+        }
+    }
+    std::sort(order.begin(), order.end());
+
+    fTokens.resize(order.size());
+    fTimes.resize(order.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        fTimes[i] = order[i].first;
+        fTokens[i] = order[i].second;
+    }
+    return true;
+}
+
+std::pair<const void*, size_t> GTraceDecoder::breadcrumb(const size_t i) const
+{
+    const Buffer& buffer = fBuffers[i];
+    const size_t len = buffer.fBreadcrumbTokens * kGTraceEntrySize;
+    return {(len) ? buffer.fBreadcrumb : nullptr, len};
+}
+
+void GTraceDecoder::buildIndexes()
+{
+    fByComponent.clear();
+    fByRegistryID.clear();
+    fByFunction.assign(kGTraceFilterFunctions, index_type());
+
+    // Positions are appended in time order, so every list stays sorted
+    for (pos_type pos = 0; pos < fTokens.size(); ++pos) {
+        const GTraceEntry& entry = *fTokens[pos];
+        fByComponent[entry.component()].push_back(pos);
+        fByRegistryID[entry.registryID()].push_back(pos);
+        fByFunction[GUNPACKFUNCCODE(entry.tag(0))].push_back(pos);
+    }
+}
+
+// Pairs each END with the most recent unpaired START of the same function on
+// the same thread and component, which handles recursion. The ring loses the
+// oldest tokens first, so leading ENDs and trailing STARTs are left unpaired.
+void GTraceDecoder::pairSpans()
+{
+    std::unordered_map<SpanKey, index_type, SpanKeyHash> open;
+
+    fSpans.clear();
+    fSpanOf.assign(fTokens.size(), kNoPos);
+    for (pos_type pos = 0; pos < fTokens.size(); ++pos) {
+        const GTraceEntry& entry = *fTokens[pos];
+        const uint16_t tag0 = entry.tag(0);
+        const uint8_t type = GUNPACKFUNCTYPE(tag0);
+        if (type != 1 && type != 2)  // DBG_FUNC_START, DBG_FUNC_END
+            continue;
+
+        const SpanKey key
+            = { entry.component(), entry.threadID(), GUNPACKFUNCCODE(tag0) };
+        if (type == 1) {
+            open[key].push_back(pos);
+            continue;
+        }
+        pos_type start = kNoPos;
+        const auto it = open.find(key);
+        if (it != open.end() && !it->second.empty()) {
+            start = it->second.back();
+            it->second.pop_back();
+        }
+        fSpans.push_back(Span{start, pos});
+    }
+    for (const auto& starts : open)
+        for (const pos_type start : starts.second)
+            fSpans.push_back(Span{start, kNoPos});
+
+    std::sort(fSpans.begin(), fSpans.end(),
+        [](const Span& a, const Span& b) {
+            const pos_type apos = (a.fStart != kNoPos) ? a.fStart : a.fEnd;
+            const pos_type bpos = (b.fStart != kNoPos) ? b.fStart : b.fEnd;
+            return apos < bpos;
+        });
+    for (pos_type i = 0; i < fSpans.size(); ++i) {
+        if (fSpans[i].fStart != kNoPos)
+            fSpanOf[fSpans[i].fStart] = i;
+        if (fSpans[i].fEnd != kNoPos)
+            fSpanOf[fSpans[i].fEnd] = i;
+    }
+}
+
+uint64_t GTraceDecoder::duration(const Span& span) const
+{
+    if (span.fStart == kNoPos || span.fEnd == kNoPos)
+        return 0;
+    return fTimes[span.fEnd] - fTimes[span.fStart];
+}
+
+std::pair<GTraceDecoder::pos_type, GTraceDecoder::pos_type>
+GTraceDecoder::timeRange(const Query& q) const
+{
+    const auto lo = std::lower_bound(fTimes.begin(), fTimes.end(), q.fBegin);
+    const auto hi = std::upper_bound(lo, fTimes.end(), q.fEnd);
+    return {static_cast<pos_type>(lo - fTimes.begin()),
+            static_cast<pos_type>(hi - fTimes.begin())};
+}
+
+bool GTraceDecoder::matches(const GTraceEntry& entry, const Query& q) const
+{
+    return (q.fComponent  == kAny || q.fComponent  == entry.component())
+        && (q.fRegistryID == kAny || q.fRegistryID == entry.registryID())
+        && (q.fFunction   == kAny
+            || q.fFunction == GUNPACKFUNCCODE(entry.tag(0)))
+        && (q.fThreadID   == kAny || q.fThreadID   == entry.threadID());
+}
+
+GTraceDecoder::index_type GTraceDecoder::query(const Query& q) const
+{
+    index_type ret;
+    const auto range = timeRange(q);
+    if (range.first >= range.second)
+        return ret;
+
+    // Pick the shortest index that applies, a missing key matches nothing
+    static const index_type kEmpty;
+    const index_type* list = nullptr;
+    auto consider = [&list](const index_type* candidate) {
+        if (!list || candidate->size() < list->size())
+            list = candidate;
+    };
+    if (q.fComponent != kAny) {
+        const auto it = fByComponent.find(q.fComponent);
+        consider((it != fByComponent.end()) ? &it->second : &kEmpty);
+    }
+    if (q.fRegistryID != kAny) {
+        const auto it = fByRegistryID.find(
+                static_cast<uint32_t>(q.fRegistryID));
+        consider((it != fByRegistryID.end() && q.fRegistryID <= UINT32_MAX)
+                 ? &it->second : &kEmpty);
+    }
+    if (q.fFunction != kAny) {
+        consider((q.fFunction < fByFunction.size())
+                 ? &fByFunction[q.fFunction] : &kEmpty);
+    }
+
+    if (!list) {
+        for (pos_type pos = range.first; pos < range.second; ++pos)
+            if (matches(*fTokens[pos], q))
+                ret.push_back(pos);
+        return ret;
+    }
+    const auto first
+        = std::lower_bound(list->begin(), list->end(), range.first);
+    const auto last = std::lower_bound(first, list->end(), range.second);
+    for (auto it = first; it != last; ++it)
+        if (matches(*fTokens[*it], q))
+            ret.push_back(*it);
+    return ret;
+}
+
+GTraceDecoder::index_type GTraceDecoder::querySpans(const Query& q) const
+{
+    index_type ret;
+    for (const pos_type pos : query(q)) {
+        const pos_type span = fSpanOf[pos];
+        if (span != kNoPos)
+            ret.push_back(span);
+    }
+    // A span matches through its START and its END
+    std::sort(ret.begin(), ret.end());
+    ret.erase(std::unique(ret.begin(), ret.end()), ret.end());
+    return ret;
+}
@@ -0,0 +1,124 @@
+//
+//  GTraceDecoder.hpp
+//  IOGraphics
+//
+//  Offline decoder for the binary written by iogdiagnose -b. Only depends on
+//  GTraceTypes.hpp and POSIX, so it also builds on non Apple hosts.
+//
+
+#ifndef GTraceDecoder_hpp
+#define GTraceDecoder_hpp
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "IOKit/graphics/GTraceTypes.hpp"
+
+// Tokens of every buffer in the file, merged into timestamp order. Tokens are
+// referred to by their position in that order, a pos_type. The file is mapped
+// read only and tokens are never copied.
+//
+// Indexes by component, registry ID and function code are position lists in
+// ascending order, so any of them can be cut to a time range with a binary
+// search. Queries walk the shortest list that applies and test the remaining
+// fields on each token.
+//
+// START and END tokens, see GUNPACKFUNCTYPE, are paired into spans by
+// component, thread and function code. Nested calls of the same function pair
+// innermost first.
+class GTraceDecoder
+{
+public:
+    using pos_type = uint32_t;
+    using index_type = std::vector<pos_type>;
+
+    static constexpr pos_type kNoPos = UINT32_MAX;
+    static constexpr uint64_t kAny = UINT64_MAX;
+
+    // Every field that isn't kAny must match, fBegin and fEnd are inclusive
+    struct Query {
+        uint64_t fBegin      = 0;
+        uint64_t fEnd        = UINT64_MAX;
+        uint64_t fComponent  = kAny;
+        uint64_t fRegistryID = kAny;
+        uint64_t fFunction   = kAny;  // GUNPACKFUNCCODE of tag0
+        uint64_t fThreadID   = kAny;
+    };
+
+    // fStart is kNoPos if the START was lost to the ring, fEnd is kNoPos if
+    // the function hadn't returned when the buffer was copied.
+    struct Span {
+        pos_type fStart;
+        pos_type fEnd;
+    };
+
+    GTraceDecoder() = default;
+    ~GTraceDecoder();
+
+    GTraceDecoder(const GTraceDecoder&)            = delete;
+    GTraceDecoder& operator=(const GTraceDecoder&) = delete;
+
+    // Maps and indexes filename. Returns false and sets *errorP on failure.
+    bool open(const char* filename, std::string* errorP);
+
+    // As open() but for a file image owned by the caller, which must outlive
+    // the decoder.
+    bool load(const void* data, size_t size, std::string* errorP);
+
+    // Buffers in file order
+    size_t bufferCount() const              { return fBuffers.size(); }
+    const GTraceHeader& bufferHeader(const size_t i) const
+        { return *fBuffers[i].fHeader; }
+    std::pair<const void*, size_t> breadcrumb(const size_t i) const;
+
+    // Tokens in time order
+    size_t size() const                     { return fTokens.size(); }
+    const GTraceEntry& token(const pos_type pos) const
+        { return *fTokens[pos]; }
+    uint64_t timestamp(const pos_type pos) const { return fTimes[pos]; }
+
+    // Positions of the matching tokens, in time order
+    index_type query(const Query& q) const;
+
+    // Spans ordered by the position of the START, or of the END if the START
+    // is missing.
+    const std::vector<Span>& spans() const  { return fSpans; }
+    uint64_t duration(const Span& span) const;
+
+    // Indexes into spans() of the spans with a START or END matching q
+    index_type querySpans(const Query& q) const;
+
+private:
+    struct Buffer {
+        const GTraceHeader* fHeader;
+        const GTraceEntry*  fBreadcrumb;
+        size_t              fBreadcrumbTokens;
+    };
+
+    void unmap();
+    bool parse(std::string* errorP);
+    void buildIndexes();
+    void pairSpans();
+    std::pair<pos_type, pos_type> timeRange(const Query& q) const;
+    bool matches(const GTraceEntry& entry, const Query& q) const;
+
+    const uint8_t*  fData = nullptr;
+    size_t          fSize = 0;
+    bool            fMapped = false;
+
+    std::vector<Buffer>                          fBuffers;
+    std::vector<const GTraceEntry*>              fTokens;
+    std::vector<uint64_t>                        fTimes;  // Parallel fTokens
+    std::unordered_map<uint64_t, index_type>     fByComponent;
+    std::unordered_map<uint32_t, index_type>     fByRegistryID;
+    std::vector<index_type>                      fByFunction;
+    std::vector<Span>                            fSpans;
+    std::vector<pos_type>                        fSpanOf;  // Parallel fTokens
+};
+
+#endif // GTraceDecoder_hpp
@@ -0,0 +1,346 @@
+//
+//  GTraceDecoderTests.cpp
+//  IOGraphics
+//
+//  Unit tests for GTraceDecoder over synthetic captures laid out as
+//  iogdiagnose's writeGTraceBinary() writes them. Only needs GTraceTypes.hpp.
+//
+
+/*
+c++ -std=c++17 -O2 -Wall -I../../IOGraphicsFamily -o /tmp/gtracedecodertests GTraceDecoderTests.cpp GTraceDecoder.cpp
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <initializer_list>
+#include <string>
+#include <vector>
+
+#include "GTraceDecoder.hpp"
+
+namespace {
+
+int gFailures = 0;
+
+#define CHECK(cond) do {                                                    \
+    if (!(cond)) {                                                          \
+        fprintf(stderr, "%s:%d: CHECK(%s) failed\n",                        \
+                __FILE__, __LINE__, #cond);                                 \
+        ++gFailures;                                                        \
+    }                                                                       \
+} while (0)
+
+#define CHECK_EQ(a, b) do {                                                 \
+    const auto _a = (a);                                                    \
+    const auto _b = (b);                                                    \
+    if (!(_a == _b)) {                                                      \
+        fprintf(stderr, "%s:%d: CHECK_EQ(%s, %s) failed, %llu != %llu\n",   \
+                __FILE__, __LINE__, #a, #b,                                 \
+                (unsigned long long) _a, (unsigned long long) _b);          \
+        ++gFailures;                                                        \
+    }                                                                       \
+} while (0)
+
+using Decoder = GTraceDecoder;
+
+constexpr uint16_t kStart = 1;  // DBG_FUNC_START
+constexpr uint16_t kEnd   = 2;  // DBG_FUNC_END
+
+GTraceEntry token(const uint64_t ts, const uint64_t component,
+                  const uint32_t threadID, const uint32_t regID,
+                  const uint16_t func, const uint16_t type = 0,
+                  const uint64_t arg = 0)
+{
+    return GTraceEntry(ts, 0, component, 0, threadID, regID,
+                       GPACKFUNCTAG(func, type, 0), arg, 0, 0, 0, 0, 0, 0);
+}
+
+// One kernel buffer as copied out: header, breadcrumb then the token ring,
+// with unused ring slots left zero.
+struct BufferImage {
+    std::vector<GTraceEntry> fBreadcrumb;
+    std::vector<GTraceEntry> fTokens;
+    size_t                   fEmptySlots = 0;
+};
+
+// A writeGTraceBinary() image, 8 byte aligned as load() requires
+class Capture {
+public:
+    void add(const BufferImage& buffer) { fBuffers.push_back(buffer); }
+
+    const std::vector<GTraceEntry>& build(const uint64_t revision = GTRACE_REVISION)
+    {
+        fImage.clear();
+        fImage.emplace_back(static_cast<int16_t>(fBuffers.size()), revision);
+        uint16_t index = 0;
+        for (const BufferImage& buffer : fBuffers) {
+            const size_t tokens = buffer.fBreadcrumb.size()
+                                + buffer.fTokens.size() + buffer.fEmptySlots;
+            GTraceEntry header[kGTraceHeaderEntries];
+            auto* h = reinterpret_cast<GTraceHeader*>(&header[0]);
+            memset(static_cast<void*>(header), 0, sizeof(header));
+            strncpy(reinterpret_cast<char*>(h->fDecoderName),
+                    "GTraceDecoderTests", sizeof(h->fDecoderName) - 1);
+            strncpy(reinterpret_cast<char*>(h->fBufferName), "synthetic",
+                    sizeof(h->fBufferName) - 1);
+            h->fBufferIndex      = index++;
+            h->fVersion          = GTRACE_REVISION;
+            h->fBreadcrumbTokens = static_cast<uint16_t>(buffer.fBreadcrumb.size());
+            h->fTokensCopied     = static_cast<uint16_t>(tokens);
+            h->fBufferSize       = static_cast<uint32_t>(
+                    (kGTraceHeaderEntries + tokens) * kGTraceEntrySize);
+            fImage.insert(fImage.end(), header, header + kGTraceHeaderEntries);
+            fImage.insert(fImage.end(), buffer.fBreadcrumb.begin(),
+                          buffer.fBreadcrumb.end());
+            fImage.insert(fImage.end(), buffer.fTokens.begin(),
+                          buffer.fTokens.end());
+            fImage.resize(fImage.size() + buffer.fEmptySlots);
+        }
+        return fImage;
+    }
+
+    bool load(Decoder* decoder, std::string* errorP)
+    {
+        build();
+        return decoder->load(fImage.data(), fImage.size() * sizeof(GTraceEntry),
+                             errorP);
+    }
+
+private:
+    std::vector<BufferImage> fBuffers;
+    std::vector<GTraceEntry> fImage;
+};
+
+std::vector<uint64_t> timestamps(const Decoder& decoder,
+                                 const Decoder::index_type& found)
+{
+    std::vector<uint64_t> ret;
+    for (const auto pos : found)
+        ret.push_back(decoder.timestamp(pos));
+    return ret;
+}
+
+void testRejectsBadImages()
+{
+    Decoder decoder;
+    std::string error;
+
+    const uint64_t garbage[16] = { 1, 2, 3 };
+    CHECK(!decoder.load(garbage, sizeof(garbage), &error));
+    CHECK(!error.empty());
+
+    Capture capture;
+    BufferImage buffer;
+    buffer.fTokens.push_back(token(10, 1, 1, 1, 1));
+    capture.add(buffer);
+
+    auto image = capture.build(GTRACE_REVISION + 1);
+    error.clear();
+    CHECK(!decoder.load(image.data(), image.size() * kGTraceEntrySize, &error));
+    CHECK(error.find("revision") != std::string::npos);
+
+    // Buffer claims more bytes than the file holds
+    image = capture.build();
+    error.clear();
+    CHECK(!decoder.load(image.data(), (image.size() - 1) * kGTraceEntrySize,
+                        &error));
+    CHECK(!error.empty());
+    CHECK_EQ(decoder.size(), 0u);
+
+    // load() needs the image 8 byte aligned
+    std::vector<uint8_t> unaligned(image.size() * kGTraceEntrySize + 1);
+    memcpy(unaligned.data() + 1, image.data(), unaligned.size() - 1);
+    error.clear();
+    CHECK(!decoder.load(unaligned.data() + 1, unaligned.size() - 1, &error));
+}
+
+void testMergesBuffersInTimeOrder()
+{
+    Capture capture;
+    BufferImage a, b;
+    a.fBreadcrumb.push_back(token(1, 99, 9, 9, 9));  // Not a token
+    a.fTokens = { token(30, 1, 1, 1, 1), token(10, 1, 1, 1, 1),
+                  token(50, 1, 1, 1, 1) };
+    a.fEmptySlots = 3;
+    b.fTokens = { token(20, 2, 2, 2, 2), token(40, 2, 2, 2, 2) };
+    capture.add(a);
+    capture.add(b);
+
+    Decoder decoder;
+    std::string error;
+    CHECK(capture.load(&decoder, &error));
+    CHECK_EQ(decoder.bufferCount(), 2u);
+    CHECK_EQ(decoder.bufferHeader(1).fBufferIndex, 1u);
+    CHECK_EQ(decoder.breadcrumb(0).second, static_cast<size_t>(kGTraceEntrySize));
+    CHECK(decoder.breadcrumb(1).first == nullptr);
+
+    CHECK_EQ(decoder.size(), 5u);  // Empty slots and breadcrumb skipped
+    for (Decoder::pos_type pos = 0; pos < decoder.size(); ++pos) {
+        CHECK_EQ(decoder.timestamp(pos), 10u * (pos + 1));
+        CHECK_EQ(decoder.token(pos).timestamp(), decoder.timestamp(pos));
+    }
+}
+
+void testOpenMapsFile()
+{
+    Capture capture;
+    BufferImage buffer;
+    buffer.fTokens = { token(7, 3, 3, 3, 3), token(5, 3, 3, 3, 3) };
+    capture.add(buffer);
+    const auto& image = capture.build();
+
+    char path[] = "/tmp/gtracedecodertests.XXXXXX";
+    const int fd = mkstemp(path);
+    CHECK(fd >= 0);
+    if (fd < 0)
+        return;
+    const ssize_t len = static_cast<ssize_t>(image.size() * kGTraceEntrySize);
+    CHECK_EQ(write(fd, image.data(), len), len);
+    close(fd);
+
+    Decoder decoder;
+    std::string error;
+    CHECK(decoder.open(path, &error));
+    CHECK_EQ(decoder.size(), 2u);
+    CHECK_EQ(decoder.timestamp(0), 5u);
+    unlink(path);
+
+    error.clear();
+    CHECK(!decoder.open(path, &error));
+    CHECK(!error.empty());
+    CHECK_EQ(decoder.size(), 0u);
+}
+
+void testQueries()
+{
+    // ts 100..199, component ts % 3, thread ts % 4, registry ts % 5,
+    // function ts % 7
+    Capture capture;
+    BufferImage a, b;
+    for (uint64_t ts = 100; ts < 200; ++ts) {
+        const auto t = token(ts, ts % 3, ts % 4, ts % 5, ts % 7);
+        ((ts & 1) ? a : b).fTokens.push_back(t);
+    }
+    capture.add(a);
+    capture.add(b);
+
+    Decoder decoder;
+    std::string error;
+    CHECK(capture.load(&decoder, &error));
+    CHECK_EQ(decoder.size(), 100u);
+
+    // Brute force over every combination of a few values of each field
+    using Values = std::initializer_list<uint64_t>;
+    using Range = std::pair<uint64_t, uint64_t>;
+    const uint64_t any = Decoder::kAny;
+    for (const uint64_t comp : Values{ any, 0, 2, 7 }) {
+    for (const uint64_t reg : Values{ any, 1, 4 }) {
+    for (const uint64_t func : Values{ any, 3, 6, 1023, 5000 }) {
+    for (const uint64_t thread : Values{ any, 0, 3 }) {
+    for (const Range& range : { Range(0, UINT64_MAX), Range(150, 150),
+                               Range(120, 179), Range(300, 400),
+                               Range(160, 140) }) {
+        Decoder::Query q;
+        q.fBegin = range.first;
+        q.fEnd = range.second;
+        q.fComponent = comp;
+        q.fRegistryID = reg;
+        q.fFunction = func;
+        q.fThreadID = thread;
+
+        std::vector<uint64_t> expected;
+        for (uint64_t ts = 100; ts < 200; ++ts) {
+            if (ts < q.fBegin || ts > q.fEnd)                   continue;
+            if (comp != any && ts % 3 != comp)          continue;
+            if (reg != any && ts % 5 != reg)            continue;
+            if (func != any && ts % 7 != func)          continue;
+            if (thread != any && ts % 4 != thread)      continue;
+            expected.push_back(ts);
+        }
+        const auto found = timestamps(decoder, decoder.query(q));
+        CHECK(found == expected);
+    }}}}}
+}
+
+void testSpans()
+{
+    // Component 1 thread 1: a leading END whose START was lost, then
+    // f5 { f5 { } } recursion, then f6 still running when copied.
+    // Component 1 thread 2 runs f5 interleaved and must pair separately.
+    Capture capture;
+    BufferImage buffer;
+    buffer.fTokens = {
+        token(10, 1, 1, 0, 4, kEnd),
+        token(20, 1, 1, 0, 5, kStart),
+        token(25, 1, 2, 0, 5, kStart),
+        token(30, 1, 1, 0, 5, kStart),
+        token(35, 1, 1, 0, 5, 0),       // Plain token, not paired
+        token(40, 1, 1, 0, 5, kEnd),
+        token(45, 1, 2, 0, 5, kEnd),
+        token(60, 1, 1, 0, 5, kEnd),
+        token(70, 1, 1, 0, 6, kStart),
+    };
+    capture.add(buffer);
+
+    Decoder decoder;
+    std::string error;
+    CHECK(capture.load(&decoder, &error));
+
+    const auto& spans = decoder.spans();
+    CHECK_EQ(spans.size(), 5u);
+    if (spans.size() != 5)
+        return;
+
+    auto ts = [&decoder](const Decoder::pos_type pos) {
+        return (pos == Decoder::kNoPos) ? 0 : decoder.timestamp(pos);
+    };
+    // Ordered by START, or END when the START is missing
+    CHECK_EQ(spans[0].fStart, Decoder::kNoPos);
+    CHECK_EQ(ts(spans[0].fEnd), 10u);
+    CHECK_EQ(decoder.duration(spans[0]), 0u);
+    CHECK_EQ(ts(spans[1].fStart), 20u);  // Outer f5, thread 1
+    CHECK_EQ(ts(spans[1].fEnd), 60u);
+    CHECK_EQ(decoder.duration(spans[1]), 40u);
+    CHECK_EQ(ts(spans[2].fStart), 25u);  // Thread 2
+    CHECK_EQ(ts(spans[2].fEnd), 45u);
+    CHECK_EQ(ts(spans[3].fStart), 30u);  // Inner f5
+    CHECK_EQ(ts(spans[3].fEnd), 40u);
+    CHECK_EQ(ts(spans[4].fStart), 70u);
+    CHECK_EQ(spans[4].fEnd, Decoder::kNoPos);
+
+    // A span is found through its START or its END, once
+    Decoder::Query q;
+    q.fFunction = 5;
+    q.fBegin = 38;
+    q.fEnd = 61;
+    const auto found = decoder.querySpans(q);
+    CHECK_EQ(found.size(), 3u);
+    if (found.size() == 3) {
+        CHECK_EQ(found[0], 1u);
+        CHECK_EQ(found[1], 2u);
+        CHECK_EQ(found[2], 3u);
+    }
+    q = Decoder::Query();
+    q.fThreadID = 2;
+    CHECK_EQ(decoder.querySpans(q).size(), 1u);
+}
+
+}; // namespace
+
+int main()
+{
+    testRejectsBadImages();
+    testMergesBuffersInTimeOrder();
+    testOpenMapsFile();
+    testQueries();
+    testSpans();
+
+    if (gFailures) {
+        fprintf(stderr, "GTraceDecoderTests: %d failures\n", gFailures);
+        return EXIT_FAILURE;
+    }
+    fprintf(stdout, "GTraceDecoderTests: passed\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,176 @@
+//
+//  gtracedecode.cpp
+//  IOGraphics
+//
+//  Queries a GTrace binary written by iogdiagnose -b, on any POSIX host.
+//
+
+/*
+clang++ -std=c++17 -O2 -Wall -I../../IOGraphicsFamily -o /tmp/gtracedecode gtracedecode.cpp GTraceDecoder.cpp
+*/
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <string>
+
+#include "GTraceDecoder.hpp"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+void print_usage(const char* name)
+{
+    fprintf(stdout,
+        "usage: %s [-i] [-s] [-b begin] [-e end] [-c component]\n"
+        "       [-r registryID] [-f function] [-t threadID] file\n"
+        "\t-i, --info       Print the buffers and index timings first\n"
+        "\t-s, --spans      Print START/END spans instead of tokens\n"
+        "\t-b, --begin      First timestamp, inclusive\n"
+        "\t-e, --end        Last timestamp, inclusive\n"
+        "\t-c, --component  Tokens of a component\n"
+        "\t-r, --registry   Tokens of a registry ID\n"
+        "\t-f, --function   Tokens with a tag0 function code\n"
+        "\t-t, --thread     Tokens of a thread ID\n"
+        "Numbers may be decimal or 0x hexadecimal.\n", name);
+}
+
+bool parseNumber(const char* arg, uint64_t* valueP)
+{
+    char* end = nullptr;
+    *valueP = strtoull(arg, &end, 0);
+    return end != arg && !*end;
+}
+
+double msSince(const Clock::time_point start)
+{
+    const std::chrono::duration<double, std::milli> ms = Clock::now() - start;
+    return ms.count();
+}
+
+// Same columns as iogdiagnose's report
+void printToken(const GTraceDecoder& decoder, const GTraceDecoder::pos_type pos)
+{
+    const GTraceEntry& entry = decoder.token(pos);
+    fprintf(stdout,
+            "\t\tTkn: %06u\tTS: %llu\tLn: %u\tC: %#llx\tCTID: %u-%#llx\t"
+            "OID: %#llx\tTag: %#llx\tA: %#llx-%#llx-%#llx-%#llx\n",
+            pos, (unsigned long long) entry.timestamp(), entry.line(),
+            (unsigned long long) entry.component(), entry.cpu(),
+            (unsigned long long) entry.threadID(),
+            (unsigned long long) entry.registryID(),
+            (unsigned long long) entry.tag(),
+            (unsigned long long) entry.arg64(0),
+            (unsigned long long) entry.arg64(1),
+            (unsigned long long) entry.arg64(2),
+            (unsigned long long) entry.arg64(3));
+}
+
+void printSpan(const GTraceDecoder& decoder, const GTraceDecoder::Span& span)
+{
+    const auto pos = (span.fStart != GTraceDecoder::kNoPos)
+                   ? span.fStart : span.fEnd;
+    const GTraceEntry& entry = decoder.token(pos);
+    fprintf(stdout, "\tTS: %llu\tC: %#llx\tTID: %#llx\tOID: %#llx\tF: %u\t",
+            (unsigned long long) entry.timestamp(),
+            (unsigned long long) entry.component(),
+            (unsigned long long) entry.threadID(),
+            (unsigned long long) entry.registryID(),
+            GUNPACKFUNCCODE(entry.tag(0)));
+    if (span.fStart == GTraceDecoder::kNoPos)
+        fprintf(stdout, "D: ? (no START)\n");
+    else if (span.fEnd == GTraceDecoder::kNoPos)
+        fprintf(stdout, "D: ? (no END)\n");
+    else
+        fprintf(stdout, "D: %llu\n",
+                (unsigned long long) decoder.duration(span));
+}
+
+}; // namespace
+
+int main(int argc, char* argv[])
+{
+    static struct option opts[] = {
+        "info",      no_argument,        nullptr, 'i',
+        "spans",     no_argument,        nullptr, 's',
+        "begin",     required_argument,  nullptr, 'b',
+        "end",       required_argument,  nullptr, 'e',
+        "component", required_argument,  nullptr, 'c',
+        "registry",  required_argument,  nullptr, 'r',
+        "function",  required_argument,  nullptr, 'f',
+        "thread",    required_argument,  nullptr, 't',
+        nullptr,     no_argument,        nullptr,  0 ,
+    };
+
+    GTraceDecoder::Query query;
+    bool bInfo = false;
+    bool bSpans = false;
+    int flag;
+    while (-1 != (flag = getopt_long(argc, argv, "isb:e:c:r:f:t:", opts,
+                                     nullptr))) {
+        uint64_t* valueP = nullptr;
+        switch (flag) {
+        case 'i': bInfo = true;                    continue;
+        case 's': bSpans = true;                   continue;
+        case 'b': valueP = &query.fBegin;          break;
+        case 'e': valueP = &query.fEnd;            break;
+        case 'c': valueP = &query.fComponent;      break;
+        case 'r': valueP = &query.fRegistryID;     break;
+        case 'f': valueP = &query.fFunction;       break;
+        case 't': valueP = &query.fThreadID;       break;
+        default:
+            print_usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        if (!parseNumber(optarg, valueP)) {
+            print_usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (optind + 1 != argc) {
+        print_usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    GTraceDecoder decoder;
+    std::string error;
+    auto start = Clock::now();
+    if (!decoder.open(argv[optind], &error)) {
+        fprintf(stderr, "gtracedecode: %s\n", error.c_str());
+        exit(EXIT_FAILURE);
+    }
+    const double loadMS = msSince(start);
+
+    start = Clock::now();
+    const GTraceDecoder::index_type found
+        = (bSpans) ? decoder.querySpans(query) : decoder.query(query);
+    const double queryMS = msSince(start);
+
+    if (bInfo) {
+        for (size_t i = 0; i < decoder.bufferCount(); ++i) {
+            const GTraceHeader& header = decoder.bufferHeader(i);
+            fprintf(stdout, "Buffer %u: %.32s/%.32s, %u bytes, %u tokens\n",
+                    header.fBufferIndex,
+                    reinterpret_cast<const char*>(header.fDecoderName),
+                    reinterpret_cast<const char*>(header.fBufferName),
+                    header.fBufferSize,
+                    static_cast<unsigned>(header.fBufferSize / kGTraceEntrySize
+                        - kGTraceHeaderEntries - header.fBreadcrumbTokens));
+        }
+        fprintf(stdout, "Tokens: %zu Spans: %zu Matched: %zu\n",
+                decoder.size(), decoder.spans().size(), found.size());
+        fprintf(stdout, "Load and index: %.1f ms Query: %.3f ms\n\n",
+                loadMS, queryMS);
+    }
+
+    for (const auto i : found) {
+        if (bSpans)
+            printSpan(decoder, decoder.spans()[i]);
+        else
+            printToken(decoder, i);
+    }
+    return EXIT_SUCCESS;
+}
@@ -12,6 +12,7 @@
 #include <osutility>
 #include <iolocks>
 
+#include <IOKit/IOBufferMemoryDescriptor.h>
 #include <IOKit/IOMemoryDescriptor.h>
 #include <IOKit/IOLib.h>
 
@@ -41,7 +42,12 @@ __END_DECLS
 #include <IOKit/IOReturn.h>
 
 #include <pthread.h>
+#if __linux__
+#include <sched.h>
+#define cpu_number() sched_getcpu()  // Exercises per-CPU slices off target
+#else
 #define cpu_number() (-1)
+#endif
 
 #define D(categ, name, args...) do{}while(0)  // Not needed in userland
 
@@ -100,8 +106,10 @@ uint64_t threadID()
     uint64_t tid;
 #if KERNEL
     tid = thread_tid(current_thread());
-#else
+#elif __APPLE__
     pthread_threadid_np(NULL, &tid);
+#else
+    tid = static_cast<uint64_t>(gettid());
 #endif
     return tid;
 }
@@ -111,6 +119,280 @@ uint8_t cpu()
     return static_cast<uint8_t>(cpu_number());
 }
 
+// Slot sequence words. Zero is an empty slot, otherwise the word holds the
+// line that last claimed the slot and a busy bit while the entry is written.
+constexpr uint64_t kSeqBusy = 1;
+constexpr uint64_t seqDone(const uint32_t line)
+    { return (static_cast<uint64_t>(line) + 1) << 1; }
+constexpr uint64_t seqBusy(const uint32_t line)
+    { return seqDone(line) | kSeqBusy; }
+
+// Per-CPU slices, CPUs beyond kMaximumSliceCount share slices
+constexpr uint32_t kMinimumSliceLineCount = 128;
+constexpr uint32_t kMaximumSliceCount = 16;
+
+// Adaptive thresholds, see isSlow(). One word per function code, a saturating
+// sample count in the top byte and the running p95 below it. The estimate
+// steps down by 1/256th of itself on a shorter call and up 19 times that on a
+// longer one, so it settles where 5% of calls are longer.
+constexpr uint32_t kThresholdCountShift = 56;
+constexpr uint64_t kThresholdMask = (UINT64_C(1) << kThresholdCountShift) - 1;
+constexpr uint64_t kThresholdMaxCount = 0xff;
+constexpr uint64_t kThresholdWarmup = 20;
+constexpr uint32_t kThresholdStepShift = 8;
+constexpr uint64_t kThresholdRiseSteps = 19;
+
+// Walks one slice from its newest line down to its oldest, see copyOut()
+struct SliceCursor {
+    GTraceEntry  fEntry;
+    uint32_t     fLine;    // Line of fEntry, or compact block position
+    uint32_t     fFloor;   // Oldest line to copy, or compact top position
+    uint32_t     fBlocks;  // Compact blocks left to expand
+    uint32_t     fCached;  // Expanded tokens left in fBlock
+    GTraceEntry* fBlock;   // Compact block, expanded oldest to newest
+    bool         fValid;   // fEntry holds the next token of this slice
+};
+
+// Compact ring, kGTraceOptionCompact. Each slice is a ring of 64 bit words
+// claimed with a CAS of Slice::fCompact, which holds the next word position
+// and the time base, i.e. the timestamp of the last token claimed. Tokens
+// never straddle a block, the first token of a block has an absolute
+// timestamp and the rest a delta from the token before them, so every block
+// expands on its own. Word 0 of a token is its header, stored last:
+//   [63:32] First 4 bytes of the encoding, see compactEncode()
+//   [31:28] kCompactToken
+//   [27:24] Length in words
+//   [23:0]  Word position, rejects stale and unwritten tokens
+//
+// Each block also has a sequence word, the generation (i.e. lap) of the block
+// and a count of writers in it. Writers join the current generation or start
+// the next one once the block is empty, so a writer that stalled for a lap
+// drops its token instead of tearing newer ones. See enterCompactBlock().
+constexpr uint32_t kCompactBlockWords = 64;
+constexpr int      kCompactBlockShift = 6;
+constexpr uint32_t kCompactMaxWords = 15;
+constexpr uint32_t kCompactLineWords = kGTraceEntrySize / sizeof(uint64_t);
+constexpr int      kCompactPosBits = 24;
+constexpr uint32_t kCompactPosMask = (UINT32_C(1) << kCompactPosBits) - 1;
+constexpr uint32_t kCompactGenMask = kCompactPosMask >> kCompactBlockShift;
+constexpr int      kCompactLenShift = kCompactPosBits;
+constexpr uint64_t kCompactKindMask = UINT64_C(0xf) << 28;
+constexpr uint64_t kCompactToken = UINT64_C(0xa) << 28;
+constexpr uint64_t kCompactHeaderMask = (UINT64_C(1) << 32) - 1;
+constexpr int      kCompactHeaderBytes = 4;
+constexpr int      kCompactTimeShift = 16;  // Time base granularity
+constexpr uint64_t kCompactTimeMask
+    = (UINT64_C(1) << (64 - kCompactPosBits)) - 1;
+constexpr uint64_t kCompactWriter = UINT64_C(1) << 32;  // Block writer count
+
+enum CompactFlags : uint8_t {
+    kCompactSync      = 0x01,  // Absolute timestamp
+    kCompactCPU       = 0x02,  // CPU isn't the slice index
+    kCompactRegistry  = 0x04,  // Non zero registry ID
+    kCompactComponent = 0x08,  // Component isn't the buffer ID
+    kCompactArgShift  = 4,     // Bits 7:4, non zero args
+};
+
+// The time base only has to match between recorder and expander, it drops
+// low bits so it fits next to the position.
+constexpr uint64_t compactBase(const uint64_t timestamp)
+{
+    return ((timestamp >> kCompactTimeShift) & kCompactTimeMask)
+        << kCompactTimeShift;
+}
+constexpr uint64_t compactState(const uint32_t pos, const uint64_t timestamp)
+{
+    return (((timestamp >> kCompactTimeShift) & kCompactTimeMask)
+            << kCompactPosBits)
+         | (pos & kCompactPosMask);
+}
+constexpr uint64_t compactStateBase(const uint64_t state)
+    { return (state >> kCompactPosBits) << kCompactTimeShift; }
+constexpr uint32_t compactPos(const uint64_t state)
+    { return static_cast<uint32_t>(state) & kCompactPosMask; }
+constexpr uint64_t compactHeader(const uint32_t pos, const uint32_t len)
+{
+    return kCompactToken | (static_cast<uint64_t>(len) << kCompactLenShift)
+         | (pos & kCompactPosMask);
+}
+constexpr uint32_t compactLen(const uint64_t header)
+    { return static_cast<uint32_t>(header >> kCompactLenShift) & 0xf; }
+// Positions wrap at kCompactPosBits
+constexpr uint32_t compactDistance(const uint32_t to, const uint32_t from)
+    { return (to - from) & kCompactPosMask; }
+constexpr uint32_t compactGeneration(const uint32_t pos)
+    { return (pos >> kCompactBlockShift) & kCompactGenMask; }
+constexpr uint32_t compactSeqGeneration(const uint64_t seq)
+    { return static_cast<uint32_t>(seq); }
+constexpr bool compactNewer(const uint32_t gen, const uint32_t than)
+{
+    const uint32_t laps = (gen - than) & kCompactGenMask;
+    return laps && laps <= kCompactGenMask / 2;
+}
+
+struct CompactWriter {
+    uint8_t* fP;
+
+    void byte(const uint8_t b) { *fP++ = b; }
+    void raw64(const uint64_t v)
+        { memcpy(fP, &v, sizeof(v)); fP += sizeof(v); }
+    void varint(uint64_t v)
+    {
+        for ( ; v >= 0x80; v >>= 7)
+            *fP++ = static_cast<uint8_t>(v | 0x80);
+        *fP++ = static_cast<uint8_t>(v);
+    }
+    void zigzag(const uint64_t v)
+    {
+        const auto sign = static_cast<uint64_t>(static_cast<int64_t>(v) >> 63);
+        varint((v << 1) ^ sign);
+    }
+};
+
+struct CompactReader {
+    const uint8_t* fP;
+    const uint8_t* fEnd;
+    bool           fOK;
+
+    uint8_t byte()
+    {
+        fOK = fOK && fP < fEnd;
+        return fOK ? *fP++ : 0;
+    }
+    uint64_t raw64()
+    {
+        uint64_t v = 0;
+        fOK = fOK && fP + sizeof(v) <= fEnd;
+        if (fOK) {
+            memcpy(&v, fP, sizeof(v));
+            fP += sizeof(v);
+        }
+        return v;
+    }
+    uint64_t varint()
+    {
+        uint64_t v = 0;
+        for (int shift = 0; fOK && shift < 64; shift += 7) {
+            const uint8_t b = byte();
+            v |= static_cast<uint64_t>(b & 0x7f) << shift;
+            if (!(b & 0x80))
+                return v;
+        }
+        fOK = false;
+        return 0;
+    }
+    uint64_t zigzag()
+    {
+        const uint64_t v = varint();
+        return (v >> 1) ^ (0 - (v & 1));
+    }
+};
+
+// Encodes the entry after the header bytes, zero args and fields that match
+// the slice are left out. Returns the length in words.
+uint32_t compactEncode(const GTraceEntry& entry, const uint64_t component,
+                       const uint32_t slice, const bool sync,
+                       const uint64_t timeBase, uint64_t* words)
+{
+    uint8_t* const bytes = reinterpret_cast<uint8_t*>(words);
+    CompactWriter out{bytes};
+    uint8_t flags = sync ? kCompactSync : 0;
+    if (entry.cpu() != slice)
+        flags |= kCompactCPU;
+    if (entry.registryID())
+        flags |= kCompactRegistry;
+    if (entry.component() != component)
+        flags |= kCompactComponent;
+    for (int i = 0; i < GTraceEntry::ArgsTag::kNum; ++i)
+        if (entry.arg64(i))
+            flags |= 1 << (kCompactArgShift + i);
+
+    for (int i = 0; i < kCompactHeaderBytes; ++i)
+        out.byte(0);
+    out.byte(flags);
+    out.varint(entry.line());
+    if (sync)
+        out.raw64(entry.timestamp());
+    else
+        out.zigzag(entry.timestamp() - timeBase);
+    out.varint(entry.tag());
+    if (kCompactCPU & flags)
+        out.byte(entry.cpu());
+    out.varint(entry.threadID());
+    if (kCompactRegistry & flags)
+        out.varint(entry.registryID());
+    if (kCompactComponent & flags)
+        out.varint(entry.component());
+    for (int i = 0; i < GTraceEntry::ArgsTag::kNum; ++i)
+        if (entry.arg64(i))
+            out.varint(entry.arg64(i));
+
+    const uint32_t used = static_cast<uint32_t>(out.fP - bytes);
+    const uint32_t len = (used + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+    memset(out.fP, 0, len * sizeof(uint64_t) - used);
+    return len;
+}
+
+// Expands one token, *prevP is the timestamp of the token before it in the
+// block and is updated.
+bool compactDecode(const uint64_t* words, const uint32_t len,
+                   const uint64_t component, const uint32_t slice,
+                   const bool first, uint64_t* prevP, GTraceEntry* entryP)
+{
+    const uint8_t* const bytes = reinterpret_cast<const uint8_t*>(words);
+    CompactReader in{bytes + kCompactHeaderBytes,
+                     bytes + len * sizeof(uint64_t), true};
+    const uint8_t flags = in.byte();
+    if (first && !(kCompactSync & flags))
+        return false;
+    const uint64_t line = in.varint();
+    const uint64_t timestamp = (kCompactSync & flags)
+                             ? in.raw64()
+                             : compactBase(*prevP) + in.zigzag();
+    const uint64_t tags = in.varint();
+    const uint8_t cpu = (kCompactCPU & flags)
+                      ? in.byte() : static_cast<uint8_t>(slice);
+    const uint64_t tid = in.varint();
+    const uint64_t regID = (kCompactRegistry & flags) ? in.varint() : 0;
+    const uint64_t comp = (kCompactComponent & flags)
+                        ? in.varint() : component;
+    uint64_t args[GTraceEntry::ArgsTag::kNum] = { 0 };
+    for (int i = 0; i < GTraceEntry::ArgsTag::kNum; ++i)
+        if ((1 << (kCompactArgShift + i)) & flags)
+            args[i] = in.varint();
+    if (!in.fOK)
+        return false;
+
+    *entryP = GTraceEntry(timestamp, static_cast<uint16_t>(line), comp, cpu,
+                          tid, static_cast<uint32_t>(regID), tags,
+                          args[0], args[1], args[2], args[3]);
+    *prevP = timestamp;
+    return true;
+}
+
+// Replace pointer arguments with their external obfuscated value
+void obfuscate(GTraceEntry* entryP)
+{
+    const auto& tags = entryP->fArgsTag;
+    for (int j = 0; tags.tag() && j < GTraceEntry::ArgsTag::kNum; ++j) {
+        if (kGTRACE_ARGUMENT_POINTER & tags.tag(j)) {
+            vm_offset_t outArg = 0;
+            vm_kernel_addrperm_external(
+                static_cast<vm_offset_t>(entryP->arg64(j)), &outArg);
+            entryP->arg64(j) = outArg;
+        }
+    }
+}
+
+bool hasPointerArgs(const GTraceEntry& entry)
+{
+    const auto& tags = entry.fArgsTag;
+    for (int j = 0; tags.tag() && j < GTraceEntry::ArgsTag::kNum; ++j)
+        if (kGTRACE_ARGUMENT_POINTER & tags.tag(j))
+            return true;
+    return false;
+}
+
 };  // namespace
 
 // GTraceBuffer implementation
@@ -119,6 +401,16 @@ uint8_t cpu()
 static_assert(isPowerOf2(kGTraceEntrySize), "Entry size not a power of two");
 static_assert(isPowerOf2(kGTraceMinimumLineCount), "Min not a power of two");
 static_assert(isPowerOf2(kGTraceMaximumLineCount), "Max not a power of two");
+static_assert(isPowerOf2(kMinimumSliceLineCount), "Slice not a power of two");
+static_assert(isPowerOf2(kMaximumSliceCount), "Slices not a power of two");
+static_assert(kMinimumSliceLineCount * kMaximumSliceCount
+              <= kGTraceMaximumLineCount, "Slices exceed maximum");
+static_assert(kMinimumSliceLineCount * kCompactLineWords
+              % kCompactBlockWords == 0, "Compact slice isn't whole blocks");
+static_assert(kGTraceMaximumLineCount * kCompactLineWords
+              <= (kCompactPosMask + 1) / 2, "Compact positions too narrow");
+static_assert(kCompactBlockWords == 1 << kCompactBlockShift, "Block shift");
+static_assert(kCompactMaxWords <= 0xf, "Compact length too narrow");
 
 bool GTraceBuffer::init()
 {
@@ -129,21 +421,55 @@ bool GTraceBuffer::init()
 void GTraceBuffer::free()
 {
     DGT("[%d]\n", bufferID());
+    if (fStreamMD) {
+        // Slices, sequence words and ring all live in the stream, which may
+        // still be mapped by a consumer.
+        OSSafeReleaseNULL(fStreamMD);
+        fStream = nullptr;
+        fSlices = nullptr;
+        fSeqs = nullptr;
+        fBuffer = nullptr;
+        fSliceCount = 0;
+        fLineCount = 0;
+    }
+    if (fWords) {
+        IODelete(fWords, _Atomic(uint64_t), fLineCount * kCompactLineWords);
+        fWords = nullptr;
+    }
+    if (fCompactBlocks) {
+        IODelete(fCompactBlocks, _Atomic(uint64_t),
+                 fLineCount * kCompactLineWords / kCompactBlockWords);
+        fCompactBlocks = nullptr;
+    }
+    if (fSlices) {
+        IODelete(fSlices, Slice, fSliceCount);
+        fSlices = nullptr;
+        fSliceCount = 0;
+    }
+    if (fSeqs) {
+        IODelete(fSeqs, _Atomic(uint64_t), fLineCount);
+        fSeqs = nullptr;
+    }
     if (fBuffer) {
         IODelete(fBuffer, GTraceEntry, fLineCount);
         fBuffer = nullptr;
         fLineCount = 0;
     }
+    if (fThresholds) {
+        IODelete(fThresholds, _Atomic(uint64_t), kGTraceFilterFunctions);
+        fThresholds = nullptr;
+    }
     super::free();
 }
 
 /* static */ GTraceBuffer::shared_type GTraceBuffer::makeFromHeader(
         const GTraceHeader& header, IOMemoryDescriptor* userBufferMD,
-        breadcrumb_func bcf, void* context, IOReturn* errP)
+        breadcrumb_func bcf, void* context, const uint32_t options,
+        IOReturn* errP)
 {
     shared_type ret(new GTraceBuffer);
     if (static_cast<bool>(ret)) {
-        IOReturn err = ret->init(header, userBufferMD, bcf, context);
+        IOReturn err = ret->init(header, userBufferMD, bcf, context, options);
         const auto lineCount = header.fTokensMask + 1;
         __unused const char* decoderName
             = reinterpret_cast<const char*>(header.fDecoderName);
@@ -156,6 +482,8 @@ void GTraceBuffer::free()
                 if ( !static_cast<bool>(gGTraceArray[i]) ) {
                     gGTraceArray[i] = ret;  // Cache a shared copy
                     ret->fHeader.fBufferIndex = i;
+                    if (static_cast<bool>(ret->fStream))
+                        ret->fStream->fHeader.fBufferIndex = i;
                     DGT("[%d] (d=%s,b=%.32s,lc=%u, bcf=%.32s) {ind=%d}\n",
                         ret->bufferID(), decoderName, bufferName, lineCount,
                         static_cast<bool>(bcf) ? "yes" : "no", i);
@@ -198,24 +526,25 @@ void GTraceBuffer::free()
 
 /* static */ GTraceBuffer::shared_type GTraceBuffer::make(
         const char* decoderName, const char* bufferName,
-        const uint32_t lineCount, breadcrumb_func bcf, void* context)
+        const uint32_t lineCount, breadcrumb_func bcf, void* context,
+        const uint32_t options)
 {
     IOReturn err = kIOReturnInternalError;
     GTraceHeader header = buildHeader(decoderName, bufferName, lineCount);
-    shared_type ret
-        = makeFromHeader(header, /* user */ nullptr, bcf, context, &err);
+    shared_type ret = makeFromHeader(
+            header, /* user */ nullptr, bcf, context, options, &err);
     __unused const uint32_t
         bufferID = static_cast<bool>(ret) ? ret->bufferID() : -1;
-    DGT("[%d] (uc=%ld,d=%s,b=%s,lc=%u, %s bcf) -> %x\n",
+    DGT("[%d] (uc=%ld,d=%s,b=%s,lc=%u, %s bcf, o=%x) -> %x\n",
         bufferID, ret.use_count(), decoderName, bufferName, lineCount,
-        static_cast<bool>(bcf) ? "has" : "no", err);
+        static_cast<bool>(bcf) ? "has" : "no", options, err);
     return iog::move(ret);
 }
 
 
 IOReturn GTraceBuffer::init(
         const GTraceHeader& header, IOMemoryDescriptor* userBufferMD,
-        breadcrumb_func bcf, const void* context)
+        breadcrumb_func bcf, const void* context, const uint32_t options)
 {
     DGT("[%d] dn'%.32s' bn'%.32s' m%x v%d %llx\n",
         header.fBufferIndex, reinterpret_cast<const char*>(header.fDecoderName),
@@ -235,17 +564,69 @@ IOReturn GTraceBuffer::init(
     }
 
     const int lines = header.fTokensMask + 1;
+    const uint32_t slices = (kGTraceOptionPerCPU & options)
+        ? bound(UINT32_C(1), lines / kMinimumSliceLineCount, kMaximumSliceCount)
+        : 1;
 
     // From here on I expect the code to run quickly
+    for (int i = 0; i < kGTraceFilterWords; ++i)
+        atomic_init(&fFilter[i], 0);
+    memset(fSlowest, '\0', sizeof(fSlowest));
+    atomic_init(&fSlowestMin, 0);
+    atomic_init(&fSlowestBusy, 0);
     fHeader = header;
     fLineCount = lines;
     fLineMask = header.fTokensMask;
-    fNextLine = 0;
+    fSliceCount = slices;
+    fSliceMask = (lines / slices) - 1;
+    fSliceShift = static_cast<uint8_t>(__builtin_ctz(lines / slices));
+    fWordMask = (lines / slices) * kCompactLineWords - 1;
+    fWordShift = static_cast<uint8_t>(__builtin_ctz(fWordMask + 1));
     {
         // Allocate kernel buffer and record breadcrumb details.
-        fBuffer = IONew(GTraceEntry, lines);
-        if (fBuffer)
-            memset(fBuffer, '\0', lines * sizeof(GTraceEntry));
+        const bool compact = (kGTraceOptionCompact & options)
+                          && !(kGTraceOptionStream & options);
+        if (kGTraceOptionStream & options) {
+            const IOReturn err = initStream(lines, slices);
+            if (err)
+                return err;
+        }
+        else {
+            fSlices = IONew(Slice, slices);
+            if (compact) {
+                fWords = IONew(_Atomic(uint64_t), lines * kCompactLineWords);
+                fCompactBlocks = IONew(_Atomic(uint64_t),
+                        lines * kCompactLineWords / kCompactBlockWords);
+            }
+            else {
+                fBuffer = IONew(GTraceEntry, lines);
+                fSeqs = IONew(_Atomic(uint64_t), lines);
+            }
+        }
+        fThresholds = IONew(_Atomic(uint64_t), kGTraceFilterFunctions);
+        const bool ring = compact ? (fWords && fCompactBlocks)
+                                  : (fBuffer && fSeqs);
+        if (fSlices && ring && fThresholds) {
+            for (uint32_t i = 0; i < kGTraceFilterFunctions; ++i)
+                atomic_init(&fThresholds[i], 0);
+            for (uint32_t i = 0; i < slices; ++i) {
+                atomic_init(&fSlices[i].fNextLine, 0);
+                atomic_init(&fSlices[i].fDropped, 0);
+                atomic_init(&fSlices[i].fCompact, 0);
+            }
+            if (compact) {
+                for (uint32_t i = 0; i < lines * kCompactLineWords; ++i)
+                    atomic_init(&fWords[i], 0);
+                for (uint32_t i = 0;
+                     i < lines * kCompactLineWords / kCompactBlockWords; ++i)
+                    atomic_init(&fCompactBlocks[i], 0);
+            }
+            else {
+                memset(fBuffer, '\0', lines * sizeof(GTraceEntry));
+                for (int i = 0; i < lines; ++i)
+                    atomic_init(&fSeqs[i], 0);
+            }
+        }
         else {
             DGT(" no memory\n");
             IOLog("GTraceBuffer no memory\n");
@@ -258,9 +639,53 @@ IOReturn GTraceBuffer::init(
     {
         LockGuard<IOLock> locked(sLock);
         fHeader.fBufferID = sCurBufferID++;
+        if (static_cast<bool>(fStream))
+            fStream->fHeader = fHeader;
+    }
+
+    DGT("[%d] {lc=%x lm=%x sc=%u}\n",
+        bufferID(), fLineCount, fLineMask, fSliceCount);
+    return kIOReturnSuccess;
+}
+
+// Lay out a GTraceStreamHeader, the slices, sequence words and ring in one
+// shareable descriptor, see GTraceTypes.hpp.
+IOReturn GTraceBuffer::initStream(const uint32_t lines, const uint32_t slices)
+{
+    static_assert(sizeof(Slice) == sizeof(GTraceStreamSlice)
+               && offsetof(Slice, fNextLine)
+                  == offsetof(GTraceStreamSlice, fNextLine)
+               && offsetof(Slice, fDropped)
+                  == offsetof(GTraceStreamSlice, fDropped),
+                  "Slice doesn't match GTraceStreamSlice");
+
+    const uint32_t slicesOffset = kGTraceHeaderSize;
+    const uint32_t seqsOffset = slicesOffset + slices * sizeof(Slice);
+    const uint32_t tokensOffset = static_cast<uint32_t>(
+        (seqsOffset + lines * sizeof(uint64_t) + kGTraceEntrySize - 1)
+        & ~static_cast<uint32_t>(kGTraceEntrySize - 1));
+    const uint32_t mapSize = tokensOffset + lines * sizeof(GTraceEntry);
+
+    fStreamMD = IOBufferMemoryDescriptor::withOptions(
+            kIODirectionNone | kIOMemoryKernelUserShared, mapSize, PAGE_SIZE);
+    if (!static_cast<bool>(fStreamMD)) {
+        DGT(" no stream memory\n");
+        return kIOReturnNoMemory;
     }
 
-    DGT("[%d] {lc=%x lm=%x}\n", bufferID(), fLineCount, fLineMask);
+    uint8_t* const base = static_cast<uint8_t*>(fStreamMD->getBytesNoCopy());
+    bzero(base, fStreamMD->getLength());
+    fStream = reinterpret_cast<GTraceStreamHeader*>(base);
+    fStream->fStreamVersion = kGTraceStreamVersion;
+    fStream->fSliceCount = slices;
+    fStream->fSliceLines = lines / slices;
+    fStream->fSlicesOffset = slicesOffset;
+    fStream->fSeqsOffset = seqsOffset;
+    fStream->fTokensOffset = tokensOffset;
+    fStream->fMapSize = mapSize;
+    fSlices = reinterpret_cast<Slice*>(base + slicesOffset);
+    fSeqs = reinterpret_cast<_Atomic(uint64_t)*>(base + seqsOffset);
+    fBuffer = reinterpret_cast<GTraceEntry*>(base + tokensOffset);
     return kIOReturnSuccess;
 }
 
@@ -297,9 +722,268 @@ GTraceBuffer::formatToken(const uint16_t line,
                        MAKEGTRACETAG(tag4), MAKEGTRACEARG(arg4));
 }
 
+void GTraceBuffer::setFilter(const GTraceFilter& filter)
+{
+    for (int i = 0; i < kGTraceFilterWords; ++i) {
+        atomic_store_explicit(&fFilter[i], filter.fDropFunctions[i],
+                              memory_order_relaxed);
+    }
+}
+
+GTraceFilter GTraceBuffer::filter() const
+{
+    GTraceFilter ret;
+    for (int i = 0; i < kGTraceFilterWords; ++i) {
+        ret.fDropFunctions[i]
+            = atomic_load_explicit(&fFilter[i], memory_order_relaxed);
+    }
+    return ret;
+}
+
+// The estimate is updated with a plain store, not a CAS, so a concurrent call
+// of the same function may be lost. That only delays the estimate a step.
+// A fixed delayat leaves the estimate alone, the store would only bounce the
+// function's word between CPUs for a p95 nobody reads.
+bool GTraceBuffer::isSlow(const uint16_t tag0, const uint64_t duration,
+                          const uint64_t delayat)
+{
+    if (delayat)
+        return duration > delayat;
+
+    _Atomic(uint64_t)* const wordP = &fThresholds[GUNPACKFUNCCODE(tag0)];
+    const uint64_t word = atomic_load_explicit(wordP, memory_order_relaxed);
+    uint64_t count = word >> kThresholdCountShift;
+    uint64_t p95 = word & kThresholdMask;
+    const uint64_t sample
+        = (duration < kThresholdMask) ? duration : kThresholdMask;
+
+    const bool slow = (count >= kThresholdWarmup && sample > p95);
+
+    const uint64_t step = (p95 >> kThresholdStepShift) | 1;
+    if (!count)
+        p95 = sample;
+    else if (sample > p95) {
+        p95 += kThresholdRiseSteps * step;
+        if (p95 > kThresholdMask)
+            p95 = kThresholdMask;
+    }
+    else
+        p95 -= (step < p95) ? step : p95;
+    if (count < kThresholdMaxCount)
+        ++count;
+    atomic_store_explicit(wordP, (count << kThresholdCountShift) | p95,
+                          memory_order_relaxed);
+    return slow;
+}
+
+// Slow calls are rare, so the table is guarded by a try lock and an offer that
+// finds it busy is dropped rather than spinning, which is safe from any
+// context.
+void GTraceBuffer::recordSlowCall(const GTraceEntry& entry,
+                                  const uint64_t duration)
+{
+    if (duration <= atomic_load_explicit(&fSlowestMin, memory_order_relaxed))
+        return;
+    uint32_t idle = 0;
+    if (!atomic_compare_exchange_strong_explicit(&fSlowestBusy, &idle, 1,
+            memory_order_acquire, memory_order_relaxed))
+        return;
+
+    int shortest = 0;
+    for (int i = 1; i < kGTraceSlowestCount; ++i)
+        if (fSlowest[i].fDuration < fSlowest[shortest].fDuration)
+            shortest = i;
+    if (duration > fSlowest[shortest].fDuration) {
+        GTraceSlowCall& call = fSlowest[shortest];
+        call.fDuration = duration;
+        call.fThreshold = kThresholdMask & atomic_load_explicit(
+                &fThresholds[GUNPACKFUNCCODE(entry.tag(0))],
+                memory_order_relaxed);
+        call.fEntry = entry;
+    }
+    uint64_t min = fSlowest[0].fDuration;
+    for (int i = 1; i < kGTraceSlowestCount; ++i)
+        if (fSlowest[i].fDuration < min)
+            min = fSlowest[i].fDuration;
+    atomic_store_explicit(&fSlowestMin, min, memory_order_relaxed);
+
+    atomic_store_explicit(&fSlowestBusy, 0, memory_order_release);
+}
+
+// Lock free. The writer owns its slot while the busy bit is set, a writer that
+// laps the ring onto a slot that is still busy drops its entry rather than
+// tearing the one in flight. Preemption may still put two writers on one
+// slice, so the per-CPU index is atomic too, but it is not shared with other
+// CPUs.
 void GTraceBuffer::recordToken(const GTraceEntry& entry)
 {
-    fBuffer[getNextLine()] = entry;
+    // Catches callers that format their own tokens, the macros test earlier
+    if (filtered(entry.tag(0)))
+        return;
+
+    // A streamed ring is readable by its consumer, hide pointers now
+    if (static_cast<bool>(fWords))
+        storeCompact(entry);
+    else if (static_cast<bool>(fStream) && hasPointerArgs(entry)) {
+        GTraceEntry obfuscated(entry);
+        obfuscate(&obfuscated);
+        storeToken(obfuscated);
+    }
+    else
+        storeToken(entry);
+}
+
+void GTraceBuffer::storeToken(const GTraceEntry& entry)
+{
+    const uint32_t slice = (fSliceCount > 1) ? cpu() & (fSliceCount - 1) : 0;
+    const uint32_t line = getNextLine(fSlices[slice]);
+    const uint32_t i = slot(slice, line);
+    _Atomic(uint64_t)* const seqP = &fSeqs[i];
+    uint64_t seq = atomic_load_explicit(seqP, memory_order_relaxed);
+    if ((seq & kSeqBusy)
+    ||  !atomic_compare_exchange_strong_explicit(seqP, &seq, seqBusy(line),
+            memory_order_relaxed, memory_order_relaxed)) {
+        atomic_fetch_add_explicit(&fSlices[slice].fDropped, 1,
+                                  memory_order_relaxed);
+        return;
+    }
+    atomic_thread_fence(memory_order_release);  // Busy before entry stores
+    fBuffer[i] = entry;
+    atomic_store_explicit(seqP, seqDone(line), memory_order_release);
+}
+
+// Lock free. The claim CAS also swaps the time base, so a token's delta is
+// always from the token claimed just before it. A reader only sees a token
+// once its header word is stored.
+void GTraceBuffer::storeCompact(const GTraceEntry& entry)
+{
+    const uint32_t slice = (fSliceCount > 1) ? cpu() & (fSliceCount - 1) : 0;
+    Slice& sl = fSlices[slice];
+    uint64_t words[kCompactMaxWords];
+    uint64_t state = atomic_load_explicit(&sl.fCompact, memory_order_relaxed);
+    uint32_t start, len;
+    for (;;) {
+        const uint32_t pos = compactPos(state);
+        const uint32_t offset = pos & (kCompactBlockWords - 1);
+        start = pos;
+        len = compactEncode(entry, bufferID(), slice, !offset,
+                            compactStateBase(state), words);
+        if (offset && offset + len > kCompactBlockWords) {
+            // Skip to the next block, which starts with an absolute time
+            start = pos + kCompactBlockWords - offset;
+            len = compactEncode(entry, bufferID(), slice, true, 0, words);
+        }
+        const uint64_t next = compactState(start + len, entry.timestamp());
+        if (atomic_compare_exchange_weak_explicit(&sl.fCompact, &state, next,
+                memory_order_relaxed, memory_order_relaxed))
+            break;
+    }
+    atomic_fetch_add_explicit(&sl.fNextLine, 1, memory_order_relaxed);
+
+    _Atomic(uint64_t)* const blockP = &fCompactBlocks[blockSlot(slice, start)];
+    if (!enterCompactBlock(blockP, compactGeneration(start))) {
+        atomic_fetch_add_explicit(&sl.fDropped, 1, memory_order_relaxed);
+        return;
+    }
+    atomic_thread_fence(memory_order_release);  // Generation before stores
+    for (uint32_t i = 1; i < len; ++i) {
+        atomic_store_explicit(&fWords[wordSlot(slice, start + i)], words[i],
+                              memory_order_relaxed);
+    }
+    const uint64_t header = (words[0] & ~kCompactHeaderMask)
+                          | compactHeader(start, len);
+    atomic_store_explicit(&fWords[wordSlot(slice, start)], header,
+                          memory_order_release);
+    atomic_fetch_sub_explicit(blockP, kCompactWriter, memory_order_release);
+}
+
+// Join the writers of generation gen of a block. Fails if writers of another
+// generation are still in it, or the block has moved on to a later one.
+bool GTraceBuffer::enterCompactBlock(
+        _Atomic(uint64_t)* blockP, const uint32_t gen)
+{
+    uint64_t seq = atomic_load_explicit(blockP, memory_order_relaxed);
+    for (;;) {
+        uint64_t next;
+        if (compactSeqGeneration(seq) == gen)
+            next = seq + kCompactWriter;
+        else if (seq < kCompactWriter
+             &&  compactNewer(gen, compactSeqGeneration(seq)))
+            next = gen | kCompactWriter;
+        else
+            return false;
+        if (atomic_compare_exchange_weak_explicit(blockP, &seq, next,
+                memory_order_relaxed, memory_order_relaxed))
+            return true;
+    }
+}
+
+// Expands the tokens of the block at blockPos that were claimed before top,
+// oldest first. Stops at a token that is not written yet and returns no
+// tokens if the block moved on to a later generation while being copied.
+uint32_t GTraceBuffer::copyCompactBlock(
+        const uint32_t slice, const uint32_t blockPos, const uint32_t top,
+        GTraceEntry* entriesP) const
+{
+    _Atomic(uint64_t)* const blockP
+        = &fCompactBlocks[blockSlot(slice, blockPos)];
+    const uint32_t gen = compactGeneration(blockPos);
+    if (gen != compactSeqGeneration(
+            atomic_load_explicit(blockP, memory_order_acquire)))
+        return 0;
+
+    const uint32_t end = compactDistance(top, blockPos) < kCompactBlockWords
+                       ? compactDistance(top, blockPos) : kCompactBlockWords;
+    uint64_t words[kCompactMaxWords];
+    uint64_t prev = 0;
+    uint32_t count = 0;
+    for (uint32_t offset = 0; offset < end; ) {
+        const uint32_t pos = blockPos + offset;
+        words[0] = atomic_load_explicit(&fWords[wordSlot(slice, pos)],
+                                        memory_order_acquire);
+        const uint32_t len = compactLen(words[0]);
+        if (compactPos(words[0]) != (pos & kCompactPosMask)
+        ||  (kCompactKindMask & words[0]) != kCompactToken
+        ||  !len || offset + len > end)
+            break;  // Skipped to the next block, or not written yet
+        for (uint32_t i = 1; i < len; ++i) {
+            words[i] = atomic_load_explicit(
+                    &fWords[wordSlot(slice, pos + i)], memory_order_relaxed);
+        }
+        if (!compactDecode(words, len, bufferID(), slice, !count, &prev,
+                           &entriesP[count]))
+            break;
+        ++count;
+        offset += len;
+    }
+
+    atomic_thread_fence(memory_order_acquire);  // Ring loads before recheck
+    const uint64_t seq = atomic_load_explicit(blockP, memory_order_relaxed);
+    return (gen == compactSeqGeneration(seq)) ? count : 0;
+}
+
+uint32_t GTraceBuffer::nextLine() const
+{
+    uint32_t ret = 0;
+    for (uint32_t i = 0; i < fSliceCount; ++i)
+        ret += nextLine(i);
+    return ret;
+}
+
+// Writers are still running, a slot is only copied if its sequence word holds
+// the expected line before and after the copy. Returns false for slots that
+// are empty, being written or already overwritten by a later line.
+bool GTraceBuffer::copySlot(const uint32_t slice, const uint32_t line,
+                            GTraceEntry* entryP) const
+{
+    const uint64_t seq = seqDone(line);
+    const uint32_t i = slot(slice, line);
+    _Atomic(uint64_t)* const seqP = &fSeqs[i];
+    if (seq != atomic_load_explicit(seqP, memory_order_acquire))
+        return false;
+    *entryP = fBuffer[i];
+    atomic_thread_fence(memory_order_acquire);  // Entry before recheck
+    return seq == atomic_load_explicit(seqP, memory_order_relaxed);
 }
 
 namespace {
@@ -385,32 +1069,100 @@ IOReturn GTraceBuffer::copyOut(
     }
     auto* const outTokensP = &outBufP->fTokens[bcTokens];
     header.fTokenLine = nextLine();
+    const bool compact = static_cast<bool>(fWords);
+    const uint32_t blockCount = fSliceCount * kCompactBlockWords;
+    SliceCursor* cursors = nullptr;
+    GTraceEntry* blocks = nullptr;
     if (remaining >= kGTraceEntrySize) {
+        cursors = IONew(SliceCursor, fSliceCount);
+        if (compact)
+            blocks = IONew(GTraceEntry, blockCount);
+    }
+    if (compact && !blocks && cursors) {
+        IODelete(cursors, SliceCursor, fSliceCount);
+        cursors = nullptr;
+    }
+    if (static_cast<bool>(cursors)) {
         // We have room to copy at least one entry
-        const int outNumEntries = remaining / kGTraceEntrySize;
-        const int availLines = fLineCount;
-        const int copyEntries
-            = (availLines < outNumEntries) ? availLines : outNumEntries;
-
-        // Copy and obfuscate trace entries into client's buffer.
-        int curToken = 0;
-        for (int i = 0; i < copyEntries; i++) {
-            GTraceEntry entry = fBuffer[i];
-            if (!static_cast<bool>(entry.timestamp()))  // Skip unused slots
+        const uint32_t outNumEntries = remaining / kGTraceEntrySize;
+        const uint32_t sliceLines = fSliceMask + 1;
+        const uint32_t copyEntries = (sliceLines < outNumEntries)
+                                   ? sliceLines : outNumEntries;
+
+        // Find the newest token of each slice, lines claimed after the
+        // snapshot of the slice's index are skipped.
+        auto prevToken = [this, cursors](const uint32_t slice) {
+            SliceCursor& cursor = cursors[slice];
+            cursor.fValid = false;
+            while (!cursor.fValid && cursor.fLine != cursor.fFloor)
+                cursor.fValid = copySlot(slice, --cursor.fLine, &cursor.fEntry);
+        };
+        // Compact slices expand a block at a time, newest block first
+        auto prevCompactToken = [this, cursors](const uint32_t slice) {
+            SliceCursor& cursor = cursors[slice];
+            while (!cursor.fCached && cursor.fBlocks) {
+                --cursor.fBlocks;
+                cursor.fLine -= kCompactBlockWords;
+                cursor.fCached = copyCompactBlock(
+                        slice, cursor.fLine, cursor.fFloor, cursor.fBlock);
+            }
+            cursor.fValid = static_cast<bool>(cursor.fCached);
+            if (cursor.fValid)
+                cursor.fEntry = cursor.fBlock[--cursor.fCached];
+        };
+        for (uint32_t i = 0; i < fSliceCount; ++i) {
+            if (compact) {
+                // The newest block may be partly claimed, the oldest may be
+                // partly overwritten, copyCompactBlock() sorts that out.
+                const uint32_t top = compactPos(atomic_load_explicit(
+                        &fSlices[i].fCompact, memory_order_relaxed));
+                cursors[i].fFloor = top;
+                cursors[i].fLine = (top + kCompactBlockWords - 1)
+                                 & ~(kCompactBlockWords - 1);
+                cursors[i].fBlocks = (fWordMask + 1) / kCompactBlockWords;
+                cursors[i].fCached = 0;
+                cursors[i].fBlock = &blocks[i * kCompactBlockWords];
+                prevCompactToken(i);
                 continue;
+            }
+            const uint32_t top = nextLine(i);
+            cursors[i].fLine = top;
+            cursors[i].fFloor = top - copyEntries;
+            prevToken(i);
+        }
 
-            const auto& tags = entry.fArgsTag;
-            for (int j = 0; tags.tag() && j < GTraceEntry::ArgsTag::kNum; ++j) {
-                if (kGTRACE_ARGUMENT_POINTER & tags.tag(j)) {
-                    vm_offset_t outArg = 0;
-                    vm_kernel_addrperm_external(
-                        static_cast<vm_offset_t>(entry.arg64(j)), &outArg);
-                    entry.arg64(j) = outArg;
-                }
+        // Merge the slices newest first into the tail of the client's buffer,
+        // stopping when it is full, then slide the tokens down so they read
+        // oldest to newest.
+        uint32_t first = outNumEntries;
+        while (first) {
+            int newest = -1;
+            for (uint32_t i = 0; i < fSliceCount; ++i) {
+                if (cursors[i].fValid
+                &&  (newest < 0 || cursors[newest].fEntry.timestamp()
+                                   < cursors[i].fEntry.timestamp()))
+                    newest = static_cast<int>(i);
             }
-            outTokensP[curToken++] = entry;
+            if (newest < 0)
+                break;
+
+            GTraceEntry& entry = cursors[newest].fEntry;
+            if (!static_cast<bool>(fStream))  // Stream is obfuscated already
+                obfuscate(&entry);
+            outTokensP[--first] = entry;
+            if (compact)
+                prevCompactToken(static_cast<uint32_t>(newest));
+            else
+                prevToken(static_cast<uint32_t>(newest));
         }
-        header.fTokensCopied = curToken;
+        const uint32_t copied = outNumEntries - first;
+        if (first && copied)
+            memmove(&outTokensP[0], &outTokensP[first],
+                    copied * sizeof(GTraceEntry));
+        header.fTokensCopied = static_cast<uint16_t>(copied);
+        IODelete(cursors, SliceCursor, fSliceCount);
+        if (blocks)
+            IODelete(blocks, GTraceEntry, blockCount);
     }
     // Add breadcrumb size to copied tokens if any.
     header.fTokensCopied += bcTokens;
@@ -508,6 +1260,98 @@ GTraceBuffer::fetch(const uint32_t index, IOMemoryDescriptor* outDesc)
     return err;
 }
 
+// API used by friend class IOGDiagnosticGTraceClient to map a live stream.
+/* static */ IOReturn
+GTraceBuffer::streamDescriptor(const uint32_t index, IOMemoryDescriptor** descP)
+{
+    if (index >= kGTraceMaximumBufferCount)
+        return kIOReturnNotFound;
+
+    IOReturn err = kIOReturnNotFound;
+    {
+        LockGuard<IOLock> locked(sLock);
+        const auto& so = gGTraceArray[index];  // alias
+        if (static_cast<bool>(so)) {
+            err = kIOReturnUnsupported;
+            if (static_cast<bool>(so->fStreamMD)) {
+                so->fStreamMD->retain();
+                *descP = so->fStreamMD;
+                err = kIOReturnSuccess;
+            }
+        }
+    }
+    DGT("(%u) -> %x\n", index, err);
+    return err;
+}
+
+// API used by friend class IOGDiagnosticGTraceClient to filter a buffer.
+/* static */ IOReturn
+GTraceBuffer::setFilter(const uint32_t index, const GTraceFilter& filter)
+{
+    if (index >= kGTraceMaximumBufferCount)
+        return kIOReturnNotFound;
+
+    IOReturn err = kIOReturnNotFound;
+    {
+        LockGuard<IOLock> locked(sLock);
+        const auto& so = gGTraceArray[index];  // alias
+        if (static_cast<bool>(so)) {
+            so->setFilter(filter);
+            err = kIOReturnSuccess;
+        }
+    }
+    DGT("(%u) -> %x\n", index, err);
+    return err;
+}
+
+// API used by friend class IOGDiagnosticGTraceClient to dump the slow calls.
+/* static */ IOReturn
+GTraceBuffer::fetchSlowest(const uint32_t index, IOMemoryDescriptor* outDesc)
+{
+    if (index >= kGTraceMaximumBufferCount)
+        return kIOReturnNotFound;
+    if (outDesc->getLength() < sizeof(fSlowest))
+        return kIOReturnBadArgument;
+
+    shared_type traceBuffer;
+    {
+        // Locked while we copy cached GTraceBuffer to a local OSSharedObject
+        LockGuard<IOLock> locked(sLock);
+        const auto& so = gGTraceArray[index];  // alias
+        if (!static_cast<bool>(so))
+            return kIOReturnNotFound;
+        traceBuffer = so;
+    }
+
+    // Unlocked, a recorder holding the table may have been preempted. Retry
+    // rather than spin, recorders that find the table busy drop their offer.
+    GTraceSlowCall calls[kGTraceSlowestCount];
+    uint32_t idle = 0;
+    while (!atomic_compare_exchange_strong_explicit(
+                &traceBuffer->fSlowestBusy, &idle, 1,
+                memory_order_acquire, memory_order_relaxed)) {
+        idle = 0;
+        IOSleep(1);
+    }
+    memcpy(static_cast<void*>(calls), traceBuffer->fSlowest, sizeof(calls));
+    atomic_store_explicit(&traceBuffer->fSlowestBusy, 0, memory_order_release);
+
+    // Slowest first, insertion sort is plenty for a handful of calls
+    for (int i = 1; i < kGTraceSlowestCount; ++i) {
+        const GTraceSlowCall call = calls[i];
+        int j = i;
+        for ( ; j > 0 && calls[j - 1].fDuration < call.fDuration; --j)
+            calls[j] = calls[j - 1];
+        calls[j] = call;
+    }
+    for (auto& call : calls)
+        obfuscate(&call.fEntry);
+
+    (void) outDesc->writeBytes(0, calls, sizeof(calls));
+    DGT("(%u)\n", index);
+    return kIOReturnSuccess;
+}
+
 // Note at the end of this function only the cached reference will remain until
 // the next run of iogdiagnose.
 /* static */ void GTraceBuffer::destroy(shared_type&& inBso)
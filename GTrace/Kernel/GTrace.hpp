@@ -30,8 +30,11 @@
 // Function has been moved and renamed, define old macro in terms of new
 #define GTFuncTag(i, t, tag) GPACKFUNCTAG(i, t, tag)
 
+// Tokens whose function code is dropped by the buffer's filter, see
+// GTraceBuffer::setFilter(), cost one relaxed load and are never formatted.
 #define GTRACERAW(tracer, t0, a0, t1, a1, t2, a2, t3, a3) do{                  \
-    if (static_cast<bool>(tracer)){                                            \
+    if (static_cast<bool>(tracer)                                              \
+     && !(tracer)->filtered(MAKEGTRACETAG(t0))){                               \
         (tracer)->recordToken(__LINE__,                                        \
                 MAKEGTRACETAG(t0), MAKEGTRACEARG(a0),                          \
                 MAKEGTRACETAG(t1), MAKEGTRACEARG(a1),                          \
@@ -53,42 +56,53 @@
 
 // GTrace for calls that are slow. The GTRACE_IFSLOW_START records the current
 // time, then GTRACE_IFSLOW_END will record an entry if the duration between
-// start and end is > the threshold.  Note `delayat` is in absolute time units.
+// start and end is > the threshold.  Note `delayat` is in absolute time units,
+// a `delayat` of 0 instead records calls that are outliers for the fid, see
+// GTraceBuffer::isSlow().
 #define GTRACE_IFSLOW_START(tracer, fid) do {                                  \
     const uint64_t _gtrace_ ## fid ## _start_                                  \
-        = ((static_cast<bool>(tracer)) ? mach_continuous_time() : 0)
+        = ((static_cast<bool>(tracer)                                          \
+         && !(tracer)->filtered(GTFuncTag(fid, 0, 0)))                         \
+            ? mach_continuous_time() : 0)
 
 // Matches the do{ from GTRACE_IFSLOW_START, must be in same scope
 #define GTRACE_IFSLOW_END(tracer, fid, ft, t0, a0, t1, a1, t2, a2, delayat)    \
-    if(static_cast<bool>(tracer)) {                                            \
+    if(static_cast<bool>(tracer) && _gtrace_ ## fid ## _start_) {              \
         const uint64_t _gtrace_ifslow_now_ = mach_continuous_time();           \
         const uint64_t _gtrace_delta_                                          \
             = _gtrace_ifslow_now_ - _gtrace_ ## fid ## _start_;                \
-        if(_gtrace_delta_ > (delayat))                                         \
-            (tracer)->recordToken(__LINE__, GTFuncTag(fid, ft, 0),             \
-                                _gtrace_delta_, t0, a0, t1, a1, t2, a2,        \
-                                _gtrace_ifslow_now_);                          \
+        if((tracer)->isSlow(GTFuncTag(fid, ft, 0), _gtrace_delta_, delayat)) { \
+            const GTraceEntry _gtrace_slow_ = (tracer)->formatToken(__LINE__,  \
+                    GTFuncTag(fid, ft, 0), _gtrace_delta_,                     \
+                    t0, a0, t1, a1, t2, a2, _gtrace_ifslow_now_);              \
+            (tracer)->recordToken(_gtrace_slow_);                              \
+            (tracer)->recordSlowCall(_gtrace_slow_, _gtrace_delta_);           \
+        }                                                                      \
     }                                                                          \
 }while(0)
 
 // Create a pair of GTrace records but only record them if the time duration
-// was > than the absolute time threshold given in GTRACE_DEFER_END
+// was > than the absolute time threshold given in GTRACE_DEFER_END, or with a
+// threshold of 0 is an outlier for t0's function code, as for
+// GTRACE_IFSLOW_END.
 #define GTRACE_DEFER_START(tracer, t0, a0, t1, a1, t2, a2, t3, a3)             \
 do{                                                                            \
-    const GTraceEntry _gtrace_start_ = (static_cast<bool>(tracer))             \
+    const GTraceEntry _gtrace_start_ = (static_cast<bool>(tracer)              \
+                                     && !(tracer)->filtered(MAKEGTRACETAG(t0)))\
         ? (tracer)->formatToken(__LINE__, t0, a0, t1, a1, t2, a2, t3, a3)      \
         : GTraceEntry()
 
 // Matches the do{ from GTRACE_DEFER_START, must be in same block scope
 #define GTRACE_DEFER_END(tracer, t0, a0, t1, a1, t2, a2, t3, a3, delayat)      \
-    if (static_cast<bool>(tracer)) {                                           \
+    if (static_cast<bool>(tracer) && _gtrace_start_.timestamp()) {             \
         const uint64_t _gtrace_defer_now_ = mach_continuous_time();            \
         const uint64_t _gtrace_delta_                                          \
             = _gtrace_defer_now_ - _gtrace_start_.timestamp();                 \
-        if(_gtrace_delta_ > (delayat)) {                                       \
+        if((tracer)->isSlow(MAKEGTRACETAG(t0), _gtrace_delta_, delayat)) {     \
             (tracer)->recordToken(_gtrace_start_);                             \
             (tracer)->recordToken(__LINE__, t0, a0, t1, a1,                    \
                                           t2, a2, t3, a3, _gtrace_defer_now_); \
+            (tracer)->recordSlowCall(_gtrace_start_, _gtrace_delta_);          \
         }                                                                      \
     }                                                                          \
 }while(0)
@@ -106,6 +120,7 @@ do{                                                                            \
 }while(0)
 #endif
 
+class IOBufferMemoryDescriptor;
 class IOMemoryDescriptor;
 class IOMemoryMap;
 class GTraceBuffer final : public OSObject
@@ -153,12 +168,22 @@ public:
      @param bcf: breadcrumb_func. May be null. Function to call when the buffer
             is being fetched, to be used by your decode module. See discussion.
      @param context: Context to pass to the bcf function.
+     @param options: kGTraceOption* flags. kGTraceOptionPerCPU splits the ring
+            into per-CPU slices, each with its own line index, so busy
+            recorders on different CPUs don't share a cache line. Slices are
+            merged by timestamp on fetch. kGTraceOptionStream allocates the
+            ring so that it can be mapped read only into `iogdiagnose
+            --follow`, see GTraceStreamHeader. Pointer arguments are then
+            obfuscated as they are recorded. kGTraceOptionCompact stores
+            variable length, delta encoded tokens in the same memory, that
+            fetch expands back to GTraceEntry. Ignored for streamed buffers.
      @result OSSharedObject<GTraceBuffer> with the new created buffer. An empty
              buffer on failure.
      */
     static shared_type make(
             const char* decoderName, const char* bufferName,
-            const uint32_t lineCount, breadcrumb_func bcf, void* context);
+            const uint32_t lineCount, breadcrumb_func bcf, void* context,
+            const uint32_t options = 0);
 
     /*! @function destroy
      @abstract Destroy a buffer shared object created with make.
@@ -261,7 +286,54 @@ public:
             line, tag1, arg1, tag2, arg2, tag3, arg3, tag4, arg4, timestamp));
     }
 
+    /*! @function filtered
+     @abstract Test tag0 against the record time filter.
+     @discussion Used by the GTRACE macros to skip formatToken() for tokens
+         that recordToken() would drop anyway. A single relaxed load, a new
+         filter is seen by each CPU eventually rather than immediately.
+     @param tag0 The tag associated with arg1, see GPACKFUNCTAG.
+     @result true if tokens for tag0's function code are not recorded.
+     */
+    inline bool filtered(const uint16_t tag0) const
+    {
+        const uint16_t code = GUNPACKFUNCCODE(tag0);
+        return atomic_load_explicit(&fFilter[code / 64], memory_order_relaxed)
+             & (UINT64_C(1) << (code % 64));
+    }
+
+    /*! @function isSlow
+     @abstract Threshold of GTRACE_IFSLOW_END and GTRACE_DEFER_END.
+     @discussion A non-zero delayat is a fixed threshold, as before the
+         estimate. A zero delayat feeds duration into a running estimate of
+         the 95th percentile of tag0's function code, and tests it against the
+         estimate from before, once the function has been timed a few times.
+         Lock free, concurrent callers may lose a step of the estimate.
+     @param tag0 The tag of the call, see GPACKFUNCTAG.
+     @param duration Absolute time taken by the call.
+     @param delayat Absolute time threshold, 0 for the running p95.
+     @result true if duration > delayat, or with a zero delayat if duration is
+         above the running p95.
+     */
+    bool isSlow(const uint16_t tag0, const uint64_t duration,
+                const uint64_t delayat);
+
+    /*! @function recordSlowCall
+     @abstract Offers a slow call to the table of slowest calls.
+     @discussion Keeps the kGTraceSlowestCount longest calls for the life of
+         the buffer, fetched by iogdiagnose as GTraceSlowCalls. Lock free, a
+         call that races another insert is dropped.
+     @param entry Token identifying the call and its arguments.
+     @param duration Absolute time taken by the call.
+     */
+    void recordSlowCall(const GTraceEntry& entry, const uint64_t duration);
+
+private:
+    // Dropped function codes, see setFilter(). Outside of GTRACE_IMPL so that
+    // filtered() can be inlined by every client.
+    _Atomic(uint64_t)    fFilter[kGTraceFilterWords];
+
 #if GTRACE_IMPL
+public:
     /*! @function synchIndex
      @abstract Publishes the current gtrace token index.
      @discussion  Used by Decode to synchronize between os_log and GTrace. I
@@ -278,6 +350,8 @@ public:
          IOMemoryDescriptor, which must be prepared. Data is copied up to the
          buffer size or the internal buffer size (which ever is less). Once the
          data is copied a post processing step that obfuscates pointers is run.
+         Tokens are copied oldest to newest, ending at fTokenLine. Slots that
+         are being written during the copy are dropped rather than torn.
      @param bso OSSharedObject<GTraceBuffer> (i.e. shared_type) of GTraceBuffer
      @param outDesc pointer to a prepared memory descriptor.
      @result kIOReturnSuccess if the copy was successful, else an error.
@@ -293,6 +367,17 @@ public:
     uint32_t lineCount() const { return fLineCount; }
     uint32_t bufferID() const  { return fHeader.fBufferID; }
 
+    /*! @function setFilter
+     @abstract Replace the record time filter.
+     @discussion Tokens whose tag0 function code has its bit set in
+         filter.fDropFunctions are dropped by recordToken() and, through
+         filtered(), before formatToken() by the GTRACE macros. The words are
+         stored independently, a concurrent recorder may see a mix of old and
+         new words for a moment.
+     */
+    void setFilter(const GTraceFilter& filter);
+    GTraceFilter filter() const;
+
 protected:
     // OSObject overrides
     bool init() APPLE_KEXT_OVERRIDE;
@@ -302,22 +387,49 @@ protected:
     // See make() for details on arguments
     IOReturn init(
         const GTraceHeader& header, IOMemoryDescriptor* userBufferMD,
-        breadcrumb_func bcf, const void* context);
+        breadcrumb_func bcf, const void* context, const uint32_t options);
     static shared_type makeFromHeader(
             const GTraceHeader& header, IOMemoryDescriptor* userBufferMD,
-            breadcrumb_func bcf, void* context, IOReturn* errP);
+            breadcrumb_func bcf, void* context, const uint32_t options,
+            IOReturn* errP);
     static GTraceHeader buildHeader(
             const char* decoderName, const char* bufferName,
             const uint32_t count);
 
-    inline uint32_t getNextLine(void)
-        { return atomic_fetch_add(&fNextLine, 1) & fLineMask; }
-
-    // Complicated const casting because atomic_load will not take a const
-    // pointer, problem mixing C and C++, but C++ <atomic> doesn't exist
-    // in the kernel yet and probably never will as it is deep STL.
-    inline uint32_t nextLine() const
-        { return atomic_load(&(const_cast<GTraceBuffer*>(this)->fNextLine)); }
+    // One line index per slice, padded so that no two indices share a cache
+    // line. A buffer made without kGTraceOptionPerCPU has a single slice.
+    // Layout matches GTraceStreamSlice, so that slices can be streamed.
+    struct Slice {
+        _Atomic(uint32_t) fNextLine;
+        _Atomic(uint32_t) fDropped;  // Tokens dropped on a busy slot
+        _Atomic(uint64_t) fCompact;  // kGTraceOptionCompact word position
+        uint8_t           fPad[64 - 2 * sizeof(uint32_t) - sizeof(uint64_t)];
+    };
+
+    // Returns the slice local unmasked line, see slot()
+    inline uint32_t getNextLine(Slice& slice)
+        { return atomic_fetch_add(&slice.fNextLine, 1); }
+
+    inline uint32_t nextLine(const uint32_t slice) const
+        { return atomic_load(&fSlices[slice].fNextLine); }
+    // Total lines recorded across all slices
+    uint32_t nextLine() const;
+
+    inline uint32_t slot(const uint32_t slice, const uint32_t line) const
+        { return (slice << fSliceShift) | (line & fSliceMask); }
+    bool copySlot(const uint32_t slice, const uint32_t line,
+                  GTraceEntry* entryP) const;
+    void storeToken(const GTraceEntry& entry);
+    void storeCompact(const GTraceEntry& entry);
+    inline uint32_t wordSlot(const uint32_t slice, const uint32_t pos) const
+        { return (slice << fWordShift) | (pos & fWordMask); }
+    inline uint32_t blockSlot(const uint32_t slice, const uint32_t pos) const
+        { return wordSlot(slice, pos) >> 6; }  // 64 word blocks
+    static bool enterCompactBlock(_Atomic(uint64_t)* blockP,
+                                  const uint32_t gen);
+    uint32_t copyCompactBlock(const uint32_t slice, const uint32_t blockPos,
+                              const uint32_t top, GTraceEntry* entriesP) const;
+    IOReturn initStream(const uint32_t lines, const uint32_t slices);
 
     IOReturn copyOut(
             iog::OSUniqueObject<IOMemoryMap> map, OSData* bcData) const;
@@ -344,11 +456,70 @@ protected:
      */
     static IOReturn fetch(const uint32_t index, IOMemoryDescriptor* outDesc);
 
+    /*! @function streamDescriptor
+     @abstract
+         Returns the live ring of a kGTraceOptionStream buffer.
+         IOGDiagnosticUserClient interface
+     @discussion
+         For clientMemoryForType(kGTraceStreamMemoryType(index)), the caller
+         must map the descriptor read only. The descriptor starts with a
+         GTraceStreamHeader and remains valid after the buffer is released.
+     @param index Index of buffer in buffer pool cache
+     @param descP On success a retained descriptor, caller releases.
+     @result kIOReturnUnsupported if the buffer wasn't made for streaming.
+     */
+    static IOReturn streamDescriptor(
+            const uint32_t index, IOMemoryDescriptor** descP);
+
+    /*! @function setFilter
+     @abstract
+         Replaces the record time filter of a buffer.
+         IOGDiagnosticUserClient interface
+     @discussion
+         See setFilter(const GTraceFilter&). The filter lasts until it is
+         replaced or the buffer is freed.
+     @param index Index of buffer in buffer pool cache
+     @param filter New filter, an all zero filter records everything.
+     @result kIOReturnNotFound if there is no buffer at index.
+     */
+    static IOReturn setFilter(const uint32_t index, const GTraceFilter& filter);
+
+    /*! @function fetchSlowest
+     @abstract
+         Copies out the slowest calls of a buffer.
+         IOGDiagnosticUserClient interface
+     @discussion
+         See recordSlowCall(). Pointer arguments are obfuscated as they are
+         copied.
+     @param index Index of buffer in buffer pool cache
+     @param outDesc Prepared descriptor for GTraceSlowCall[kGTraceSlowestCount]
+     @result kIOReturnNotFound if there is no buffer at index.
+     */
+    static IOReturn fetchSlowest(
+            const uint32_t index, IOMemoryDescriptor* outDesc);
+
 private:
     // Header that is copied out on demand
     GTraceHeader         fHeader;
-    atomic_uint_fast32_t fNextLine;
+    Slice*               fSlices;
     GTraceEntry*         fBuffer;
+    // Per slot sequence words, parallel to fBuffer. Written by recordToken()
+    // to let copyOut() detect torn slots and order them, see GTrace.cpp.
+    _Atomic(uint64_t)*   fSeqs;
+    // Streamed buffers keep slices, sequence words and ring in fStreamMD
+    IOBufferMemoryDescriptor* fStreamMD;
+    GTraceStreamHeader*  fStream;
+    // Compact buffers replace fBuffer and fSeqs with a ring of encoded words
+    // and a sequence word per block of the ring.
+    _Atomic(uint64_t)*   fWords;
+    _Atomic(uint64_t)*   fCompactBlocks;
+    // Running p95 and sample count per function code, see isSlow()
+    _Atomic(uint64_t)*   fThresholds;
+    // Slowest calls, guarded by fSlowestBusy. fSlowestMin is the shortest
+    // call in a full table so that most offers are rejected unlocked.
+    GTraceSlowCall       fSlowest[kGTraceSlowestCount];
+    _Atomic(uint64_t)    fSlowestMin;
+    _Atomic(uint32_t)    fSlowestBusy;
 
 
     breadcrumb_func      fBreadcrumbFunc;
@@ -358,7 +529,11 @@ private:
 
     uint32_t             fLineMask;
     uint32_t             fLineCount;
-    bool                 fWrapped;
+    uint32_t             fSliceMask;  // Lines per slice - 1
+    uint32_t             fSliceCount;
+    uint8_t              fSliceShift;
+    uint32_t             fWordMask;   // Words per slice - 1
+    uint8_t              fWordShift;
 
     // Workaround for pre-C++11 clients, which can't see OSSharedObject.
     shared_type          fArchaicCPPSharedObjectHack;
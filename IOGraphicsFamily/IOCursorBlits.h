@@ -51,6 +51,315 @@
          | (_bm35To34SampleTable[(x & 0x7C00) >> 10] << 12) )
 #endif
 
+/*
+ * The software cursor blitters share one row walker, specialized per pixel
+ * format by a small ops struct.  Each cursor row is split into runs of
+ * transparent pixels (VRAM is left alone), opaque pixels (stored without
+ * reading VRAM, copied wholesale when the cursor pixel is already the screen
+ * pixel) and pixels that combine with the screen (xor or sover).  The save
+ * under is taken as one bulk copy per row, and combining pixels read the
+ * screen back from that copy rather than from VRAM, which is uncached.
+ *
+ * An ops struct provides:
+ *   Pixel                      VRAM / cursor pixel type
+ *   kHasMask                   cursor has a separate 8 bit mask plane
+ *   kOpaqueIsCopy              opaque(s) == s
+ *   kind(s, m)                 one of the kCursorSpan* values
+ *   opaque(s)                  screen pixel for an opaque cursor pixel
+ *   blend(s, m, d)             screen pixel for a combining cursor pixel
+ *
+ * extSetNewCursor records the runs of each frame in an IOFBCursorSpans
+ * table, so drawing only walks the spans that intersect the save rect and
+ * never looks at transparent pixels.  Frames without a current table fall
+ * back to classifying the pixels as they are drawn.
+ *
+ * When a move has already filled the save under (StdFBMoveCursor), the
+ * blitters skip the VRAM fetch and instead restore transparent pixels from
+ * it, since the old cursor image may still be on screen beneath them.
+ */
+
+enum
+{
+    kCursorSpanSkip   = 0,
+    kCursorSpanOpaque = 1,
+    kCursorSpanBlend  = 2
+};
+
+enum
+{
+    kCursorSpanKindShift  = 14,
+    kCursorSpanLengthMask = (1 << kCursorSpanKindShift) - 1
+};
+
+template <class Ops>
+static inline void StdFBCursorSpanRun(
+                const Ops & ops,
+                int kind,
+                typename Ops::Pixel * dst,
+                const typename Ops::Pixel * curs,
+                const unsigned char * mask,
+                const typename Ops::Pixel * save,
+                int count,
+                bool restore )
+{
+    typedef typename Ops::Pixel Pixel;
+    unsigned int m = 0;
+
+    if (kCursorSpanSkip == kind) {
+        if (restore)
+            bcopy(save, dst, count * sizeof(Pixel));
+    } else if (kCursorSpanOpaque == kind) {
+        if (Ops::kOpaqueIsCopy)
+            bcopy(curs, dst, count * sizeof(Pixel));
+        else for (int k = 0; k < count; k++)
+            dst[k] = ops.opaque(curs[k]);
+    } else if (kCursorSpanBlend == kind) {
+        for (int k = 0; k < count; k++) {
+            if (Ops::kHasMask) m = mask[k];
+            dst[k] = ops.blend(curs[k], m, save[k]);
+        }
+    }
+}
+
+template <class Ops>
+static inline void StdFBCursorBlit(
+                const Ops & ops,
+                volatile void * vramPtr,
+                const volatile void * cursBase,
+                const volatile void * maskBase,
+                volatile void * saveBase,
+                unsigned int vramRow,
+                unsigned int cursRow,
+                int width,
+                int height,
+                bool restore )
+{
+    typedef typename Ops::Pixel Pixel;
+
+    Pixel *               dst  = (Pixel *) vramPtr;
+    const Pixel *         curs = (const Pixel *) cursBase;
+    const unsigned char * mask = (const unsigned char *) maskBase;
+    Pixel *               save = (Pixel *) saveBase;
+    const size_t          rowBytes = width * sizeof(Pixel);
+    unsigned int          m = 0;
+    int                   i, j, x, kind;
+
+    for (i = height; --i >= 0; ) {
+        if (!restore)
+            bcopy((const void *) dst, save, rowBytes);
+        for (j = 0; j < width; j = x) {
+            if (Ops::kHasMask) m = mask[j];
+            kind = ops.kind(curs[j], m);
+            for (x = j + 1; x < width; x++) {
+                if (Ops::kHasMask) m = mask[x];
+                if (kind != ops.kind(curs[x], m)) break;
+            }
+            StdFBCursorSpanRun(ops, kind, &dst[j], &curs[j],
+                               Ops::kHasMask ? &mask[j] : NULL, &save[j], x - j,
+                               restore);
+        }
+        save += width;
+        curs += width + cursRow;    /* starting point of next cursor line */
+        if (Ops::kHasMask)
+            mask += width + cursRow;
+        dst  += width + vramRow;    /* starting point of next screen line */
+    }
+}
+
+/* Build the span table for one cursor frame of width x height pixels. */
+template <class Ops>
+static inline void StdFBCursorSpansBuild(
+                const Ops & ops,
+                IOFBCursorSpans * table,
+                const volatile void * cursBase,
+                const volatile void * maskBase,
+                int width,
+                int height )
+{
+    typedef typename Ops::Pixel Pixel;
+
+    const Pixel *         curs = (const Pixel *) cursBase;
+    const unsigned char * mask = (const unsigned char *) maskBase;
+    unsigned int          m = 0;
+    unsigned int          count = 0;
+    int                   y, j, x, kind;
+
+    table->width = 0;
+    if ((width <= 0) || (width > kCursorSpanLengthMask)
+     || (height <= 0) || (height > table->rowLimit))
+        return;
+
+    for (y = 0; y < height; y++) {
+        table->rows[y] = count;
+        for (j = 0; j < width; j = x) {
+            if (Ops::kHasMask) m = mask[j];
+            kind = ops.kind(curs[j], m);
+            for (x = j + 1; x < width; x++) {
+                if (Ops::kHasMask) m = mask[x];
+                if (kind != ops.kind(curs[x], m)) break;
+            }
+            if ((kCursorSpanSkip == kind) && (x == width))
+                break;                  /* trailing transparency is implied */
+            if (count == table->spanLimit)
+                return;
+            table->spans[count++] = (kind << kCursorSpanKindShift) | (x - j);
+        }
+        curs += width;
+        if (Ops::kHasMask)
+            mask += width;
+    }
+    table->rows[height] = count;
+    table->height = height;
+    table->width  = width;
+}
+
+/*
+ * Draw from a span table.  The save rect is a width x height window of the
+ * cursor image starting at cursStart, with cursRow image pixels between rows.
+ */
+template <class Ops>
+static inline void StdFBCursorBlitSpans(
+                const Ops & ops,
+                const IOFBCursorSpans * table,
+                unsigned int cursStart,
+                volatile void * vramPtr,
+                const volatile void * cursBase,
+                const volatile void * maskBase,
+                volatile void * saveBase,
+                unsigned int vramRow,
+                unsigned int cursRow,
+                int width,
+                int height,
+                bool restore )
+{
+    typedef typename Ops::Pixel Pixel;
+
+    Pixel *               dst  = (Pixel *) vramPtr;
+    const Pixel *         curs = (const Pixel *) cursBase;
+    const unsigned char * mask = (const unsigned char *) maskBase;
+    Pixel *               save = (Pixel *) saveBase;
+    const size_t          rowBytes = width * sizeof(Pixel);
+    const unsigned int    cursorWidth = width + cursRow;
+    const int             x0 = cursStart % cursorWidth;
+    const int             x1 = x0 + width;
+    const UInt16 *        row = &table->rows[cursStart / cursorWidth];
+    int                   i, x, e, a, b;
+
+    for (i = height; --i >= 0; row++) {
+        if (!restore)
+            bcopy((const void *) dst, save, rowBytes);
+        x = 0;
+        for (const UInt16 * span = &table->spans[row[0]];
+             (span < &table->spans[row[1]]) && (x < x1);
+             span++, x = e) {
+            e = x + (*span & kCursorSpanLengthMask);
+            a = (x > x0) ? x : x0;
+            b = (e < x1) ? e : x1;
+            if (a < b)
+                StdFBCursorSpanRun(ops, *span >> kCursorSpanKindShift,
+                                   &dst[a - x0], &curs[a - x0],
+                                   Ops::kHasMask ? &mask[a - x0] : NULL,
+                                   &save[a - x0], b - a, restore);
+        }
+        if (restore && (x < x1)) {
+            a = (x > x0) ? x : x0;
+            bcopy(&save[a - x0], &dst[a - x0], (x1 - a) * sizeof(Pixel));
+        }
+        save += width;
+        curs += cursorWidth;        /* starting point of next cursor line */
+        if (Ops::kHasMask)
+            mask += cursorWidth;
+        dst  += width + vramRow;    /* starting point of next screen line */
+    }
+}
+
+/* Use the frame's span table when it describes the image being drawn. */
+template <class Ops>
+static inline void StdFBCursorDraw(
+                const Ops & ops,
+                const IOFBCursorSpans * table,
+                unsigned int cursStart,
+                volatile void * vramPtr,
+                const volatile void * cursBase,
+                const volatile void * maskBase,
+                volatile void * saveBase,
+                unsigned int vramRow,
+                unsigned int cursRow,
+                int width,
+                int height,
+                bool restore )
+{
+    if (table && (table->width == (width + cursRow))
+     && ((cursStart / table->width) + height <= table->height))
+        StdFBCursorBlitSpans(ops, table, cursStart, vramPtr, cursBase, maskBase,
+                             saveBase, vramRow, cursRow, width, height, restore);
+    else
+        StdFBCursorBlit(ops, vramPtr, cursBase, maskBase, saveBase,
+                        vramRow, cursRow, width, height, restore);
+}
+
+static inline const IOFBCursorSpans * StdFBCursorSpansFor(
+                IOFramebufferPrivate * __private, int frame )
+{
+    return (__private->cursorSpans ? &__private->cursorSpans[frame] : NULL);
+}
+
+template <class Pixel>
+static inline void StdFBCursorRestore(
+                volatile void * vramPtr,
+                const volatile void * saveBase,
+                unsigned int vramRow,
+                int width,
+                int height )
+{
+    Pixel *       dst  = (Pixel *) vramPtr;
+    const Pixel * save = (const Pixel *) saveBase;
+    const size_t  rowBytes = width * sizeof(Pixel);
+    int           i;
+
+    for (i = height; --i >= 0; ) {
+        bcopy(save, dst, rowBytes);
+        save += width;
+        dst  += width + vramRow;
+    }
+}
+
+/* 16 bit 555 screen, cursor is 4444 RGBA */
+struct StdFBCursorOps555
+{
+    typedef unsigned short Pixel;
+    enum { kHasMask = 0, kOpaqueIsCopy = 0 };
+
+    unsigned char * _bm34To35SampleTable;
+    unsigned char * _bm35To34SampleTable;
+
+    inline int kind( Pixel s, unsigned int ) const
+    {
+        if (s == 0)                     /* Transparent black area.  Leave dst as is. */
+            return (kCursorSpanSkip);
+        if (((~s) & AMASK) == 0)        /* Opaque cursor pixel.  Mark it. */
+            return (kCursorSpanOpaque);
+        return (kCursorSpanBlend);
+    }
+    inline Pixel opaque( Pixel s ) const
+    {
+        return (short34to35WithGamma(s));
+    }
+    inline Pixel blend( Pixel s, unsigned int, Pixel d ) const
+    {
+        unsigned short f = (~s) & (unsigned int)AMASK;
+
+        if (f == AMASK)                 /* Transparent non black cursor pixel.  xor it. */
+            return (d ^ short34to35WithGamma(s));
+
+        /* Alpha is not 0 or 1.0.  Sover the cursor. */
+        d = short35to34WithGamma(d);
+        d = s + (((((d & RBMASK)>>4)*f + GAMASK) & RBMASK)
+            | ((((d & GAMASK)*f+GAMASK)>>4) & GAMASK));
+        return (short34to35WithGamma(d));
+    }
+};
+
 void IOFramebuffer::StdFBDisplayCursor555(
                 IOFramebuffer * inst,
                 StdFBShmem_t *shmem,
@@ -62,12 +371,8 @@ void IOFramebuffer::StdFBDisplayCursor555(
                 int height )
 {
     IOFB_START(StdFBDisplayCursor555,0,0,0);
-    int i, j;
     volatile unsigned short *cursPtr;
-    volatile unsigned short *savePtr;
-    unsigned short s, d, f;
-    unsigned char *_bm34To35SampleTable;
-    unsigned char *_bm35To34SampleTable;
+    StdFBCursorOps555 ops;
     int frame;
 
 	frame = shmem->frame;
@@ -77,40 +382,16 @@ void IOFramebuffer::StdFBDisplayCursor555(
         return;
     }
 
-    savePtr = (volatile unsigned short *) inst->cursorSave;
     cursPtr = (volatile unsigned short *) inst->__private->cursorImages[ frame ];
     cursPtr += cursStart;
 
-    _bm34To35SampleTable = inst->colorConvert.t._bm34To35SampleTable;
-    _bm35To34SampleTable = inst->colorConvert.t._bm35To34SampleTable;
-    
-    for (i = height; --i >= 0; ) {
-        for (j = width; --j >= 0; ) {
-            d = *savePtr++ = *vramPtr;
-            if ( (s = *cursPtr++) == 0 )
-            {   /* Transparent black area.  Leave dst as is. */
-                ++vramPtr;
-                continue;
-            }
-            if ( (f = (~s) & (unsigned int)AMASK) == 0 )
-            {   /* Opaque cursor pixel.  Mark it. */
-                *vramPtr++ = short34to35WithGamma(s);
-                continue;
-            }
-            if (f == AMASK)
-            {   /* Transparent non black cursor pixel.  xor it. */
-                *vramPtr++ = d ^ short34to35WithGamma(s);
-                continue;
-            }
-            /* Alpha is not 0 or 1.0.  Sover the cursor. */
-            d = short35to34WithGamma(d);
-            d = s + (((((d & RBMASK)>>4)*f + GAMASK) & RBMASK)
-                | ((((d & GAMASK)*f+GAMASK)>>4) & GAMASK));
-            *vramPtr++ = short34to35WithGamma(d);
-        }
-        cursPtr += cursRow; /* starting point of next cursor line */
-        vramPtr += vramRow; /* starting point of next screen line */
-    }
+    ops._bm34To35SampleTable = inst->colorConvert.t._bm34To35SampleTable;
+    ops._bm35To34SampleTable = inst->colorConvert.t._bm35To34SampleTable;
+
+    StdFBCursorDraw(ops, StdFBCursorSpansFor(inst->__private, frame), cursStart,
+                    vramPtr, cursPtr, NULL, inst->cursorSave,
+                    vramRow, cursRow, width, height,
+                    inst->__private->cursorSaveShifted);
     IOFB_END(StdFBDisplayCursor555,0,0,0);
 }
 
@@ -141,6 +422,42 @@ static inline unsigned char map32to256( unsigned char *directToLogical, unsigned
     return( directToLogical[ logicalValue + 1024 ]);
 }
 
+/* 8 bit indexed screen, cursor has an 8 bit alpha mask */
+struct StdFBCursorOps8P
+{
+    typedef unsigned char Pixel;
+    enum { kHasMask = 1, kOpaqueIsCopy = 1 };
+
+    unsigned int *  _bm256To38SampleTable;
+    unsigned char * _bm38To256SampleTable;
+    unsigned char   white;
+
+    inline int kind( Pixel s, unsigned int alpha ) const
+    {
+        if (alpha == 0xFF)
+            return (kCursorSpanOpaque);
+        if (alpha || (s == white))
+            return (kCursorSpanBlend);
+        return (kCursorSpanSkip);
+    }
+    inline Pixel opaque( Pixel s ) const
+    {
+        return (s);
+    }
+    inline Pixel blend( Pixel s, unsigned int alpha, Pixel d ) const
+    {
+        unsigned int rgb32val;
+
+        if (!alpha)
+            return (d ^ 0xFF);
+        alpha = (~alpha) & 0xFF;
+        rgb32val = _bm256To38SampleTable[d];
+        rgb32val = (_bm256To38SampleTable[s] & ~0xFF) +
+                          MUL32(rgb32val, alpha);
+        return (map32to256(_bm38To256SampleTable, rgb32val));
+    }
+};
+
 void IOFramebuffer::StdFBDisplayCursor8P(
                 IOFramebuffer * inst,
                 StdFBShmem_t *shmem,
@@ -152,16 +469,9 @@ void IOFramebuffer::StdFBDisplayCursor8P(
                 int height )
 {
     IOFB_START(StdFBDisplayCursor8P,0,0,0);
-    int i, j;
-    volatile unsigned char *savePtr;    /* saved screen data pointer */
     volatile unsigned char *cursPtr;
-    unsigned char dst, src, alpha, white;
-    unsigned int rgb32val;
     volatile unsigned char *maskPtr;            /* cursor mask pointer */
-    unsigned int *_bm256To38SampleTable
-        = inst->colorConvert.t._bm256To38SampleTable;
-    unsigned char *_bm38To256SampleTable
-        = inst->colorConvert.t._bm38To256SampleTable;
+    StdFBCursorOps8P ops;
     int frame;
 
 	frame = shmem->frame;
@@ -171,35 +481,50 @@ void IOFramebuffer::StdFBDisplayCursor8P(
         return;
     }
 
-    savePtr = (volatile unsigned char *) inst->cursorSave;
     cursPtr = (volatile unsigned char *) inst->__private->cursorImages[ frame ];
     maskPtr = (volatile unsigned char *) inst->__private->cursorMasks[ frame ];
     cursPtr += cursStart;
     maskPtr += cursStart;
-    
-    white = inst->white;
-    for (i = height; --i >= 0; ) {
-        for (j = width; --j >= 0; savePtr++,maskPtr++,cursPtr++,vramPtr++) {
-            dst = *savePtr = *vramPtr;
-            src = *cursPtr;
-            if ((alpha = *maskPtr)) {
-                if ((alpha = ~alpha)) {
-                    rgb32val = _bm256To38SampleTable[dst];
-                    rgb32val = (_bm256To38SampleTable[src] & ~0xFF) +
-                                      MUL32(rgb32val, alpha);
-                    *vramPtr = map32to256(_bm38To256SampleTable, rgb32val);
-                } else
-                    *vramPtr = src;
-            } else if (src == white)
-                *vramPtr = dst ^ 0xFF;
-        }
-        cursPtr += cursRow; /* starting point of next cursor line */
-        maskPtr += cursRow;
-        vramPtr += vramRow; /* starting point of next screen line */
-    }
+
+    ops._bm256To38SampleTable = inst->colorConvert.t._bm256To38SampleTable;
+    ops._bm38To256SampleTable = inst->colorConvert.t._bm38To256SampleTable;
+    ops.white = inst->white;
+
+    StdFBCursorDraw(ops, StdFBCursorSpansFor(inst->__private, frame), cursStart,
+                    vramPtr, cursPtr, maskPtr, inst->cursorSave,
+                    vramRow, cursRow, width, height,
+                    inst->__private->cursorSaveShifted);
     IOFB_END(StdFBDisplayCursor8P,0,0,0);
 }
 
+/* 8 bit gray screen, cursor has an 8 bit alpha mask */
+struct StdFBCursorOps8G
+{
+    typedef unsigned char Pixel;
+    enum { kHasMask = 1, kOpaqueIsCopy = 1 };
+
+    inline int kind( Pixel s, unsigned int a ) const
+    {
+        if (a == 0xFF)
+            return (kCursorSpanOpaque);
+        if (a || s)
+            return (kCursorSpanBlend);
+        return (kCursorSpanSkip);
+    }
+    inline Pixel opaque( Pixel s ) const
+    {
+        return (s);
+    }
+    inline Pixel blend( Pixel s, unsigned int a, Pixel d ) const
+    {
+        int t;
+
+        if (!a)
+            return (d ^ s);
+        t = d * (255 - a);
+        return (s + ((t + (t >> 8) + 1) >> 8));
+    }
+};
 
 void IOFramebuffer::StdFBDisplayCursor8G(
                                  IOFramebuffer * inst,
@@ -212,11 +537,9 @@ void IOFramebuffer::StdFBDisplayCursor8G(
                                  int height )
 {
     IOFB_START(StdFBDisplayCursor8G,0,0,0);
-    int i, j;
-    volatile unsigned char *savePtr;    /* saved screen data pointer */
-    unsigned short s, d, a;
     volatile unsigned char *cursPtr;
     volatile unsigned char *maskPtr;            /* cursor mask pointer */
+    StdFBCursorOps8G ops;
     int frame;
 
 	frame = shmem->frame;
@@ -226,32 +549,60 @@ void IOFramebuffer::StdFBDisplayCursor8G(
         return;
     }
 
-    savePtr = (volatile unsigned char *) inst->cursorSave;
     cursPtr = (volatile unsigned char *) inst->__private->cursorImages[ frame ];
     maskPtr = (volatile unsigned char *) inst->__private->cursorMasks[ frame ];
     cursPtr += cursStart;
     maskPtr += cursStart;
 
-    for (i = height; --i >= 0; ) {
-        for (j = width; --j >= 0; ) {
-            int t;
-            d = *savePtr++ = *vramPtr;
-            s = *cursPtr++;
-            a = *maskPtr++;
-            if (a) {
-                t = d * (255 - *maskPtr++);
-                *vramPtr = s + ((t + (t >> 8) + 1) >> 8);
-            } else if (s)
-                *vramPtr = d ^ s;
-            vramPtr++;
-        }
-        cursPtr += cursRow; /* starting point of next cursor line */
-        maskPtr += cursRow;
-        vramPtr += vramRow; /* starting point of next screen line */
-    }
+    StdFBCursorDraw(ops, StdFBCursorSpansFor(inst->__private, frame), cursStart,
+                    vramPtr, cursPtr, maskPtr, inst->cursorSave,
+                    vramRow, cursRow, width, height,
+                    inst->__private->cursorSaveShifted);
     IOFB_END(StdFBDisplayCursor8G,0,0,0);
 }
 
+/* 32 bit 2:10:10:10 screen, cursor is 8 bit ARGB */
+struct StdFBCursorOps30Axxx
+{
+    typedef unsigned int Pixel;
+    enum { kHasMask = 0, kOpaqueIsCopy = 0 };
+
+    static inline unsigned long long expand( unsigned int s )
+    {
+        return (((s&0x000000FF)<<2)|((s&0x0000FF00)<<4)|((unsigned long long)(s&0x00FF0000)<<6));
+    }
+    inline int kind( Pixel s, unsigned int ) const
+    {
+        unsigned int f = s >> 24;
+
+        if (f == 0xFF)                  // Opaque pixel
+            return (kCursorSpanOpaque);
+        if (f || (s & 0x00FFFFFF))
+            return (kCursorSpanBlend);
+        return (kCursorSpanSkip);       // Transparent cursor pixel
+    }
+    inline Pixel opaque( Pixel s ) const
+    {
+        return (static_cast<unsigned int>(expand(s)));
+    }
+    inline Pixel blend( Pixel sp, unsigned int, Pixel dp ) const
+    {
+        unsigned int       f = sp >> 24;
+        unsigned long long s = expand(sp);
+        unsigned long long d = dp;
+
+        if (!f)                         // Transparent non black cursor pixel.  xor it.
+            return (static_cast<unsigned int>(d ^ s));
+
+        // SOVER the cursor pixel
+        s <<= 10;  d <<= 10;   /* Now pixels are xxxA */
+        f ^= 0xFF;
+        d = s+(((((d&0xFFC00FFC00ULL)>>8)*f+0x0FF000FF) & 0xFFC00FFC00ULL)
+            | ((((d & 0x3FF003FF)*f+0x0FF000FF)>>8) & 0x3FF003FF));
+        return (static_cast<unsigned int>((d>>10) | 0xC0000000));
+    }
+};
+
 void IOFramebuffer::StdFBDisplayCursor30Axxx(
                                  IOFramebuffer * inst,
                                  StdFBShmem_t *shmem,
@@ -263,11 +614,8 @@ void IOFramebuffer::StdFBDisplayCursor30Axxx(
                                  int height )
 {
     IOFB_START(StdFBDisplayCursor30Axxx,0,0,0);
-    int i, j;
-    volatile unsigned int *savePtr;     /* saved screen data pointer */
-    unsigned long long s, d;
-    unsigned int f;
     volatile unsigned int *cursPtr;
+    StdFBCursorOps30Axxx ops;
     int frame;
 
 	frame = shmem->frame;
@@ -277,40 +625,54 @@ void IOFramebuffer::StdFBDisplayCursor30Axxx(
         return;
     }
 
-    savePtr = (volatile unsigned int *) inst->cursorSave;
     cursPtr = (volatile unsigned int *) inst->__private->cursorImages[ frame ];
     cursPtr += cursStart;
 
     /* Pixel format is Axxx */
-    for (i = height; --i >= 0; ) {
-        for (j = width; --j >= 0; ) {
-            d = *savePtr++ = *vramPtr;
-            s = *cursPtr++;
-            f = static_cast<unsigned int>(s >> 24);
-            s = ((s&0x000000FF)<<2)|((s&0x0000FF00)<<4)|((s&0x00FF0000)<<6);
-            if (f) {
-                if (f == 0xFF)          // Opaque pixel
-                    *vramPtr++ = static_cast<unsigned int>(s);
-                else {                  // SOVER the cursor pixel
-                    s <<= 10;  d <<= 10;   /* Now pixels are xxxA */
-                    f ^= 0xFF;
-                    d = s+(((((d&0xFFC00FFC00ULL)>>8)*f+0x0FF000FF) & 0xFFC00FFC00ULL)
-                        | ((((d & 0x3FF003FF)*f+0x0FF000FF)>>8) & 0x3FF003FF));
-                    *vramPtr++ = static_cast<unsigned int>((d>>10) | 0xC0000000);
-                }
-            } else if (s) {
-                // Transparent non black cursor pixel.  xor it.
-                *vramPtr++ = static_cast<unsigned int>(d ^ s);
-                continue;
-            } else                      // Transparent cursor pixel
-                vramPtr++;
-        }
-        cursPtr += cursRow; /* starting point of next cursor line */
-        vramPtr += vramRow; /* starting point of next screen line */
-    }
+    StdFBCursorDraw(ops, StdFBCursorSpansFor(inst->__private, frame), cursStart,
+                    vramPtr, cursPtr, NULL, inst->cursorSave,
+                    vramRow, cursRow, width, height,
+                    inst->__private->cursorSaveShifted);
     IOFB_END(StdFBDisplayCursor30Axxx,0,0,0);
 }
 
+/* 32 bit 8:8:8:8 screen, cursor is 8 bit ARGB */
+struct StdFBCursorOps32Axxx
+{
+    typedef unsigned int Pixel;
+    enum { kHasMask = 0, kOpaqueIsCopy = 1 };
+
+    inline int kind( Pixel s, unsigned int ) const
+    {
+        unsigned int f = s >> 24;
+
+        if (f == 0xFF)                  // Opaque pixel
+            return (kCursorSpanOpaque);
+        if (s)
+            return (kCursorSpanBlend);
+        return (kCursorSpanSkip);       // Transparent cursor pixel
+    }
+    inline Pixel opaque( Pixel s ) const
+    {
+        return (s);
+    }
+    inline Pixel blend( Pixel s, unsigned int, Pixel d ) const
+    {
+        unsigned int f = s >> 24;
+
+        if (!f)                         // Transparent non black cursor pixel.  xor it.
+            return (d ^ s);
+
+        // SOVER the cursor pixel
+        s <<= 8;  d <<= 8;   /* Now pixels are xxxA */
+        f ^= 0xFF;
+        d = s+(((((d&0xFF00FF00)>>8)*f+0x00FF00FF)&0xFF00FF00)
+            | ((((d & 0x00FF00FF)*f+0x00FF00FF)>>8) &
+                0x00FF00FF));
+        return ((d>>8) | 0xFF000000);
+    }
+};
+
 void IOFramebuffer::StdFBDisplayCursor32Axxx(
                                  IOFramebuffer * inst,
                                  StdFBShmem_t *shmem,
@@ -322,10 +684,8 @@ void IOFramebuffer::StdFBDisplayCursor32Axxx(
                                  int height )
 {
     IOFB_START(StdFBDisplayCursor32Axxx,0,0,0);
-    int i, j;
-    volatile unsigned int *savePtr;     /* saved screen data pointer */
-    unsigned int s, d, f;
     volatile unsigned int *cursPtr;
+    StdFBCursorOps32Axxx ops;
     int frame;
 
 	frame = shmem->frame;
@@ -335,37 +695,14 @@ void IOFramebuffer::StdFBDisplayCursor32Axxx(
         return;
     }
 
-    savePtr = (volatile unsigned int *) inst->cursorSave;
     cursPtr = (volatile unsigned int *) inst->__private->cursorImages[ frame ];
     cursPtr += cursStart;
 
     /* Pixel format is Axxx */
-    for (i = height; --i >= 0; ) {
-        for (j = width; --j >= 0; ) {
-            d = *savePtr++ = *vramPtr;
-            s = *cursPtr++;
-            f = s >> 24;
-            if (f) {
-                if (f == 0xFF)          // Opaque pixel
-                    *vramPtr++ = s;
-                else {                  // SOVER the cursor pixel
-                    s <<= 8;  d <<= 8;   /* Now pixels are xxxA */
-                    f ^= 0xFF;
-                    d = s+(((((d&0xFF00FF00)>>8)*f+0x00FF00FF)&0xFF00FF00)
-                        | ((((d & 0x00FF00FF)*f+0x00FF00FF)>>8) &
-                            0x00FF00FF));
-                    *vramPtr++ = (d>>8) | 0xFF000000;
-                }
-            } else if (s) {
-                // Transparent non black cursor pixel.  xor it.
-                *vramPtr++ = d ^ s;
-                continue;
-            } else                      // Transparent cursor pixel
-                vramPtr++;
-        }
-        cursPtr += cursRow; /* starting point of next cursor line */
-        vramPtr += vramRow; /* starting point of next screen line */
-    }
+    StdFBCursorDraw(ops, StdFBCursorSpansFor(inst->__private, frame), cursStart,
+                    vramPtr, cursPtr, NULL, inst->cursorSave,
+                    vramRow, cursRow, width, height,
+                    inst->__private->cursorSaveShifted);
     IOFB_END(StdFBDisplayCursor32Axxx,0,0,0);
 }
 
@@ -378,16 +715,8 @@ void IOFramebuffer::StdFBRemoveCursor16(
                                 int height )
 {
     IOFB_START(StdFBRemoveCursor16,0,0,0);
-    int i, j;
-    volatile unsigned short *savePtr;
-
-    savePtr = (volatile unsigned short *) inst->cursorSave;
-
-    for (i = height; --i >= 0; ) {
-        for (j = width; --j >= 0; )
-            *vramPtr++ = *savePtr++;
-        vramPtr += vramRow;
-    }
+    StdFBCursorRestore<unsigned short>(vramPtr, inst->cursorSave,
+                                       vramRow, width, height);
     IOFB_END(StdFBRemoveCursor16,0,0,0);
 }
 
@@ -400,16 +729,8 @@ void IOFramebuffer::StdFBRemoveCursor8(
                                int height )
 {
     IOFB_START(StdFBRemoveCursor8,0,0,0);
-    int i, j;
-    volatile unsigned char *savePtr;
-
-    savePtr = (volatile unsigned char *) inst->cursorSave;
-
-    for (i = height; --i >= 0; ) {
-        for (j = width; --j >= 0; )
-            *vramPtr++ = *savePtr++;
-        vramPtr += vramRow;
-    }
+    StdFBCursorRestore<unsigned char>(vramPtr, inst->cursorSave,
+                                      vramRow, width, height);
     IOFB_END(StdFBRemoveCursor8,0,0,0);
 }
 
@@ -422,15 +743,56 @@ void IOFramebuffer::StdFBRemoveCursor32(
                                 int height )
 {
     IOFB_START(StdFBRemoveCursor32,0,0,0);
-    int i, j;
-    volatile unsigned int *savePtr;
+    StdFBCursorRestore<unsigned int>(vramPtr, inst->cursorSave,
+                                     vramRow, width, height);
+    IOFB_END(StdFBRemoveCursor32,0,0,0);
+}
 
-    savePtr = (volatile unsigned int *) inst->cursorSave;
+void IOFramebuffer::StdFBBuildCursorSpans(
+                                IOFramebuffer * inst,
+                                StdFBShmem_t *shmem,
+                                UInt32 frame )
+{
+    IOFBCursorSpans * table;
+    volatile unsigned char * cursPtr;
+    volatile unsigned char * maskPtr;
+    CursorBlitProc proc = inst->cursorBlitProc;
+    int width, height;
 
-    for (i = height; --i >= 0; ) {
-        for (j = width; --j >= 0; )
-            *vramPtr++ = *savePtr++;
-        vramPtr += vramRow;
+    if (!inst->__private->cursorSpans || (frame >= inst->__private->numCursorFrames))
+        return;
+
+    table   = &inst->__private->cursorSpans[frame];
+    cursPtr = inst->__private->cursorImages[frame];
+    maskPtr = inst->__private->cursorMasks[frame];
+    width   = shmem->cursorSize[0 != frame].width;
+    height  = shmem->cursorSize[0 != frame].height;
+    table->width = 0;
+
+    if (proc == (CursorBlitProc) StdFBDisplayCursor32Axxx)
+    {
+        StdFBCursorOps32Axxx ops;
+        StdFBCursorSpansBuild(ops, table, cursPtr, NULL, width, height);
+    }
+    else if (proc == (CursorBlitProc) StdFBDisplayCursor30Axxx)
+    {
+        StdFBCursorOps30Axxx ops;
+        StdFBCursorSpansBuild(ops, table, cursPtr, NULL, width, height);
+    }
+    else if (proc == (CursorBlitProc) StdFBDisplayCursor555)
+    {
+        StdFBCursorOps555 ops;
+        StdFBCursorSpansBuild(ops, table, cursPtr, NULL, width, height);
+    }
+    else if ((proc == (CursorBlitProc) StdFBDisplayCursor8P) && maskPtr)
+    {
+        StdFBCursorOps8P ops;
+        ops.white = inst->white;
+        StdFBCursorSpansBuild(ops, table, cursPtr, maskPtr, width, height);
+    }
+    else if ((proc == (CursorBlitProc) StdFBDisplayCursor8G) && maskPtr)
+    {
+        StdFBCursorOps8G ops;
+        StdFBCursorSpansBuild(ops, table, cursPtr, maskPtr, width, height);
     }
-    IOFB_END(StdFBRemoveCursor32,0,0,0);
 }
@@ -0,0 +1,310 @@
+/*
+ * Copyright (c) 2026 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * The contents of this file constitute Original Code as defined in and
+ * are subject to the Apple Public Source License Version 1.1 (the
+ * "License").  You may not use this file except in compliance with the
+ * License.  Please obtain a copy of the License at
+ * http://www.apple.com/publicsource and read it before using this file.
+ *
+ * This Original Code and all software distributed under the License are
+ * distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE OR NON-INFRINGEMENT.  Please see the
+ * License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+/*
+** Piecewise linear gamma fit, shared by IOFramebuffer (boot-gamma and the
+** hibernate gamma table) and tools/fitline.c, tools/bootgamma.c:
+**
+**   cc -I../IOGraphicsFamily -o /tmp/fitline fitline.c
+**
+** No allocation here, callers pass IOFBGammaFitScratchSize() bytes of
+** scratch, so the same code runs in the kernel and on the host.
+*/
+
+#ifndef _IOFBGAMMAFIT_H
+#define _IOFBGAMMAFIT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#ifndef __cplusplus
+#include <stdbool.h>
+#endif
+#include <IOKit/graphics/IOGraphicsTypesPrivate.h>
+
+enum { kIOFBGammaPointCountMax = 256 };
+enum { kIOFBGammaDesiredError  = 127 };
+// Largest error, in 16 bit units, of a fit that may be used instead of the table
+enum { kIOFBGammaMaxError      = 0x400 };
+// Largest error of a fit kept in place of the hibernate gamma table, below
+// 1 LSB of the 8 bit table in the hibernate preview
+enum { kIOFBGammaPreviewMaxError = 0xFF };
+
+struct IOFBLineSeg
+{
+	// [start end]
+    uint16_t start;
+    uint16_t end;
+    uint16_t dist;
+    uint16_t split;
+};
+typedef struct IOFBLineSeg IOFBLineSeg;
+
+static inline size_t
+IOFBGammaFitSize(uint16_t maxCount)
+{
+	return (sizeof(IOFBBootGamma) + maxCount * sizeof(IOFBGammaPoint));
+}
+
+// Segments while fitting, one channel of decoded table while checking the fit
+static inline size_t
+IOFBGammaFitScratchSize(uint16_t srcDataCount, uint16_t maxCount)
+{
+	size_t segs = maxCount * sizeof(IOFBLineSeg);
+	size_t line = srcDataCount * sizeof(uint16_t);
+	return ((segs > line) ? segs : line);
+}
+
+static inline IOFBGamma *
+IOFBGammaNextChannel(const IOFBGamma * channelGamma)
+{
+	return ((IOFBGamma *) &channelGamma->points[channelGamma->pointCount]);
+}
+
+static inline void
+IOFBSegDist(const uint16_t data[], IOFBLineSeg * seg)
+{
+	uint16_t start;
+	uint16_t end;
+	uint16_t idx;
+	int32_t  interp;
+	int32_t  dist;
+
+	seg->dist  = 0;
+	seg->split = seg->start;
+	start = seg->start;
+	end   = seg->end;
+	for (idx = start + 1; idx < end; idx++)
+	{
+		interp = data[start] + ((data[end] - data[start]) * (idx - start)) / (end - start);
+		dist = data[idx] - interp;
+		if (dist < 0) dist = -dist;
+		if (dist > seg->dist)
+		{
+			seg->dist  = (uint16_t) dist;
+			seg->split = idx;
+		}
+	}
+}
+
+static inline void
+IOFBSegInit(const uint16_t data[], IOFBLineSeg * seg, uint16_t start, uint16_t end)
+{
+	seg->start = start;
+	seg->end   = end;
+	IOFBSegDist(data, seg);
+}
+
+// Split the segment furthest from its line until all are within desiredError
+// or there are maxCount segments.
+static inline uint16_t
+IOFBSimplifySegs(const uint16_t data[], uint16_t desiredError,
+				IOFBLineSeg * segs, uint16_t count, uint16_t maxCount)
+{
+	uint16_t idx;
+	uint16_t furthest;
+
+	while (count < maxCount)
+	{
+		furthest = 0;
+		for (idx = 1; idx < count; idx++)
+		{
+			if (segs[idx].dist > segs[furthest].dist) furthest = idx;
+		}
+		if (segs[furthest].dist <= desiredError) break;
+		memmove(&segs[furthest+2], &segs[furthest+1], (count - furthest - 1) * sizeof(IOFBLineSeg));
+		count++;
+		IOFBSegInit(data, &segs[furthest+1], segs[furthest].split, segs[furthest].end);
+		segs[furthest].end = segs[furthest].split;
+		IOFBSegDist(data, &segs[furthest]);
+	}
+	return (count);
+}
+
+/*
+** Decodes one channel to count evenly spaced entries, returns the next
+** channel. Points are (in, out) knots on a 0..0xFFFF scale with implicit
+** ends at (0, 0) and (0xFFFF, 0xFFFF); a point at 0xFFFF replaces the end.
+** Each knot costs a few divides, an entry between knots is only a 32 bit
+** multiply add of a 16.16 output from its offset, with no divide per entry and
+** no entry depending on the one before. Both steps round toward the knot
+** before, which keeps every entry between the outs of its knots.
+*/
+static inline const IOFBGamma *
+IOFBDecompressGammaChannel(const IOFBGamma * channelGamma, uint16_t * data, uint16_t count)
+{
+	const uint32_t maxIdx = count - 1;
+	const int64_t  stepFx = (INT64_C(0xFFFF) << 16) / maxIdx;
+	uint32_t idx, stop, seg, i;
+	uint32_t base, inc;
+	int32_t  startIn, startOut, endIn, endOut;
+	int64_t  slope, delta;
+
+	idx      = 0;
+	startIn  = 0;
+	startOut = 0x0000;
+	for (seg = 0; seg <= channelGamma->pointCount; seg++)
+	{
+		if (seg < channelGamma->pointCount)
+		{
+			endIn  = channelGamma->points[seg].in;
+			endOut = channelGamma->points[seg].out;
+		}
+		else if (startIn < 0xFFFF) endIn = endOut = 0xFFFF;
+		else break;
+
+		if (endIn <= startIn)
+		{
+			// a step, out of order points are ignored
+			if (endIn == startIn) startOut = endOut;
+			continue;
+		}
+		// entries whose position idx * 0xFFFF / maxIdx is before endIn
+		stop = (endIn * maxIdx + 0xFFFE) / 0xFFFF;
+		if (stop > idx)
+		{
+			// out per in, and position of the first entry past startIn, 16.16
+			slope = ((int64_t) (endOut - startOut)) * 65536 / (endIn - startIn);
+			delta = (((int64_t) idx * 0xFFFF) << 16) / maxIdx - (((int64_t) startIn) << 16);
+			base  = (uint32_t) ((((int64_t) startOut) << 16) + slope * delta / 65536);
+			// only needed, and only bounded, with two entries in the segment
+			inc   = (stop - idx > 1) ? (uint32_t) (slope * stepFx / 65536) : 0;
+			for (i = idx; i < stop; i++)
+			{
+				data[i] = (uint16_t) ((base + (i - idx) * inc) >> 16);
+			}
+			idx = stop;
+		}
+		startIn  = endIn;
+		startOut = endOut;
+	}
+	for (; idx <= maxIdx; idx++) data[idx] = (uint16_t) startOut;
+
+	return (IOFBGammaNextChannel(channelGamma));
+}
+
+static inline void
+IOFBDecompressGamma(const IOFBBootGamma * bootGamma, uint16_t * data, uint16_t count)
+{
+	const IOFBGamma * channelGamma;
+	uint16_t          channel;
+
+	if (count < 2) return;
+	channelGamma = &bootGamma->gamma.red;
+	for (channel = 0; channel < 3; channel++)
+	{
+		channelGamma = IOFBDecompressGammaChannel(channelGamma, &data[channel * count], count);
+	}
+}
+
+static inline void
+IOFBGammaAddPoint(IOFBGamma * channelGamma, uint16_t in, uint16_t out)
+{
+	channelGamma->points[channelGamma->pointCount].in  = in;
+	channelGamma->points[channelGamma->pointCount].out = out;
+	channelGamma->pointCount++;
+}
+
+enum
+{
+	// Emit a point at 0 for a channel that doesn't start at 0. boot-gamma is
+	// read by the booter, which divides by zero on such a point, so this is
+	// only for fits decoded by IOFBDecompressGamma().
+	kIOFBGammaFitStartPoints = 0x00000001,
+};
+
+/*
+** Fits a 3 channel, 16 bit table with at most maxCount points into bootGamma,
+** which must hold IOFBGammaFitSize(maxCount) bytes. The result is decoded back
+** at srcDataCount entries and *maxError is the largest difference from the
+** table. Returns true if the fit is within kIOFBGammaMaxError. Only the
+** gamma and length fields of bootGamma are written.
+*/
+static inline bool
+IOFBCompressGamma(
+	IOFBBootGamma * bootGamma,
+    uint16_t channelCount, uint16_t srcDataCount,
+    uint16_t dataWidth, const void * _data,
+    uint16_t desiredError, uint16_t maxCount, uint32_t options,
+    void * scratch, uint16_t * maxError)
+{
+	const uint16_t *  data = (const uint16_t *) _data;
+	IOFBLineSeg *     segs = (IOFBLineSeg *) scratch;
+	uint16_t *        deco = (uint16_t *) scratch;
+	IOFBGamma *       channelGamma;
+	const IOFBGamma * decoGamma;
+	uint16_t          idx, count, start, reserve;
+	int32_t           dist;
+
+	*maxError = 0xFFFF;
+	// Points kept back for the channel ends, every other segment adds a point
+	reserve = (kIOFBGammaFitStartPoints & options) ? 6 : 3;
+	if ((3 != channelCount) || (16 != dataWidth)
+		|| (srcDataCount < 2) || (maxCount < reserve)) return (false);
+
+	for (idx = 0; idx < 3; idx++) IOFBSegInit(data, &segs[idx], idx * srcDataCount, ((idx + 1) * srcDataCount) - 1);
+	count = IOFBSimplifySegs(data, desiredError, segs, 3, maxCount + 3 - reserve);
+
+	channelGamma = &bootGamma->gamma.red;
+	for (idx = 0; idx < count; idx++)
+	{
+		start = segs[idx].start % srcDataCount;
+		if (start)
+		{
+			IOFBGammaAddPoint(channelGamma, (uint16_t)
+				((start * 0xFFFFU + (srcDataCount - 1) / 2) / (srcDataCount - 1)),
+				data[segs[idx].start]);
+			continue;
+		}
+		if (idx)
+		{
+			if (0xFFFF != data[segs[idx - 1].end])
+				IOFBGammaAddPoint(channelGamma, 0xFFFF, data[segs[idx - 1].end]);
+			channelGamma = IOFBGammaNextChannel(channelGamma);
+		}
+		channelGamma->pointCount = 0;
+		if ((kIOFBGammaFitStartPoints & options) && data[segs[idx].start])
+			IOFBGammaAddPoint(channelGamma, 0, data[segs[idx].start]);
+	}
+	if (0xFFFF != data[segs[count - 1].end])
+		IOFBGammaAddPoint(channelGamma, 0xFFFF, data[segs[count - 1].end]);
+	channelGamma = IOFBGammaNextChannel(channelGamma);
+	bootGamma->length = (uint16_t) ((uintptr_t) channelGamma - (uintptr_t) bootGamma);
+
+	// The segments are done with, check the fit as it will be decoded
+	*maxError = 0;
+	decoGamma = &bootGamma->gamma.red;
+	for (idx = 0; idx < 3; idx++)
+	{
+		decoGamma = IOFBDecompressGammaChannel(decoGamma, deco, srcDataCount);
+		for (start = 0; start < srcDataCount; start++)
+		{
+			dist = deco[start] - data[idx * srcDataCount + start];
+			if (dist < 0) dist = -dist;
+			if (dist > *maxError) *maxError = (uint16_t) dist;
+		}
+	}
+
+	return (*maxError <= kIOFBGammaMaxError);
+}
+
+#endif /* ! _IOFBGAMMAFIT_H */
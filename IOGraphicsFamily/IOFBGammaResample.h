@@ -0,0 +1,208 @@
+/*
+ * Copyright (c) 2026 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * The contents of this file constitute Original Code as defined in and
+ * are subject to the Apple Public Source License Version 1.1 (the
+ * "License").  You may not use this file except in compliance with the
+ * License.  Please obtain a copy of the License at
+ * http://www.apple.com/publicsource and read it before using this file.
+ *
+ * This Original Code and all software distributed under the License are
+ * distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE OR NON-INFRINGEMENT.  Please see the
+ * License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+/*
+** Gamma table resampling and scaling for IOFramebuffer::updateGammaTable(),
+** shared with tools/gammatest.cpp and tools/gammabench.cpp, see
+** tools/CMakeLists.txt.
+**
+** A client ramp of srcCount entries is resampled onto the driver's dstCount
+** entries from a plan, IOFBGammaResample, that is only rebuilt when either
+** count changes. The resampled ramp is kept in the plan ahead of the gamma
+** scale, so a fade step only has to redo IOFBGammaScaleTable().
+*/
+
+#ifndef _IOFBGAMMARESAMPLE_H
+#define _IOFBGAMMARESAMPLE_H
+
+#include <IOKit/IOLib.h>
+
+struct IOFBGammaStep
+{
+    UInt32                      in;             // source entry
+    UInt32                      weight;         // idx % interpCount, 0 if no interpolation
+};
+
+struct IOFBGammaResample
+{
+    UInt32                      srcCount;
+    UInt32                      dstCount;
+    UInt32                      interpCount;    // 1 if never interpolating
+    UInt32                      interpShift;    // 0 if interpCount is divided
+    UInt64                      interpRecip;    // ceil(2^interpShift / interpCount)
+    IOFBGammaStep *             steps;          // dstCount
+    UInt16 *                    ramp;           // 3 channels of dstCount
+    UInt32                      rampGeneration; // of the raw table in ramp, 0 if none
+};
+
+// Dividing by interpCount becomes a multiply and shift, exact for numerators
+// below 2^(17 + l) where 2^l >= interpCount. That covers any 16 bit delta
+// times a weight below interpCount, while the product still fits 64 bits.
+enum { kIOFBGammaInterpLog2Max = 14 };
+
+static void
+IOFBGammaResampleFree(IOFBGammaResample * resample)
+{
+    if (!resample) return;
+    if (resample->steps) IODelete(resample->steps, IOFBGammaStep, resample->dstCount);
+    if (resample->ramp)  IODelete(resample->ramp, UInt16, 3 * resample->dstCount);
+    IODelete(resample, IOFBGammaResample, 1);
+}
+
+static IOFBGammaResample *
+IOFBGammaResampleCreate(uint32_t srcCount, uint32_t dstCount)
+{
+    IOFBGammaResample * resample;
+    uint32_t            in, idx, maxSrc, maxDst, interpCount, log2;
+
+    resample = IONew(IOFBGammaResample, 1);
+    if (!resample) return (NULL);
+    bzero(resample, sizeof(*resample));
+    resample->srcCount = srcCount;
+    resample->dstCount = dstCount;
+    resample->steps    = IONew(IOFBGammaStep, dstCount);
+    resample->ramp     = IONew(UInt16, 3 * dstCount);
+    if (!resample->steps || !resample->ramp)
+    {
+        IOFBGammaResampleFree(resample);
+        return (NULL);
+    }
+
+    // Same source entry and interpolation choice per destination entry as
+    // updateGammaTable() used to make, so the tables are bit for bit the same
+    maxSrc = srcCount - 1;
+    maxDst = dstCount - 1;
+    if ((srcCount < dstCount) && (0 == (dstCount % srcCount)))
+        interpCount = dstCount / srcCount;
+    else
+        interpCount = 0;
+    for (idx = 0; idx <= maxDst; idx++)
+    {
+        in = maxDst ? ((idx * maxSrc) + (idx ? (idx - 1) : 0)) / maxDst : 0;
+        resample->steps[idx].in     = in;
+        resample->steps[idx].weight = (interpCount && (in < maxSrc)) ? (idx % interpCount) : 0;
+    }
+
+    // A weight of 0 adds (interpCount - 1) / interpCount, which is nothing
+    resample->interpCount = interpCount ? interpCount : 1;
+    for (log2 = 0; (1U << log2) < resample->interpCount; log2++) {}
+    if (log2 <= kIOFBGammaInterpLog2Max)
+    {
+        resample->interpShift = 17 + 2 * log2;
+        resample->interpRecip = ((1ULL << resample->interpShift) + resample->interpCount - 1)
+                              / resample->interpCount;
+    }
+
+    return (resample);
+}
+
+// Resamples the three 16 bit channels of data into resample->ramp
+static void
+IOFBGammaResampleRamp(IOFBGammaResample * resample, const uint16_t * data)
+{
+    const IOFBGammaStep * step;
+    const int64_t         round = resample->interpCount - 1;
+    const uint64_t        recip = resample->interpRecip;
+    const uint32_t        shift = resample->interpShift;
+    UInt16 *              ramp  = resample->ramp;
+    uint32_t              channel, idx;
+    int64_t               value, num, sign;
+    uint64_t              quot;
+
+    for (channel = 0; channel < 3; channel++, data += resample->srcCount)
+    {
+        step = resample->steps;
+        for (idx = 0; idx < resample->dstCount; idx++, step++)
+        {
+            // value += (delta * weight + round) / interpCount truncates toward
+            // zero, so divide the magnitude and restore the sign after
+            value = data[step->in];
+            num   = (data[step->in + (0 != step->weight)] - value) * step->weight + round;
+            sign  = num >> 63;
+            quot  = (uint64_t) ((num ^ sign) - sign);
+            quot  = shift ? ((quot * recip) >> shift) : (quot / resample->interpCount);
+            *ramp++ = (UInt16) (value + (((int64_t) quot ^ sign) - sign));
+        }
+    }
+}
+
+// Scale pass over the resampled ramp into the driver's table of tryWidth bit
+// entries, a fade only changes the scale. A NULL ramp is the linear ramp of
+// dataWidth. gammaScale[3] scales all channels, adjustParams, if any, are
+// pairs of threshold and offset.
+static void
+IOFBGammaScaleTable(const UInt16 * ramp, uint32_t channelCount, uint32_t dataCount,
+                    uint32_t dataWidth, uint32_t tryWidth,
+                    const uintptr_t * gammaScale, bool gammaHaveScale,
+                    const uint32_t * adjustParams, UInt8 * table)
+{
+    const uint32_t * adjustNext = NULL;
+    uint32_t pin, out, channel, idx, maxDst;
+    uint32_t gammaThresh = -1U;
+    uint32_t gammaAdjust = 0;
+    uint64_t scale;
+    int64_t value;
+
+    pin = (1 << tryWidth) - 1;
+    if (gammaHaveScale)
+        dataWidth += 32;
+
+    maxDst = (dataCount - 1);
+    for (out = 0, channel = 0; channel < channelCount; channel++)
+    {
+        scale = gammaScale[channel] * gammaScale[3];
+        if (adjustParams)
+        {
+            gammaThresh = 0;
+            adjustNext = adjustParams;
+        }
+        for (idx = 0; idx <= maxDst; idx++)
+        {
+            if (idx >= gammaThresh)
+            {
+                gammaThresh = *adjustNext++;
+                gammaAdjust = *adjustNext++;
+            }
+            if (ramp)
+                value = *ramp++;
+            else
+                value = (idx * ((1 << dataWidth) - 1)) / maxDst;
+            if (gammaHaveScale)
+            {
+                value = ((value * scale) + (1U << 31));
+            }
+            value = (value >> (dataWidth - tryWidth));
+            if (value)
+                value += gammaAdjust;
+            if (value > pin)
+                value = pin;
+
+            if (tryWidth <= 8)
+                ((UInt8 *) table)[out] = (value & 0xff);
+            else
+                ((UInt16 *) table)[out] = value;
+            out++;
+        }
+    }
+}
+
+#endif /* ! _IOFBGAMMARESAMPLE_H */
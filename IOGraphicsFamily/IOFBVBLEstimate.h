@@ -0,0 +1,157 @@
+/*
+ * Copyright (c) 2026 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * The contents of this file constitute Original Code as defined in and
+ * are subject to the Apple Public Source License Version 1.1 (the
+ * "License").  You may not use this file except in compliance with the
+ * License.  Please obtain a copy of the License at
+ * http://www.apple.com/publicsource and read it before using this file.
+ *
+ * This Original Code and all software distributed under the License are
+ * distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE OR NON-INFRINGEMENT.  Please see the
+ * License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+/*
+** VBL phase and period estimate, fed from IOFramebuffer::handleVBL() and
+** shared with tools/vblsim.c:
+**
+**   cc -I../IOGraphicsFamily -o /tmp/vblsim vblsim.c
+**
+** An alpha-beta filter, a second order phase locked loop: each VBL is
+** matched to the predicted VBL nearest it, the phase moves a quarter of the
+** way to it and the period by 1/64 of the error per frame. The frame count
+** comes from the estimate, so throttled VBL interrupts, which only arrive
+** every few hundred ms, still correct it. Integer only, no allocation.
+**
+** Updates write locked, period then phase, so a reader that copies the
+** estimate until phase reads the same twice gets a usable one.
+*/
+
+#ifndef _IOFBVBLESTIMATE_H
+#define _IOFBVBLESTIMATE_H
+
+#include <stdint.h>
+#ifndef __cplusplus
+#include <stdbool.h>
+#endif
+
+enum
+{
+    kIOFBVBLPeriodFrac  = 16,       // fraction bits of IOFBVBLEstimate.period
+    kIOFBVBLPhaseGain   = 4,        // phase moves error / 4
+    kIOFBVBLPeriodGain  = 64,       // period moves error / 64 / frames
+    kIOFBVBLLockWindow  = 8,        // VBLs within period / 8 of predicted are in lock
+    kIOFBVBLLockCount   = 8,        // VBLs in lock before the estimate is used
+    kIOFBVBLMaxFrames   = 4096,     // longer gaps restart the estimate
+};
+
+struct IOFBVBLEstimate
+{
+    uint64_t phase;                 // estimated time of the last VBL seen
+    uint64_t period;                // estimated interval, kIOFBVBLPeriodFrac fixed point
+    uint32_t locked;                // VBLs in lock, up to kIOFBVBLLockCount
+    uint32_t resets;                // VBLs out of lock
+};
+typedef struct IOFBVBLEstimate IOFBVBLEstimate;
+
+static inline void
+IOFBVBLEstimateReset(IOFBVBLEstimate * est)
+{
+    est->locked = 0;
+    est->period = 0;
+    est->phase  = 0;
+}
+
+// In lock, and heard from within kIOFBVBLMaxFrames of now
+static inline bool
+IOFBVBLEstimateLocked(const IOFBVBLEstimate * est, uint64_t now)
+{
+    return ((est->locked >= kIOFBVBLLockCount)
+            && ((now < est->phase)
+                || ((now - est->phase) / kIOFBVBLMaxFrames
+                    < (est->period >> kIOFBVBLPeriodFrac))));
+}
+
+/*
+** now is the time of a VBL interrupt. nominal is the period from the mode
+** timing, or 0 when every VBL interrupt is seen and the last interval can
+** stand in for it while the estimate starts.
+*/
+static inline void
+IOFBVBLEstimateUpdate(IOFBVBLEstimate * est, uint64_t now, uint64_t nominal)
+{
+    uint64_t elapsed, frames, predicted;
+    int64_t  error, window;
+
+    if (!est->phase || (now + (est->period >> kIOFBVBLPeriodFrac) < est->phase))
+    {
+        est->locked = 0;
+        est->period = nominal << kIOFBVBLPeriodFrac;
+        est->phase  = now;
+        return;
+    }
+    elapsed = (now > est->phase) ? (now - est->phase) : 0;
+    if (!est->period)
+    {
+        est->period = elapsed << kIOFBVBLPeriodFrac;
+        est->phase  = now;
+        return;
+    }
+
+    frames = 0;
+    if (elapsed / kIOFBVBLMaxFrames < (est->period >> kIOFBVBLPeriodFrac))
+    {
+        frames = ((elapsed << kIOFBVBLPeriodFrac) + est->period / 2) / est->period;
+        if (!frames)
+        {
+            // a second interrupt for the same VBL
+            return;
+        }
+    }
+    predicted = est->phase + ((frames * est->period) >> kIOFBVBLPeriodFrac);
+    error     = (int64_t) (now - predicted);
+    window    = (int64_t) (est->period >> kIOFBVBLPeriodFrac) / kIOFBVBLLockWindow;
+
+    if (!frames || (error > window) || (error < -window))
+    {
+        // restart from this VBL, the period from the timing or the interval
+        est->locked = 0;
+        if (nominal)
+            est->period = nominal << kIOFBVBLPeriodFrac;
+        else if (frames == 1)
+            est->period = elapsed << kIOFBVBLPeriodFrac;
+        est->phase  = now;
+        est->resets++;
+        return;
+    }
+
+    est->period = (uint64_t) ((int64_t) est->period
+                  + error * (1 << kIOFBVBLPeriodFrac) / kIOFBVBLPeriodGain / (int64_t) frames);
+    est->phase  = (uint64_t) ((int64_t) predicted + error / kIOFBVBLPhaseGain);
+    if (est->locked < kIOFBVBLLockCount) est->locked++;
+}
+
+/*
+** Time of the VBL frames after the last one at or before now, so frames 0 is
+** the most recent VBL and 1 the next.
+*/
+static inline uint64_t
+IOFBVBLEstimateNext(const IOFBVBLEstimate * est, uint64_t now, uint32_t frames)
+{
+    uint64_t count;
+
+    count = (now > est->phase)
+          ? (((now - est->phase) << kIOFBVBLPeriodFrac) / est->period) : 0;
+    return (est->phase + (((count + frames) * est->period) >> kIOFBVBLPeriodFrac));
+}
+
+#endif /* ! _IOFBVBLESTIMATE_H */
@@ -52,6 +52,7 @@
 #include <sys/queue.h>
 
 #include <mach/mach_types.h>
+#include <kern/thread.h>
 #include <sys/systm.h>
 #include <sys/types.h>
 #include <sys/sysctl.h>
@@ -95,6 +96,7 @@
 #define DEADLOCK_DETECT RLOG
 
 enum { kIOFBVRAMCompressSpeed = 0 };
+enum { kIOFBRestoreLines = 64, kIOFBRestoreDelayUS = 500 };  // Per lazy restore pass
 enum { kVBLThrottleTimeMS     = 5000 };
 enum { kInitFBTimeoutNS = 1000000000ULL };
 enum { k2xDPI = (150*10) };
@@ -129,6 +131,9 @@ enum { kIOFBMapCacheMode = kIOMapInhibitCache };
 #if VRAM_COMPRESS
 #include "bmcompress.h"
 #endif
+#include "IOFBGammaFit.h"
+#include "IOFBGammaResample.h"
+#include "IOFBVBLEstimate.h"
 
 #if DOANIO
 #include <sys/uio.h>
@@ -492,6 +497,19 @@ public:
     void startAsync(uint32_t asyncWork);
 };
 
+// Software cursor span table for one cursor frame, built by extSetNewCursor.
+// Each row is a list of (kind << kCursorSpanKindShift) | length entries.
+struct IOFBCursorSpans
+{
+    UInt16                      width;          // image size the table describes, 0 if none
+    UInt16                      height;
+    UInt16                      rowLimit;       // capacity of rows[] less one
+    UInt16                      spanLimit;      // capacity of spans[]
+    UInt16 *                    rows;           // height + 1 indices into spans[]
+    UInt16 *                    spans;
+};
+enum { kIOFBCursorSpansPerRow = 8 };
+
 struct IOFBInterruptRegister
 {
     IOFBInterruptProc           handler;
@@ -520,6 +538,8 @@ struct IOFramebufferPrivate
     UInt8 *                     cursorFlags;
     volatile unsigned char **   cursorImages;
     volatile unsigned char **   cursorMasks;
+    IOFBCursorSpans *           cursorSpans;
+    vm_size_t                   cursorSpansSize;
     IOMemoryDescriptor *        saveBitsMD[kIOPreviewImageCount];
 
 	IOGBounds					screenBounds[2];			// phys & virtual bounds
@@ -532,6 +552,7 @@ struct IOFramebufferPrivate
 	IOTimerEventSource *        deferredCLUTSetTimerEvent;
 	IOInterruptEventSource *    deferredVBLDisableEvent;
     uint64_t					actualVBLCount;
+    IOFBVBLEstimate				vblEstimate;
 	OSObject *                  displayAttributes;
 
 	IOFBInterruptRegister		interruptRegisters[kIOFBNumInterruptRegister];
@@ -566,18 +587,31 @@ struct IOFramebufferPrivate
     UInt32                      gammaChannelCount;
     UInt32                      gammaDataCount;
     UInt32                      gammaDataWidth;
+    IOFBGammaResample *         gammaResample;
+    IOByteCount                 gammaAppliedLen;
+    UInt8 *                     gammaApplied;       // Last table the driver took
+    uint64_t                    gammaBytesSent;
+    uint64_t                    gammaBytesTable;    // Sent had every push been full
 
     IOByteCount                 rawGammaDataLen;
     UInt8 *                     rawGammaData;
+    UInt32                      rawGammaGeneration; // see rawGammaChanged()
     UInt32                      rawGammaChannelCount;
     UInt32                      rawGammaDataCount;
     UInt32                      rawGammaDataWidth;
 
-    IOByteCount                 clutDataLen;
+    IOByteCount                 clutDataLen;        // Pending, 0 if none
+    IOByteCount                 clutBufferLen;      // clutData, kept across flips
     UInt8 *                     clutData;
     UInt32                      clutIndex;
     UInt32                      clutOptions;
 
+    // Deferred gamma and CLUT flips, see checkDeferredCLUTSet()
+    uint32_t                    colorFlips;
+    uint32_t                    gammaCoalesced;     // Replaced before their flip
+    uint32_t                    clutCoalesced;      // Merged into a pending CLUT
+    uint32_t                    gammaDropped;       // Left to a transactional server
+
     uint32_t                    framebufferWidth;
     uint32_t                    framebufferHeight;
     uint32_t                    consoleDepth;
@@ -585,8 +619,20 @@ struct IOFramebufferPrivate
 	uint32_t					hibernateGfxStatus;
     uint32_t                    saveLength;
     void *                      saveFramebuffer;
+    void *                      saveSkipIndex;
+#if VRAM_COMPRESS
+    IOTimerEventSource *        restoreTimer;       // Paints restoreRects lazily
+    DecompressState             restoreState;       // The rect being painted
+    IOGBounds                   restoreRects[4];    // Around the first rect painted
+    uint32_t                    restoreImage;
+    uint32_t                    restoreRectNext;
+    uint32_t                    restoreRectCount;
+    bool                        restorePending;     // restoreState not done
+#endif
 
 	UInt8						needGammaRestore;
+    UInt8                       gammaAppliedValid;
+    UInt8                       gammaRangesUnsupported;
 	UInt8						vblThrottle;
 	UInt8						_reservedB;
     UInt8                       gammaNeedSet;
@@ -598,6 +644,8 @@ struct IOFramebufferPrivate
 	UInt8						gammaSet;
     UInt8                       cursorSlept;
     UInt8                       cursorPanning;
+    UInt8                       cursorMovePending;
+    UInt8                       cursorSaveShifted;
     UInt8                       pendingSpeedChange;
     bool                        pendingUsable;
 
@@ -666,6 +714,9 @@ struct IOFramebufferPrivate
     uint32_t                    hibernateGammaChannelCount;
     uint32_t                    hibernateGammaDataCount;
     uint32_t                    hibernateGammaDataWidth;
+    // Fit of the hibernate gamma table, replaces hibernateGammaData when set
+    IOByteCount                 hibernateGammaFitLen;
+    uint8_t *                   hibernateGammaFit;     // IOFBBootGamma
 
     uint64_t                    hdcpLimitState;
 
@@ -1661,6 +1712,7 @@ void IOFBController::asyncWork(IOInterruptEventSource * evtSrc, int intCount)
 {
     IOFBC_START(asyncWork,intCount,0,0);
     FCASSERTGATED(this);
+    IOG_KTRACE_IFSLOW_START(DBG_IOG_ASYNC_WORK);
 
     uint32_t work = fAsyncWork;
     IOFramebuffer *fb;
@@ -1694,9 +1746,13 @@ void IOFBController::asyncWork(IOInterruptEventSource * evtSrc, int intCount)
             FB_END(setAttributeForConnection,0,__LINE__,0);
         }
 
+        // No fixed thresholds, only calls slower than usual are recorded
         FOREACH_FRAMEBUFFER(fb)
         {
+            IOG_KTRACE_IFSLOW_START(DBG_IOG_PROCESS_CONNECT_CHANGE);
             fb->processConnectChange(bg);
+            IOG_KTRACE_IFSLOW_END(DBG_IOG_PROCESS_CONNECT_CHANGE, DBG_FUNC_NONE,
+                                  0, fb->__private->regID, 0, bg, 0, 0, 0);
         }
 
         if (fOnlineMask)
@@ -1704,7 +1760,14 @@ void IOFBController::asyncWork(IOInterruptEventSource * evtSrc, int intCount)
             FOREACH_FRAMEBUFFER(fb)
             {
                 if (fb->__private->online)
+                {
+                    IOG_KTRACE_IFSLOW_START(DBG_IOG_MATCH_FRAMEBUFFER);
                     fb->matchFramebuffer();
+                    IOG_KTRACE_IFSLOW_END(DBG_IOG_MATCH_FRAMEBUFFER,
+                                          DBG_FUNC_NONE,
+                                          0, fb->__private->regID,
+                                          0, 0, 0, 0, 0);
+                }
             }
         }
         else
@@ -1724,6 +1787,9 @@ void IOFBController::asyncWork(IOInterruptEventSource * evtSrc, int intCount)
 
     IOG_KTRACE_NT(DBG_IOG_ASYNC_WORK, DBG_FUNC_END,
         fFbs[0]->__private->regID, fAsyncWork, fDidWork, 0);
+    IOG_KTRACE_IFSLOW_END(DBG_IOG_ASYNC_WORK, DBG_FUNC_NONE,
+                          0, fFbs[0]->__private->regID, 0, work, 0, fDidWork,
+                          0);
     IOFBC_END(asyncWork,0,0,0);
 }
 
@@ -1962,9 +2028,21 @@ static void setupGTraceBuffers()
 
     if (gIOGATLines)
     {
+        // IOG_KTRACE traffic comes from every CPU, iog=0x4000 gives each
+        // CPU its own slice of the ring. iog=0x8000 lets iogdiagnose --follow
+        // map the ring and drain it live. iog=0x20000 packs the ring to keep
+        // several times more history in the same memory.
+        const uint64_t dbgFlags = atomic_load(&gIOGDebugFlags);
+        uint32_t options = 0;
+        if (kIOGDbgGTracePerCPU & dbgFlags)
+            options |= kGTraceOptionPerCPU;
+        if (kIOGDbgGTraceStream & dbgFlags)
+            options |= kGTraceOptionStream;
+        if (kIOGDbgGTraceCompact & dbgFlags)
+            options |= kGTraceOptionCompact;
         gGTrace = GTraceBuffer::make(
                 "iogdecoder", "IOGraphicsFamily", gIOGATLines,
-                &IOFramebuffer::gTraceData, NULL);
+                &IOFramebuffer::gTraceData, NULL, options);
     }
     // Always create an AGDC gtrace buffer.
     sAGDCGTrace = GTraceBuffer::make(
@@ -2026,6 +2104,10 @@ __private_extern__ "C" kern_return_t IOGraphicsFamilyModuleStart(kmod_info_t *ki
         gIOGATLines = flags;
 
     setupGTraceBuffers();
+#if ENABLE_TELEMETRY
+    if (kIOGDbgLatency & gIOGDebugFlags)
+        (void) GLatencyRecorder::prepareForRecording();
+#endif
 
     IOLog("IOG flags 0x%llx (0x%x)\n", gIOGDebugFlags, gIOGATFlags);
 
@@ -2212,6 +2294,139 @@ inline void IOFramebuffer::StdFBRemoveCursor( IOFramebuffer * inst )
     IOFB_END(StdFBRemoveCursor,0,0,0);
 }
 
+// Description: MoveCursor replaces a RemoveCursor / DisplayCursor pair when
+//              the software cursor moves but keeps its save rect size. Only
+//              the part of the old rect the new one no longer covers is
+//              restored, the overlapping background is shifted within the
+//              save buffer, and only newly covered pixels are read back from
+//              VRAM before the cursor is drawn at its new position.
+
+inline void IOFramebuffer::StdFBMoveCursor( IOFramebuffer * inst )
+{
+    IOFB_START(StdFBMoveCursor,0,0,0);
+    StdFBShmem_t sShMem = {0};
+    StdFBShmem_t * shmem = &sShMem;
+    IOGBounds oldRect, newRect;
+    volatile unsigned char *vramPtr;    /* screen data pointer */
+    unsigned char *save;
+    unsigned char *oldPtr, *newPtr;
+    size_t bpp, saveRowBytes;
+    int width, height, dx, dy, c0, c1, r;
+    bool moved = false;
+
+    memcpy(shmem, GetShmem(inst), sizeof(sShMem));
+
+    oldRect = shmem->saveRect;
+    newRect = shmem->cursorRect;
+    /* Clip newRect within screen bounds, as StdFBDisplayCursor will */
+    if (newRect.miny < shmem->screenBounds.miny)
+        newRect.miny = shmem->screenBounds.miny;
+    if (newRect.maxy > shmem->screenBounds.maxy)
+        newRect.maxy = shmem->screenBounds.maxy;
+    if (newRect.minx < shmem->screenBounds.minx)
+        newRect.minx = shmem->screenBounds.minx;
+    if (newRect.maxx > shmem->screenBounds.maxx)
+        newRect.maxx = shmem->screenBounds.maxx;
+
+    width  = newRect.maxx - newRect.minx;
+    height = newRect.maxy - newRect.miny;
+    dx     = newRect.minx - oldRect.minx;
+    dy     = newRect.miny - oldRect.miny;
+
+    if ((width <= 0) || (height <= 0)
+     || (width != (oldRect.maxx - oldRect.minx))
+     || (height != (oldRect.maxy - oldRect.miny))
+     || (dx >= width) || (-dx >= width) || (dy >= height) || (-dy >= height)
+     || (oldRect.minx < shmem->screenBounds.minx)
+     || (oldRect.miny < shmem->screenBounds.miny)
+     || (oldRect.maxx > shmem->screenBounds.maxx)
+     || (oldRect.maxy > shmem->screenBounds.maxy))
+    {
+        /* No overlap to reuse, or not a like-sized rect */
+        StdFBRemoveCursor(inst);
+        StdFBDisplayCursor(inst);
+        IOFB_END(StdFBMoveCursor,0,__LINE__,0);
+        return;
+    }
+
+    bpp          = inst->bytesPerPixel;
+    saveRowBytes = width * bpp;
+    save         = (unsigned char *) inst->cursorSave;
+    /* Overlap columns, in new rect coordinates */
+    c0 = (dx < 0) ? -dx : 0;
+    c1 = (dx > 0) ? width - dx : width;
+
+    IOMemoryDescriptor * fbRange = inst->getApertureRangeWithLength(kIOFBSystemAperture, inst->rowBytes * inst->__private->framebufferHeight);
+    if (NULL != fbRange)
+    {
+        IOMemoryMap * newVramMap = fbRange->map(kIOFBMapCacheMode);
+        fbRange->release();
+        if (NULL != newVramMap)
+        {
+            vramPtr = (volatile unsigned char *)newVramMap->getVirtualAddress();
+            if (NULL != vramPtr)
+            {
+                oldPtr = (unsigned char *) vramPtr +
+                (inst->rowBytes * (oldRect.miny - shmem->screenBounds.miny)) +
+                (bpp * (oldRect.minx - shmem->screenBounds.minx));
+                newPtr = (unsigned char *) vramPtr +
+                (inst->rowBytes * (newRect.miny - shmem->screenBounds.miny)) +
+                (bpp * (newRect.minx - shmem->screenBounds.minx));
+
+                /* Restore the strip of the old rect that is being exposed */
+                for (r = 0; r < height; r++)
+                {
+                    unsigned char * dst = oldPtr + r * inst->rowBytes;
+                    unsigned char * src = save + r * saveRowBytes;
+                    if (((r - dy) < 0) || ((r - dy) >= height))
+                        bcopy(src, dst, saveRowBytes);
+                    else
+                    {
+                        bcopy(src, dst, (c0 + dx) * bpp);
+                        bcopy(src + (c1 + dx) * bpp, dst + (c1 + dx) * bpp,
+                              (width - c1 - dx) * bpp);
+                    }
+                }
+
+                /* Shift the overlapping background to its new save position */
+                for (int i = 0; i < height; i++)
+                {
+                    r = (dy > 0) ? i : (height - 1 - i);
+                    if (((r + dy) < 0) || ((r + dy) >= height))
+                        continue;
+                    memmove(save + r * saveRowBytes + c0 * bpp,
+                            save + (r + dy) * saveRowBytes + (c0 + dx) * bpp,
+                            (c1 - c0) * bpp);
+                }
+
+                /* Fetch only the newly covered pixels from VRAM */
+                for (r = 0; r < height; r++)
+                {
+                    unsigned char * src = newPtr + r * inst->rowBytes;
+                    unsigned char * dst = save + r * saveRowBytes;
+                    if (((r + dy) < 0) || ((r + dy) >= height))
+                        bcopy(src, dst, saveRowBytes);
+                    else
+                    {
+                        bcopy(src, dst, c0 * bpp);
+                        bcopy(src + c1 * bpp, dst + c1 * bpp, (width - c1) * bpp);
+                    }
+                }
+                moved = true;
+            }
+            newVramMap->release();
+        }
+    }
+
+    if (moved)
+    {
+        inst->__private->cursorSaveShifted = true;
+        StdFBDisplayCursor(inst);
+        inst->__private->cursorSaveShifted = false;
+    }
+    IOFB_END(StdFBMoveCursor,moved,0,0);
+}
+
 inline void IOFramebuffer::RemoveCursor( IOFramebuffer * inst )
 {
     IOFB_START(RemoveCursor,0,0,0);
@@ -2233,7 +2448,10 @@ inline void IOFramebuffer::RemoveCursor( IOFramebuffer * inst )
             shmem->cursorLoc.y - hs->y - shmem->screenBounds.miny, false );
     }
     else
+    {
+        inst->__private->cursorMovePending = false;
         StdFBRemoveCursor(inst);
+    }
     IOFB_END(RemoveCursor,0,0,0);
 }
 
@@ -2263,7 +2481,13 @@ inline void IOFramebuffer::DisplayCursor( IOFramebuffer * inst )
                                  + shmem->cursorSize[0 != shmem->frame].width;
         shmem->cursorRect.maxy = (shmem->cursorRect.miny = y)
                                  + shmem->cursorSize[0 != shmem->frame].height;
-        StdFBDisplayCursor(inst);
+        if (inst->__private->cursorMovePending)
+        {
+            inst->__private->cursorMovePending = false;
+            StdFBMoveCursor(inst);
+        }
+        else
+            StdFBDisplayCursor(inst);
         shmem->oldCursorRect = shmem->cursorRect;
     }
     IOFB_END(DisplayCursor,0,0,0);
@@ -2447,6 +2671,9 @@ void IOFramebuffer::setupCursor(void)
     else
         __private->cursorBytesPerPixel = bytesPerPixel;
 
+#if VRAM_COMPRESS
+    finishRestore(false);
+#endif
     fFrameBuffer = (volatile unsigned char *) (fVramMap ? fVramMap->getVirtualAddress() : 0);
     __private->framebufferWidth  = info->activeWidth;
     __private->framebufferHeight = info->activeHeight;
@@ -2479,6 +2706,7 @@ void IOFramebuffer::setupCursor(void)
 			shmem->cursorSize[3] = __private->maxWaitCursorSize;
         }
 		__private->actualVBLCount = 0;
+		IOFBVBLEstimateReset(&__private->vblEstimate);
 
         cursorImageBytes = maxCursorSize.width * maxCursorSize.height
                            * __private->cursorBytesPerPixel;
@@ -2489,6 +2717,8 @@ void IOFramebuffer::setupCursor(void)
         for (UInt32 i = 0; i < __private->numCursorFrames; i++)
         {
             __private->cursorFlags[i] = kIOFBCursorImageNew;
+            if (__private->cursorSpans)
+                __private->cursorSpans[i].width = 0;
             __private->cursorImages[i] = bits;
             bits += i ? waitCursorImageBytes : cursorImageBytes;
         }
@@ -2774,181 +3004,6 @@ static void IOFBLogGamma(
 }
 #endif
 
-enum { kIOFBGammaPointCountMax = 256 };
-enum { kIOFBGammaDesiredError  = 127 };
-
-struct IOFBLineSeg
-{
-	// [start end]
-    uint16_t start;
-    uint16_t end;
-    uint16_t dist;
-    uint16_t split;
-};
-typedef struct IOFBLineSeg IOFBLineSeg;
-
-static void 
-IOFBSegDist(const uint16_t data[], IOFBLineSeg * seg)
-{
-	uint16_t start;
-	uint16_t end;
-	uint16_t idx;
-	uint16_t interp;
-	int16_t  dist;
-
-	seg->dist  = 0;
-	start = seg->start;
-	end   = seg->end;
-	for (idx = start + 1; idx < end; idx++)
-	{
-		interp = data[start] + ((data[end] - data[start]) * (idx - start)) / (end - start);
-		dist = data[idx] - interp;
-		if (dist < 0) dist = -dist;
-		if (dist > seg->dist)
-		{
-			seg->dist = dist;
-			seg->split = idx;
-		}
-	}
-}
-
-static void 
-IOFBSegInit(const uint16_t data[], IOFBLineSeg * seg, uint16_t start, uint16_t end)
-{
-	seg->start = start;
-	seg->end   = end;
-	IOFBSegDist(data, seg);
-}
-
-static void
-IOFBSimplifySegs(const uint16_t data[], uint16_t srcDataCount,
-				uint16_t desiredError, uint16_t * maxError, 
-				IOFBLineSeg * segs, uint16_t count, uint16_t maxCount,
-				IOFBBootGamma * bootGamma)
-{
-	IOFBGamma * channelGamma;
-	uint16_t    idx;
-	uint16_t    furthest;
-	uint16_t    start;
-
-	while (count < maxCount)
-	{
-		furthest = 0;
-		for (idx = 1; idx < count; idx++)
-		{
-			if (segs[idx].dist > segs[furthest].dist) furthest = idx;
-		}
-		if (segs[furthest].dist <= desiredError) break;
-		bcopy(&segs[furthest+1], &segs[furthest+2], (count - furthest - 1) * sizeof(IOFBLineSeg));
-		count++;
-		IOFBSegInit(data, &segs[furthest+1], segs[furthest].split, segs[furthest].end);
-		segs[furthest].end = segs[furthest].split;
-		IOFBSegDist(data, &segs[furthest]);
-	}
-
-	*maxError = 0;
-	channelGamma = &bootGamma->gamma.red;
-	for (idx = 0; idx < count; idx++)
-	{
-		if (segs[idx].dist > *maxError) 
-		{
-			*maxError = segs[idx].dist;
-			//IOLog("max error seg 0x%x, 0x%x count %d, target %d\n", segs[idx].start, segs[idx].end, count, maxCount);
-		}
-		start = segs[idx].start % srcDataCount;
-		if (!start)
-		{
-			if (segs[idx].start) 
-			{ 
-				channelGamma = (IOGRAPHICS_TYPEOF(channelGamma)) &channelGamma->points[channelGamma->pointCount];
-			}
-			channelGamma->pointCount = 0;
-			continue;
-		}
-		channelGamma->points[channelGamma->pointCount].in = 
-						(start * 65536 / srcDataCount)
-						 | (start * 65536 / srcDataCount / srcDataCount);
-		channelGamma->points[channelGamma->pointCount].out = data[segs[idx].start];
-		channelGamma->pointCount++;
-	}
-}
-
-static bool 
-IOFBCompressGamma(
-	IOFBBootGamma * bootGamma,
-    uint16_t channelCount, uint16_t srcDataCount,
-    uint16_t dataWidth, const void * _data,
-    uint16_t desiredError, uint16_t maxCount,
-    uint16_t * maxError)
-{
-	IOFBGamma *      channelGamma;
-	const uint16_t * data = (IOGRAPHICS_TYPEOF(data)) _data;
-	IOFBLineSeg *    segs;
-	uint16_t         idx;
-
-	if ((3 != channelCount) || (16 != dataWidth)) return (false);
-
-	maxCount += 3;
-	segs = IONew(IOFBLineSeg, maxCount);
-	if (!segs) return (false);
-
-	for (idx = 0; idx < 3; idx++) IOFBSegInit(data, &segs[idx], idx * srcDataCount, ((idx + 1) * srcDataCount) - 1);
-
-	IOFBSimplifySegs(data, srcDataCount, desiredError, maxError,
-					segs, 3, maxCount,
-					bootGamma);
-
-	IODelete(segs, IOFBLineSeg, maxCount);
-
-	channelGamma = &bootGamma->gamma.red;
-	for (idx = 0; idx < channelCount; idx++)
-	{
-		channelGamma = (IOGRAPHICS_TYPEOF(channelGamma)) &channelGamma->points[channelGamma->pointCount];
-	}
-	bootGamma->length = ((uintptr_t) channelGamma) - ((uintptr_t) bootGamma);
-
-	return (true);
-}
-
-
-static void __unused
-IOFBDecompressGamma(const IOFBBootGamma * bootGamma, uint16_t * data, uint16_t count) 
-{
-	const IOFBGamma * channelGamma;
-	uint16_t channel, idx, maxIdx, seg;
-	uint16_t startIn, startOut, point;
-	uint16_t endIn, endOut;
-
-	maxIdx = count - 1;
-	channelGamma = &bootGamma->gamma.red;
-	for (channel = 0; channel < 3; channel++)
-	{
-		seg = 0;
-		startIn = 0;
-		startOut = 0x0000;
-		endIn = 0;
-		endOut = 0;
-		for (idx = 0; idx <= maxIdx; idx++)
-		{
-			point = idx * 65535 / maxIdx;
-			if ((point >= endIn) && (idx != maxIdx))
-			{
-				startIn = endIn;
-				startOut = endOut;
-				if (seg < channelGamma->pointCount)
-				{
-					endIn  = channelGamma->points[seg].in;
-					endOut = channelGamma->points[seg].out;
-					seg++;
-				}
-				else endIn = endOut = 0xFFFF;
-			}
-			data[channel * count + idx] = startOut + ((endOut - startOut) * (point - startIn)) / (endIn - startIn);
-		}
-		channelGamma = (IOGRAPHICS_TYPEOF(channelGamma)) &channelGamma->points[channelGamma->pointCount];
-	}
-}
-
 void IOFramebuffer::saveGammaTables(void)
 {
     IOFB_START(saveGammaTables,0,0,0);
@@ -2958,8 +3013,11 @@ void IOFramebuffer::saveGammaTables(void)
 	IOFramebuffer *   fb;
 	OSNumber *        num;
 	OSData *          data;
+	uint8_t *         scratch;
+	size_t            scratchLen;
 	uint32_t          maxCount;
 	uint16_t          maxError;
+	bool              withinBound;
 
 	options = IORegistryEntry::fromPath("/options", gIODTPlane);
 	if (!options)
@@ -3015,21 +3073,33 @@ void IOFramebuffer::saveGammaTables(void)
         				 fb->__private->rawGammaDataWidth, 
         				 fb->__private->rawGammaData);
 #endif
-        	if (IOFBCompressGamma(bootGamma, 
+			scratchLen = IOFBGammaFitScratchSize(fb->__private->rawGammaDataCount, maxCount);
+			scratch = IONew(uint8_t, scratchLen);
+			if (!scratch) continue;
+			// No start points, the booter decodes boot-gamma. The best fit
+			// is always written, the error bound is only reported
+        	withinBound = IOFBCompressGamma(bootGamma, 
         							fb->__private->rawGammaChannelCount, 
         							fb->__private->rawGammaDataCount, 
         							fb->__private->rawGammaDataWidth, 
         							fb->__private->rawGammaData,
-        						    kIOFBGammaDesiredError, maxCount, 
-        						    &maxError))
+        						    kIOFBGammaDesiredError, maxCount, 0,
+        						    scratch, &maxError);
+			if (bootGamma->length)
 			{
-				DEBG1(fb->thisName, " compressed gamma %d max error 0x%04x\n", bootGamma->length, maxError);
-				if (bootGamma->gamma.red.pointCount)
+				DEBG1(fb->thisName, " compressed gamma %d max error 0x%04x%s\n", bootGamma->length, maxError,
+					  withinBound ? "" : " over bound");
+				// A linear table has no points, the booter's default
+				if (bootGamma->length > offsetof(IOFBBootGamma, gamma.blue.points))
 				{
 					data->appendBytes(bootGamma, bootGamma->length);
 				}
 			}
-
+			else
+			{
+				DEBG1(fb->thisName, " no boot gamma\n");
+			}
+			IODelete(scratch, uint8_t, scratchLen);
 		}
 	}
     IODelete(bootGamma, IOFBBootGamma, IOFBGammaPoint, maxCount);
@@ -3122,6 +3192,13 @@ IOReturn IOFramebuffer::extSetHibernateGammaTable(
                               inst->__private->hibernateGammaDataLen,
                               inst->__private->hibernateGammaData);
     
+    if (inst->__private->hibernateGammaFitLen)
+    {
+        IODelete(inst->__private->hibernateGammaFit, uint8_t, inst->__private->hibernateGammaFitLen);
+        inst->__private->hibernateGammaFit    = NULL;
+        inst->__private->hibernateGammaFitLen = 0;
+    }
+
     if (kIOReturnSuccess == err)
     {
         inst->__private->hibernateGammaChannelCount = channelCount;
@@ -3166,12 +3243,49 @@ IOReturn IOFramebuffer::extSetHibernateGammaTable(
 
     }
 
+    if ((kIOReturnSuccess == err) && (16 == dataWidth))
+    {
+        // Keep a fit instead of the table only when the preview can't tell them apart
+        const IOByteCount fitLen     = IOFBGammaFitSize(kIOFBGammaPointCountMax);
+        const size_t      scratchLen = IOFBGammaFitScratchSize(dataCount, kIOFBGammaPointCountMax);
+        uint8_t *         fit        = IONew(uint8_t, fitLen);
+        uint8_t *         scratch    = IONew(uint8_t, scratchLen);
+        uint16_t          maxError   = 0xFFFF;
+
+        if (fit && scratch
+            && IOFBCompressGamma((IOFBBootGamma *) fit, channelCount, dataCount, dataWidth,
+                                  inst->__private->hibernateGammaData,
+                                  kIOFBGammaDesiredError, kIOFBGammaPointCountMax,
+                                  kIOFBGammaFitStartPoints, scratch, &maxError)
+            && (maxError <= kIOFBGammaPreviewMaxError))
+        {
+            IODelete(inst->__private->hibernateGammaData, uint8_t, inst->__private->hibernateGammaDataLen);
+            inst->__private->hibernateGammaData    = NULL;
+            inst->__private->hibernateGammaDataLen = 0;
+            inst->__private->hibernateGammaFit     = fit;
+            inst->__private->hibernateGammaFitLen  = fitLen;
+            fit = NULL;
+        }
+        DEBG1(inst->thisName, " hibernate gamma %s, max error 0x%04x\n",
+              fit ? "table" : "fit", maxError);
+        if (fit) IODelete(fit, uint8_t, fitLen);
+        if (scratch) IODelete(scratch, uint8_t, scratchLen);
+    }
+
     inst->extExit(err,kIOGReportAPIState_SetHibernateGammaTable);
 
     IOFB_END(extSetHibernateGammaTable,err,0,0);
     return (err);
 }
 
+// Called whenever rawGammaData is rewritten, in place or not, so that
+// updateGammaTable() resamples it again rather than use its cached ramp.
+void IOFramebuffer::rawGammaChanged( void )
+{
+    if (!++__private->rawGammaGeneration)
+        __private->rawGammaGeneration = 1;
+}
+
 IOReturn IOFramebuffer::extSetGammaTable(
         OSObject * target, void * reference, IOExternalMethodArguments * args)
 {
@@ -3210,6 +3324,8 @@ IOReturn IOFramebuffer::extSetGammaTable(
                               inst->__private->rawGammaDataLen,
                               inst->__private->rawGammaData);
 
+    inst->rawGammaChanged();
+
     if (kIOReturnSuccess == err)
     {
         inst->__private->rawGammaChannelCount = channelCount;
@@ -3284,32 +3400,26 @@ IOReturn IOFramebuffer::updateGammaTable(
     IOFB_START(updateGammaTable,channelCount,syncType,immediate);
     IOReturn    err = kIOReturnBadArgument;
     IOByteCount dataLen;
-    UInt16 *    channelData;
     UInt32      dataCount;
     UInt32      tryWidth;
     UInt8 *     table = NULL;
     bool        needAlloc;
+    bool        copyRaw;
+    IOFBGammaResample * resample = NULL;
     bool        gammaHaveScale = ((1 << 16) != __private->gammaScale[0])
         || ((1 << 16) != __private->gammaScale[1])
         || ((1 << 16) != __private->gammaScale[2])
         || ((1 << 16) != __private->gammaScale[3]);
     const uint32_t * adjustParams = NULL;
-    const uint32_t * adjustNext   = NULL;
-    uint32_t         gammaThresh;
-    uint32_t         gammaAdjust;
     const bool  dropGammaSet = ((!ignoreTransactionActive) &&
                                 __private->transactionsEnabled);
+    const bool  gammaPending = __private->gammaNeedSet;
 
     if (GAMMA_ADJ && gIOGraphicsControl && (__private->desiredGammaDataWidth <= 8))
     {
         static const uint32_t _params[]  = { 138, 3, 256, 4 };
         adjustParams = &_params[0];
     }
-    else
-    {
-        gammaThresh = -1U;
-        gammaAdjust = 0;
-    }
     do
     {
         if (!__private->online)
@@ -3334,6 +3444,37 @@ IOReturn IOFramebuffer::updateGammaTable(
         dataLen  *= dataCount * channelCount;
         dataLen  += __private->gammaHeaderSize;
 
+        copyRaw = (!gammaHaveScale && data && !adjustParams
+               &&  (__private->desiredGammaDataCount == srcDataCount)
+               &&  (__private->desiredGammaDataWidth == dataWidth));
+
+        if (data && !copyRaw)
+        {
+            resample = __private->gammaResample;
+            if (!resample
+            ||  (resample->srcCount != srcDataCount)
+            ||  (resample->dstCount != dataCount))
+            {
+                IOFBGammaResampleFree(resample);
+                resample = IOFBGammaResampleCreate(srcDataCount, dataCount);
+                __private->gammaResample = resample;
+                if (!resample)
+                {
+                    err = kIOReturnNoMemory;
+                    continue;
+                }
+            }
+            // Only rawGammaData is cached, every rewrite of it bumps the generation
+            if ((data != __private->rawGammaData)
+            ||  !resample->rampGeneration
+            ||  (resample->rampGeneration != __private->rawGammaGeneration))
+            {
+                IOFBGammaResampleRamp(resample, (const uint16_t *) data);
+                resample->rampGeneration = (data == __private->rawGammaData)
+                                         ? __private->rawGammaGeneration : 0;
+            }
+        }
+
         needAlloc = (0 == __private->gammaDataLen);
         if (!needAlloc)
         {
@@ -3362,9 +3503,7 @@ IOReturn IOFramebuffer::updateGammaTable(
         table += __private->gammaHeaderSize;
         tryWidth = __private->desiredGammaDataWidth;
 
-        if (!gammaHaveScale && data && !adjustParams
-        &&  (__private->desiredGammaDataCount == srcDataCount)
-        &&  (__private->desiredGammaDataWidth == dataWidth))
+        if (copyRaw)
         {
             const IOByteCount len = dataLen - __private->gammaHeaderSize;
             assert(len == __private->rawGammaDataLen);
@@ -3372,67 +3511,10 @@ IOReturn IOFramebuffer::updateGammaTable(
         }
         else
         {
-            uint32_t pin, pt5, in, out, channel, idx, maxSrc, maxDst, interpCount;
-            int64_t value, value2;
-
-            pin = (1 << tryWidth) - 1;
-            pt5 = 0; //(1 << (tryWidth - 1));               // truncate not round
-            if (gammaHaveScale)
-                dataWidth += 32;
-
-            channelData = (UInt16 *) data;
-            maxSrc = (srcDataCount - 1);
-            maxDst = (__private->desiredGammaDataCount - 1);
-            if ((srcDataCount < __private->desiredGammaDataCount)
-            &&  (0 == (__private->desiredGammaDataCount % srcDataCount)))
-                interpCount = __private->desiredGammaDataCount / srcDataCount;
-            else
-                interpCount = 0;
-
-            for (out = 0, channel = 0; channel < channelCount; channel++)
-            {
-                if (adjustParams)
-                {
-                    gammaThresh = 0;
-                    adjustNext = adjustParams;
-                }
-                for (idx = 0; idx <= maxDst; idx++)
-                {
-                    if (idx >= gammaThresh)
-                    {
-                        gammaThresh = *adjustNext++;
-                        gammaAdjust = *adjustNext++;
-                    }
-                    if (channelData)
-                    {
-                        in = ((idx * maxSrc) + (idx ? (idx - 1) : 0)) / maxDst;
-                        value = (channelData[in] /*+ pt5*/);
-                        if (interpCount && (in < maxSrc))
-                        {
-                            value2 = (channelData[in+1] /*+ pt5*/);
-                            value += ((value2 - value) * (idx % interpCount) + (interpCount - 1)) / interpCount;
-                        }
-                    }
-                    else
-                        value = (idx * ((1 << dataWidth) - 1)) / maxDst;
-                    if (gammaHaveScale)
-                    {
-                        value = ((value * __private->gammaScale[channel] * __private->gammaScale[3]) + (1U << 31));
-                    }
-                    value = (value >> (dataWidth - tryWidth));
-                    if (value)
-                        value += gammaAdjust;
-                    if (value > pin)
-                        value = pin;
-
-                    if (tryWidth <= 8)
-                        ((UInt8 *) table)[out] = (value & 0xff);
-                    else
-                        ((UInt16 *) table)[out] = value;
-                    out++;
-                }
-                if (channelData) channelData += srcDataCount;
-            }
+            IOFBGammaScaleTable(resample ? resample->ramp : NULL,
+                                channelCount, dataCount, dataWidth, tryWidth,
+                                &__private->gammaScale[0], gammaHaveScale,
+                                adjustParams, table);
         }
         __private->gammaChannelCount = channelCount;
         __private->gammaDataCount    = dataCount;
@@ -3455,6 +3537,8 @@ IOReturn IOFramebuffer::updateGammaTable(
                 __private->gammaNeedSet = true;
                 err = kIOReturnSuccess;
             }
+            if (gammaPending && __private->gammaNeedSet)
+                __private->gammaCoalesced++;
         }
 #if 0
         OSData * ddata;
@@ -3477,51 +3561,11 @@ IOReturn IOFramebuffer::updateGammaTable(
 
         if (!__private->gammaNeedSet && !dropGammaSet)
         {
-            // If CD sent us a sync request, try with new, else fallback.
-            if (kIOFBSetGammaSyncNotSpecified != __private->gammaSyncType)
-            {
-                FB_START(setGammaTable2,0,__LINE__,0);
-                IOG_KTRACE(DBG_IOG_SET_GAMMA_TABLE, DBG_FUNC_START,
-                           0, __private->regID,
-                           0, DBG_IOG_SOURCE_UPDATE_GAMMA_TABLE,
-                           0, 0,
-                           0, 0);
-                err = setGammaTable(
-                        __private->gammaChannelCount, __private->gammaDataCount,
-                        __private->gammaDataWidth, __private->gammaData,
-                        kIOFBSetGammaSyncNoSync != __private->gammaSyncType);
-                IOG_KTRACE(DBG_IOG_SET_GAMMA_TABLE, DBG_FUNC_END,
-                           0, __private->regID,
-                           0, DBG_IOG_SOURCE_UPDATE_GAMMA_TABLE,
-                           0, err,
-                           0, 0);
-                FB_END(setGammaTable2,err,__LINE__,0);
-            }
-            else
-            {
-                err = kIOReturnUnsupported;
-            }
-
-            if (kIOReturnUnsupported == err)
-            {
-                FB_START(setGammaTable,0,__LINE__,0);
-                IOG_KTRACE(DBG_IOG_SET_GAMMA_TABLE, DBG_FUNC_START,
-                           0, __private->regID,
-                           0, DBG_IOG_SOURCE_UPDATE_GAMMA_TABLE,
-                           0, 0,
-                           0, 0);
-                err = setGammaTable(
-                        __private->gammaChannelCount, __private->gammaDataCount,
-                        __private->gammaDataWidth, __private->gammaData );
-                IOG_KTRACE(DBG_IOG_SET_GAMMA_TABLE, DBG_FUNC_END,
-                           0, __private->regID,
-                           0, DBG_IOG_SOURCE_UPDATE_GAMMA_TABLE,
-                           0, err,
-                           0, 0);
-                FB_END(setGammaTable,err,__LINE__,0);
-            }
+            err = pushGammaTable(DBG_IOG_SOURCE_UPDATE_GAMMA_TABLE);
             updateCursorForCLUTSet();
         }
+        else if (dropGammaSet && !__private->gammaNeedSet)
+            __private->gammaDropped++;
     }
     while (false);
 
@@ -3542,7 +3586,6 @@ IOReturn IOFramebuffer::extSetCLUTWithEntries(
 
     IOReturn    err;
     UInt8 *     table;
-    bool        needAlloc;
 
     if ((err = inst->extEntry(false, kIOGReportAPIState_SetCLUTWithEntries)))
     {
@@ -3555,35 +3598,58 @@ IOReturn IOFramebuffer::extSetCLUTWithEntries(
     {
         do
         {
-            needAlloc = (0 == inst->__private->clutDataLen);
-            if (!needAlloc)
-            {
-                if (index || (inst->__private->clutDataLen != dataLen))
-                {
-                    inst->checkDeferredCLUTSet();
-                    needAlloc = true;
-                }
-                inst->__private->clutDataLen = 0;
-            }
-    
-            if (needAlloc)
-            {
-                table = IONew(UInt8, dataLen);
+            if (!dataLen)
+                continue;
+
+            const IOByteCount pendLen   = inst->__private->clutDataLen;
+            const uint64_t    pendFirst = inst->__private->clutIndex;
+            const uint64_t    pendLast  = pendFirst + pendLen / sizeof(IOColorEntry);
+            uint64_t          first     = index;
+            uint64_t          last      = first + dataLen / sizeof(IOColorEntry);
+            IOByteCount       keep      = 0;
+            IOByteCount       len;
+
+            // An update overlapping or next to the pending one, with the same
+            // options, merges with it so the next VBL flips both at once.
+            if (pendLen
+             && (options == inst->__private->clutOptions)
+             && !((pendLen | dataLen) % sizeof(IOColorEntry))
+             && (first <= pendLast) && (pendFirst <= last))
+            {
+                keep = pendLen;
+                if (pendFirst < first) first = pendFirst;
+                if (pendLast > last)   last  = pendLast;
+            }
+            else if (pendLen)
+                inst->checkDeferredCLUTSet();
+            len = keep ? (last - first) * sizeof(IOColorEntry) : dataLen;
+
+            table = inst->__private->clutData;
+            if (len > inst->__private->clutBufferLen)
+            {
+                table = IONew(UInt8, len);
                 if (!table)
                 {
                     err = kIOReturnNoMemory;
                     continue;
                 }
-                inst->__private->clutData = table;
-            }
-            else
-                table = inst->__private->clutData;
-        
-            inst->__private->clutIndex   = index;
+                if (keep)
+                    bcopy(inst->__private->clutData,
+                          table + (pendFirst - first) * sizeof(IOColorEntry), keep);
+                if (inst->__private->clutBufferLen)
+                    IODelete(inst->__private->clutData, UInt8, inst->__private->clutBufferLen);
+                inst->__private->clutData      = table;
+                inst->__private->clutBufferLen = len;
+            }
+            else if (keep && (pendFirst != first))
+                bcopy(table, table + (pendFirst - first) * sizeof(IOColorEntry), keep);
+            bcopy(colors, table + (index - first) * sizeof(IOColorEntry), dataLen);
+
+            if (keep)
+                inst->__private->clutCoalesced++;
+            inst->__private->clutIndex   = static_cast<UInt32>(first);
             inst->__private->clutOptions = options;
-            inst->__private->clutDataLen = dataLen;
-    
-            bcopy(colors, table, dataLen);
+            inst->__private->clutDataLen = len;
 
 			if (inst->__private->vblThrottle && inst->__private->deferredCLUTSetTimerEvent)
 			{
@@ -3669,6 +3735,146 @@ void IOFramebuffer::deferredCLUTSetTimer(OSObject * owner, IOTimerEventSource *
     IOFB_END(deferredCLUTSetTimer,0,0,0);
 }
 
+enum { kIOFBGammaRangeMax = 16 };
+enum { kIOFBGammaRangeGap = 8 };    // Entries, closer changes share a range
+
+// Changed entries between two gamma tables of count entries, width bytes each.
+// Once kIOFBGammaRangeMax ranges are used the last one grows to the end.
+static UInt32
+IOFBGammaRanges(const UInt8 * last, const UInt8 * next, UInt32 count, UInt32 width,
+                IOGammaRange ranges[kIOFBGammaRangeMax])
+{
+    UInt32 idx, end = 0, rangeCount = 0;
+    bool   same;
+
+    for (idx = 0; idx < count; idx++)
+    {
+        same = (1 == width) ? (last[idx] == next[idx])
+                            : (((const UInt16 *) last)[idx] == ((const UInt16 *) next)[idx]);
+        if (same)
+            continue;
+        if (rangeCount
+         && (((idx - end) < kIOFBGammaRangeGap) || (kIOFBGammaRangeMax == rangeCount)))
+        {
+            ranges[rangeCount - 1].count = idx + 1 - ranges[rangeCount - 1].start;
+        }
+        else
+        {
+            ranges[rangeCount].start = idx;
+            ranges[rangeCount].count = 1;
+            rangeCount++;
+        }
+        end = idx + 1;
+    }
+    return (rangeCount);
+}
+
+// Sends gammaData to the driver. If it implements setGammaTableRanges() it
+// only gets the entries that changed since the last table it accepted.
+IOReturn IOFramebuffer::pushGammaTable( const uint64_t source )
+{
+    IOGammaRange      ranges[kIOFBGammaRangeMax];
+    const IOByteCount len    = __private->gammaDataLen;
+    const IOByteCount header = __private->gammaHeaderSize;
+    const UInt32      width  = (__private->gammaDataWidth + 7) / 8;
+    const UInt32      count  = static_cast<UInt32>((len - header) / width);
+    const bool        ranged = (kIOFBSetGammaSyncNotSpecified != __private->gammaSyncType)
+                             && !__private->gammaRangesUnsupported;
+    UInt32            idx, rangeCount = 0;
+    uint64_t          bytes  = len;
+    IOReturn          err    = kIOReturnUnsupported;
+
+    IOG_KTRACE(DBG_IOG_SET_GAMMA_TABLE, DBG_FUNC_START,
+               0, __private->regID,
+               0, source,
+               0, 0,
+               0, 0);
+
+    // If CD sent us a sync request, try with new, else fallback.
+    if (kIOFBSetGammaSyncNotSpecified != __private->gammaSyncType)
+    {
+        const bool sync = (kIOFBSetGammaSyncNoSync != __private->gammaSyncType);
+        const bool diff = ranged && __private->gammaAppliedValid
+                       && (__private->gammaAppliedLen == len)
+                       && !bcmp(__private->gammaApplied, __private->gammaData, header);
+
+        if (diff)
+            rangeCount = IOFBGammaRanges(__private->gammaApplied + header,
+                                         __private->gammaData + header,
+                                         count, width, ranges);
+        if (diff && !rangeCount)
+        {
+            // Driver already has this table
+            err   = kIOReturnSuccess;
+            bytes = 0;
+        }
+        else if (diff && ((rangeCount > 1) || (ranges[0].count < count)))
+        {
+            FB_START(setGammaTableRanges,rangeCount,__LINE__,0);
+            err = setGammaTableRanges(
+                    __private->gammaChannelCount, __private->gammaDataCount,
+                    __private->gammaDataWidth, __private->gammaData,
+                    ranges, rangeCount, sync);
+            FB_END(setGammaTableRanges,err,__LINE__,0);
+            if (kIOReturnUnsupported == err)
+                __private->gammaRangesUnsupported = true;
+            for (bytes = header, idx = 0; idx < rangeCount; idx++)
+                bytes += ranges[idx].count * width;
+        }
+
+        if (kIOReturnUnsupported == err)
+        {
+            bytes = len;
+            FB_START(setGammaTable2,0,__LINE__,0);
+            err = setGammaTable(
+                    __private->gammaChannelCount, __private->gammaDataCount,
+                    __private->gammaDataWidth, __private->gammaData, sync);
+            FB_END(setGammaTable2,err,__LINE__,0);
+        }
+    }
+
+    if (kIOReturnUnsupported == err)
+    {
+        FB_START(setGammaTable,0,__LINE__,0);
+        err = setGammaTable(
+                __private->gammaChannelCount, __private->gammaDataCount,
+                __private->gammaDataWidth, __private->gammaData );
+        FB_END(setGammaTable,err,__LINE__,0);
+    }
+
+    // Keep a copy of what the driver holds to diff the next table against
+    __private->gammaAppliedValid = false;
+    if (kIOReturnSuccess == err)
+    {
+        __private->gammaBytesSent  += bytes;
+        __private->gammaBytesTable += len;
+        if (ranged && !__private->gammaRangesUnsupported)
+        {
+            if (__private->gammaAppliedLen != len)
+            {
+                if (__private->gammaAppliedLen)
+                    IODelete(__private->gammaApplied, UInt8, __private->gammaAppliedLen);
+                __private->gammaApplied    = IONew(UInt8, len);
+                __private->gammaAppliedLen = __private->gammaApplied ? len : 0;
+            }
+            if (__private->gammaApplied)
+            {
+                bcopy(__private->gammaData, __private->gammaApplied, len);
+                __private->gammaAppliedValid = true;
+            }
+        }
+    }
+    else
+        bytes = 0;
+
+    IOG_KTRACE(DBG_IOG_SET_GAMMA_TABLE, DBG_FUNC_END,
+               0, __private->regID,
+               0, source,
+               0, err,
+               0, bytes);
+    return (err);
+}
+
 void IOFramebuffer::checkDeferredCLUTSet( void )
 {
     IOFB_START(checkDeferredCLUTSet,0,0,0);
@@ -3684,50 +3890,10 @@ void IOFramebuffer::checkDeferredCLUTSet( void )
 
     __private->gammaNeedSet = false;
     __private->clutDataLen  = 0;
+    __private->colorFlips++;
 
     if (gammaNeedSet)
-    {
-        if (kIOFBSetGammaSyncNotSpecified != __private->gammaSyncType)
-        {
-            FB_START(setGammaTable2,0,__LINE__,0);
-            IOG_KTRACE(DBG_IOG_SET_GAMMA_TABLE, DBG_FUNC_START,
-                       0, __private->regID,
-                       0, DBG_IOG_SOURCE_DEFERRED_CLUT,
-                       0, 0,
-                       0, 0);
-            ret = setGammaTable( __private->gammaChannelCount, __private->gammaDataCount,
-                                __private->gammaDataWidth, __private->gammaData,
-                                (kIOFBSetGammaSyncNoSync == __private->gammaSyncType) ? false : true );
-            IOG_KTRACE(DBG_IOG_SET_GAMMA_TABLE, DBG_FUNC_END,
-                       0, __private->regID,
-                       0, DBG_IOG_SOURCE_DEFERRED_CLUT,
-                       0, ret,
-                       0, 0);
-            FB_END(setGammaTable2,ret,__LINE__,0);
-        }
-        else
-        {
-            ret = kIOReturnUnsupported;
-        }
-
-        if (kIOReturnUnsupported == ret)
-        {
-            FB_START(setGammaTable,0,__LINE__,0);
-            IOG_KTRACE(DBG_IOG_SET_GAMMA_TABLE, DBG_FUNC_START,
-                       0, __private->regID,
-                       0, DBG_IOG_SOURCE_DEFERRED_CLUT,
-                       0, 0,
-                       0, 0);
-            ret = setGammaTable( __private->gammaChannelCount, __private->gammaDataCount,
-                                __private->gammaDataWidth, __private->gammaData );
-            IOG_KTRACE(DBG_IOG_SET_GAMMA_TABLE, DBG_FUNC_END,
-                       0, __private->regID,
-                       0, DBG_IOG_SOURCE_DEFERRED_CLUT,
-                       0, ret,
-                       0, 0);
-            FB_END(setGammaTable,ret,__LINE__,0);
-        }
-    }
+        ret = pushGammaTable(DBG_IOG_SOURCE_DEFERRED_CLUT);
 
     if (clutLen)
     {
@@ -3735,11 +3901,17 @@ void IOFramebuffer::checkDeferredCLUTSet( void )
         ret = setCLUTWithEntries( (IOColorEntry *) __private->clutData, __private->clutIndex,
                                   static_cast<UInt32>(clutLen / sizeof(IOColorEntry)), __private->clutOptions );
         FB_END(setCLUTWithEntries,ret,__LINE__,0);
-
-        IODelete(__private->clutData, UInt8, clutLen);
     }
 
     updateCursorForCLUTSet();
+
+    IOG_KTRACE_NT(DBG_IOG_COLOR_FLIP, DBG_FUNC_NONE,
+        GPACKUINT64T(__private->regID),
+        GPACKUINT32T(1, __private->colorFlips) |
+        GPACKUINT32T(0, __private->gammaDropped),
+        GPACKUINT32T(1, __private->gammaCoalesced) |
+        GPACKUINT32T(0, __private->clutCoalesced),
+        GPACKUINT64T(__private->gammaBytesTable - __private->gammaBytesSent));
     IOFB_END(checkDeferredCLUTSet,0,0,0);
 }
 
@@ -3762,19 +3934,31 @@ IOReturn IOFramebuffer::createSharedCursor(
     const auto uMaxWidth = static_cast<uint32_t>(maxWidth);
     const auto uMaxWaitWidth = static_cast<uint32_t>(maxWaitWidth);
     if (uMaxWidth > kIOFBMaxCursorWidth || uMaxWaitWidth > kIOFBMaxCursorWidth)
+    {
+        IOFB_END(createSharedCursor,kIOReturnNoMemory,__LINE__,0);
         return (kIOReturnNoMemory);
+    }
 
     if (uMaxWidth == 0 || uMaxWaitWidth == 0)
+    {
+        IOFB_END(createSharedCursor,kIOReturnBadArgument,__LINE__,0);
         return (kIOReturnBadArgument);
+    }
 
     if (shmemVersion == kIOFBTenPtTwoShmemVersion)
     {
         numCursorFrames = (kIOFBShmemCursorNumFramesMask & cursorversion) >> kIOFBShmemCursorNumFramesShift;
         if (numCursorFrames > kIOFBMaxCursorFrames)
+        {
+            IOFB_END(createSharedCursor,kIOReturnNoMemory,__LINE__,0);
             return (kIOReturnNoMemory);
+        }
 
         if (0 == numCursorFrames)
+        {
+            IOFB_END(createSharedCursor,kIOReturnBadArgument,__LINE__,0);
             return (kIOReturnBadArgument);
+        }
 
         setProperty(kIOFBWaitCursorFramesKey, (numCursorFrames - 1), 32);
         setProperty(kIOFBWaitCursorPeriodKey, 33333333, 32);    /* 30 fps */
@@ -3806,6 +3990,12 @@ IOReturn IOFramebuffer::createSharedCursor(
         IODelete( __private->cursorMasks, volatile unsigned char *, __private->numCursorFrames );
         __private->cursorMasks = 0;
     }
+    if (__private->cursorSpans)
+    {
+        IOFree( __private->cursorSpans, __private->cursorSpansSize );
+        __private->cursorSpans = 0;
+        __private->cursorSpansSize = 0;
+    }
     __private->numCursorFrames = numCursorFrames;
     __private->cursorFlags     = IONew( UInt8, numCursorFrames );
     __private->cursorImages    = IONew( volatile unsigned char *, numCursorFrames );
@@ -3821,6 +4011,36 @@ IOReturn IOFramebuffer::createSharedCursor(
     bzero(__private->cursorImages, numCursorFrames * sizeof(volatile unsigned char *));
     bzero(__private->cursorMasks,  numCursorFrames * sizeof(volatile unsigned char *));
 
+    // Span tables for all frames share one allocation: the headers, then each
+    // frame's row index and span entries. A missing table only costs speed.
+    size = numCursorFrames * sizeof(IOFBCursorSpans);
+    for (UInt32 i = 0; i < numCursorFrames; i++)
+    {
+        size_t rows = i ? maxWaitWidth : maxWidth;
+        size += (rows + 1 + rows * kIOFBCursorSpansPerRow) * sizeof(UInt16);
+    }
+    __private->cursorSpans = (IOFBCursorSpans *) IOMalloc(size);
+    if (__private->cursorSpans)
+    {
+        UInt16 * entries = (UInt16 *) &__private->cursorSpans[numCursorFrames];
+
+        __private->cursorSpansSize = size;
+        for (UInt32 i = 0; i < numCursorFrames; i++)
+        {
+            IOFBCursorSpans * table = &__private->cursorSpans[i];
+            UInt16            rows  = i ? maxWaitWidth : maxWidth;
+
+            table->width     = 0;
+            table->height    = 0;
+            table->rowLimit  = rows;
+            table->spanLimit = rows * kIOFBCursorSpansPerRow;
+            table->rows      = entries;
+            entries += rows + 1;
+            table->spans     = entries;
+            entries += table->spanLimit;
+        }
+    }
+
     maxImageSize = (maxWidth * maxWidth * kIOFBMaxCursorDepth) / 8;
     maxWaitImageSize = (maxWaitWidth * maxWaitWidth * kIOFBMaxCursorDepth) / 8;
 
@@ -4172,7 +4392,11 @@ IOReturn IOFramebuffer::_extEntry(bool system, bool allowOffline, uint32_t apibi
     IOFB_START(_extEntry,system,allowOffline,apibit);
     IOReturn             err = kIOReturnSuccess;
 
-    if (!__private->controller) return kIOReturnNotReady;
+    if (!__private->controller)
+    {
+        IOFB_END(_extEntry,kIOReturnNotReady,__LINE__,0);
+        return kIOReturnNotReady;
+    }
 
 	if (system)
 	{
@@ -4450,6 +4674,10 @@ do {                                                                           \
         RELEASE_EVENT_SOURCE(FBWL(this), __private->deferredCLUTSetTimerEvent);
         RELEASE_EVENT_SOURCE(FBWL(this), __private->dpInterruptES);
         RELEASE_EVENT_SOURCE(FBWL(this), __private->deferredSpeedChangeEvent);
+#if VRAM_COMPRESS
+        finishRestore(false);
+        RELEASE_EVENT_SOURCE(FBWL(this), __private->restoreTimer);
+#endif
 
         OSSafeReleaseNULL(__private->pmSettingNotificationHandle);
         OSSafeReleaseNULL(__private->paramHandler);
@@ -4539,9 +4767,20 @@ do {                                                                           \
     }                                                                          \
 } while(0)
         SAFE_IODELETE(__private->gammaData, UInt8, __private->gammaDataLen);
+        IOFBGammaResampleFree(__private->gammaResample);
+        __private->gammaResample = NULL;
+        SAFE_IODELETE(__private->gammaApplied, UInt8, __private->gammaAppliedLen);
+        __private->gammaAppliedValid = false;
         SAFE_IODELETE(__private->rawGammaData, UInt8, __private->rawGammaDataLen);
-        SAFE_IODELETE(__private->clutData, UInt8, __private->clutDataLen);
+        SAFE_IODELETE(__private->clutData, UInt8, __private->clutBufferLen);
+        __private->clutDataLen = 0;
         SAFE_IODELETE(__private->hibernateGammaData, uint8_t, __private->hibernateGammaDataLen);
+        SAFE_IODELETE(__private->hibernateGammaFit, uint8_t, __private->hibernateGammaFitLen);
+        if (__private->cursorSpans)
+        {
+            IOFree(__private->cursorSpans, __private->cursorSpansSize);
+            __private->cursorSpans = NULL;
+        }
         SAFE_IODELETE(__private->cursorFlags, UInt8, __private->numCursorFrames);
         SAFE_IODELETE(__private->cursorImages, volatile unsigned char *, __private->numCursorFrames);
         SAFE_IODELETE(__private->cursorMasks, volatile unsigned char *, __private->numCursorFrames);
@@ -4805,7 +5044,11 @@ bool IOFramebuffer::start( IOService * provider )
         __private->fCloseWorkES = IOInterruptEventSource::interruptEventSource(this,
             OSMemberFunctionCast(IOInterruptEventSource::Action, this,
                 &IOFramebuffer::closeWork));
-        if (!static_cast<bool>(__private->fCloseWorkES)) return false;
+        if (!static_cast<bool>(__private->fCloseWorkES))
+        {
+            IOFB_END(start,false,__LINE__,0);
+            return false;
+        }
         gIOFBSystemWorkLoop->addEventSource(__private->fCloseWorkES);
 
         // Grab the gate before we try to find a controller
@@ -4917,8 +5160,15 @@ void IOFramebuffer::deferredMoveCursor( IOFramebuffer * inst )
     }
     else
     {
+        // Leave the cursor up; if it is redrawn below, DisplayCursor moves
+        // it in one pass, otherwise it is removed once the state settles.
         if (!shmem->cursorShow++)
-            RemoveCursor(inst);
+        {
+            if (inst->pagingState && inst->cursorRemoveProc && inst->cursorBlitProc)
+                inst->__private->cursorMovePending = true;
+            else
+                RemoveCursor(inst);
+        }
         if (shmem->cursorObscured)
         {
             shmem->cursorObscured = 0;
@@ -4930,6 +5180,11 @@ void IOFramebuffer::deferredMoveCursor( IOFramebuffer * inst )
         if (shmem->cursorShow)
             if (!--shmem->cursorShow)
                 DisplayCursor(inst);
+        if (inst->__private->cursorMovePending)
+        {
+            inst->__private->cursorMovePending = false;
+            RemoveCursor(inst);
+        }
 
         FB_START(flushCursor,0,__LINE__,0);
         inst->flushCursor();
@@ -5244,6 +5499,7 @@ bool IOFramebuffer::getTimeOfVBL(AbsoluteTime * deadlineAT, uint32_t frames)
     IOFB_START(getTimeOfVBL,frames,0,0);
 	uint64_t last, now;
 	uint64_t delta;
+	IOFBVBLEstimate est;
 
     StdFBShmem_t * shmem = GetShmem(this);
     if (!shmem)
@@ -5252,6 +5508,23 @@ bool IOFramebuffer::getTimeOfVBL(AbsoluteTime * deadlineAT, uint32_t frames)
         return (false);
     }
 
+	// may race handleVBL(), see IOFBVBLEstimate.h
+	do
+	{
+		est.phase = __private->vblEstimate.phase;
+		est.period = __private->vblEstimate.period;
+		est.locked = __private->vblEstimate.locked;
+		now = mach_absolute_time();
+	}
+	while (est.phase != __private->vblEstimate.phase);
+
+	if (IOFBVBLEstimateLocked(&est, now))
+	{
+		AbsoluteTime_to_scalar(deadlineAT) = IOFBVBLEstimateNext(&est, now, frames);
+		IOFB_END(getTimeOfVBL,true,1,0);
+		return (true);
+	}
+
 	do
 	{
 		last = AbsoluteTime_to_scalar(&shmem->vblTime);
@@ -5321,9 +5594,17 @@ void IOFramebuffer::handleVBL(IOFramebuffer * inst, void *)
     shmem->vblTime  = now;
 	inst->__private->actualVBLCount = 0;
 
+	// vblDeltaReal is the mode's period only while throttled
+	IOFBVBLEstimate * est = &inst->__private->vblEstimate;
+	IOFBVBLEstimateUpdate(est, _now, inst->__private->vblThrottle ? calculatedDelta : 0);
+	const bool locked = IOFBVBLEstimateLocked(est, _now);
+	shmem->vblPeriod = locked ? est->period : 0;
+	AbsoluteTime_to_scalar(&shmem->vblPhase) = locked ? est->phase : 0;
+
     const uint64_t bits =
         (inst->__private->vblThrottle ? 1 : 0) |
         (gIOFBVBLDrift ? 2 : 0) |
+        (locked ? 4 : 0) |
         0;
 
     KDBG_FILTERED(IOGDBG_VBLANK | DBG_FUNC_END, inst->__private->regID, shmem->vblCount, shmem->vblDelta, bits);
@@ -5381,6 +5662,8 @@ void IOFramebuffer::getVBLTime( AbsoluteTime * time, AbsoluteTime * delta )
     {
 		getTimeOfVBL(time, 0);
         *delta = shmem->vblDeltaReal;
+        if (shmem->vblPeriod)
+            AbsoluteTime_to_scalar(delta) = shmem->vblPeriod >> kIOFBVBLPeriodFrac;
     }
     else
     {
@@ -5477,6 +5760,7 @@ IOReturn IOFramebuffer::extSetCursorPosition(
     if (screenBounds == nullptr)
     {
         IOLog("IOG: screenBounds is null");
+        IOFB_END(extSetCursorPosition,kIOReturnBadArgument,__LINE__,0);
         return kIOReturnBadArgument;
     }
     else
@@ -5487,6 +5771,7 @@ IOReturn IOFramebuffer::extSetCursorPosition(
             IOLog("IOG: cursor position (%d,%d) is out of screen bounds:(%d,%d,%d,%d)",
             cursorLoc.x, cursorLoc.y,
             screenBounds->minx, screenBounds->miny, screenBounds->maxx, screenBounds->maxy);
+            IOFB_END(extSetCursorPosition,kIOReturnBadArgument,__LINE__,0);
             return kIOReturnBadArgument;
         }
     }
@@ -5494,6 +5779,7 @@ IOReturn IOFramebuffer::extSetCursorPosition(
     if (argFrame > INT_MAX)
     {
         IOLog("IOG: frame index integer overflow %llx", argFrame);
+        IOFB_END(extSetCursorPosition,kIOReturnBadArgument,__LINE__,0);
         return kIOReturnBadArgument;
     }
     const int frame = static_cast<int>(argFrame);
@@ -5514,7 +5800,7 @@ IOReturn IOFramebuffer::extSetCursorPosition(
     
     inst->moveCursorImpl(cursorLoc, frame);
 
-    IOFB_END(extSetCursorPosition,kIOReturnUnsupported,0,0);
+    IOFB_END(extSetCursorPosition,kIOReturnSuccess,0,0);
     return kIOReturnSuccess;
 }
 
@@ -5656,6 +5942,11 @@ IOReturn IOFramebuffer::extSetNewCursor(
                 || (shmem->cursorSize[0 != frame].height > inst->maxCursorSize.height))
             err = kIOReturnBadArgument;
 
+        else if (!inst->haveHWCursor && inst->cursorBlitProc)
+        {
+            StdFBBuildCursorSpans(inst, shmem, frame);
+            err = kIOReturnUnsupported;
+        }
         else if (inst->haveHWCursor)
         {
             if (frame == shmem->frame)
@@ -6182,125 +6473,129 @@ void IOFramebuffer::saveFramebuffer(void)
 		vm_size_t sLen;
 		sLen = __private->framebufferHeight * rowBytes;
 
+#if VRAM_COMPRESS
 		/*
-		* dLen should account for possible growth. (e.g. run-length encoding noise)
-		*       Add 5 bytes for header,
-		*       12% for RLE growth
-		*       2 bytes per line for line spans,
-		*       1 additional escape code byte for trailing pixel in each line
+		* The compressor streams its output into chunks and allocates the
+		* preview buffer once the compressed size is known, so the sleep
+		* path never holds a worst case (source size plus RLE growth, per
+		* image) pageable allocation.
 		*/
-#if VRAM_COMPRESS
-		vm_size_t dLen;
-		uint32_t  idx;
-
-		dLen = 5 + sLen + ((sLen + 7) >> 3) + (__private->framebufferHeight * 3) + rowBytes;
+		vm_size_t     dLen = 0;
+		vm_size_t     allocLen = 0;
+		vm_size_t     skipOffset = 0;
+		uint32_t      idx;
+		UInt8 *       bits[kIOPreviewImageCount] = { 0 };
+		IOByteCount   bitsLen = 0;
+		IOMemoryMap * map[kIOPreviewImageCount] = { 0 };
 
 		for (idx = 0;
 			 (idx < kIOPreviewImageCount) && __private->saveBitsMD[idx];
-			 idx++)	{}
-
-		dLen *= (idx + 1);
-		DEBG1(thisName, " dLen 0x%x\n", (int) dLen);
-
-		dLen = round_page(dLen);
-		if (dLen >= 96*1024*1024) dLen = 95*1024*1024;
-		__private->saveLength = static_cast<uint32_t>(dLen);
-#else
-		__private->saveLength = round_page(sLen);
-#endif
-		__private->saveFramebuffer = IOMallocPageable( __private->saveLength, page_size );
-		if (!__private->saveFramebuffer)
-			__private->saveLength = 0;
-		else
+			 idx++)
 		{
-#if VRAM_COMPRESS
-			UInt8 *       bits[kIOPreviewImageCount] = { 0 };
-			IOByteCount   bitsLen = 0;
-			IOMemoryMap * map[kIOPreviewImageCount] = { 0 };
-
-			for (idx = 0;
-				 (idx < kIOPreviewImageCount) && __private->saveBitsMD[idx];
-				 idx++)
+			map[idx] = __private->saveBitsMD[idx]->map(kIOMapReadOnly);
+			if (map[idx])
 			{
-				map[idx] = __private->saveBitsMD[idx]->map(kIOMapReadOnly);
-				if (map[idx])
+				bits[idx] = (UInt8 *) map[idx]->getVirtualAddress();
+				if (!idx) bitsLen = map[idx]->getLength();
+				else if (bitsLen != map[idx]->getLength())
 				{
-					bits[idx] = (UInt8 *) map[idx]->getVirtualAddress();
-					if (!idx) bitsLen = map[idx]->getLength();
-					else if (bitsLen != map[idx]->getLength())
-					{
-						bits[idx] = NULL;
-						map[idx]->release();
-						map[idx] = 0;
-					}
+					bits[idx] = NULL;
+					map[idx]->release();
+					map[idx] = 0;
 				}
-				__private->saveBitsMD[idx]->release();
-				__private->saveBitsMD[idx] = 0;
 			}
+			__private->saveBitsMD[idx]->release();
+			__private->saveBitsMD[idx] = 0;
+		}
 
-			if (!bits[0])
+		if (!bits[0])
+		{
+			IOLog("%s: no save bits\n", thisName);
+		}
+		else if ((((__private->framebufferHeight - 1) * rowBytes)
+			 + __private->framebufferWidth * bytesPerPixel) > bitsLen)
+		{
+			IOLog("%s: bad pixel parameters %d x %d x %d > 0x%x\n", thisName,
+			 (int) __private->framebufferWidth, (int) __private->framebufferHeight, (int) rowBytes, (int) bitsLen);
+		}
+		else
+		{
+			uint32_t pixelBits;
+			if (__private->pixelInfo.bitsPerComponent > 8)
+				pixelBits = __private->pixelInfo.componentCount * __private->pixelInfo.bitsPerComponent;
+			else
+				pixelBits = __private->pixelInfo.bitsPerPixel;
+
+			uint8_t * saveGammaData;
+			uint32_t saveGammaChannelCount;
+			uint32_t saveGammaDataCount;
+			uint32_t saveGammaDataWidth;
+			// The preview header holds 3 x 256 entries, decode just those
+			uint16_t * fitGammaData = NULL;
+			if (NULL != __private->hibernateGammaFit)
+				fitGammaData = IONew(uint16_t, 3 * 256);
+			// Preference to hibernateGamma
+			if (NULL != fitGammaData)
 			{
-				IOLog("%s: no save bits\n", thisName);
-				dLen = 0;
+				IOFBDecompressGamma((const IOFBBootGamma *) __private->hibernateGammaFit,
+									fitGammaData, 256);
+				saveGammaData = (uint8_t *) fitGammaData;
+				saveGammaChannelCount = 3;
+				saveGammaDataCount = 256;
+				saveGammaDataWidth = 16;
 			}
-			else if ((((__private->framebufferHeight - 1) * rowBytes)
-				 + __private->framebufferWidth * bytesPerPixel) > bitsLen)
+			else if (NULL != __private->hibernateGammaData)
 			{
-				IOLog("%s: bad pixel parameters %d x %d x %d > 0x%x\n", thisName,
-				 (int) __private->framebufferWidth, (int) __private->framebufferHeight, (int) rowBytes, (int) bitsLen);
-				dLen = 0;
+				saveGammaData = __private->hibernateGammaData;
+				saveGammaChannelCount = __private->hibernateGammaChannelCount;
+				saveGammaDataCount = __private->hibernateGammaDataCount;
+				saveGammaDataWidth = __private->hibernateGammaDataWidth;
 			}
 			else
 			{
-                uint32_t pixelBits;
-                if (__private->pixelInfo.bitsPerComponent > 8)
-                    pixelBits = __private->pixelInfo.componentCount * __private->pixelInfo.bitsPerComponent;
-                else
-                    pixelBits = __private->pixelInfo.bitsPerPixel;
-
-                uint8_t * saveGammaData;
-                uint32_t saveGammaChannelCount;
-                uint32_t saveGammaDataCount;
-                uint32_t saveGammaDataWidth;
-                // Preference to hibernateGamma
-                if (NULL != __private->hibernateGammaData)
-                {
-                    saveGammaData = __private->hibernateGammaData;
-                    saveGammaChannelCount = __private->hibernateGammaChannelCount;
-                    saveGammaDataCount = __private->hibernateGammaDataCount;
-                    saveGammaDataWidth = __private->hibernateGammaDataWidth;
-                }
-                else
-                {
-                    saveGammaData = __private->rawGammaData;
-                    saveGammaChannelCount = __private->rawGammaChannelCount;
-                    saveGammaDataCount = __private->rawGammaDataCount;
-                    saveGammaDataWidth = __private->rawGammaDataWidth;
-                }
-
-                dLen = CompressData( bits, kIOPreviewImageCount, bytesPerPixel, pixelBits,
-                                    __private->framebufferWidth, __private->framebufferHeight, rowBytes,
-                                    (UInt8 *) __private->saveFramebuffer, __private->saveLength,
-                                    saveGammaChannelCount, saveGammaDataCount,
-                                    saveGammaDataWidth, saveGammaData);
+				saveGammaData = __private->rawGammaData;
+				saveGammaChannelCount = __private->rawGammaChannelCount;
+				saveGammaDataCount = __private->rawGammaDataCount;
+				saveGammaDataWidth = __private->rawGammaDataWidth;
 			}
-			DEBG1(thisName, " compressed to %d%%\n", (int) ((dLen * 100) / sLen));
 
-			for (idx = 0; (idx < kIOPreviewImageCount); idx++) 
-			{
-				if (map[idx]) map[idx]->release();
-			}
+			__private->saveFramebuffer = CompressDataStream( bits, kIOPreviewImageCount, bytesPerPixel, pixelBits,
+								__private->framebufferWidth, __private->framebufferHeight, rowBytes,
+								saveGammaChannelCount, saveGammaDataCount,
+								saveGammaDataWidth, saveGammaData,
+								!(kIOGDbgNoPreviewLineDedup & atomic_load(&gIOGDebugFlags)),
+								true, &skipOffset, &dLen, &allocLen);
+			if (fitGammaData) IODelete(fitGammaData, uint16_t, 3 * 256);
+		}
+		DEBG1(thisName, " compressed to %d%%\n", (int) ((dLen * 100) / sLen));
+
+		for (idx = 0; (idx < kIOPreviewImageCount); idx++) 
+		{
+			if (map[idx]) map[idx]->release();
+		}
 
+		if (__private->saveFramebuffer)
+		{
 			dLen = round_page( dLen );
-			if (__private->saveLength > dLen)
+			if (allocLen > dLen)
 			{
 				IOFreePageable( (void *) (((uintptr_t) __private->saveFramebuffer) + dLen),
-								__private->saveLength - dLen );
-				__private->saveLength = static_cast<uint32_t>(dLen);
+								allocLen - dLen );
 			}
+			__private->saveLength = static_cast<uint32_t>(dLen);
+			__private->saveSkipIndex = skipOffset
+				? (void *) (((uintptr_t) __private->saveFramebuffer) + skipOffset) : NULL;
+		}
 #else
-			if (fFrameBuffer) bcopy_nc( (void *) fFrameBuffer, __private->saveFramebuffer, sLen );
+		__private->saveLength = static_cast<uint32_t>(round_page(sLen));
+		__private->saveFramebuffer = IOMallocPageable( __private->saveLength, page_size );
+		if (!__private->saveFramebuffer)
+			__private->saveLength = 0;
+		else if (fFrameBuffer)
+			bcopy_nc( (void *) fFrameBuffer, __private->saveFramebuffer, sLen );
 #endif
+		if (__private->saveFramebuffer)
+		{
 			if (__private->saveLength)
 			{
 #if RLOG
@@ -6456,6 +6751,10 @@ IOReturn IOFramebuffer::restoreFramebuffer(IOIndex event)
             }
         }
 
+#if VRAM_COMPRESS
+		// Whatever is drawn now replaces the rest of an earlier restore
+		finishRestore(false);
+#endif
 		if (fFrameBuffer && (true == bPerformVRAMWrite))
 		{
             if (kIOScreenRestoreStateDark == restoreType)
@@ -6479,8 +6778,29 @@ IOReturn IOFramebuffer::restoreFramebuffer(IOIndex event)
 				uint32_t image = (kOSBooleanTrue == 
 					IORegistryEntry::getRegistryRoot()->getProperty(kIOConsoleLockedKey));
 				if (image >= kIOPreviewImageCount) image = 0;
-				DecompressData((UInt8 *) __private->saveFramebuffer, image, (UInt8 *) fFrameBuffer,
-								0, 0, __private->framebufferWidth, __private->framebufferHeight, rowBytes);
+
+				// The middle of the screen, where the login panel is, is
+				// painted now and the four rects around it from restoreTimer.
+				const SInt16 w = static_cast<SInt16>(__private->framebufferWidth);
+				const SInt16 h = static_cast<SInt16>(__private->framebufferHeight);
+				const IOGBounds first = { static_cast<SInt16>(w / 4), static_cast<SInt16>(w - w / 4),
+										  static_cast<SInt16>(h / 4), static_cast<SInt16>(h - h / 4) };
+				DecompressData((UInt8 *) __private->saveFramebuffer, __private->saveSkipIndex,
+								image, (UInt8 *) fFrameBuffer,
+								first.minx, first.miny, first.maxx - first.minx,
+								first.maxy - first.miny, rowBytes);
+
+				__private->restoreRects[0] = { 0, w, 0, first.miny };
+				__private->restoreRects[1] = { 0, first.minx, first.miny, first.maxy };
+				__private->restoreRects[2] = { first.maxx, w, first.miny, first.maxy };
+				__private->restoreRects[3] = { 0, w, first.maxy, h };
+				__private->restoreImage     = image;
+				__private->restoreRectNext  = 0;
+				__private->restoreRectCount = 4;
+				if (__private->restoreTimer)
+					__private->restoreTimer->setTimeoutUS(kIOFBRestoreDelayUS);
+				else
+					continueRestore(UINT32_MAX);
 	#else
 				bcopy_nc( __private->saveFramebuffer, (void *) fFrameBuffer, __private->saveLength );
 	#endif
@@ -6512,6 +6832,7 @@ IOReturn IOFramebuffer::restoreFramebuffer(IOIndex event)
           && !__private->transactionsEnabled)
 		{
 			DEBG1(thisName, " set gamma\n");
+            __private->gammaAppliedValid = false;
             FB_START(setGammaTable,0,__LINE__,0);
             IOG_KTRACE(DBG_IOG_SET_GAMMA_TABLE, DBG_FUNC_START,
                        0, __private->regID,
@@ -6532,6 +6853,71 @@ IOReturn IOFramebuffer::restoreFramebuffer(IOIndex event)
     return (ret);
 }
 
+#if VRAM_COMPRESS
+// Paints up to lineCount lines of the rects left by restoreFramebuffer(),
+// returns true once they are all done.
+bool IOFramebuffer::continueRestore(uint32_t lineCount)
+{
+    DecompressState * state = &__private->restoreState;
+    uint32_t          y;
+
+    while (lineCount)
+    {
+        if (!__private->restorePending)
+        {
+            if (__private->restoreRectNext >= __private->restoreRectCount)
+                break;
+            const IOGBounds & rect = __private->restoreRects[__private->restoreRectNext++];
+            __private->restorePending = DecompressDataBegin(state,
+                        (UInt8 *) __private->saveFramebuffer, __private->saveSkipIndex,
+                        __private->restoreImage, (UInt8 *) fFrameBuffer, rowBytes,
+                        rect.minx, rect.miny, rect.maxx - rect.minx, rect.maxy - rect.miny);
+            continue;
+        }
+        y = state->y;
+        if (DecompressDataContinue(state, lineCount))
+            __private->restorePending = false;
+        y = state->y - y;
+        lineCount = (y < lineCount) ? lineCount - y : 0;
+    }
+
+    return (!__private->restorePending
+         && (__private->restoreRectNext >= __private->restoreRectCount));
+}
+
+// Ends a lazy restore, painting what is left of it if paint is set.
+void IOFramebuffer::finishRestore(bool paint)
+{
+    if (!__private->restorePending
+     && (__private->restoreRectNext >= __private->restoreRectCount))
+        return;
+
+    IOFB_START(finishRestore,paint,0,0);
+    if (__private->restoreTimer)
+        __private->restoreTimer->cancelTimeout();
+    if (paint && fFrameBuffer && __private->saveFramebuffer)
+        continueRestore(UINT32_MAX);
+    __private->restorePending   = false;
+    __private->restoreRectNext  = 0;
+    __private->restoreRectCount = 0;
+    IOFB_END(finishRestore,0,0,0);
+}
+
+void IOFramebuffer::restoreTimer(OSObject * owner, IOTimerEventSource * sender)
+{
+    IOFB_START(restoreTimer,0,0,0);
+    IOFramebuffer * fb = (IOFramebuffer *) owner;
+
+    if (!fb->fFrameBuffer || !fb->__private->saveFramebuffer)
+        fb->finishRestore(false);
+    else if (!fb->continueRestore(kIOFBRestoreLines))
+        sender->setTimeoutUS(kIOFBRestoreDelayUS);
+    else
+        DEBG1(fb->thisName, " screen finished\n");
+    IOFB_END(restoreTimer,0,0,0);
+}
+#endif /* VRAM_COMPRESS */
+
 IOReturn IOFramebuffer::handleEvent( IOIndex event, void * info )
 {
     IOFB_START(handleEvent,event,0,0);
@@ -6646,11 +7032,16 @@ IOReturn IOFramebuffer::notifyServer(const uint8_t state)
                     getPMRootDomain()->removeProperty(kIOHibernatePreviewBufferKey);
                     getProvider()->removeProperty(kIOHibernatePreviewActiveKey);
                 }
+#if VRAM_COMPRESS
+                // The server draws next, leave it the whole preview
+                finishRestore(true);
+#endif
                 if (__private->saveFramebuffer && __private->saveLength)
                 {
                     IOFreePageable( __private->saveFramebuffer, __private->saveLength );
                 }
                 __private->saveFramebuffer = 0;
+                __private->saveSkipIndex   = 0;
                 __private->saveLength      = 0;
                 setProperty(kIOScreenRestoreStateKey,
                             &__private->restoreType, sizeof(__private->restoreType));
@@ -7269,6 +7660,26 @@ bool IOFramebuffer::copyDisplayConfig(IOFramebuffer *from)
               __private->hibernateGammaDataLen);
     }
 
+    if (from->__private->hibernateGammaFitLen != __private->hibernateGammaFitLen)
+    {
+        if (__private->hibernateGammaFitLen)
+        {
+            IODelete(__private->hibernateGammaFit, uint8_t, __private->hibernateGammaFitLen);
+        }
+        __private->hibernateGammaFit = from->__private->hibernateGammaFitLen
+            ? IONew(uint8_t, from->__private->hibernateGammaFitLen) : NULL;
+    }
+    if (NULL == __private->hibernateGammaFit)
+    {
+        __private->hibernateGammaFitLen = 0;
+    }
+    else
+    {
+        __private->hibernateGammaFitLen = from->__private->hibernateGammaFitLen;
+        bcopy(from->__private->hibernateGammaFit, __private->hibernateGammaFit,
+              __private->hibernateGammaFitLen);
+    }
+
     if (from->__private->rawGammaDataLen != __private->rawGammaDataLen)
     {
         if (__private->rawGammaDataLen)
@@ -7288,6 +7699,7 @@ bool IOFramebuffer::copyDisplayConfig(IOFramebuffer *from)
 
     bcopy(from->__private->rawGammaData, __private->rawGammaData,
             __private->rawGammaDataLen);
+    rawGammaChanged();
     IOFB_END(copyDisplayConfig,true,0,0);
     return true;
 }
@@ -7870,11 +8282,14 @@ void IOFramebuffer::displaysOnline(bool nowOnline)
 	__private->displaysOnline = nowOnline;
 
 	__private->actualVBLCount = 0;
+	IOFBVBLEstimateReset(&__private->vblEstimate);
     StdFBShmem_t * shmem = GetShmem(this);
 	if (shmem)
 	{
 		shmem->vblDrift         = 0;
 		shmem->vblDeltaMeasured = 0;
+		shmem->vblPeriod        = 0;
+		AbsoluteTime_to_scalar(&shmem->vblPhase) = 0;
 	}
 	if (nowOnline)
 	{
@@ -7992,6 +8407,7 @@ IOReturn IOFramebuffer::matchFramebuffer(void)
 		if (__private->rawGammaData)
 		{
 			TIMESTART();
+            __private->gammaAppliedValid = false;   // New mode, full table
             updateGammaTable(__private->rawGammaChannelCount,
                              __private->rawGammaDataCount,
                              __private->rawGammaDataWidth,
@@ -9304,6 +9720,11 @@ IOReturn IOFramebuffer::open( void )
                                                                     this, deferredSpeedChangeEvent);
         if (__private->deferredSpeedChangeEvent)
             getWorkLoop()->addEventSource(__private->deferredSpeedChangeEvent);
+#if VRAM_COMPRESS
+        __private->restoreTimer = IOTimerEventSource::timerEventSource(this, &restoreTimer);
+        if (__private->restoreTimer)
+            getWorkLoop()->addEventSource(__private->restoreTimer);
+#endif
         
         opened = true;
 
@@ -10315,6 +10736,7 @@ void IOFramebuffer::close( void )
                     UInt8 * gammaData = IONew(UInt8, __private->gammaDataLen);
                     if (NULL != gammaData) {
                         bzero(gammaData, sizeof(UInt8) * __private->gammaDataLen);
+                        __private->gammaAppliedValid = false;
 
                         IOG_KTRACE(DBG_IOG_SET_GAMMA_TABLE, DBG_FUNC_START,
                                    0, __private->regID,
@@ -10617,6 +11039,14 @@ void IOFramebuffer::setVBLTiming(void)
     IOFB_START(setVBLTiming,0,0,0);
     StdFBShmem_t * shmem = GetShmem(this);
 
+	// a new timing, the estimate starts again from the next VBL
+	IOFBVBLEstimateReset(&__private->vblEstimate);
+	if (shmem)
+	{
+		shmem->vblPeriod = 0;
+		AbsoluteTime_to_scalar(&shmem->vblPhase) = 0;
+	}
+
 	if (kIODetailedTimingValid & __private->timingInfo.flags)
 	{
 		uint64_t count = ((uint64_t)(__private->timingInfo.detailedInfo.v2.horizontalActive
@@ -10753,6 +11183,9 @@ IOReturn IOFramebuffer::doSetup( const bool full )
     {
         const auto apertureLen = __private->pixelInfo.bytesPerRow
                                * __private->pixelInfo.activeHeight;
+#if VRAM_COMPRESS
+        finishRestore(false);
+#endif
         OSSafeReleaseNULL(fVramMap);
         fFrameBuffer = NULL;
         fbRange = getApertureRangeWithLength(kIOFBSystemAperture, apertureLen);
@@ -12290,6 +12723,7 @@ IONotifier * IOFramebuffer::addFramebufferNotificationWithOptions(IOFramebufferN
                     notify->fEnable = true;
 
                     // Success
+                    IOFB_END(addFramebufferNotificationWithOptions,0,__LINE__,0);
                     return (notify);
 
                 } while(0);
@@ -12318,7 +12752,7 @@ IONotifier * IOFramebuffer::addFramebufferNotificationWithOptions(IOFramebufferN
 
 IOReturn IOFramebuffer::deliverFramebufferNotification( IOIndex event, void * info )
 {
-    IOFB_START(addFramebufferNotification,event,0,0);
+    IOFB_START(deliverFramebufferNotification,event,0,0);
     IOReturn    ret = kIOReturnSuccess;
     IOSelect    eventMask = 0;
     IOSelect    groupIndex = 0;
@@ -12326,6 +12760,8 @@ IOReturn IOFramebuffer::deliverFramebufferNotification( IOIndex event, void * in
     LOCKNOTIFY();
     __private->fNotificationActive = 1;
     __private->fNotificationGroup = 0;
+    // Modes, power and online changes can all reload the hardware gamma
+    __private->gammaAppliedValid = false;
 
 #if RLOG1
     const auto startTime = mach_absolute_time();
@@ -12895,6 +13331,16 @@ IOReturn IOFramebuffer::setGammaTable( UInt32 /* channelCount */,
     return (kIOReturnUnsupported);
 }
 
+IOReturn IOFramebuffer::setGammaTableRanges( UInt32 /* channelCount */,
+                                             UInt32 /* dataCount */, UInt32 /* dataWidth */, void * /* data */,
+                                             const IOGammaRange * /* ranges */, UInt32 /* rangeCount */,
+                                             bool /* syncToVBL */)
+{
+    IOFB_START(setGammaTableRanges,0,0,0);
+    IOFB_END(setGammaTableRanges,kIOReturnUnsupported,0,0);
+    return (kIOReturnUnsupported);
+}
+
 
 //// Display mode timing information
 
@@ -15350,8 +15796,8 @@ IOReturn IOFramebufferI2CInterface::create( IOFramebuffer * framebuffer, const c
 OSMetaClassDefineReservedUsed(IOFramebuffer, 0);
 OSMetaClassDefineReservedUsed(IOFramebuffer, 1);
 OSMetaClassDefineReservedUsed(IOFramebuffer, 2);
+OSMetaClassDefineReservedUsed(IOFramebuffer, 3);
 
-OSMetaClassDefineReservedUnused(IOFramebuffer, 3);
 OSMetaClassDefineReservedUnused(IOFramebuffer, 4);
 OSMetaClassDefineReservedUnused(IOFramebuffer, 5);
 OSMetaClassDefineReservedUnused(IOFramebuffer, 6);
@@ -14,6 +14,11 @@
 #define IOGRAPHICS_MAXIMUM_REPORTS              16
 #define IOGRAPHICS_MAXIMUM_FBS                  96
 
+#define IOGRAPHICS_LATENCY_VERSION              1
+#define IOGRAPHICS_LATENCY_BUCKETS              24
+#define IOGRAPHICS_LATENCY_BUCKET_SHIFT         10
+#define IOGRAPHICS_LATENCY_FUNCTIONS            64
+
 
 
 // stateBits
@@ -134,6 +139,33 @@ typedef struct IOGDiagnose {
 
     IOGReport       fbState[IOGRAPHICS_MAXIMUM_FBS];
 } IOGDiagnose;
+
+// Durations of one Ariadne START/END traced function, in mach absolute time.
+// buckets[0] counts durations < 2^IOGRAPHICS_LATENCY_BUCKET_SHIFT, buckets[i]
+// counts [2^(shift + i - 1), 2^(shift + i)) and the last bucket also counts
+// everything longer.
+typedef struct IOGLatency {
+    uint16_t        classID;        // *_TELEMETRY_START of the function
+    uint16_t        functionID;     // *_FID_* of the function
+    uint32_t        _reservedA;
+    uint64_t        count;
+    uint64_t        total;
+    uint32_t        buckets[IOGRAPHICS_LATENCY_BUCKETS];
+} IOGLatency;
+
+// Kernel to User, only functions that completed at least once are reported.
+// copiedCount < functionCount if the buffer was too short.
+typedef struct IOGLatencyReport {
+    uint64_t        version;
+    uint32_t        functionCount;
+    uint32_t        copiedCount;
+    uint32_t        droppedStarts;  // No room to remember a START
+    uint32_t        unpairedEnds;   // END without a START on the same thread
+    uint32_t        staleStarts;    // START left without END, taken over
+    uint32_t        untrackedEnds;  // IOGRAPHICS_LATENCY_FUNCTIONS were taken
+
+    IOGLatency      functions[];
+} IOGLatencyReport;
 #pragma pack(pop)
 
 
@@ -588,6 +588,10 @@ extern uint32_t gIOGATFlags;
 #define IOFB_FID_extSetHibernateGammaTable              248
 // 249 unused since Dec 2018
 #define IOFB_FID_clamshellOfflineShouldChange           250
+#define IOFB_FID_StdFBMoveCursor                        251
+#define IOFB_FID_setGammaTableRanges                    252
+#define IOFB_FID_finishRestore                          253
+#define IOFB_FID_restoreTimer                           254
 
 // IOFramebufferParameterHandler
 #define IOFBPH_FID_reserved                             0
@@ -643,6 +647,7 @@ extern uint32_t gIOGATFlags;
 #define FB_FID_doI2CRequest                             41
 #define FB_FID_diagnoseReport                           42
 #define FB_FID_setGammaTable2                           43
+#define FB_FID_setGammaTableRanges                      44
 // AppleBackLight
 #define ABL_FID_reserved                                0
 #define ABL_FID_probe                                   1
@@ -867,6 +872,10 @@ extern uint32_t gIOGATFlags;
 #define IOAUC_FID_extCreate                             7
 #define IOAUC_FID_extDestroy                            8
 
+// START/END pairs also feed the per function latency histograms, see
+// GLatencyRecorder. Off unless booted with iog=0x40000.
+#include "GMetric.hpp"
+
 // Telemetry Macros
 /*
  Macro Parameters are:
@@ -877,72 +886,72 @@ extern uint32_t gIOGATFlags;
  param 5: Implementation specific.
  */
 // IODisplayWrangler
-#define IODW_START(_fID_,args...)                       do{if(gIOGATFlags&TRACE_IODISPLAYWRANGLER){KERNEL_DEBUG_CONSTANT_RELEASE(IODISPLAYWRANGLER_ARIADNE_START,MAKE_FID_DEFINE(IODW,_fID_),## args,0);}}while(0)
-#define IODW_END(_fID_,args...)                         do{if(gIOGATFlags&TRACE_IODISPLAYWRANGLER){KERNEL_DEBUG_CONSTANT_RELEASE(IODISPLAYWRANGLER_ARIADNE_END,MAKE_FID_DEFINE(IODW,_fID_),## args,0);}}while(0)
+#define IODW_START(_fID_,args...)                       do{GMETRIC_LATENCY_START(IODISPLAYWRANGLER_TELEMETRY_START,MAKE_FID_DEFINE(IODW,_fID_));if(gIOGATFlags&TRACE_IODISPLAYWRANGLER){KERNEL_DEBUG_CONSTANT_RELEASE(IODISPLAYWRANGLER_ARIADNE_START,MAKE_FID_DEFINE(IODW,_fID_),## args,0);}}while(0)
+#define IODW_END(_fID_,args...)                         do{GMETRIC_LATENCY_END(IODISPLAYWRANGLER_TELEMETRY_START,MAKE_FID_DEFINE(IODW,_fID_));if(gIOGATFlags&TRACE_IODISPLAYWRANGLER){KERNEL_DEBUG_CONSTANT_RELEASE(IODISPLAYWRANGLER_ARIADNE_END,MAKE_FID_DEFINE(IODW,_fID_),## args,0);}}while(0)
 
 // IODisplay
-#define IOD_START(_fID_,args...)                        do{if(gIOGATFlags&TRACE_IODISPLAY){KERNEL_DEBUG_CONSTANT_RELEASE(IODISPLAY_ARIADNE_START,MAKE_FID_DEFINE(IOD,_fID_),## args,0);}}while(0)
-#define IOD_END(_fID_,args...)                          do{if(gIOGATFlags&TRACE_IODISPLAY){KERNEL_DEBUG_CONSTANT_RELEASE(IODISPLAY_ARIADNE_END,MAKE_FID_DEFINE(IOD,_fID_),## args,0);}}while(0)
+#define IOD_START(_fID_,args...)                        do{GMETRIC_LATENCY_START(IODISPLAY_TELEMETRY_START,MAKE_FID_DEFINE(IOD,_fID_));if(gIOGATFlags&TRACE_IODISPLAY){KERNEL_DEBUG_CONSTANT_RELEASE(IODISPLAY_ARIADNE_START,MAKE_FID_DEFINE(IOD,_fID_),## args,0);}}while(0)
+#define IOD_END(_fID_,args...)                          do{GMETRIC_LATENCY_END(IODISPLAY_TELEMETRY_START,MAKE_FID_DEFINE(IOD,_fID_));if(gIOGATFlags&TRACE_IODISPLAY){KERNEL_DEBUG_CONSTANT_RELEASE(IODISPLAY_ARIADNE_END,MAKE_FID_DEFINE(IOD,_fID_),## args,0);}}while(0)
 
 // IODisplayConnect
-#define IODC_START(_fID_,args...)                       do{if(gIOGATFlags&TRACE_IODISPLAYCONNECT){KERNEL_DEBUG_CONSTANT_RELEASE(IODISPLAYCONNECT_ARIADNE_START,MAKE_FID_DEFINE(IODC,_fID_),## args,0);}}while(0)
-#define IODC_END(_fID_,args...)                         do{if(gIOGATFlags&TRACE_IODISPLAYCONNECT){KERNEL_DEBUG_CONSTANT_RELEASE(IODISPLAYCONNECT_ARIADNE_END,MAKE_FID_DEFINE(IODC,_fID_),## args,0);}}while(0)
+#define IODC_START(_fID_,args...)                       do{GMETRIC_LATENCY_START(IODISPLAYCONNECT_TELEMETRY_START,MAKE_FID_DEFINE(IODC,_fID_));if(gIOGATFlags&TRACE_IODISPLAYCONNECT){KERNEL_DEBUG_CONSTANT_RELEASE(IODISPLAYCONNECT_ARIADNE_START,MAKE_FID_DEFINE(IODC,_fID_),## args,0);}}while(0)
+#define IODC_END(_fID_,args...)                         do{GMETRIC_LATENCY_END(IODISPLAYCONNECT_TELEMETRY_START,MAKE_FID_DEFINE(IODC,_fID_));if(gIOGATFlags&TRACE_IODISPLAYCONNECT){KERNEL_DEBUG_CONSTANT_RELEASE(IODISPLAYCONNECT_ARIADNE_END,MAKE_FID_DEFINE(IODC,_fID_),## args,0);}}while(0)
 
 // IOFBController
-#define IOFBC_START(_fID_,args...)                      do{if(gIOGATFlags&TRACE_IOFBCONTROLLER){KERNEL_DEBUG_CONSTANT_RELEASE(IOFBCONTROLLER_ARIADNE_START,MAKE_FID_DEFINE(IOFBC,_fID_),## args,0);}}while(0)
-#define IOFBC_END(_fID_,args...)                        do{if(gIOGATFlags&TRACE_IOFBCONTROLLER){KERNEL_DEBUG_CONSTANT_RELEASE(IOFBCONTROLLER_ARIADNE_END,MAKE_FID_DEFINE(IOFBC,_fID_),## args,0);}}while(0)
+#define IOFBC_START(_fID_,args...)                      do{GMETRIC_LATENCY_START(IOFBCONTROLLER_TELEMETRY_START,MAKE_FID_DEFINE(IOFBC,_fID_));if(gIOGATFlags&TRACE_IOFBCONTROLLER){KERNEL_DEBUG_CONSTANT_RELEASE(IOFBCONTROLLER_ARIADNE_START,MAKE_FID_DEFINE(IOFBC,_fID_),## args,0);}}while(0)
+#define IOFBC_END(_fID_,args...)                        do{GMETRIC_LATENCY_END(IOFBCONTROLLER_TELEMETRY_START,MAKE_FID_DEFINE(IOFBC,_fID_));if(gIOGATFlags&TRACE_IOFBCONTROLLER){KERNEL_DEBUG_CONSTANT_RELEASE(IOFBCONTROLLER_ARIADNE_END,MAKE_FID_DEFINE(IOFBC,_fID_),## args,0);}}while(0)
 
 // IOFramebuffer
-#define IOFB_START(_fID_,args...)                       do{if(gIOGATFlags&TRACE_IOFRAMEBUFFER){KERNEL_DEBUG_CONSTANT_RELEASE(IOFRAMEBUFFER_ARIADNE_START,MAKE_FID_DEFINE(IOFB,_fID_),## args,0);}}while(0)
-#define IOFB_END(_fID_,args...)                         do{if(gIOGATFlags&TRACE_IOFRAMEBUFFER){KERNEL_DEBUG_CONSTANT_RELEASE(IOFRAMEBUFFER_ARIADNE_END,MAKE_FID_DEFINE(IOFB,_fID_),## args,0);}}while(0)
+#define IOFB_START(_fID_,args...)                       do{GMETRIC_LATENCY_START(IOFRAMEBUFFER_TELEMETRY_START,MAKE_FID_DEFINE(IOFB,_fID_));if(gIOGATFlags&TRACE_IOFRAMEBUFFER){KERNEL_DEBUG_CONSTANT_RELEASE(IOFRAMEBUFFER_ARIADNE_START,MAKE_FID_DEFINE(IOFB,_fID_),## args,0);}}while(0)
+#define IOFB_END(_fID_,args...)                         do{GMETRIC_LATENCY_END(IOFRAMEBUFFER_TELEMETRY_START,MAKE_FID_DEFINE(IOFB,_fID_));if(gIOGATFlags&TRACE_IOFRAMEBUFFER){KERNEL_DEBUG_CONSTANT_RELEASE(IOFRAMEBUFFER_ARIADNE_END,MAKE_FID_DEFINE(IOFB,_fID_),## args,0);}}while(0)
 
 // IOFramebufferParameterHandler
-#define IOFBPH_START(_fID_,args...)                     do{if(gIOGATFlags&TRACE_IOFRAMEBUFFERPARAMETERHANDLER){KERNEL_DEBUG_CONSTANT_RELEASE(IOFRAMEBUFFERPARAMETERHANDLER_ARIADNE_START,MAKE_FID_DEFINE(IOFBPH,_fID_),## args,0);}}while(0)
-#define IOFBPH_END(_fID_,args...)                       do{if(gIOGATFlags&TRACE_IOFRAMEBUFFERPARAMETERHANDLER){KERNEL_DEBUG_CONSTANT_RELEASE(IOFRAMEBUFFERPARAMETERHANDLER_ARIADNE_END,MAKE_FID_DEFINE(IOFBPH,_fID_),## args,0);}}while(0)
+#define IOFBPH_START(_fID_,args...)                     do{GMETRIC_LATENCY_START(IOFRAMEBUFFERPARAMETERHANDLER_TELEMETRY_START,MAKE_FID_DEFINE(IOFBPH,_fID_));if(gIOGATFlags&TRACE_IOFRAMEBUFFERPARAMETERHANDLER){KERNEL_DEBUG_CONSTANT_RELEASE(IOFRAMEBUFFERPARAMETERHANDLER_ARIADNE_START,MAKE_FID_DEFINE(IOFBPH,_fID_),## args,0);}}while(0)
+#define IOFBPH_END(_fID_,args...)                       do{GMETRIC_LATENCY_END(IOFRAMEBUFFERPARAMETERHANDLER_TELEMETRY_START,MAKE_FID_DEFINE(IOFBPH,_fID_));if(gIOGATFlags&TRACE_IOFRAMEBUFFERPARAMETERHANDLER){KERNEL_DEBUG_CONSTANT_RELEASE(IOFRAMEBUFFERPARAMETERHANDLER_ARIADNE_END,MAKE_FID_DEFINE(IOFBPH,_fID_),## args,0);}}while(0)
 
 // Vendor framebuffer
-#define FB_START(_fID_,args...)                         do{if(gIOGATFlags&TRACE_FRAMEBUFFER){KERNEL_DEBUG_CONSTANT_RELEASE(FRAMEBUFFER_ARIADNE_START,MAKE_FID_DEFINE(FB,_fID_),## args,0);}}while(0)
-#define FB_END(_fID_,args...)                           do{if(gIOGATFlags&TRACE_FRAMEBUFFER){KERNEL_DEBUG_CONSTANT_RELEASE(FRAMEBUFFER_ARIADNE_END,MAKE_FID_DEFINE(FB,_fID_),## args,0);}}while(0)
+#define FB_START(_fID_,args...)                         do{GMETRIC_LATENCY_START(FRAMEBUFFER_TELEMETRY_START,MAKE_FID_DEFINE(FB,_fID_));if(gIOGATFlags&TRACE_FRAMEBUFFER){KERNEL_DEBUG_CONSTANT_RELEASE(FRAMEBUFFER_ARIADNE_START,MAKE_FID_DEFINE(FB,_fID_),## args,0);}}while(0)
+#define FB_END(_fID_,args...)                           do{GMETRIC_LATENCY_END(FRAMEBUFFER_TELEMETRY_START,MAKE_FID_DEFINE(FB,_fID_));if(gIOGATFlags&TRACE_FRAMEBUFFER){KERNEL_DEBUG_CONSTANT_RELEASE(FRAMEBUFFER_ARIADNE_END,MAKE_FID_DEFINE(FB,_fID_),## args,0);}}while(0)
 
 // AppleBackLight
-#define ABL_START(_fID_,args...)                        do{if(gIOGATFlags&TRACE_APPLEBACKLIGHT){KERNEL_DEBUG_CONSTANT_RELEASE(APPLEBACKLIGHT_ARIADNE_START,MAKE_FID_DEFINE(ABL,_fID_),## args,0);}}while(0)
-#define ABL_END(_fID_,args...)                          do{if(gIOGATFlags&TRACE_APPLEBACKLIGHT){KERNEL_DEBUG_CONSTANT_RELEASE(APPLEBACKLIGHT_ARIADNE_END,MAKE_FID_DEFINE(ABL,_fID_),## args,0);}}while(0)
+#define ABL_START(_fID_,args...)                        do{GMETRIC_LATENCY_START(APPLEBACKLIGHT_TELEMETRY_START,MAKE_FID_DEFINE(ABL,_fID_));if(gIOGATFlags&TRACE_APPLEBACKLIGHT){KERNEL_DEBUG_CONSTANT_RELEASE(APPLEBACKLIGHT_ARIADNE_START,MAKE_FID_DEFINE(ABL,_fID_),## args,0);}}while(0)
+#define ABL_END(_fID_,args...)                          do{GMETRIC_LATENCY_END(APPLEBACKLIGHT_TELEMETRY_START,MAKE_FID_DEFINE(ABL,_fID_));if(gIOGATFlags&TRACE_APPLEBACKLIGHT){KERNEL_DEBUG_CONSTANT_RELEASE(APPLEBACKLIGHT_ARIADNE_END,MAKE_FID_DEFINE(ABL,_fID_),## args,0);}}while(0)
 
 // IOFramebufferUserClient
-#define IOFBUC_START(_fID_,args...)                     do{if(gIOGATFlags&TRACE_IOFBUSERCLIENT){KERNEL_DEBUG_CONSTANT_RELEASE(IOFBUSERCLIENT_ARIADNE_START,MAKE_FID_DEFINE(IOFBUC,_fID_),## args,0);}}while(0)
-#define IOFBUC_END(_fID_,args...)                       do{if(gIOGATFlags&TRACE_IOFBUSERCLIENT){KERNEL_DEBUG_CONSTANT_RELEASE(IOFBUSERCLIENT_ARIADNE_END,MAKE_FID_DEFINE(IOFBUC,_fID_),## args,0);}}while(0)
+#define IOFBUC_START(_fID_,args...)                     do{GMETRIC_LATENCY_START(IOFBUSERCLIENT_TELEMETRY_START,MAKE_FID_DEFINE(IOFBUC,_fID_));if(gIOGATFlags&TRACE_IOFBUSERCLIENT){KERNEL_DEBUG_CONSTANT_RELEASE(IOFBUSERCLIENT_ARIADNE_START,MAKE_FID_DEFINE(IOFBUC,_fID_),## args,0);}}while(0)
+#define IOFBUC_END(_fID_,args...)                       do{GMETRIC_LATENCY_END(IOFBUSERCLIENT_TELEMETRY_START,MAKE_FID_DEFINE(IOFBUC,_fID_));if(gIOGATFlags&TRACE_IOFBUSERCLIENT){KERNEL_DEBUG_CONSTANT_RELEASE(IOFBUSERCLIENT_ARIADNE_END,MAKE_FID_DEFINE(IOFBUC,_fID_),## args,0);}}while(0)
 
 // IOFramebufferSharedUserClient
-#define IOFBSUC_START(_fID_,args...)                    do{if(gIOGATFlags&TRACE_IOFBSHAREDUSERCLIENT){KERNEL_DEBUG_CONSTANT_RELEASE(IOFBSHAREDUSERCLIENT_ARIADNE_START,MAKE_FID_DEFINE(IOFBSUC,_fID_),## args,0);}}while(0)
-#define IOFBSUC_END(_fID_,args...)                      do{if(gIOGATFlags&TRACE_IOFBSHAREDUSERCLIENT){KERNEL_DEBUG_CONSTANT_RELEASE(IOFBSHAREDUSERCLIENT_ARIADNE_END,MAKE_FID_DEFINE(IOFBSUC,_fID_),## args,0);}}while(0)
+#define IOFBSUC_START(_fID_,args...)                    do{GMETRIC_LATENCY_START(IOFBSHAREDUSERCLIENT_TELEMETRY_START,MAKE_FID_DEFINE(IOFBSUC,_fID_));if(gIOGATFlags&TRACE_IOFBSHAREDUSERCLIENT){KERNEL_DEBUG_CONSTANT_RELEASE(IOFBSHAREDUSERCLIENT_ARIADNE_START,MAKE_FID_DEFINE(IOFBSUC,_fID_),## args,0);}}while(0)
+#define IOFBSUC_END(_fID_,args...)                      do{GMETRIC_LATENCY_END(IOFBSHAREDUSERCLIENT_TELEMETRY_START,MAKE_FID_DEFINE(IOFBSUC,_fID_));if(gIOGATFlags&TRACE_IOFBSHAREDUSERCLIENT){KERNEL_DEBUG_CONSTANT_RELEASE(IOFBSHAREDUSERCLIENT_ARIADNE_END,MAKE_FID_DEFINE(IOFBSUC,_fID_),## args,0);}}while(0)
 
 // IOFramebufferDiagnosticUserClient
-#define IOGDUC_START(_fID_,args...)                    do{if(gIOGATFlags&TRACE_IOGDIAGNOSTICUSERCLIENT){KERNEL_DEBUG_CONSTANT_RELEASE(IOGDIAGNOSTICUSERCLIENT_ARIADNE_START,MAKE_FID_DEFINE(IOGDUC,_fID_),## args,0);}}while(0)
-#define IOGDUC_END(_fID_,args...)                      do{if(gIOGATFlags&TRACE_IOGDIAGNOSTICUSERCLIENT){KERNEL_DEBUG_CONSTANT_RELEASE(IOGDIAGNOSTICUSERCLIENT_ARIADNE_END,MAKE_FID_DEFINE(IOGDUC,_fID_),## args,0);}}while(0)
+#define IOGDUC_START(_fID_,args...)                    do{GMETRIC_LATENCY_START(IOGDIAGNOSTICUSERCLIENT_TELEMETRY_START,MAKE_FID_DEFINE(IOGDUC,_fID_));if(gIOGATFlags&TRACE_IOGDIAGNOSTICUSERCLIENT){KERNEL_DEBUG_CONSTANT_RELEASE(IOGDIAGNOSTICUSERCLIENT_ARIADNE_START,MAKE_FID_DEFINE(IOGDUC,_fID_),## args,0);}}while(0)
+#define IOGDUC_END(_fID_,args...)                      do{GMETRIC_LATENCY_END(IOGDIAGNOSTICUSERCLIENT_TELEMETRY_START,MAKE_FID_DEFINE(IOGDUC,_fID_));if(gIOGATFlags&TRACE_IOGDIAGNOSTICUSERCLIENT){KERNEL_DEBUG_CONSTANT_RELEASE(IOGDIAGNOSTICUSERCLIENT_ARIADNE_END,MAKE_FID_DEFINE(IOGDUC,_fID_),## args,0);}}while(0)
 
 // IOI2CInterfaceUserClient
-#define IOI2CUC_START(_fID_,args...)                    do{if(gIOGATFlags&TRACE_IOI2INTERFACEUSERCLIENT){KERNEL_DEBUG_CONSTANT_RELEASE(IOI2INTERFACEUSERCLIENT_ARIADNE_START,MAKE_FID_DEFINE(IOI2CUC,_fID_),## args,0);}}while(0)
-#define IOI2CUC_END(_fID_,args...)                      do{if(gIOGATFlags&TRACE_IOI2INTERFACEUSERCLIENT){KERNEL_DEBUG_CONSTANT_RELEASE(IOI2INTERFACEUSERCLIENT_ARIADNE_END,MAKE_FID_DEFINE(IOI2CUC,_fID_),## args,0);}}while(0)
+#define IOI2CUC_START(_fID_,args...)                    do{GMETRIC_LATENCY_START(IOI2INTERFACEUSERCLIENT_TELEMETRY_START,MAKE_FID_DEFINE(IOI2CUC,_fID_));if(gIOGATFlags&TRACE_IOI2INTERFACEUSERCLIENT){KERNEL_DEBUG_CONSTANT_RELEASE(IOI2INTERFACEUSERCLIENT_ARIADNE_START,MAKE_FID_DEFINE(IOI2CUC,_fID_),## args,0);}}while(0)
+#define IOI2CUC_END(_fID_,args...)                      do{GMETRIC_LATENCY_END(IOI2INTERFACEUSERCLIENT_TELEMETRY_START,MAKE_FID_DEFINE(IOI2CUC,_fID_));if(gIOGATFlags&TRACE_IOI2INTERFACEUSERCLIENT){KERNEL_DEBUG_CONSTANT_RELEASE(IOI2INTERFACEUSERCLIENT_ARIADNE_END,MAKE_FID_DEFINE(IOI2CUC,_fID_),## args,0);}}while(0)
 
 // IOI2CInterface
-#define IOI2C_START(_fID_,args...)                      do{if(gIOGATFlags&TRACE_IOI2INTERFACE){KERNEL_DEBUG_CONSTANT_RELEASE(IOI2INTERFACE_ARIADNE_START,MAKE_FID_DEFINE(IOI2C,_fID_),## args,0);}}while(0)
-#define IOI2C_END(_fID_,args...)                        do{if(gIOGATFlags&TRACE_IOI2INTERFACE){KERNEL_DEBUG_CONSTANT_RELEASE(IOI2INTERFACE_ARIADNE_END,MAKE_FID_DEFINE(IOI2C,_fID_),## args,0);}}while(0)
+#define IOI2C_START(_fID_,args...)                      do{GMETRIC_LATENCY_START(IOI2INTERFACE_TELEMETRY_START,MAKE_FID_DEFINE(IOI2C,_fID_));if(gIOGATFlags&TRACE_IOI2INTERFACE){KERNEL_DEBUG_CONSTANT_RELEASE(IOI2INTERFACE_ARIADNE_START,MAKE_FID_DEFINE(IOI2C,_fID_),## args,0);}}while(0)
+#define IOI2C_END(_fID_,args...)                        do{GMETRIC_LATENCY_END(IOI2INTERFACE_TELEMETRY_START,MAKE_FID_DEFINE(IOI2C,_fID_));if(gIOGATFlags&TRACE_IOI2INTERFACE){KERNEL_DEBUG_CONSTANT_RELEASE(IOI2INTERFACE_ARIADNE_END,MAKE_FID_DEFINE(IOI2C,_fID_),## args,0);}}while(0)
 
 // IOFramebufferI2CInterface
-#define IOFBI2C_START(_fID_,args...)                    do{if(gIOGATFlags&TRACE_IOFBI2INTERFACE){KERNEL_DEBUG_CONSTANT_RELEASE(IOFBI2INTERFACE_ARIADNE_START,MAKE_FID_DEFINE(IOFBI2C,_fID_),## args,0);}}while(0)
-#define IOFBI2C_END(_fID_,args...)                      do{if(gIOGATFlags&TRACE_IOFBI2INTERFACE){KERNEL_DEBUG_CONSTANT_RELEASE(IOFBI2INTERFACE_ARIADNE_END,MAKE_FID_DEFINE(IOFBI2C,_fID_),## args,0);}}while(0)
+#define IOFBI2C_START(_fID_,args...)                    do{GMETRIC_LATENCY_START(IOFBI2INTERFACE_TELEMETRY_START,MAKE_FID_DEFINE(IOFBI2C,_fID_));if(gIOGATFlags&TRACE_IOFBI2INTERFACE){KERNEL_DEBUG_CONSTANT_RELEASE(IOFBI2INTERFACE_ARIADNE_START,MAKE_FID_DEFINE(IOFBI2C,_fID_),## args,0);}}while(0)
+#define IOFBI2C_END(_fID_,args...)                      do{GMETRIC_LATENCY_END(IOFBI2INTERFACE_TELEMETRY_START,MAKE_FID_DEFINE(IOFBI2C,_fID_));if(gIOGATFlags&TRACE_IOFBI2INTERFACE){KERNEL_DEBUG_CONSTANT_RELEASE(IOFBI2INTERFACE_ARIADNE_END,MAKE_FID_DEFINE(IOFBI2C,_fID_),## args,0);}}while(0)
 
 // IOBootFramebuffer
-#define IOBFB_START(_fID_,args...)                      do{if(gIOGATFlags&TRACE_IOBOOTFRAMEBUFFER){KERNEL_DEBUG_CONSTANT_RELEASE(IOBOOTFRAMEBUFFER_ARIADNE_START,MAKE_FID_DEFINE(IOBFB,_fID_),## args,0);}}while(0)
-#define IOBFB_END(_fID_,args...)                        do{if(gIOGATFlags&TRACE_IOBOOTFRAMEBUFFER){KERNEL_DEBUG_CONSTANT_RELEASE(IOBOOTFRAMEBUFFER_ARIADNE_END,MAKE_FID_DEFINE(IOBFB,_fID_),## args,0);}}while(0)
+#define IOBFB_START(_fID_,args...)                      do{GMETRIC_LATENCY_START(IOBOOTFRAMEBUFFER_TELEMETRY_START,MAKE_FID_DEFINE(IOBFB,_fID_));if(gIOGATFlags&TRACE_IOBOOTFRAMEBUFFER){KERNEL_DEBUG_CONSTANT_RELEASE(IOBOOTFRAMEBUFFER_ARIADNE_START,MAKE_FID_DEFINE(IOBFB,_fID_),## args,0);}}while(0)
+#define IOBFB_END(_fID_,args...)                        do{GMETRIC_LATENCY_END(IOBOOTFRAMEBUFFER_TELEMETRY_START,MAKE_FID_DEFINE(IOBFB,_fID_));if(gIOGATFlags&TRACE_IOBOOTFRAMEBUFFER){KERNEL_DEBUG_CONSTANT_RELEASE(IOBOOTFRAMEBUFFER_ARIADNE_END,MAKE_FID_DEFINE(IOBFB,_fID_),## args,0);}}while(0)
 
 // IOAccelerator
-#define IOA_START(_fID_,args...)                        do{if(gIOGATFlags&TRACE_IOACCELERATOR){KERNEL_DEBUG_CONSTANT_RELEASE(IOACCELERATOR_ARIADNE_START,MAKE_FID_DEFINE(IOA,_fID_),## args,0);}}while(0)
-#define IOA_END(_fID_,args...)                          do{if(gIOGATFlags&TRACE_IOACCELERATOR){KERNEL_DEBUG_CONSTANT_RELEASE(IOACCELERATOR_ARIADNE_END,MAKE_FID_DEFINE(IOA,_fID_),## args,0);}}while(0)
+#define IOA_START(_fID_,args...)                        do{GMETRIC_LATENCY_START(IOACCELERATOR_TELEMETRY_START,MAKE_FID_DEFINE(IOA,_fID_));if(gIOGATFlags&TRACE_IOACCELERATOR){KERNEL_DEBUG_CONSTANT_RELEASE(IOACCELERATOR_ARIADNE_START,MAKE_FID_DEFINE(IOA,_fID_),## args,0);}}while(0)
+#define IOA_END(_fID_,args...)                          do{GMETRIC_LATENCY_END(IOACCELERATOR_TELEMETRY_START,MAKE_FID_DEFINE(IOA,_fID_));if(gIOGATFlags&TRACE_IOACCELERATOR){KERNEL_DEBUG_CONSTANT_RELEASE(IOACCELERATOR_ARIADNE_END,MAKE_FID_DEFINE(IOA,_fID_),## args,0);}}while(0)
 
 // IOAcceleratorUserClient
-#define IOAUC_START(_fID_,args...)                      do{if(gIOGATFlags&TRACE_IOACCELERATORUSERCLIENT){KERNEL_DEBUG_CONSTANT_RELEASE(IOACCELERATORUSERCLIENT_ARIADNE_START,MAKE_FID_DEFINE(IOAUC,_fID_),## args,0);}}while(0)
-#define IOAUC_END(_fID_,args...)                        do{if(gIOGATFlags&TRACE_IOACCELERATORUSERCLIENT){KERNEL_DEBUG_CONSTANT_RELEASE(IOACCELERATORUSERCLIENT_ARIADNE_END,MAKE_FID_DEFINE(IOAUC,_fID_),## args,0);}}while(0)
+#define IOAUC_START(_fID_,args...)                      do{GMETRIC_LATENCY_START(IOACCELERATORUSERCLIENT_TELEMETRY_START,MAKE_FID_DEFINE(IOAUC,_fID_));if(gIOGATFlags&TRACE_IOACCELERATORUSERCLIENT){KERNEL_DEBUG_CONSTANT_RELEASE(IOACCELERATORUSERCLIENT_ARIADNE_START,MAKE_FID_DEFINE(IOAUC,_fID_),## args,0);}}while(0)
+#define IOAUC_END(_fID_,args...)                        do{GMETRIC_LATENCY_END(IOACCELERATORUSERCLIENT_TELEMETRY_START,MAKE_FID_DEFINE(IOAUC,_fID_));if(gIOGATFlags&TRACE_IOACCELERATORUSERCLIENT){KERNEL_DEBUG_CONSTANT_RELEASE(IOACCELERATORUSERCLIENT_ARIADNE_END,MAKE_FID_DEFINE(IOAUC,_fID_),## args,0);}}while(0)
 
 
 #if ENABLE_IONDRV_TELEMETRY
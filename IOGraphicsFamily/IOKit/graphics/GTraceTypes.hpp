@@ -11,7 +11,9 @@
 #define GTraceTypes_hpp
 
 #include <stdint.h>
+#if __APPLE__
 #include <os/base.h>
+#endif // Offline decoders, GTrace/Decoder, also build on other hosts
 
 #include <string.h>
 
@@ -19,6 +21,14 @@
 #define GTRACE_ARCHAIC_CPP ((KERNEL || _KERNEL_) && __cplusplus < 201103L)
 #endif
 
+// GTraceEntry's fields share a union with fEntry[8]. That needs clang, which
+// allows members with constructors in an anonymous struct. Host builds with
+// g++, see tools/CMakeLists.txt and GTrace/Decoder, get the same 64 bytes as
+// plain members, without fEntry.
+#ifndef GTRACE_ENTRY_UNION
+#define GTRACE_ENTRY_UNION (__clang__ || !__GNUC__)
+#endif
+
 #define GTRACE_REVISION         0x2
 
 #define kGTraceMaximumBufferCount 32
@@ -28,6 +38,25 @@
 #define kGTraceDevelopLineCount UINT32_C(3072)   // @64b == 192k
 #define kGTraceMaximumLineCount UINT32_C(8192)   // @64b == 512k
 
+// GTraceBuffer::make() options
+#define kGTraceOptionPerCPU     UINT32_C(0x1)    // Per-CPU ring slices
+#define kGTraceOptionStream     UINT32_C(0x2)    // Ring can be mapped, live
+#define kGTraceOptionCompact    UINT32_C(0x4)    // Ring is delta encoded
+
+// IOConnectMapMemory64 type on a kIOGDiagnoseGTraceType connection for the
+// read only GTraceStream mapping of the buffer at index i.
+#define kGTraceStreamVersion         1
+#define kGTraceStreamMemoryBase      0x47540000  // 'GT'
+#define kGTraceStreamMemoryType(i)   (kGTraceStreamMemoryBase + (i))
+
+// Record time filter, GTraceBuffer::setFilter(). A set bit drops every token
+// whose tag0 function code, GUNPACKFUNCCODE, is that bit's index.
+#define kGTraceFilterFunctions       1024        // 10 bit GPACKFUNCTAG funcid
+#define kGTraceFilterWords           (kGTraceFilterFunctions / 64)
+
+// Calls kept by GTraceBuffer::recordSlowCall(), see GTraceSlowCall
+#define kGTraceSlowestCount          16
+
 #if DEVELOPMENT
 #define kGTraceDefaultLineCount kGTraceDevelopLineCount
 #else
@@ -128,6 +157,9 @@ typedef struct GTraceEntry {
         uint64_t fID;
 
 #if !GTRACE_ARCHAIC_CPP
+#if !GTRACE_ENTRY_UNION
+        ID() : fID(0) {}
+#endif
         ID(uint64_t id) : fID(id) {}
         ID(uint64_t line, uint64_t component)
             : fID((line & 0xffff) | (component << 16)) {}
@@ -142,6 +174,9 @@ typedef struct GTraceEntry {
         uint64_t fTi;
 
 #if !GTRACE_ARCHAIC_CPP
+#if !GTRACE_ENTRY_UNION
+        ThreadInfo() : fTi(0) {}
+#endif
         ThreadInfo(uint64_t cpu, uint64_t threadID, uint64_t registryID)
             : fTi( (cpu & 0xff) | ((threadID & 0xffffff) << 8)
                  | ((registryID & 0xffffffff) << 32)) {}
@@ -160,6 +195,9 @@ typedef struct GTraceEntry {
         };
 
 #if !GTRACE_ARCHAIC_CPP
+#if !GTRACE_ENTRY_UNION
+        ArgsTag() : fTag64(0) {}
+#endif
         ArgsTag(uint64_t tag) : fTag64{tag} {}
         ArgsTag(uint16_t tag0, uint16_t tag1, uint16_t tag2, uint16_t tag3)
         {
@@ -182,6 +220,9 @@ typedef struct GTraceEntry {
         };
 
 #if !GTRACE_ARCHAIC_CPP
+#if !GTRACE_ENTRY_UNION
+        Args() { fU64s[0] = fU64s[1] = fU64s[2] = fU64s[3] = 0; }
+#endif
         Args(uint64_t arg0, uint64_t arg1, uint64_t arg2, uint64_t arg3)
         {
             fU64s[0] = arg0; fU64s[1] = arg1; fU64s[2] = arg2; fU64s[3] = arg3;
@@ -201,6 +242,7 @@ typedef struct GTraceEntry {
     };
 
     // GTraceEntry data
+#if GTRACE_ENTRY_UNION
     union {
         struct {
             uint64_t   fTimestamp;      // mach continuous time
@@ -215,6 +257,13 @@ typedef struct GTraceEntry {
         uint64_t       fEntry[8];
 #endif
     };
+#else
+    uint64_t   fTimestamp = 0;  // mach continuous time
+    ID         fID;             // unique ID to entry
+    ThreadInfo fThreadInfo;     // CPU, thread info
+    ArgsTag    fArgsTag;        // Argument tags
+    Args       fArgs;           // Argument data
+#endif // GTRACE_ENTRY_UNION
 
 #if !GTRACE_ARCHAIC_CPP
     GTraceEntry() {}
@@ -225,7 +274,7 @@ typedef struct GTraceEntry {
     // describing and contain version information.
     GTraceEntry(const int16_t numBuffers, const uint64_t gtraceVersion)
     {
-        memset(&fEntry[0], -1, sizeof(fEntry));
+        memset(static_cast<void*>(this), -1, sizeof(*this));
         fID = ID(numBuffers, gtraceVersion);
     }
 
@@ -262,10 +311,10 @@ typedef struct GTraceEntry {
 
     // Copy constructor and assignment
     GTraceEntry(const GTraceEntry& other)
-        { memcpy(&fEntry[0], &other.fEntry[0], sizeof(fEntry)); }
+        { memcpy(static_cast<void*>(this), &other, sizeof(*this)); }
     GTraceEntry& operator=(const GTraceEntry& other)
     {
-        memcpy(&fEntry[0], &other.fEntry[0], sizeof(fEntry));
+        memcpy(static_cast<void*>(this), &other, sizeof(*this));
         return *this;
     }
 
@@ -324,6 +373,50 @@ struct IOGTraceBuffer
     GTraceEntry fTokens[];
 };
 
+// Live mapping of a buffer made with kGTraceOptionStream. The kernel writes
+// the ring in place, consumers poll fNextLine of each slice and copy new slots.
+//
+// Slot sequence words: 0 is an empty slot, otherwise bits 63:1 hold the slice
+// line + 1 that last claimed the slot and bit 0 is set while the token is
+// written. A token is only valid if its sequence word is the same, not busy,
+// and for the expected line, both before and after it is copied. Pointer
+// arguments are obfuscated before they are recorded.
+typedef struct GTraceStreamSlice
+{
+    uint32_t fNextLine;          // Next line to claim, slot is line & mask
+    uint32_t fDropped;           // Tokens the recorder dropped, slot busy
+    uint8_t  _padding[56];       // One cache line per slice
+} GTraceStreamSlice;
+
+typedef struct GTraceStreamHeader
+{
+    GTraceHeader fHeader;        // Constant buffer details, no token counts
+    uint32_t fStreamVersion;     // kGTraceStreamVersion
+    uint32_t fSliceCount;        // Number of GTraceStreamSlices
+    uint32_t fSliceLines;        // Lines per slice, power of 2
+    uint32_t fSlicesOffset;      // Byte offsets from start of mapping
+    uint32_t fSeqsOffset;        // uint64_t[fSliceCount * fSliceLines]
+    uint32_t fTokensOffset;      // GTraceEntry[fSliceCount * fSliceLines]
+    uint32_t fMapSize;           // Bytes used in the mapping
+} GTraceStreamHeader;
+
+// GTraceBuffer::setFilter() input, also returned by GTraceBuffer::filter()
+typedef struct GTraceFilter
+{
+    uint64_t fDropFunctions[kGTraceFilterWords];  // Bit per function code
+} GTraceFilter;
+
+// GTraceBuffer::fetchSlowest() output is GTraceSlowCall[kGTraceSlowestCount]
+// ordered slowest first, unused calls have a zero fDuration. fEntry is the
+// GTRACE_IFSLOW_END token or the GTRACE_DEFER_START token of the call.
+typedef struct GTraceSlowCall
+{
+    uint64_t    fDuration;       // Absolute time
+    uint64_t    fThreshold;      // Running p95, 0 if timed by a fixed delayat
+    uint64_t    _reserved[6];    // Keeps fEntry on a 64 byte boundary
+    GTraceEntry fEntry;
+} GTraceSlowCall;
+
 #pragma pack(pop)
 
 #if __cplusplus
@@ -332,9 +425,17 @@ static_assert(sizeof(GTraceHeader) <= kGTraceHeaderSize,
     "header doesnt fit in two entries, change union to preserve alignment");
 static_assert(kGTraceEntrySize == 8 * sizeof(uint64_t),
     "GTraceEntry != 64 bytes");
+static_assert(sizeof(GTraceStreamHeader) <= kGTraceHeaderSize,
+    "stream header doesnt fit in two entries");
+static_assert(sizeof(GTraceStreamSlice) == 64, "slice != 64 bytes");
+static_assert(sizeof(GTraceFilter) * 8 == kGTraceFilterFunctions,
+    "filter doesnt cover every function code");
+static_assert(sizeof(GTraceSlowCall) == 2 * kGTraceEntrySize,
+    "slow call != 128 bytes");
 #endif // __cplusplus
 
 #if !KERNEL && __cplusplus
+#include <algorithm>
 #include <vector>
 #include <utility> // for std::pair<T1, T2>
 class GTraceBuffer
@@ -415,5 +516,137 @@ public:
 private:
     std::vector<GTraceEntry> fData;
 };
+
+// Consumer of a live GTraceStreamHeader mapping, see kGTraceOptionStream.
+class GTraceStreamReader
+{
+public:
+    using vector_type = GTraceBuffer::vector_type;
+
+    // The mapping must outlive the reader. Reading starts at the current end
+    // of every slice, only tokens recorded from now on are drained.
+    GTraceStreamReader(const void* mapping, const size_t mapSize)
+        : fBase(static_cast<const uint8_t*>(mapping))
+    {
+        const auto* stream = reinterpret_cast<const GTraceStreamHeader*>(fBase);
+        if (!fBase || mapSize < sizeof(*stream)
+        ||  stream->fStreamVersion != kGTraceStreamVersion
+        ||  !stream->fSliceCount || !stream->fSliceLines
+        ||  (stream->fSliceLines & (stream->fSliceLines - 1)))
+            return;
+        const uint64_t lines
+            = static_cast<uint64_t>(stream->fSliceCount) * stream->fSliceLines;
+        if (stream->fMapSize > mapSize
+        ||  stream->fSlicesOffset
+                + stream->fSliceCount * sizeof(GTraceStreamSlice)
+                > stream->fMapSize
+        ||  stream->fSeqsOffset + lines * sizeof(uint64_t) > stream->fMapSize
+        ||  stream->fTokensOffset + lines * sizeof(GTraceEntry)
+                > stream->fMapSize)
+            return;
+
+        fStream = stream;
+        fLines.resize(stream->fSliceCount);
+        for (uint32_t i = 0; i < stream->fSliceCount; ++i) {
+            fLines[i] = load(&slices()[i].fNextLine);
+            fDroppedBase += load(&slices()[i].fDropped);
+        }
+    }
+
+    bool valid() const                  { return static_cast<bool>(fStream); }
+    const GTraceHeader& header() const  { return fStream->fHeader; }
+
+    // Tokens overwritten before they could be drained, or claimed by a
+    // recorder that never finished them.
+    uint64_t overruns() const           { return fOverruns; }
+
+    // Tokens the recorder dropped since the reader was created.
+    uint64_t dropped() const
+    {
+        uint64_t ret = 0;
+        for (uint32_t i = 0; i < fStream->fSliceCount; ++i)
+            ret += load(&slices()[i].fDropped);
+        return ret - fDroppedBase;
+    }
+
+    // Appends the tokens recorded since the last drain and returns how many.
+    // Slices are merged by timestamp.
+    size_t drain(vector_type* outP)
+    {
+        const size_t start = outP->size();
+        const uint32_t sliceLines = fStream->fSliceLines;
+        for (uint32_t i = 0; i < fStream->fSliceCount; ++i) {
+            uint32_t& line = fLines[i];
+            const uint32_t top = load(&slices()[i].fNextLine);
+            if (top - line > sliceLines) {  // Ring has lapped us
+                fOverruns += (top - sliceLines) - line;
+                line = top - sliceLines;
+            }
+            for ( ; line != top; ++line) {
+                GTraceEntry entry;
+                const SlotState state = copySlot(i, line, &entry);
+                if (kSlotValid == state)
+                    outP->push_back(entry);
+                else if (kSlotPending != state)
+                    ++fOverruns;
+                else if (top - line < sliceLines / 2)
+                    break;  // Still being written, pick it up next drain
+                else
+                    ++fOverruns;  // Writer was lapped and gave up
+            }
+        }
+        if (fStream->fSliceCount > 1) {
+            std::stable_sort(outP->begin() + start, outP->end(),
+                [](const GTraceEntry& a, const GTraceEntry& b)
+                    { return a.timestamp() < b.timestamp(); });
+        }
+        return outP->size() - start;
+    }
+
+private:
+    enum SlotState { kSlotValid, kSlotPending, kSlotOverwritten };
+
+    template <typename T>
+    static T load(const T* p) { return __atomic_load_n(p, __ATOMIC_ACQUIRE); }
+
+    const GTraceStreamSlice* slices() const
+    {
+        return reinterpret_cast<const GTraceStreamSlice*>(
+                fBase + fStream->fSlicesOffset);
+    }
+
+    SlotState copySlot(const uint32_t slice, const uint32_t line,
+                       GTraceEntry* entryP) const
+    {
+        const uint32_t slot
+            = slice * fStream->fSliceLines + (line & (fStream->fSliceLines - 1));
+        const auto* seqP = reinterpret_cast<const uint64_t*>(
+                fBase + fStream->fSeqsOffset) + slot;
+        const auto* tokenP = reinterpret_cast<const GTraceEntry*>(
+                fBase + fStream->fTokensOffset) + slot;
+        const uint64_t expect = (static_cast<uint64_t>(line) + 1) << 1;
+
+        uint64_t seq = load(seqP);
+        if (seq == expect) {
+            memcpy(static_cast<void*>(entryP), tokenP, sizeof(*entryP));
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            seq = __atomic_load_n(seqP, __ATOMIC_RELAXED);
+            if (seq == expect)
+                return kSlotValid;
+        }
+        if (!seq)
+            return kSlotPending;
+        // Compare lines modulo 2^32, the recorder's index wraps
+        const auto seqLine = static_cast<uint32_t>((seq >> 1) - 1);
+        const auto ahead = static_cast<int32_t>(seqLine - line);
+        return (ahead > 0) ? kSlotOverwritten : kSlotPending;
+    }
+
+    const uint8_t*            fBase;
+    const GTraceStreamHeader* fStream = nullptr;
+    std::vector<uint32_t>     fLines;  // Next line to drain, per slice
+    uint64_t                  fDroppedBase = 0;
+    uint64_t                  fOverruns = 0;
+};
 #endif // !KERNEL && __cplusplus
 #endif /* GTraceTypes_hpp */
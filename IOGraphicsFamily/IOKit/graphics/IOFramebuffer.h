@@ -105,6 +105,15 @@ enum {
 
 typedef void (*IOFBInterruptProc)( OSObject * target, void * ref );
 
+/*! @struct IOGammaRange
+    @abstract Entries [start, start + count) of a packed gamma table, counting from the first entry of the first channel. See IOFramebuffer::setGammaTableRanges.
+ */
+struct IOGammaRange {
+    UInt32      start;
+    UInt32      count;
+};
+typedef struct IOGammaRange IOGammaRange;
+
 
 typedef IOReturn (*IOFramebufferNotificationHandler)
         (OSObject * obj, void * ref,
@@ -410,9 +419,26 @@ public:
                                    UInt32 dataWidth, void * data, bool syncToVBL );
     OSMetaClassDeclareReservedUsed(IOFramebuffer, 2);
 
+/*! @function setGammaTableRanges
+    @abstract Update the changed entries of the gamma table used by the framebuffer.
+    @discussion IOFramebuffer subclasses may implement this method to receive only the entries that differ from the last table they accepted, through either this method or setGammaTable with syncToVBL. IOFramebuffer falls back to setGammaTable if it returns kIOReturnUnsupported, the default.
+    @param channelCount As for setGammaTable.
+    @param dataCount As for setGammaTable.
+    @param dataWidth As for setGammaTable.
+    @param data The complete new table, as for setGammaTable.
+    @param ranges Ascending, non overlapping ranges of the entries of data that changed.
+    @param rangeCount The number of ranges, at least one.
+    @param syncToVBL 0 don't sync to VBL, else sync.
+    @result an IOReturn code.
+ */
+    virtual IOReturn setGammaTableRanges( UInt32 channelCount, UInt32 dataCount,
+                                          UInt32 dataWidth, void * data,
+                                          const IOGammaRange * ranges, UInt32 rangeCount,
+                                          bool syncToVBL );
+    OSMetaClassDeclareReservedUsed(IOFramebuffer, 3);
+
 private:
 
-    OSMetaClassDeclareReservedUnused(IOFramebuffer, 3);
     OSMetaClassDeclareReservedUnused(IOFramebuffer, 4);
     OSMetaClassDeclareReservedUnused(IOFramebuffer, 5);
     OSMetaClassDeclareReservedUnused(IOFramebuffer, 6);
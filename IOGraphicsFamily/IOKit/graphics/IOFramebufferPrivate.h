@@ -39,6 +39,7 @@ protected:
 
     static inline void StdFBDisplayCursor( IOFramebuffer * inst );
     static inline void StdFBRemoveCursor( IOFramebuffer * inst );
+    static inline void StdFBMoveCursor( IOFramebuffer * inst );
     static inline void RemoveCursor( IOFramebuffer * inst );
     static inline void DisplayCursor( IOFramebuffer * inst );
     static inline void SysHideCursor( IOFramebuffer * inst );
@@ -121,6 +122,11 @@ protected:
                                     int width,
                                     int height );
 
+    static void StdFBBuildCursorSpans(
+                                    IOFramebuffer * inst,
+                                    StdFBShmem_t *shmem,
+                                    UInt32 frame );
+
     static void deferredMoveCursor(IOFramebuffer * inst);
 
     static void deferredCLUTSetInterrupt( OSObject * owner,
@@ -141,10 +147,12 @@ protected:
     bool copyDisplayConfig(IOFramebuffer *from);
     void checkDeferredCLUTSet( void );
     void updateCursorForCLUTSet( void );
+    IOReturn pushGammaTable( const uint64_t source );
     IOReturn updateGammaTable(  UInt32 channelCount, UInt32 dataCount,
                                 UInt32 dataWidth, const void * data,
                               SInt32 syncType, bool immediate,
                               bool ignoreTransactionActive );
+    void rawGammaChanged( void );
 
     static void dpInterruptProc(OSObject * target, void * ref);
     static void dpInterrupt(OSObject * owner, IOTimerEventSource * sender);
@@ -194,6 +202,9 @@ protected:
     static void clamshellWork( thread_call_param_t p0, thread_call_param_t p1 );
     void saveFramebuffer(void);
     IOReturn restoreFramebuffer(IOIndex event);
+    bool continueRestore(uint32_t lineCount);
+    void finishRestore(bool paint);
+    static void restoreTimer(OSObject * owner, IOTimerEventSource * sender);
 
     IOReturn deliverDisplayModeDidChangeNotification( void );
 
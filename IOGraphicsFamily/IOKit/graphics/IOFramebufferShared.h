@@ -167,6 +167,8 @@ enum {
     @field vblTime The time of the most recent vertical blanking.
     @field vblDelta The interval between the two most recent vertical blankings.
     @field vblCount A running count of vertical blank interrupts.
+    @field vblPhase The estimated time of the most recent vertical blanking, filtered of interrupt latency jitter. Zero until the estimate has locked to the display.
+    @field vblPeriod The estimated interval between vertical blankings, in AbsoluteTime units with 16 fraction bits. Zero until the estimate has locked to the display; written before vblPhase.
     @field reservedC Reserved for future use.
     @field hardwareCursorCapable True if the hardware is capable of using hardware cursor mode.
     @field hardwareCursorActive True if currently using the hardware cursor mode.
@@ -198,7 +200,9 @@ struct StdFBShmem_t {
     unsigned long long int vblDrift;
     unsigned long long int vblDeltaMeasured;
     AbsoluteTime vblDeltaReal;
-    unsigned int reservedC[22];
+    AbsoluteTime vblPhase;
+    unsigned long long int vblPeriod;
+    unsigned int reservedC[18];
 #else
     unsigned int reservedC[27];
     unsigned char hardwareCursorFlags[kIOFBNumCursorFrames];
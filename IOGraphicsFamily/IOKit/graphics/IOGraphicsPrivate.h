@@ -243,8 +243,13 @@ enum {
     kIOGDbgNoWaitQuietController        = 0x00000400,
     kIOGDbgRemoveShutdownProtection     = 0x00000800,
     kIOGDbgWaitQuietControllerPanic     = 0x00001000,
+    kIOGDbgNoPreviewLineDedup           = 0x00002000,
+    kIOGDbgGTracePerCPU                 = 0x00004000,
+    kIOGDbgGTraceStream                 = 0x00008000,
 
     kIOGDbgEnableAutomatedTestSupport   = 0x00010000,
+    kIOGDbgGTraceCompact                = 0x00020000,
+    kIOGDbgLatency                      = 0x00040000,
     kIOGDbgClamshellInjectionEnabled    = 0x80000000,
 };
 
@@ -335,7 +335,7 @@ enum
 #define DBG_IOG_PLATFORM_CONSOLE            37  // 0x25 0x5320094: arg1 regID, arg2 hasVInfo, arg3 op, arg4:string where
 #define DBG_IOG_CONSOLE_CONFIG              38  // 0x26 0x5320098: arg1 regID, arg2 width << 32 | height, arg3 rowBytes, arg4 depth << 32 | scale
 #define DBG_IOG_VRAM_CONFIG                 39  // 0x27 0x532009c: arg1 regID, arg2 height, arg3 rowBytes, arg4 len
-#define DBG_IOG_SET_GAMMA_TABLE             40  // 0x28 0x53200A0: arg1 regID, arg2 DBG_IOG_SOURCE_xxx (below), arg3 exit-error
+#define DBG_IOG_SET_GAMMA_TABLE             40  // 0x28 0x53200A0: arg1 regID, arg2 DBG_IOG_SOURCE_xxx (below), arg3 exit-error, arg4 exit-bytes sent
 #define DBG_IOG_NEW_USER_CLIENT             41  // 0x29 0x53200a4: arg1 regID, arg2 type, arg3  exit-error, arg4 0->normal, 1->diagnostic, 2->waitQuiet
 #define DBG_IOG_FB_CLOSE                    42  // 0x2A 0x53200A8: arg1 regID, arg2 sys
 #define DBG_IOG_NOTIFY_CALLOUT_TIMEOUT      43  // 0x2B 0x53200AC: arg1 regID, arg2/3/4 - Hex-i-fied OSMetaClass::name, exit-event, return code
@@ -346,6 +346,8 @@ enum
 #define DBG_IOG_DELIVER_NOTIFY              48  // 0x30 0x53200C0: arg1 regID, arg2 event, arg3 return code
 #define DBG_IOG_AGC_MSG                     49  // 0x31 0x53200C4: arg1 switchState
 #define DBG_IOG_AGC_MUTE                    50  // 0x32 0x53200C8: arg1 regID, arg2 newState, arg3 oldState
+#define DBG_IOG_MATCH_FRAMEBUFFER           51  // 0x33 0x53200CC: arg1 duration, arg2 regID
+#define DBG_IOG_COLOR_FLIP                  52  // 0x34 0x53200D0: arg1 regID, arg2 flips << 32 | gamma dropped, arg3 gamma coalesced << 32 | CLUT coalesced, arg4 gamma bytes not sent
 
 
 // Multiple sources
@@ -118,7 +118,7 @@ static void FillVRAM8by1(int w, int h, uint32_t k0,uint32_t k1, uint8_t *dst, in
     }
 }
 
-static void DecompressRLE32(uint8_t *srcbase, uint8_t *dstbase, int minx, int maxx)
+static void DecompressRLE32(uint8_t *srcbase, uint8_t *dstbase, int minx, int maxx, int x0)
 {
     uint32_t  *src, *dst;
     int        cnt, code, n,s,x;
@@ -126,7 +126,7 @@ static void DecompressRLE32(uint8_t *srcbase, uint8_t *dstbase, int minx, int ma
     src = (uint32_t *)srcbase;
     dst = (uint32_t *)dstbase;
 
-    for(x=0 ; x<maxx ;)
+    for(x=x0 ; x<maxx ;)
     {
         code = src[0];
         cnt  = (code & 0x00FFFFFF);
@@ -166,7 +166,7 @@ static void DecompressRLE32(uint8_t *srcbase, uint8_t *dstbase, int minx, int ma
     }
 }
 
-static void DecompressRLE16(uint8_t *srcbase, uint8_t *dstbase, int minx, int maxx)
+static void DecompressRLE16(uint8_t *srcbase, uint8_t *dstbase, int minx, int maxx, int x0)
 {
     typedef u_int16_t   Pixel_Type;
     typedef u_int32_t   CodeWord_Type;
@@ -177,7 +177,7 @@ static void DecompressRLE16(uint8_t *srcbase, uint8_t *dstbase, int minx, int ma
     src = (Pixel_Type *)srcbase;
     dst = (Pixel_Type *)dstbase;
 
-    for(x=0 ; x<maxx ;)
+    for(x=x0 ; x<maxx ;)
     {
         codePtr = (CodeWord_Type*) src;
         code = codePtr[0];
@@ -221,7 +221,7 @@ static void DecompressRLE16(uint8_t *srcbase, uint8_t *dstbase, int minx, int ma
     }
 }
 
-static void DecompressRLE8(uint8_t *srcbase, uint8_t *dstbase, int minx, int maxx)
+static void DecompressRLE8(uint8_t *srcbase, uint8_t *dstbase, int minx, int maxx, int x0)
 {
     typedef u_int8_t    Pixel_Type;
     typedef u_int32_t   CodeWord_Type;
@@ -232,7 +232,7 @@ static void DecompressRLE8(uint8_t *srcbase, uint8_t *dstbase, int minx, int max
     src = (Pixel_Type *)srcbase;
     dst = (Pixel_Type *)dstbase;
 
-    for(x=0 ; x<maxx ;)
+    for(x=x0 ; x<maxx ;)
     {
         codePtr = (CodeWord_Type*) src;
         code = codePtr[0];
@@ -278,12 +278,59 @@ static void DecompressRLE8(uint8_t *srcbase, uint8_t *dstbase, int minx, int max
 }
 
 
+/*
+** Run detection for the line compressors. Eight bytes are compared at a
+** time against the run pixel replicated across a 64 bit word, and the
+** first mismatching byte is found from the xor with a bit scan, so long
+** flat runs cost one compare per 8 bytes. Kernel code can't touch the
+** vector registers, so this stays in the integer unit.
+*/
+static inline uint32_t run_length(const uint8_t *src, const uint8_t *end,
+                                  uint64_t pattern, uint32_t pixelBytes)
+{
+    const uint8_t * start = src;
+    uint64_t        data, diff;
+
+    while ((src + sizeof(uint64_t)) <= end)
+    {
+        bcopy(src, &data, sizeof(data));
+        diff = data ^ pattern;
+        if (diff)
+        {
+#if __BIG_ENDIAN__
+            src += __builtin_clzll(diff) >> 3;
+#else
+            src += __builtin_ctzll(diff) >> 3;
+#endif
+            return (static_cast<uint32_t>((src - start) / pixelBytes));
+        }
+        src += sizeof(uint64_t);
+    }
+
+    // scalar tail
+    switch (pixelBytes)
+    {
+        case 1:
+            while ((src < end) && (*src == (uint8_t) pattern)) src += 1;
+            break;
+        case 2:
+            while ((src < end) && (*(const uint16_t *) src == (uint16_t) pattern)) src += 2;
+            break;
+        default:
+            while ((src < end) && (*(const uint32_t *) src == (uint32_t) pattern)) src += 4;
+            break;
+    }
+
+    return (static_cast<uint32_t>((src - start) / pixelBytes));
+}
+
 static inline int compress_line_32(UInt8 *srcbase, int width, UInt8 *dstbase)
 {
     uint32_t  *src, *dst;
     uint32_t  *start, *end;
     uint32_t   c0,c1;
     int        cpyCnt, rplCnt, wrtCnt;
+    uint32_t   n;
 
     wrtCnt = 0;
     src    = (uint32_t *)srcbase;
@@ -299,19 +346,19 @@ static inline int compress_line_32(UInt8 *srcbase, int width, UInt8 *dstbase)
 
         for(src++ ; src<end ; src++)
         {
-            c1 = src[0];
+            n      = run_length((uint8_t *) src, (uint8_t *) end,
+                                c0 * 0x0000000100000001ULL, sizeof(uint32_t));
+            src    = src + n;
+            rplCnt = rplCnt + n;
+            if(src >= end)  break;
 
-            if(c1 != c0)
-            {
-                if(rplCnt >= 4)  break;
+            c1 = src[0];
 
-                cpyCnt = cpyCnt + rplCnt;
-                rplCnt = 1;
-                c0     = c1;
-            }
+            if(rplCnt >= 4)  break;
 
-            else
-                rplCnt++;
+            cpyCnt = cpyCnt + rplCnt;
+            rplCnt = 1;
+            c0     = c1;
         }
 
         if(rplCnt < 4)
@@ -350,6 +397,7 @@ static inline int compress_line_16(uint8_t *srcbase, int width, uint8_t *dstbase
     Pixel_Type  *start, *end;
     Pixel_Type   c0,c1;
     int        cpyCnt, rplCnt, wrtCnt;
+    uint32_t   n;
     const int kMinRunLength = ( 2 * sizeof(CodeWord_Type)  + 2 * sizeof
 ( Pixel_Type ) ) / sizeof( Pixel_Type );
 
@@ -367,18 +415,19 @@ static inline int compress_line_16(uint8_t *srcbase, int width, uint8_t *dstbase
 
         for(src++ ; src < end ; src++)
         {
+            n      = run_length((uint8_t *) src, (uint8_t *) end,
+                                c0 * 0x0001000100010001ULL, sizeof(Pixel_Type));
+            src    = src + n;
+            rplCnt = rplCnt + n;
+            if(src >= end)  break;
+
             c1 = src[0];
 
-            if(c1 != c0)
-            {
-                if(rplCnt >= kMinRunLength)  break;
+            if(rplCnt >= kMinRunLength)  break;
 
-                cpyCnt = cpyCnt + rplCnt;
-                rplCnt = 1;
-                c0     = c1;
-            }
-            else
-                rplCnt++;
+            cpyCnt = cpyCnt + rplCnt;
+            rplCnt = 1;
+            c0     = c1;
         }
 
         if(rplCnt < kMinRunLength )
@@ -423,6 +472,7 @@ static inline int compress_line_8(uint8_t *srcbase, int width, uint8_t *dstbase)
     Pixel_Type  *start, *end;
     Pixel_Type   c0,c1;
     int        cpyCnt, rplCnt, wrtCnt;
+    uint32_t   n;
     const int kMinRunLength = ( 2 * sizeof(CodeWord_Type)  + 2 * sizeof
 ( Pixel_Type ) ) / sizeof( Pixel_Type );
 
@@ -440,18 +490,19 @@ static inline int compress_line_8(uint8_t *srcbase, int width, uint8_t *dstbase)
 
         for(src++ ; src < end ; src++)
         {
+            n      = run_length((uint8_t *) src, (uint8_t *) end,
+                                c0 * 0x0101010101010101ULL, sizeof(Pixel_Type));
+            src    = src + n;
+            rplCnt = rplCnt + n;
+            if(src >= end)  break;
+
             c1 = src[0];
 
-            if(c1 != c0)
-            {
-                if(rplCnt >= kMinRunLength)  break;
+            if(rplCnt >= kMinRunLength)  break;
 
-                cpyCnt = cpyCnt + rplCnt;
-                rplCnt = 1;
-                c0     = c1;
-            }
-            else
-                rplCnt++;
+            cpyCnt = cpyCnt + rplCnt;
+            rplCnt = 1;
+            c0     = c1;
         }
 
         if(rplCnt < kMinRunLength )
@@ -488,32 +539,36 @@ static inline int compress_line_8(uint8_t *srcbase, int width, uint8_t *dstbase)
     return sizeof( Pixel_Type )*wrtCnt;
 }
 
-static int CompressData(uint8_t *srcbase[], uint32_t imageCount,
-                 uint32_t pixelBytes, uint32_t pixelBits, uint32_t width, uint32_t height,
-                 uint32_t rowbytes, uint8_t *dstbase, uint32_t dlen,
-                 uint32_t gammaChannelCount, uint32_t gammaDataCount, 
-                 uint32_t gammaDataWidth, uint8_t * gammaData)
+static inline int compress_line(uint32_t pixelBytes, uint8_t *srcbase, int width, uint8_t *dstbase)
+{
+    return ((pixelBytes <= 1 ? compress_line_8 :
+            (pixelBytes <= 2 ? compress_line_16 :
+             compress_line_32))(srcbase, width, dstbase));
+}
+
+/*
+** Writes the preview header and the 3x256 gamma table, returns the first
+** byte available for compressed scanlines or NULL if dlen can't hold the
+** y index.
+*/
+static uint8_t * CompressDataHeader(uint32_t imageCount,
+                 uint32_t pixelBits, uint32_t width, uint32_t height,
+                 uint8_t *dstbase, uint32_t dlen,
+                 uint32_t gammaDataCount, uint32_t gammaDataWidth, uint8_t * gammaData)
 {
 	hibernate_preview_t * hdr;
     uint32_t * dst;
-    uint32_t * cScan,*pScan;
-    UInt8 *    lineBuffer;
-    int32_t    cSize, pSize;
-    uint32_t   image, y, lineLen;
 
     if (dlen <= sizeof(hibernate_preview_t) + imageCount*height*sizeof(uint32_t))
     {
         DEBG("", "compressData: destination buffer size %d too small for y index (%ld)\n",
                 dlen, (imageCount+height)*sizeof(uint32_t));
-        return 0;
+        return (NULL);
     }
 
     hdr = (IOGRAPHICS_TYPEOF(hdr)) dstbase;
 	dst = (IOGRAPHICS_TYPEOF(dst)) (hdr + 1);
 
-    lineLen = width * pixelBytes;
-    dlen -= lineLen;
-
 	bzero(hdr, sizeof(*hdr));
 #if !IOHIB_PREVIEW_V0
     hdr->imageCount = imageCount;
@@ -545,7 +600,32 @@ static int CompressData(uint8_t *srcbase[], uint32_t imageCount,
 		}
     }
 
-    cScan = (uint32_t *) gammaOut;
+    return (gammaOut);
+}
+
+static int CompressData(uint8_t *srcbase[], uint32_t imageCount,
+                 uint32_t pixelBytes, uint32_t pixelBits, uint32_t width, uint32_t height,
+                 uint32_t rowbytes, uint8_t *dstbase, uint32_t dlen,
+                 uint32_t gammaChannelCount, uint32_t gammaDataCount, 
+                 uint32_t gammaDataWidth, uint8_t * gammaData)
+{
+    uint32_t * dst;
+    uint32_t * cScan,*pScan;
+    UInt8 *    lineBuffer;
+    int32_t    cSize, pSize;
+    uint32_t   image, y, lineLen;
+
+    cScan = (uint32_t *) CompressDataHeader(imageCount, pixelBits, width, height,
+                                            dstbase, dlen,
+                                            gammaDataCount, gammaDataWidth, gammaData);
+    if (!cScan)
+        return 0;
+
+	dst = (IOGRAPHICS_TYPEOF(dst)) (((hibernate_preview_t *) dstbase) + 1);
+
+    lineLen = width * pixelBytes;
+    dlen -= lineLen;
+
     pScan = cScan;
     pSize = -1;
 
@@ -568,9 +648,7 @@ static int CompressData(uint8_t *srcbase[], uint32_t imageCount,
 	
 			if (srcbase[image])	lineBuffer = srcbase[image] + y*rowbytes;
 	
-			cSize = (pixelBytes <= 1 ? compress_line_8 :
-					(pixelBytes <= 2 ? compress_line_16 :
-					 compress_line_32))(lineBuffer, width, (uint8_t *)cScan);
+			cSize = compress_line(pixelBytes, lineBuffer, width, (uint8_t *)cScan);
 	
 			if(cSize != pSize  ||  bcmp(pScan, cScan, cSize))
 			{
@@ -587,55 +665,845 @@ static int CompressData(uint8_t *srcbase[], uint32_t imageCount,
     return (static_cast<int>(reinterpret_cast<uint8_t *>(cScan) - dstbase));
 }
 
-static void DecompressData(uint8_t *srcbase, uint32_t image, UInt8 *dstbase, uint32_t dx, uint32_t dy,
-                    uint32_t dw, uint32_t dh, uint32_t rowbytes)
+/*
+** Scanline skip index.
+** Optional table appended after the compressed data (not part of
+** hibernate_preview_t, which other readers walk by y index only). For every
+** kDecompressSkipBlock pixels of a line it records the RLE token covering that
+** pixel and the x at which the token starts, so a decode of a narrow rect
+** starts at the right token instead of walking the line from x = 0.
+** Consecutive lines sharing compressed data share a row of entries.
+*/
+enum { kDecompressSkipBlock = 512 };
+
+struct DecompressSkipEntry
 {
-	hibernate_preview_t * hdr;
-    uint32_t  *src;
-    uint8_t   *dst;
-    uint32_t   xMin,xMax;
-    uint32_t   y, depth;
+    uint32_t offset;        // token byte offset from the start of the line
+    uint32_t x;             // first pixel of the token
+};
+
+struct DecompressSkipIndex
+{
+    uint32_t blockPixels;
+    uint32_t blocks;        // entries per row
+    uint32_t lines;         // imageCount * height
+    uint32_t rows;
+    // uint32_t            row[lines];
+    // DecompressSkipEntry entry[rows][blocks];
+};
+
+static inline uint32_t * DecompressSkipRows(const DecompressSkipIndex * skip)
+{
+    return ((uint32_t *) (skip + 1));
+}
+
+static inline DecompressSkipEntry * DecompressSkipEntries(const DecompressSkipIndex * skip)
+{
+    return ((DecompressSkipEntry *) (DecompressSkipRows(skip) + skip->lines));
+}
+
+static inline size_t DecompressSkipIndexMaxSize(uint32_t imageCount, uint32_t width, uint32_t height)
+{
+    uint32_t lines  = imageCount * height;
+    uint32_t blocks = (width + kDecompressSkipBlock - 1) / kDecompressSkipBlock;
+
+    return (sizeof(DecompressSkipIndex) + lines * sizeof(uint32_t)
+            + lines * blocks * sizeof(DecompressSkipEntry));
+}
+
+// Builds the skip index at skipbase, returns its size.
+static size_t CompressDataSkipIndex(uint8_t *srcbase, uint32_t imageCount,
+                                    uint32_t pixelBytes, uint32_t width, uint32_t height,
+                                    uint8_t *skipbase)
+{
+    DecompressSkipIndex * skip = (IOGRAPHICS_TYPEOF(skip)) skipbase;
+    DecompressSkipEntry * entry;
+    uint32_t *            row;
+    uint32_t *            src;
+    uint8_t *             scan;
+    uint32_t              line, lines, x, cnt, code, block, offset, prev;
+
+    lines = imageCount * height;
+    skip->blockPixels = kDecompressSkipBlock;
+    skip->blocks      = (width + kDecompressSkipBlock - 1) / kDecompressSkipBlock;
+    skip->lines       = lines;
+    skip->rows        = 0;
+
+    row   = DecompressSkipRows(skip);
+    entry = DecompressSkipEntries(skip);
+    src   = (IOGRAPHICS_TYPEOF(src)) (((hibernate_preview_t *) srcbase) + 1);
+    prev  = 0;
+    for (line = 0; line < lines; line++)
+    {
+        if (line && (src[line] == prev))
+        {
+            row[line] = row[line - 1];
+            continue;
+        }
+        prev      = src[line];
+        row[line] = skip->rows++;
+
+        scan   = srcbase + src[line];
+        offset = 0;
+        block  = 0;
+        for (x = 0; x < width;)
+        {
+            bcopy(scan + offset, &code, sizeof(code));
+            cnt  = (code & 0x00FFFFFF);
+            code = (code & 0xFF000000) >> 24;
+            if (!cnt) break;
+
+            for (; (block < skip->blocks) && (block * kDecompressSkipBlock < x + cnt); block++)
+            {
+                entry->offset = offset;
+                entry->x      = x;
+                entry++;
+            }
+
+            offset += sizeof(uint32_t) + pixelBytes * ((code == 0x80) ? 1 : cnt);
+            x      += cnt;
+        }
+        for (; block < skip->blocks; block++, entry++)
+        {
+            entry->offset = offset;
+            entry->x      = x;
+        }
+    }
+
+    return ((uint8_t *) entry - skipbase);
+}
+
+/*
+** Whole image scanline dedup.
+** The compressors only reuse the line directly above. This pass walks the
+** y index of every image in order, hashes each emitted compressed line,
+** and drops any line identical to one emitted earlier (in this or a
+** previous image), pointing its index entries at the first copy and
+** sliding the remaining lines down. The y index format is unchanged.
+*/
+struct CompressLineHash
+{
+    uint32_t hash;
+    uint32_t offset;
+    uint32_t size;
+};
+
+static inline uint32_t compress_line_hash(const uint8_t * p, uint32_t size)
+{
+    uint32_t hash = 2166136261U ^ size;
+    uint32_t word;
+
+    for (; size >= sizeof(word); size -= sizeof(word), p += sizeof(word))
+    {
+        bcopy(p, &word, sizeof(word));
+        hash = (hash ^ word) * 16777619U;
+        hash ^= hash >> 15;
+    }
+    for (; size; size--, p++)
+        hash = (hash ^ *p) * 16777619U;
+
+    return (hash ? hash : 1);
+}
+
+static int CompressDataDedup(uint8_t *dstbase, uint32_t imageCount, uint32_t height,
+                             uint32_t start, uint32_t end)
+{
+    CompressLineHash * table;
+    uint32_t *         dst;
+    uint32_t           lines, tableSize, mask, line, next, slot;
+    uint32_t           old, size, hash, out, prevOld, prevNew;
+
+    lines = imageCount * height;
+    if (lines < 2)
+        return (end);
+
+    for (tableSize = 64; tableSize < 2 * lines; tableSize <<= 1) {}
+    mask  = tableSize - 1;
+    table = IONew(CompressLineHash, tableSize);
+    if (!table)
+        return (end);
+    bzero(table, tableSize * sizeof(CompressLineHash));
+
+    dst     = (IOGRAPHICS_TYPEOF(dst)) (((hibernate_preview_t *) dstbase) + 1);
+    out     = start;
+    prevOld = 0;
+    prevNew = 0;
+    for (line = 0; line < lines; line++)
+    {
+        old = dst[line];
+        if (line && (old == prevOld))
+        {
+            dst[line] = prevNew;
+            continue;
+        }
+
+        // lines are emitted in index order, so the next new offset ends this one
+        for (next = line + 1; (next < lines) && (dst[next] == old); next++) {}
+        size = ((next < lines) ? dst[next] : end) - old;
+        hash = compress_line_hash(dstbase + old, size);
+
+        for (slot = hash & mask; table[slot].hash; slot = (slot + 1) & mask)
+        {
+            if ((table[slot].hash == hash) && (table[slot].size == size)
+             && !bcmp(dstbase + table[slot].offset, dstbase + old, size))
+                break;
+        }
+
+        prevOld = old;
+        if (table[slot].hash)
+            prevNew = table[slot].offset;
+        else
+        {
+            memmove(dstbase + out, dstbase + old, size);
+            table[slot].hash   = hash;
+            table[slot].offset = out;
+            table[slot].size   = size;
+            prevNew = out;
+            out    += size;
+        }
+        dst[line] = prevNew;
+    }
+
+    IODelete(table, CompressLineHash, tableSize);
+
+    DEBG1("", " compressDataDedup: %d -> %d bytes\n", end - start, out - start);
+    return (out);
+}
+
+#if KERNEL
+/*
+** Banded, streaming compression.
+** The preview images are treated as one run of imageCount * height scanlines
+** and split into contiguous bands, each compressed on its own thread. A band
+** streams its output into a chain of chunks sized from the worst case line,
+** so nothing is reserved for RLE growth up front. Once every band is done the
+** exact output size is known; a single buffer is allocated, the header, y
+** index and gamma table are written and the band chunks are copied in order,
+** deduping the first line of each band against the last line of the one
+** before, so the result is byte identical to CompressData().
+** The chunks are pageable like the output, and each is freed once copied, so
+** the compressed data is never held twice in wired memory.
+*/
+enum
+{
+    kCompressMaxBands     = 8,
+    kCompressMinBandLines = 256,
+    kCompressChunkSize    = 256*1024,
+};
+
+struct CompressChunk
+{
+    CompressChunk * next;
+    uint32_t        size;
+    uint32_t        used;
+
+    uint8_t * data() { return (reinterpret_cast<uint8_t *>(this + 1)); }
+};
+
+static inline void CompressChunkFree(CompressChunk * chunk)
+{
+    IOFreePageable(chunk, sizeof(CompressChunk) + chunk->size);
+}
+
+struct CompressBand
+{
+    uint8_t **      srcbase;
+    const uint8_t * zeroLine;
+    uint32_t *      index;
+    uint32_t        firstLine;
+    uint32_t        lineCount;
+    uint32_t        pixelBytes;
+    uint32_t        width;
+    uint32_t        height;
+    uint32_t        rowbytes;
+
+    CompressChunk * chunks;
+    bool            ok;
+    uint32_t        size;
+    uint32_t        firstSize;
+    uint32_t        lastSize;
+    uint8_t *       lastScan;
+
+    IOLock *        lock;
+    uint32_t *      pending;
+};
+
+static void CompressBandFree(CompressBand * band)
+{
+    CompressChunk * chunk;
+
+    while ((chunk = band->chunks))
+    {
+        band->chunks = chunk->next;
+        CompressChunkFree(chunk);
+    }
+}
+
+static void CompressBandLines(CompressBand * band)
+{
+    CompressChunk * chunk = NULL;
+    CompressChunk * newChunk;
+    uint8_t *       cScan;
+    uint8_t *       pScan = NULL;
+    uint8_t *       lineBuffer;
+    int32_t         cSize, pSize = -1;
+    uint32_t        line, image, y, maxLine, chunkSize;
+    uint32_t        base = 0, pOffset = 0;
+
+    maxLine   = 8*(band->width+1);
+    chunkSize = maxLine * 4;
+    if (chunkSize < kCompressChunkSize) chunkSize = kCompressChunkSize;
+    chunkSize = static_cast<uint32_t>(round_page(sizeof(CompressChunk) + chunkSize)
+                                      - sizeof(CompressChunk));
+
+    band->ok = false;
+    for (line = band->firstLine; line < (band->firstLine + band->lineCount); line++)
+    {
+        if (!chunk || ((chunk->size - chunk->used) < maxLine))
+        {
+            newChunk = (CompressChunk *) IOMallocPageable(sizeof(CompressChunk) + chunkSize,
+                                                          page_size);
+            if (!newChunk)
+            {
+                DEBG1("", " compressBand: no chunk at line %d\n", line);
+                return;
+            }
+            newChunk->next = NULL;
+            newChunk->size = chunkSize;
+            newChunk->used = 0;
+            if (chunk)
+            {
+                base       += chunk->used;
+                chunk->next = newChunk;
+            }
+            else band->chunks = newChunk;
+            chunk = newChunk;
+        }
+
+        image = line / band->height;
+        y     = line % band->height;
+        if (band->srcbase[image]) lineBuffer = band->srcbase[image] + y*band->rowbytes;
+        else                      lineBuffer = (uint8_t *) band->zeroLine;
+
+        cScan = chunk->data() + chunk->used;
+        cSize = compress_line(band->pixelBytes, lineBuffer, band->width, cScan);
+
+        if (cSize != pSize || bcmp(pScan, cScan, cSize))
+        {
+            if (pSize < 0) band->firstSize = cSize;
+            pScan       = cScan;
+            pOffset     = base + chunk->used;
+            pSize       = cSize;
+            chunk->used += cSize;
+        }
+
+        band->index[line] = pOffset;
+    }
+
+    band->lastScan = pScan;
+    band->lastSize = pSize;
+    band->size     = chunk ? (base + chunk->used) : 0;
+    band->ok       = true;
+}
+
+static void CompressBandThread(void * param, wait_result_t)
+{
+    CompressBand * band = (CompressBand *) param;
+    IOLock *       lock = band->lock;
+    uint32_t *     pending = band->pending;
+
+    CompressBandLines(band);
+
+    IOLockLock(lock);
+    if (!--*pending) IOLockWakeup(lock, pending, false);
+    IOLockUnlock(lock);
+
+    thread_terminate(current_thread());
+}
+
+/*
+** Returns a pageable buffer of *allocLength bytes holding a hibernate_preview_t
+** of *dataLength bytes, or NULL. Free with IOFreePageable(). With skipIndex a
+** DecompressSkipIndex follows the compressed data at *skipOffset (included in
+** *dataLength).
+*/
+static uint8_t * CompressDataStream(uint8_t *srcbase[], uint32_t imageCount,
+                 uint32_t pixelBytes, uint32_t pixelBits, uint32_t width, uint32_t height,
+                 uint32_t rowbytes,
+                 uint32_t gammaChannelCount, uint32_t gammaDataCount,
+                 uint32_t gammaDataWidth, uint8_t * gammaData,
+                 bool dedupLines, bool skipIndex, vm_size_t * skipOffset,
+                 vm_size_t * dataLength, vm_size_t * allocLength)
+{
+    CompressBand    bands[kCompressMaxBands];
+    uint32_t        skips[kCompressMaxBands];
+    CompressChunk * chunk;
+    uint32_t *      index;
+    uint32_t *      dst;
+    uint8_t *       zeroLine;
+    uint8_t *       dstbase = NULL;
+    uint8_t *       start;
+    uint8_t *       out;
+    uint8_t *       prevScan;
+    uint32_t        prevSize, skip, off, bandStart;
+    uint32_t        bandCount, lines, line, idx, pending;
+    uint64_t        total;
+    vm_size_t       dlen = 0;
+    IOLock *        lock = NULL;
+    thread_t        thread;
+    bool            ok;
+
+    *dataLength  = 0;
+    *allocLength = 0;
+    *skipOffset  = 0;
+    bzero(bands, sizeof(bands));
+
+    lines     = imageCount * height;
+    bandCount = lines / kCompressMinBandLines;
+    if (bandCount > kCompressMaxBands) bandCount = kCompressMaxBands;
+    if (!bandCount) bandCount = 1;
+
+    index    = IONew(uint32_t, lines);
+    zeroLine = IONew(uint8_t, width * pixelBytes);
+    if (bandCount > 1) lock = IOLockAlloc();
+    if (!index || !zeroLine || ((bandCount > 1) && !lock))
+        goto exit;
+    bzero(zeroLine, width * pixelBytes);
+
+    line = 0;
+    for (idx = 0; idx < bandCount; idx++)
+    {
+        CompressBand * band = &bands[idx];
+
+        band->srcbase    = srcbase;
+        band->zeroLine   = zeroLine;
+        band->index      = index;
+        band->pixelBytes = pixelBytes;
+        band->width      = width;
+        band->height     = height;
+        band->rowbytes   = rowbytes;
+        band->lock       = lock;
+        band->pending    = &pending;
+        band->firstLine  = line;
+        band->lineCount  = ((idx + 1) * lines) / bandCount - line;
+        line += band->lineCount;
+    }
+
+    // band 0 runs on the calling thread
+    pending = bandCount - 1;
+    for (idx = 1; idx < bandCount; idx++)
+    {
+        if (KERN_SUCCESS == kernel_thread_start(&CompressBandThread, &bands[idx], &thread))
+            thread_deallocate(thread);
+        else
+        {
+            CompressBandLines(&bands[idx]);
+            IOLockLock(lock);
+            pending--;
+            IOLockUnlock(lock);
+        }
+    }
+    CompressBandLines(&bands[0]);
+
+    if (lock)
+    {
+        IOLockLock(lock);
+        while (pending) IOLockSleep(lock, &pending, THREAD_UNINT);
+        IOLockUnlock(lock);
+    }
+
+    ok = true;
+    for (idx = 0; ok && (idx < bandCount); idx++) ok = bands[idx].ok;
+    if (!ok)
+        goto exit;
 
-    hdr = (IOGRAPHICS_TYPEOF(hdr)) srcbase;
-    dst = (IOGRAPHICS_TYPEOF(dst)) dstbase;
+    // size the output exactly
+    total    = sizeof(hibernate_preview_t) + lines * sizeof(uint32_t) + 3 * 256;
+    prevScan = NULL;
+    prevSize = 0;
+    for (idx = 0; idx < bandCount; idx++)
+    {
+        CompressBand * band = &bands[idx];
+
+        skip = 0;
+        if (prevScan && (band->firstSize == prevSize)
+         && !bcmp(prevScan, band->chunks->data(), prevSize))
+            skip = band->firstSize;
+        skips[idx] = skip;
+        total += band->size - skip;
+
+        if (!skip || (band->lastScan != band->chunks->data()))
+        {
+            prevScan = band->lastScan;
+            prevSize = band->lastSize;
+        }
+    }
+    if (skipIndex)
+        total += sizeof(uint64_t) + DecompressSkipIndexMaxSize(imageCount, width, height);
+    if (total >= 96*1024*1024)
+    {
+        DEBG("", "compressDataStream: output %lld too large\n", (long long) total);
+        goto exit;
+    }
+
+    dlen    = round_page(total);
+    dstbase = (uint8_t *) IOMallocPageable(dlen, page_size);
+    if (!dstbase)
+        goto exit;
+
+    start = CompressDataHeader(imageCount, pixelBits, width, height, dstbase,
+                               static_cast<uint32_t>(dlen),
+                               gammaDataCount, gammaDataWidth, gammaData);
+    if (!start)
+    {
+        IOFreePageable(dstbase, dlen);
+        dstbase = NULL;
+        goto exit;
+    }
+    dst = (IOGRAPHICS_TYPEOF(dst)) (((hibernate_preview_t *) dstbase) + 1);
+
+    // stitch
+    out       = start;
+    bandStart = 0;
+    for (idx = 0; idx < bandCount; idx++)
+    {
+        CompressBand * band = &bands[idx];
+
+        skip = skips[idx];
+        for (line = band->firstLine; line < (band->firstLine + band->lineCount); line++)
+        {
+            off = index[line];
+            if (skip && !off) dst[line] = bandStart;
+            else              dst[line] = static_cast<uint32_t>((out - dstbase) + off - skip);
+        }
+        if (band->lineCount)
+            bandStart = dst[band->firstLine + band->lineCount - 1];
+
+        while ((chunk = band->chunks))
+        {
+            bcopy(chunk->data() + skip, out, chunk->used - skip);
+            out += chunk->used - skip;
+            skip = 0;
+            band->chunks = chunk->next;
+            CompressChunkFree(chunk);
+        }
+    }
+
+    *dataLength  = out - dstbase;
+    *allocLength = dlen;
+
+    if (dedupLines)
+    {
+        *dataLength = CompressDataDedup(dstbase, imageCount, height,
+                                        static_cast<uint32_t>(start - dstbase),
+                                        static_cast<uint32_t>(*dataLength));
+    }
+    if (skipIndex)
+    {
+        *skipOffset = (*dataLength + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+        *dataLength = *skipOffset
+                    + CompressDataSkipIndex(dstbase, imageCount, pixelBytes, width, height,
+                                            dstbase + *skipOffset);
+    }
 
-    if ((dw != hdr->width)
+exit:
+    for (idx = 0; idx < bandCount; idx++) CompressBandFree(&bands[idx]);
+    if (lock)     IOLockFree(lock);
+    if (zeroLine) IODelete(zeroLine, uint8_t, width * pixelBytes);
+    if (index)    IODelete(index, uint32_t, lines);
+
+    return (dstbase);
+}
+#endif /* KERNEL */
+
+/*
+** Resumable, rect restricted decode.
+** DecompressDataBegin() validates the preview and sets up a decode of the
+** rect (dx, dy, dw, dh) of one image into the same rect of dstbase, which
+** addresses pixel (0, 0) of the destination. Each DecompressDataContinue()
+** decodes at most lineCount lines and returns true once the rect is done, so
+** callers can paint part of the screen first and finish the rest later.
+*/
+struct DecompressState
+{
+    uint8_t *                   srcbase;
+    const DecompressSkipIndex * skip;
+    uint8_t *                   dstbase;
+    uint32_t                    rowbytes;
+    uint32_t                    image;
+    uint32_t                    depth;
+    uint32_t                    height;
+    uint32_t                    minx;
+    uint32_t                    maxx;
+    uint32_t                    maxy;
+    uint32_t                    y;
+};
+
+static bool DecompressDataBegin(DecompressState * state, uint8_t *srcbase,
+                                const void * skipbase, uint32_t image,
+                                uint8_t *dstbase, uint32_t rowbytes,
+                                uint32_t dx, uint32_t dy, uint32_t dw, uint32_t dh)
+{
+	hibernate_preview_t * hdr = (IOGRAPHICS_TYPEOF(hdr)) srcbase;
+    const DecompressSkipIndex * skip = (IOGRAPHICS_TYPEOF(skip)) skipbase;
+
+    bzero(state, sizeof(*state));
+    if ((dx + dw > hdr->width)
 #if !IOHIB_PREVIEW_V0
     	|| (image >= hdr->imageCount) 
 #endif
-    	|| (dh != hdr->height))
+    	|| (dy + dh > hdr->height))
     {
         DEBG1("", " DecompressData mismatch\n");
+        return (false);
+    }
+
+    if (skip && ((skip->blockPixels != kDecompressSkipBlock)
+              || (skip->blocks != (hdr->width + kDecompressSkipBlock - 1) / kDecompressSkipBlock)
+              || (skip->lines < (image + 1) * hdr->height)))
+        skip = NULL;
+
+    state->srcbase  = srcbase;
+    state->skip     = skip;
+    state->dstbase  = dstbase;
+    state->rowbytes = rowbytes;
+    state->image    = image;
+    state->depth    = ((7 + hdr->depth) / 8);
+    state->height   = hdr->height;
+    state->minx     = dx;
+    state->maxx     = dx + dw;
+    state->y        = dy;
+    state->maxy     = dy + dh;
+
+    return (true);
+}
+
+static bool DecompressDataContinue(DecompressState * state, uint32_t lineCount)
+{
+    const DecompressSkipEntry * entry;
+    uint32_t *  src;
+    uint8_t *   scan;
+    uint8_t *   dst;
+    uint32_t    line, x0;
+
+    src = (IOGRAPHICS_TYPEOF(src)) (((hibernate_preview_t *) state->srcbase) + 1);
+    for (; lineCount && (state->y < state->maxy); lineCount--, state->y++)
+    {
+        line = state->image * state->height + state->y;
+        scan = state->srcbase + src[line];
+        dst  = state->dstbase + state->y * state->rowbytes + state->minx * state->depth;
+        x0   = 0;
+
+        if (state->skip && (state->minx >= kDecompressSkipBlock))
+        {
+            entry = DecompressSkipEntries(state->skip)
+                  + DecompressSkipRows(state->skip)[line] * state->skip->blocks
+                  + state->minx / kDecompressSkipBlock;
+            scan += entry->offset;
+            x0    = entry->x;
+        }
+
+        (state->depth <= 1  ? DecompressRLE8 :
+            (state->depth <= 2 ? DecompressRLE16 : DecompressRLE32))
+                (scan, dst, state->minx, state->maxx, x0);
+    }
+
+    return (state->y >= state->maxy);
+}
+
+static void DecompressData(uint8_t *srcbase, const void *skipbase, uint32_t image,
+                           UInt8 *dstbase, uint32_t dx, uint32_t dy,
+                           uint32_t dw, uint32_t dh, uint32_t rowbytes)
+{
+    DecompressState state;
+
+    if (!DecompressDataBegin(&state, srcbase, skipbase, image, dstbase, rowbytes, dx, dy, dw, dh))
         return;
+
+    do
+    {
+        AbsoluteTime deadline;
+        clock_interval_to_deadline(8, kMicrosecondScale, &deadline);
+        assert_wait_deadline((event_t)&clock_delay_until, THREAD_UNINT, __OSAbsoluteTime(deadline));
+        thread_block(NULL);
     }
+    while (!DecompressDataContinue(&state, 8));
+}
+
+/*
+** Preview blur.
+** Each source line is RLE decoded straight into a 70% luminance row,
+** converting each run once, so the blur loop itself never branches on RLE
+** tokens. A 4 stage running sum (gaussian approximation) is run along the
+** row and down the columns against four column accumulators. The image is
+** padded by two pixels right and below, replicating the last column and
+** line (the last luminance row is reused, not decoded again), and the
+** output is offset by two. All scratch comes from one arena allocation.
+*/
+struct PreviewBlurArena
+{
+    uint16_t * lum;         // width + 2
+    uint16_t * sc0;         // width + 2 each
+    uint16_t * sc1;
+    uint16_t * sc2;
+    uint16_t * sc3;
+    uint16_t * out;         // width + 2
+    uint8_t *  base;
+    size_t     size;
+};
+
+static bool PreviewBlurArenaAlloc(PreviewBlurArena * arena, uint32_t width)
+{
+    size_t row = (width + 2) * sizeof(uint16_t);
+
+    row = (row + sizeof(uint32_t) - 1) & ~(sizeof(uint32_t) - 1);
+    arena->size = 6 * row;
+    arena->base = IONew(uint8_t, arena->size);
+    if (!arena->base)
+        return (false);
+    bzero(arena->base, arena->size);
 
-    depth = ((7 + hdr->depth) / 8);
-    src   = (IOGRAPHICS_TYPEOF(src)) (hdr + 1); 
-    src   += dy + image * dh;
+    arena->lum    = (uint16_t *) (arena->base + 0 * row);
+    arena->sc0    = (uint16_t *) (arena->base + 1 * row);
+    arena->sc1    = (uint16_t *) (arena->base + 2 * row);
+    arena->sc2    = (uint16_t *) (arena->base + 3 * row);
+    arena->sc3    = (uint16_t *) (arena->base + 4 * row);
+    arena->out    = (uint16_t *) (arena->base + 5 * row);
 
-    xMin    = dx;
-    xMax    = dx + dw;
+    return (true);
+}
 
-    for(y=0 ; y<dh ; y++)
+static void PreviewBlurArenaFree(PreviewBlurArena * arena)
+{
+    IODelete(arena->base, uint8_t, arena->size);
+    arena->base = NULL;
+}
+
+static inline uint32_t * PreviewLine(const hibernate_preview_t * src, uint32_t image,
+                                     uint32_t height, uint32_t line)
+{
+    const uint32_t * input = (IOGRAPHICS_TYPEOF(input)) (src + 1);
+
+    return ((uint32_t *) (input[image * height + line] + ((uint8_t *) src)));
+}
+
+// RLE decodes one line straight to luminance, converting each run once
+static void PreviewLumRow16(const uint32_t * input, uint32_t width, uint16_t * lum)
+{
+    typedef u_int16_t   Pixel_Type;
+    const Pixel_Type * pixel;
+    uint32_t           count, repeat, data, i, n, k;
+
+    for (i = 0; i < width;)
     {
-        UInt8 *scan;
+        count  = *input++;
+        repeat = (count & 0xff000000);
+        count ^= repeat;
+        if (!count) break;
+        n      = (count < (width - i)) ? count : (width - i);
+        pixel  = (const Pixel_Type *) input;
+
+        for (k = 0; k < n; k++)
+        {
+            if (!k || !repeat)
+            {
+                data = pixel[repeat ? 0 : k];
+
+                // grayscale
+                // srgb 13933, 46871, 4732
+                // ntsc 19595, 38470, 7471
+                data = 13933 * (0x1f & (data >> 10))
+                     + 46871 * (0x1f & (data >> 5))
+                     +  4732 * (0x1f & data);
+                data >>= 13;
+
+                // 70% white, 30 % black
+                data *= 19661;
+                data += (103 << 16);
+                data >>= 16;
+            }
+            lum[i++] = data;
+        }
 
-        scan = srcbase + *src;
+        input = (const uint32_t *) (pixel + (repeat ? 1 : count));
+    }
+}
+
+static void PreviewLumRow32(const uint32_t * input, uint32_t width, uint16_t * lum)
+{
+    typedef u_int32_t   Pixel_Type;
+    const Pixel_Type * pixel;
+    uint32_t           count, repeat, data, i, n, k;
 
-        if (0 == (y & 7))
+    for (i = 0; i < width;)
+    {
+        count  = *input++;
+        repeat = (count & 0xff000000);
+        count ^= repeat;
+        if (!count) break;
+        n      = (count < (width - i)) ? count : (width - i);
+        pixel  = (const Pixel_Type *) input;
+
+        for (k = 0; k < n; k++)
         {
-            AbsoluteTime deadline;
-            clock_interval_to_deadline(8, kMicrosecondScale, &deadline);
-            assert_wait_deadline((event_t)&clock_delay_until, THREAD_UNINT, __OSAbsoluteTime(deadline));
-            thread_block(NULL);
+            if (!k || !repeat)
+            {
+                data = pixel[repeat ? 0 : k];
+
+                // grayscale
+                // srgb 13933, 46871, 4732
+                // ntsc 19595, 38470, 7471
+                data = 13933 * (0xff & (data >> 24))
+                     + 46871 * (0xff & (data >> 16))
+                     +  4732 * (0xff & data);
+                data >>= 16;
+
+                // 70% white, 30 % black
+                data *= 19661;
+                data += (103 << 16);
+                data >>= 16;
+            }
+            lum[i++] = data;
         }
 
-        (depth <= 1  ? DecompressRLE8 :
-            (depth <= 2 ? DecompressRLE16 : DecompressRLE32))
-                (scan, dst, xMin,xMax);
+        input = (const uint32_t *) (pixel + (repeat ? 1 : count));
+    }
+}
 
-        dst = dst + rowbytes;
-        src = src + 1;
+// Runs the row then column cascades on arena->lum, leaves (sum + 128) >> shift in arena->out
+static void PreviewBlurRow(PreviewBlurArena * arena, uint32_t width, uint32_t shift)
+{
+    const uint16_t * lum = arena->lum;
+    uint16_t * sc0 = arena->sc0;
+    uint16_t * sc1 = arena->sc1;
+    uint16_t * sc2 = arena->sc2;
+    uint16_t * sc3 = arena->sc3;
+    uint16_t * out = arena->out;
+    uint32_t   sr0, sr1, sr2, sr3;
+    uint32_t   tmp1, tmp2, i;
+
+    sr0 = sr1 = sr2 = sr3 = 0;
+    for (i = 0; i < (width + 2); i++)
+    {
+        // row cascade
+        tmp2 = sr0 + lum[i];
+        sr0  = lum[i];
+        tmp1 = sr1 + tmp2;
+        sr1  = tmp2;
+        tmp2 = sr2 + tmp1;
+        sr2  = tmp1;
+        tmp1 = sr3 + tmp2;
+        sr3  = tmp2;
+
+        // column cascade
+        tmp2 = sc0[i] + tmp1;
+        sc0[i] = tmp1;
+        tmp1 = sc1[i] + tmp2;
+        sc1[i] = tmp2;
+        tmp2 = sc2[i] + tmp1;
+        sc2[i] = tmp1;
+        out[i] = (128 + sc3[i] + tmp2) >> shift;
+        sc3[i] = tmp2;
     }
 }
 
@@ -644,101 +1512,35 @@ PreviewDecompress16(const hibernate_preview_t * src, uint32_t image,
                         uint32_t width, uint32_t height, uint32_t row, 
                         uint16_t * output)
 {
-    uint32_t i, j;
-    uint32_t * input;
-    
-    uint16_t * sc0 = IONew(uint16_t, (width+2));
-    uint16_t * sc1 = IONew(uint16_t, (width+2));
-    uint16_t * sc2 = IONew(uint16_t, (width+2));
-    uint16_t * sc3 = IONew(uint16_t, (width+2));
-    uint32_t   sr0, sr1, sr2, sr3;
+    PreviewBlurArena arena;
+    uint32_t         i, j, out;
 
-    bzero(sc0, (width+2) * sizeof(uint16_t));
-    bzero(sc1, (width+2) * sizeof(uint16_t));
-    bzero(sc2, (width+2) * sizeof(uint16_t));
-    bzero(sc3, (width+2) * sizeof(uint16_t));
+    if (!PreviewBlurArenaAlloc(&arena, width))
+        return;
 
-    uint32_t tmp1, tmp2, out;
     for (j = 0; j < (height + 2); j++)
     {
-    	input = (IOGRAPHICS_TYPEOF(input)) (src + 1);
-    	input += image * height;
+        // past the last line the luminance row is replicated as is
         if (j < height)
-            input += j;
-        else
-            input += height - 1;
-        input = (uint32_t *)(input[0] + ((uint8_t *)src));
+        {
+            PreviewLumRow16(PreviewLine(src, image, height, j), width, arena.lum);
+            arena.lum[width] = arena.lum[width + 1] = arena.lum[width - 1];
+        }
 
-        uint32_t data = 0, repeat = 0, fetch, count = 0;
-        sr0 = sr1 = sr2 = sr3 = 0;
+        PreviewBlurRow(&arena, width, 11);
 
-        for (i = 0; i < (width + 2); i++)
+        if (j > 1)
         {
-            if (i < width)
+            for (i = 0; i < width; i++)
             {
-                if (!count)
-                {
-                    count = *input++;
-                    repeat = (count & 0xff000000);
-                    count ^= repeat;
-                    fetch = true;
-                }
-                else
-                    fetch = (0 == repeat);
-    
-                count--;
-    
-                if (fetch)
-                {
-                    data = *((uint16_t *)input);
-                    input = (uint32_t *)(((uint8_t *) input) + sizeof(uint16_t));
-    
-                    // grayscale
-                    // srgb 13933, 46871, 4732
-                    // ntsc 19595, 38470, 7471
-                    data = 13933 * (0x1f & (data >> 10))
-                         + 46871 * (0x1f & (data >> 5))
-                         +  4732 * (0x1f & data);
-                    data >>= 13;
-        
-                    // 70% white, 30 % black
-                    data *= 19661;
-                    data += (103 << 16);
-                    data >>= 16;
-                }
+                out = arena.out[i + 2] & 0x1f;
+                output[i] = out | (out << 5) | (out << 10);
             }
-
-            // gauss blur
-            tmp2 = sr0 + data;
-            sr0 = data;
-            tmp1 = sr1 + tmp2;
-            sr1 = tmp2;
-            tmp2 = sr2 + tmp1;
-            sr2 = tmp1;
-            tmp1 = sr3 + tmp2;
-            sr3 = tmp2;
-            
-            tmp2 = sc0[i] + tmp1;
-            sc0[i] = tmp1;
-            tmp1 = sc1[i] + tmp2;
-            sc1[i] = tmp2;
-            tmp2 = sc2[i] + tmp1;
-            sc2[i] = tmp1;
-            out = (128 + sc3[i] + tmp2) >> 11;
-            sc3[i] = tmp2;
-
-            out &= 0x1f;
-            if ((i > 1) && (j > 1))
-                output[i-2] = out | (out << 5) | (out << 10);
-        }
-
-        if (j > 1)
             output += row;
+        }
     }
-    IODelete(sc3, uint16_t, (width+2));
-    IODelete(sc2, uint16_t, (width+2));
-    IODelete(sc1, uint16_t, (width+2));
-    IODelete(sc0, uint16_t, (width+2));
+
+    PreviewBlurArenaFree(&arena);
 }
 
 static void 
@@ -746,101 +1548,35 @@ PreviewDecompress32(const hibernate_preview_t * src, uint32_t image,
                         uint32_t width, uint32_t height, uint32_t row, 
                         uint32_t * output)
 {
-    uint32_t i, j;
-    uint32_t * input;
-    
-    uint16_t * sc0 = IONew(uint16_t, (width+2));
-    uint16_t * sc1 = IONew(uint16_t, (width+2));
-    uint16_t * sc2 = IONew(uint16_t, (width+2));
-    uint16_t * sc3 = IONew(uint16_t, (width+2));
-    uint32_t   sr0, sr1, sr2, sr3;
+    PreviewBlurArena arena;
+    uint32_t         i, j, out;
 
-    bzero(sc0, (width+2) * sizeof(uint16_t));
-    bzero(sc1, (width+2) * sizeof(uint16_t));
-    bzero(sc2, (width+2) * sizeof(uint16_t));
-    bzero(sc3, (width+2) * sizeof(uint16_t));
+    if (!PreviewBlurArenaAlloc(&arena, width))
+        return;
 
-    uint32_t tmp1, tmp2, out;
     for (j = 0; j < (height + 2); j++)
     {
-    	input = (IOGRAPHICS_TYPEOF(input)) (src + 1);
-    	input += image * height;
+        // past the last line the luminance row is replicated as is
         if (j < height)
-            input += j;
-        else
-            input += height - 1;
-        input = (uint32_t *)(input[0] + ((uint8_t *)src));
+        {
+            PreviewLumRow32(PreviewLine(src, image, height, j), width, arena.lum);
+            arena.lum[width] = arena.lum[width + 1] = arena.lum[width - 1];
+        }
 
-        uint32_t data = 0, repeat = 0, fetch, count = 0;
-        sr0 = sr1 = sr2 = sr3 = 0;
+        PreviewBlurRow(&arena, width, 8);
 
-        for (i = 0; i < (width + 2); i++)
+        if (j > 1)
         {
-            if (i < width)
+            for (i = 0; i < width; i++)
             {
-                if (!count)
-                {
-                    count = *input++;
-                    repeat = (count & 0xff000000);
-                    count ^= repeat;
-                    fetch = true;
-                }
-                else
-                    fetch = (0 == repeat);
-    
-                count--;
-    
-                if (fetch)
-                {
-                    data = *input++;
-    
-                    // grayscale
-                    // srgb 13933, 46871, 4732
-                    // ntsc 19595, 38470, 7471
-                    data = 13933 * (0xff & (data >> 24))
-                         + 46871 * (0xff & (data >> 16))
-                         +  4732 * (0xff & data);
-                    data >>= 16;
-        
-                    // 70% white, 30 % black
-                    data *= 19661;
-                    data += (103 << 16);
-                    data >>= 16;
-                }
+                out = arena.out[i + 2] & 0xff;
+                output[i] = out | (out << 8) | (out << 16);
             }
-
-            // gauss blur
-            tmp2 = sr0 + data;
-            sr0 = data;
-            tmp1 = sr1 + tmp2;
-            sr1 = tmp2;
-            tmp2 = sr2 + tmp1;
-            sr2 = tmp1;
-            tmp1 = sr3 + tmp2;
-            sr3 = tmp2;
-            
-            tmp2 = sc0[i] + tmp1;
-            sc0[i] = tmp1;
-            tmp1 = sc1[i] + tmp2;
-            sc1[i] = tmp2;
-            tmp2 = sc2[i] + tmp1;
-            sc2[i] = tmp1;
-            out = (128 + sc3[i] + tmp2) >> 8;
-            sc3[i] = tmp2;
-
-            out &= 0xff;
-            if ((i > 1) && (j > 1))
-                output[i-2] = out | (out << 8) | (out << 16);
-        }
-
-        if (j > 1)
             output += row;
+        }
     }
 
-    IODelete(sc3, uint16_t, (width+2));
-    IODelete(sc2, uint16_t, (width+2));
-    IODelete(sc1, uint16_t, (width+2));
-    IODelete(sc0, uint16_t, (width+2));
+    PreviewBlurArenaFree(&arena);
 }
 
 bool PreviewDecompressData(void *srcbase, uint32_t image, void *dstbase,
@@ -0,0 +1,156 @@
+//
+//  IOGDiagnoseRender.hpp
+//  iogdiagnose
+//
+//  Text rendering of GTrace tokens for the iogdiagnose report, shared with
+//  tools/renderbench.cpp, see tools/CMakeLists.txt.
+//
+
+#ifndef IOGDiagnoseRender_hpp
+#define IOGDiagnoseRender_hpp
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "IOKit/graphics/GTraceTypes.hpp"
+
+// Longest formatEntry() line, every field at its widest plus the newline
+constexpr size_t kEntryLineMax = 320;
+
+// printf("%0*llu", width, v) without the format parsing
+inline char* putDec(char* out, uint64_t v, const int width = 1)
+{
+    char digits[20];
+    int n = 0;
+    do {
+        digits[n++] = static_cast<char>('0' + v % 10);
+        v /= 10;
+    } while (v);
+    for (int pad = width - n; pad > 0; --pad)
+        *out++ = '0';
+    while (n)
+        *out++ = digits[--n];
+    return out;
+}
+
+// printf("%#llx", v), which prints 0 without the 0x prefix
+inline char* putHex(char* out, uint64_t v)
+{
+    static const char kHex[] = "0123456789abcdef";
+    if (!v) {
+        *out++ = '0';
+        return out;
+    }
+    char digits[16];
+    int n = 0;
+    for (; v; v >>= 4)
+        digits[n++] = kHex[v & 0xf];
+    *out++ = '0'; *out++ = 'x';
+    while (n)
+        *out++ = digits[--n];
+    return out;
+}
+
+inline char* putStr(char* out, const char* str)
+{
+    while (*str)
+        *out++ = *str++;
+    return out;
+}
+
+// Same text as
+// "\t\tTkn: %06u\tTS: %llu\tLn: %u\tC: %#llx\tCTID: %u-%#llx\t"
+// "OID: %#llx\tTag: %#llx\tA: %#llx-%#llx-%#llx-%#llx\n", but hand rolled as
+// snprintf dominated the time taken to write a report. Formats into a
+// caller's buffer of at least kEntryLineMax bytes and returns the length.
+inline size_t formatEntry(char* const buf, const unsigned currentLine,
+                          const GTraceEntry& entry)
+{
+    char* out = buf;
+    out = putStr(out, "\t\tTkn: ");  out = putDec(out, currentLine, 6);
+    out = putStr(out, "\tTS: ");      out = putDec(out, entry.timestamp());
+    out = putStr(out, "\tLn: ");      out = putDec(out, entry.line());
+    out = putStr(out, "\tC: ");       out = putHex(out, entry.component());
+    out = putStr(out, "\tCTID: ");    out = putDec(out, entry.cpu());
+    *out++ = '-';                     out = putHex(out, entry.threadID());
+    out = putStr(out, "\tOID: ");     out = putHex(out, entry.registryID());
+    out = putStr(out, "\tTag: ");     out = putHex(out, entry.tag());
+    out = putStr(out, "\tA: ");       out = putHex(out, entry.arg64(0));
+    for (int i = 1; i < 4; ++i) {
+        *out++ = '-';
+        out = putHex(out, entry.arg64(i));
+    }
+    *out++ = '\n';
+    *out = '\0';
+    assert(static_cast<size_t>(out - buf) < kEntryLineMax);
+    return static_cast<size_t>(out - buf);
+}
+
+// Writes entries as lines firstLine onwards. Entries are formatted in chunks,
+// each into its own preallocated buffer, by this thread and up to workers
+// more, then written out in order as soon as they are done.
+inline void writeEntries(FILE* outfile,
+                         const std::vector<const GTraceEntry*>& entries,
+                         const unsigned firstLine, const size_t workerCount)
+{
+    static constexpr size_t kChunkEntries = 2048;  // ~350KiB of text
+
+    struct Chunk {
+        std::vector<char> fText;
+        size_t            fLength = 0;
+        bool              fDone = false;
+    };
+    const size_t chunkCount = (entries.size() + kChunkEntries - 1)
+                            / kChunkEntries;
+    std::vector<Chunk> chunks(chunkCount);
+    std::mutex doneLock;
+    std::condition_variable doneCond;
+    std::atomic<size_t> nextChunk{0};
+
+    auto formatChunks = [&]() {
+        for (;;) {
+            const size_t ci = nextChunk.fetch_add(1, std::memory_order_relaxed);
+            if (ci >= chunkCount)
+                return;
+            const size_t first = ci * kChunkEntries;
+            const size_t last = std::min(first + kChunkEntries, entries.size());
+            Chunk& chunk = chunks[ci];
+            chunk.fText.resize((last - first) * kEntryLineMax);
+            char* out = chunk.fText.data();
+            for (size_t i = first; i < last; ++i) {
+                out += formatEntry(out, static_cast<unsigned>(firstLine + i),
+                                   *entries[i]);
+            }
+            std::lock_guard<std::mutex> locked(doneLock);
+            chunk.fLength = out - chunk.fText.data();
+            chunk.fDone = true;
+            doneCond.notify_all();
+        }
+    };
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < std::min(workerCount, chunkCount); ++i)
+        workers.emplace_back(formatChunks);
+    // This thread takes its share too, so it never sits waiting for chunk 0
+    // while it could format, and formats everything if there are no workers.
+    formatChunks();
+
+    for (Chunk& chunk : chunks) {
+        {
+            std::unique_lock<std::mutex> locked(doneLock);
+            doneCond.wait(locked, [&chunk] { return chunk.fDone; });
+        }
+        fwrite(chunk.fText.data(), 1, chunk.fLength, outfile);
+        std::vector<char>().swap(chunk.fText);  // Release as we go
+    }
+    for (std::thread& worker : workers)
+        worker.join();
+}
+
+#endif // IOGDiagnoseRender_hpp
@@ -73,11 +73,14 @@
 
 // C++ headers
 #include <cassert>
+#include <chrono>
+#include <csignal>
 #include <cstdlib>
 #include <cstdint>
 #include <cstdio>
 #include <ctime>
 #include <string>
+#include <thread>
 #include <vector>
 #include <algorithm>
 
@@ -89,11 +92,13 @@ extern char **environ;
 #include <getopt.h>
 #include <spawn.h>
 #include <sys/wait.h>
+#include <unistd.h>
 
 #include "iokit"
 
 #include "IOGraphicsDiagnose.h"
 #include "IOGDiagnoseUtils.hpp"
+#include "IOGDiagnoseRender.hpp"
 
 #include "IOKit/graphics/GTraceTypes.hpp"
 
@@ -120,6 +125,9 @@ void print_usage(const char* name)
 
     fprintf(stdout, "\n\t--binary | -b binary_file\n");
 
+    fprintf(stdout, "\n\t--follow | -F binary_file\n");
+    fprintf(stdout, "\t\tStream GTrace buffers into binary_file until interrupted (needs iog=0x8000 boot-arg)\n");
+
     fprintf(stdout, "\n");
     fflush(stdout);
 }
@@ -144,29 +152,6 @@ void foutsep(FILE* outfile, const string title)
 }
 inline void foutsep(FILE* outfile) { foutsep(outfile, string()); }
 
-string stringf(const char *fmt, ...)
-{
-    va_list args;
-    char buffer[1024]; // pretty big, but userland stacks are big
-
-    va_start(args, fmt);
-    const auto len = vsnprintf(buffer, sizeof(buffer), fmt, args);
-    va_end(args);
-    assert(len < sizeof(buffer)); (void) len;
-    return buffer;
-}
-
-string formatEntry(const int currentLine, const GTraceEntry& entry)
-{
-    return stringf(
-            "\t\tTkn: %06u\tTS: %llu\tLn: %u\tC: %#llx\tCTID: %u-%#llx\t"
-            "OID: %#llx\tTag: %#llx\tA: %#llx-%#llx-%#llx-%#llx\n",
-            currentLine, entry.timestamp(), entry.line(), entry.component(),
-            entry.cpu(), entry.threadID(), entry.registryID(),
-            entry.tag(), entry.arg64(0), entry.arg64(1),
-            entry.arg64(2), entry.arg64(3));
-}
-
 void agdcdiagnose(FILE * outfile)
 {
 #define AGCKEXT      "/System/Library/Extensions/AppleGraphicsControl.kext/"
@@ -190,20 +175,20 @@ void agdcdiagnose(FILE * outfile)
     }
 }
 
+// Entries are formatted in parallel by writeEntries(), see
+// IOGDiagnoseRender.hpp, and written out in order.
 void dumpTokenBuffer(FILE* outfile, const vector<GTraceBuffer>& gtraces)
 {
-    unsigned currentLine = 0;
-    long total_lines = 1; // Include magic
+    vector<const GTraceEntry*> entries;
     for (const GTraceBuffer& buffer : gtraces)
-        total_lines += buffer.vec().size();
-    if (!total_lines) {
-        fprintf(outfile, "-1 (No Token Data Recorded)\n\n");
-        return;
-    }
+        for (const GTraceEntry& entry : buffer.vec())
+            entries.push_back(&entry);
+    const long total_lines = 1 + entries.size(); // Include magic
 
     // Marks beginning of a multi
     const GTraceEntry magic(gtraces.size(), GTRACE_REVISION);
-    string line = formatEntry(currentLine++, magic);
+    char line[kEntryLineMax];
+    const size_t lineLen = formatEntry(line, 0, magic);
 
     fputs("\n\n", outfile);
     fprintf(outfile, "Token Buffers Recorded: %d\n",
@@ -212,14 +197,10 @@ void dumpTokenBuffer(FILE* outfile, const vector<GTraceBuffer>& gtraces)
     fprintf(outfile, "Token Buffer Size     : %ld\n",
             total_lines * kGTraceEntrySize);
     fprintf(outfile, "Token Buffer Data     :\n");
-    fputs(line.c_str(), outfile); // out magic marks as v2 or later
+    fwrite(line, 1, lineLen, outfile); // out magic marks as v2 or later
 
-    for (const GTraceBuffer& buffer : gtraces) {
-        for (const GTraceEntry& entry : buffer.vec()) {
-            line = formatEntry(currentLine++, entry);
-            fputs(line.c_str(), outfile);
-        }
-    }
+    const size_t cpus = std::max(1u, std::thread::hardware_concurrency());
+    writeEntries(outfile, entries, 1, cpus - 1);  // Line 0 is the magic
     fputc('\n', outfile);
 }
 
@@ -480,6 +461,183 @@ IOReturn fetchGTraceBuffers(const IOConnect& gtrace,
     return err;
 }
 
+// Drain the live rings every kFollowPollMs, ring lag is bounded by the poll.
+// Tokens are written as self describing buffer chunks, at most every
+// kFollowChunkSecs or kFollowChunkTokens, whichever comes first. The leading
+// magic entry counts the chunks and is rewritten when following stops.
+const useconds_t kFollowPollMs      = 10;
+const int        kFollowChunkSecs   = 5;
+const size_t     kFollowChunkTokens = 8192;
+const int        kFollowReportSecs  = 60;
+const int        kFollowMaxChunks   = INT16_MAX;
+
+volatile sig_atomic_t sStopFollowing = 0;
+void stopFollowing(int) { sStopFollowing = 1; }
+
+struct FollowedBuffer {
+    using clock = std::chrono::steady_clock;
+
+    FollowedBuffer(uint32_t type, mach_vm_address_t addr, mach_vm_size_t size)
+        : fType(type), fAddr(addr),
+          fReader(reinterpret_cast<const void*>(addr), size),
+          fLastChunk(clock::now()) {}
+
+    uint32_t                  fType;
+    mach_vm_address_t         fAddr;
+    GTraceStreamReader        fReader;
+    GTraceBuffer::vector_type fPending;     // Drained, not yet written
+    clock::time_point         fLastChunk;
+    uint64_t                  fSkipUntil = 0;  // Already in the snapshot
+    uint64_t                  fWritten = 0;
+};
+
+bool writeGTraceChunk(FILE* fp, FollowedBuffer* bufP, int* chunksP)
+{
+    auto& pending = bufP->fPending;
+    bufP->fLastChunk = FollowedBuffer::clock::now();
+    if (pending.empty())
+        return true;
+    if (*chunksP >= kFollowMaxChunks)
+        return false;
+
+    const size_t count = std::min(pending.size(), kFollowChunkTokens);
+    GTraceEntry chunk[kGTraceHeaderEntries];
+    memset(chunk, 0, sizeof(chunk));
+    GTraceHeader& header = *reinterpret_cast<GTraceHeader*>(chunk);
+    header = bufP->fReader.header();
+    header.fBreadcrumbTokens = 0;
+    header.fTokensCopied = static_cast<uint16_t>(count);
+    header.fBufferSize
+        = static_cast<uint32_t>(kGTraceHeaderSize + count * kGTraceEntrySize);
+    fwrite(chunk, sizeof(chunk), 1, fp);
+    fwrite(pending.data(), sizeof(GTraceEntry), count, fp);
+    fflush(fp);
+
+    pending.erase(pending.begin(), pending.begin() + count);
+    bufP->fWritten += count;
+    ++*chunksP;
+    return true;
+}
+
+void reportFollowing(const vector<FollowedBuffer>& buffers)
+{
+    for (const auto& buf : buffers) {
+        char name[sizeof(buf.fReader.header().fBufferName) + 1] = "";
+        memcpy(name, buf.fReader.header().fBufferName, sizeof(name) - 1);
+        fprintf(stderr, "iogdiagnose: %s[%u] wrote %llu, overrun %llu, "
+                "dropped %llu tokens\n", name, buf.fReader.header().fBufferID,
+                buf.fWritten, buf.fReader.overruns(), buf.fReader.dropped());
+    }
+}
+
+int followGTrace(const IOConnect& gtrace, const char* filename)
+{
+    vector<FollowedBuffer> buffers;
+    buffers.reserve(kGTraceMaximumBufferCount);
+    for (int i = 0; i < kGTraceMaximumBufferCount; i++) {
+        const uint32_t type = kGTraceStreamMemoryType(i);
+        mach_vm_address_t addr = 0;
+        mach_vm_size_t size = 0;
+        if (gtrace.mapMemory(type, kIOMapAnywhere | kIOMapReadOnly,
+                             &addr, &size))
+            continue;  // Not a streaming buffer
+        buffers.emplace_back(type, addr, size);
+        if (!buffers.back().fReader.valid()) {
+            fprintf(stderr, "iogdiagnose: malformed gtrace stream %d\n", i);
+            gtrace.unmapMemory(type, addr);
+            buffers.pop_back();
+        }
+    }
+    if (buffers.empty()) {
+        fprintf(stderr, "iogdiagnose: No streaming GTrace buffers, "
+                        "boot with iog=0x8000\n");
+        return EXIT_FAILURE;
+    }
+
+    // Start with a snapshot for the history and breadcrumbs, streamed tokens
+    // it already holds are skipped.
+    vector<GTraceBuffer> gtraces;
+    (void) fetchGTraceBuffers(gtrace, &gtraces);
+    for (auto& buf : buffers) {
+        for (const auto& snap : gtraces) {
+            if (snap.header().fBufferID != buf.fReader.header().fBufferID)
+                continue;
+            GTraceBuffer::ctokens_type tokens = snap.ctokens();
+            for (auto citer = tokens.first; citer != tokens.second; ++citer)
+                buf.fSkipUntil = std::max(buf.fSkipUntil, citer->timestamp());
+        }
+    }
+
+    FILE* fp = fopen(filename, "w");
+    if (!static_cast<bool>(fp)) {
+        fprintf(stderr,
+                "iogdiagnose: Failed to open %s for write access\n", filename);
+        return EXIT_FAILURE;
+    }
+    int chunks = static_cast<int>(gtraces.size());
+    const GTraceEntry placeholder(0, GTRACE_REVISION);
+    fwrite(&placeholder, sizeof(placeholder), 1, fp);
+    for (const GTraceBuffer& buf : gtraces)
+        fwrite(buf.data(), sizeof(*buf.data()), buf.size(), fp);
+
+    signal(SIGINT, stopFollowing);
+    signal(SIGTERM, stopFollowing);
+    fprintf(stderr, "iogdiagnose: following %zu GTrace buffers into %s, "
+                    "^C to stop\n", buffers.size(), filename);
+
+    auto lastReport = FollowedBuffer::clock::now();
+    bool full = false;
+    while (!full) {
+        const bool stopping = static_cast<bool>(sStopFollowing);
+        const auto now = FollowedBuffer::clock::now();
+        for (auto& buf : buffers) {
+            auto& pending = buf.fPending;
+            const size_t first = pending.size();
+            buf.fReader.drain(&pending);
+            if (buf.fSkipUntil) {
+                const uint64_t skipUntil = buf.fSkipUntil;
+                const auto stale = std::remove_if(
+                    pending.begin() + first, pending.end(),
+                    [skipUntil](const GTraceEntry& entry)
+                        { return entry.timestamp() <= skipUntil; });
+                if (stale == pending.begin() + first)
+                    buf.fSkipUntil = 0;  // Past the snapshot
+                pending.erase(stale, pending.end());
+            }
+            while (!full && (pending.size() >= kFollowChunkTokens
+                         || (stopping && !pending.empty())
+                         || now - buf.fLastChunk
+                                >= std::chrono::seconds(kFollowChunkSecs)))
+            {
+                full = !writeGTraceChunk(fp, &buf, &chunks);
+                if (pending.empty())
+                    break;
+            }
+        }
+        if (stopping)
+            break;
+        if (now - lastReport >= std::chrono::seconds(kFollowReportSecs)) {
+            reportFollowing(buffers);
+            lastReport = now;
+        }
+        usleep(kFollowPollMs * 1000);
+    }
+    if (full)
+        fprintf(stderr, "iogdiagnose: %s is full, stopped following\n",
+                filename);
+
+    // Now that the number of buffers is known, fix up the leading magic
+    const GTraceEntry magic(static_cast<int16_t>(chunks), GTRACE_REVISION);
+    fseek(fp, 0, SEEK_SET);
+    fwrite(&magic, sizeof(magic), 1, fp);
+    fclose(fp);
+
+    reportFollowing(buffers);
+    for (const auto& buf : buffers)
+        gtrace.unmapMemory(buf.fType, buf.fAddr);
+    return EXIT_SUCCESS;
+}
+
 // If errmsgP is set then the caller is required to free returned string
 kern_return_t iogDiagnose(
         const IOConnect& diag, IOGDiagnose* reportP, size_t reportLength,
@@ -537,12 +695,14 @@ int main(int argc, char * argv[])
 {
     bool                 bDumpToFile = false;
     bool                 bBinaryToFile = false;
+    bool                 bFollowToFile = false;
     int                  flagInd = 0;
     int                  flag = 0;
     char                 inputFilename[256] = { 0 };
     static struct option opts[] = {
         "file",   optional_argument,  nullptr, 'f',
         "binary", required_argument,  nullptr, 'b',
+        "follow", required_argument,  nullptr, 'F',
         nullptr,  no_argument,        nullptr,  0 ,
     };
     
@@ -551,7 +711,7 @@ int main(int argc, char * argv[])
     if (is_intel_mac()==false)
         return EXIT_SUCCESS;
     
-    const char*          argKeys = "fb:";
+    const char*          argKeys = "fb:F:";
 
     while (-1 != (flag = getopt_long(argc, argv, argKeys, opts, &flagInd)) ) {
         switch (flag) {
@@ -567,6 +727,15 @@ int main(int argc, char * argv[])
                 }
             }
             break;
+        case 'F':
+            if (optarg != nullptr) {
+                const size_t len = strlen(optarg);
+                if (len < sizeof(inputFilename)) {
+                    strncpy(inputFilename, optarg, len);
+                    bFollowToFile = true;
+                }
+            }
+            break;
         default:
             print_usage(argv[0]);
             exit(EXIT_FAILURE);
@@ -581,6 +750,14 @@ int main(int argc, char * argv[])
     const char *error = nullptr;
     kern_return_t err = kIOReturnSuccess;
 
+    if (bFollowToFile) {
+        IOConnect gtrace; // GTrace connection
+        err = openGTrace(&gtrace, &error);
+        if (err)
+            reportFailure(error, err);
+        exit(followGTrace(gtrace, inputFilename));
+    }
+
     vector<GTraceBuffer> gtraces;
     {
         IOConnect gtrace; // GTrace connection
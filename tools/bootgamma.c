@@ -1,5 +1,5 @@
 /*
-cc -o /tmp/bootgamma bootgamma.c -framework IOKit -framework CoreFoundation
+cc -I../IOGraphicsFamily -o /tmp/bootgamma bootgamma.c -framework IOKit -framework CoreFoundation
 */
 
 #include <stdlib.h>
@@ -11,46 +11,7 @@ cc -o /tmp/bootgamma bootgamma.c -framework IOKit -framework CoreFoundation
 #include <IOKit/IOKitLib.h>
 #include <IOKit/graphics/IOGraphicsTypesPrivate.h>
 #include <CoreFoundation/CoreFoundation.h>
-
-
-
-
-void IOFBDecompressGamma(const IOFBBootGamma * bootGamma, uint16_t * data, uint16_t count)
-{
-	const IOFBGamma * channelGamma;
-	uint16_t channel, idx, maxIdx, seg;
-	uint16_t startIn, startOut, point;
-	uint16_t endIn, endOut;
-
-	maxIdx = count - 1;
-	channelGamma = &bootGamma->gamma.red;
-	for (channel = 0; channel < 3; channel++)
-	{
-		seg = 0;
-		startIn = 0;
-		startOut = 0x0000;
-		endIn = 0;
-		endOut = 0;
-		for (idx = 0; idx <= maxIdx; idx++)
-		{
-			point = idx * 65535 / maxIdx;
-			if ((point >= endIn) && (idx != maxIdx))
-			{
-				startIn = endIn;
-				startOut = endOut;
-				if (seg < channelGamma->pointCount)
-				{
-					endIn  = channelGamma->points[seg].in;
-					endOut = channelGamma->points[seg].out;
-					seg++;
-				}
-				else endIn = endOut = 0xFFFF;
-			}
-			data[channel * count + idx] = startOut + ((endOut - startOut) * (point - startIn)) / (endIn - startIn);
-		}
-		channelGamma = (typeof(channelGamma)) &channelGamma->points[channelGamma->pointCount];
-	}
-}
+#include "IOFBGammaFit.h"
 
 int main(int argc, char * argv[])
 {
@@ -0,0 +1,339 @@
+//
+//  compresslinetest.cpp
+//  IOGraphics
+//
+//  Differential fuzz test of the preview line compressors in bmcompress.h
+//  against the byte at a time versions they replaced, which are kept below
+//  as they were. Random and flat run lines at 8, 16 and 32 bpp, of random
+//  width and alignment, must compress to the same bytes.
+//
+//  compresslinetest [<seed> [<lines>]]
+//
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#include <IOKit/IOLib.h>
+#include <IOKit/IOHibernatePrivate.h>
+#include <IOKit/graphics/IOGraphicsPrivate.h>
+
+#include "bmcompress.h"
+
+namespace {
+
+// The compressors before run_length(), unchanged
+
+
+
+static inline int compress_line_32_v0(UInt8 *srcbase, int width, UInt8 *dstbase)
+{
+    uint32_t  *src, *dst;
+    uint32_t  *start, *end;
+    uint32_t   c0,c1;
+    int        cpyCnt, rplCnt, wrtCnt;
+
+    wrtCnt = 0;
+    src    = (uint32_t *)srcbase;
+    dst    = (uint32_t *)dstbase;
+    end    = src + width;
+
+    while(src<end)
+    {
+        cpyCnt = 0;
+        rplCnt = 1;
+        start  = src;
+        c0     = src[0];
+
+        for(src++ ; src<end ; src++)
+        {
+            c1 = src[0];
+
+            if(c1 != c0)
+            {
+                if(rplCnt >= 4)  break;
+
+                cpyCnt = cpyCnt + rplCnt;
+                rplCnt = 1;
+                c0     = c1;
+            }
+
+            else
+                rplCnt++;
+        }
+
+        if(rplCnt < 4)
+        {
+            cpyCnt = cpyCnt + rplCnt;
+            rplCnt = 0;
+        }
+
+        if(cpyCnt > 0)
+        {
+            dst[0] = cpyCnt;
+            bcopy_nc(start, &dst[1], 4*cpyCnt);
+
+            wrtCnt = wrtCnt + cpyCnt + 1;
+            dst    = dst + cpyCnt + 1;
+        }
+
+        if(rplCnt > 0)
+        {
+            dst[0] = 0x80000000 | rplCnt;
+            dst[1] = c0;
+
+            wrtCnt = wrtCnt + 2;
+            dst    = dst + 2;
+        }
+    }
+
+    return 4*wrtCnt;
+}
+
+static inline int compress_line_16_v0(uint8_t *srcbase, int width, uint8_t *dstbase)
+{
+    typedef u_int16_t   Pixel_Type;
+    typedef u_int32_t   CodeWord_Type;
+    Pixel_Type  *src, *dst;
+    Pixel_Type  *start, *end;
+    Pixel_Type   c0,c1;
+    int        cpyCnt, rplCnt, wrtCnt;
+    const int kMinRunLength = ( 2 * sizeof(CodeWord_Type)  + 2 * sizeof
+( Pixel_Type ) ) / sizeof( Pixel_Type );
+
+    wrtCnt = 0;
+    src    = (Pixel_Type *)srcbase;
+    dst    = (Pixel_Type *)dstbase;
+    end    = src + width;
+
+    while(src < end)
+    {
+        cpyCnt = 0;
+        rplCnt = 1;
+        start  = src;
+        c0     = src[0];
+
+        for(src++ ; src < end ; src++)
+        {
+            c1 = src[0];
+
+            if(c1 != c0)
+            {
+                if(rplCnt >= kMinRunLength)  break;
+
+                cpyCnt = cpyCnt + rplCnt;
+                rplCnt = 1;
+                c0     = c1;
+            }
+            else
+                rplCnt++;
+        }
+
+        if(rplCnt < kMinRunLength )
+        {
+            cpyCnt = cpyCnt + rplCnt;
+            rplCnt = 0;
+        }
+
+        if(cpyCnt > 0)
+        {
+            CodeWord_Type       *codeWord = (CodeWord_Type*) dst;
+            codeWord[0] = cpyCnt;
+            dst = (Pixel_Type*) (codeWord + 1);
+            bcopy_nc(start, dst, sizeof( Pixel_Type )*cpyCnt);
+
+            wrtCnt = wrtCnt + cpyCnt + sizeof(CodeWord_Type) / sizeof
+( Pixel_Type );
+            dst    = dst + cpyCnt;
+        }
+
+        if(rplCnt > 0)
+        {
+            CodeWord_Type       *codeWord = (CodeWord_Type*) dst;
+            codeWord[0] = 0x80000000UL | rplCnt;
+            dst = (Pixel_Type*) (codeWord + 1);
+            dst[0] = c0;
+
+            wrtCnt = wrtCnt + 1 + sizeof(CodeWord_Type) / sizeof
+( Pixel_Type );
+            dst    = dst + 1;
+        }
+    }
+
+    return sizeof( Pixel_Type )*wrtCnt;
+}
+
+static inline int compress_line_8_v0(uint8_t *srcbase, int width, uint8_t *dstbase)
+{
+    typedef u_int8_t    Pixel_Type;
+    typedef u_int32_t   CodeWord_Type;
+    Pixel_Type  *src, *dst;
+    Pixel_Type  *start, *end;
+    Pixel_Type   c0,c1;
+    int        cpyCnt, rplCnt, wrtCnt;
+    const int kMinRunLength = ( 2 * sizeof(CodeWord_Type)  + 2 * sizeof
+( Pixel_Type ) ) / sizeof( Pixel_Type );
+
+    wrtCnt = 0;
+    src    = (Pixel_Type *)srcbase;
+    dst    = (Pixel_Type *)dstbase;
+    end    = src + width;
+
+    while(src < end)
+    {
+        cpyCnt = 0;
+        rplCnt = 1;
+        start  = src;
+        c0     = src[0];
+
+        for(src++ ; src < end ; src++)
+        {
+            c1 = src[0];
+
+            if(c1 != c0)
+            {
+                if(rplCnt >= kMinRunLength)  break;
+
+                cpyCnt = cpyCnt + rplCnt;
+                rplCnt = 1;
+                c0     = c1;
+            }
+            else
+                rplCnt++;
+        }
+
+        if(rplCnt < kMinRunLength )
+        {
+            cpyCnt = cpyCnt + rplCnt;
+            rplCnt = 0;
+        }
+
+        if(cpyCnt > 0)
+        {
+            CodeWord_Type       *codeWord = (CodeWord_Type*) dst;
+            codeWord[0] = cpyCnt;
+            dst = (Pixel_Type*) (codeWord + 1);
+            bcopy_nc(start, dst, sizeof( Pixel_Type )*cpyCnt);
+
+            wrtCnt = wrtCnt + cpyCnt + sizeof(CodeWord_Type) / sizeof
+( Pixel_Type );
+            dst    = dst + cpyCnt;
+        }
+
+        if(rplCnt > 0)
+        {
+            CodeWord_Type       *codeWord = (CodeWord_Type*) dst;
+            codeWord[0] = 0x80000000UL | rplCnt;
+            dst = (Pixel_Type*) (codeWord + 1);
+            dst[0] = c0;
+
+            wrtCnt = wrtCnt + 1 + sizeof(CodeWord_Type) / sizeof
+( Pixel_Type );
+            dst    = dst + 1;
+        }
+    }
+
+    return sizeof( Pixel_Type )*wrtCnt;
+}
+
+
+// xorshift, reproducible from the seed printed on failure
+struct Random {
+    uint64_t fState;
+    explicit Random(uint64_t seed) : fState(seed ? seed : 1) {}
+    uint64_t next()
+    {
+        fState ^= fState << 13;
+        fState ^= fState >> 7;
+        fState ^= fState << 17;
+        return fState;
+    }
+    uint32_t below(uint32_t n) { return static_cast<uint32_t>(next() % n); }
+};
+
+enum LineKind { kLineRandom, kLineRuns, kLineCount };
+
+// Runs straddle the escape thresholds (4 pixels at 32 bpp, 6 at 16, 10 at 8)
+// and the 8 byte compare, from a small palette so neighbours often repeat.
+void fillLine(Random& r, LineKind kind, uint32_t pixelBytes, uint8_t* line,
+              uint32_t width)
+{
+    uint32_t palette[4];
+    for (auto& c : palette)
+        c = static_cast<uint32_t>(r.next());
+    uint32_t x = 0;
+    while (x < width) {
+        uint32_t run, color;
+        if (kLineRandom == kind) {
+            run = 1;
+            color = static_cast<uint32_t>(r.next());
+        } else {
+            run = (r.below(4) ? 1 + r.below(12) : 1 + r.below(200));
+            color = palette[r.below(4)];
+        }
+        for (; run && x < width; --run, ++x)
+            memcpy(line + x * pixelBytes, &color, pixelBytes);
+    }
+}
+
+int compressV0(uint32_t pixelBytes, uint8_t* src, int width, uint8_t* dst)
+{
+    return ((pixelBytes <= 1 ? compress_line_8_v0 :
+            (pixelBytes <= 2 ? compress_line_16_v0 :
+             compress_line_32_v0))(src, width, dst));
+}
+
+};  // namespace
+
+int main(int argc, char* argv[])
+{
+    const uint64_t seed = (argc > 1) ? strtoull(argv[1], nullptr, 0) : 0x10de;
+    const uint32_t lines = (argc > 2) ? (uint32_t) strtoul(argv[2], nullptr, 0)
+                                      : 20000;
+    constexpr uint32_t kMaxWidth = 3000;
+    constexpr uint8_t kCanary = 0xa5;
+    const uint32_t kPixelBytes[] = { 1, 2, 4 };
+
+    Random r(seed);
+    // Room for the worst case line plus a canary, and a pixel of misalignment
+    std::vector<uint8_t> src(kMaxWidth * 4 + 8);
+    std::vector<uint8_t> expected(8 * (kMaxWidth + 1));
+    std::vector<uint8_t> actual(8 * (kMaxWidth + 1) + 16);
+    int failures = 0;
+
+    for (uint32_t i = 0; i < lines && failures < 10; ++i) {
+        const uint32_t pixelBytes = kPixelBytes[i % 3];
+        const auto kind = static_cast<LineKind>((i / 3) % kLineCount);
+        const uint32_t width = (i % 16) ? 1 + r.below(kMaxWidth)
+                                        : 1 + r.below(24);
+        // Lines aren't always 8 byte aligned in the source mapping
+        uint8_t* line = src.data() + pixelBytes * r.below(2);
+        fillLine(r, kind, pixelBytes, line, width);
+
+        const int want = compressV0(pixelBytes, line, width, expected.data());
+        memset(actual.data(), kCanary, actual.size());
+        const int got = compress_line(pixelBytes, line, width, actual.data());
+
+        bool ok = (want == got) && !memcmp(expected.data(), actual.data(), want);
+        for (size_t b = static_cast<size_t>(got > 0 ? got : 0);
+             ok && b < static_cast<size_t>(got) + 16; ++b)
+            ok = (kCanary == actual[b]);
+        if (!ok) {
+            fprintf(stderr, "compresslinetest: seed 0x%llx line %u, %u bpp %s "
+                    "width %u: %d bytes, expected %d\n",
+                    (unsigned long long) seed, i, pixelBytes * 8,
+                    (kLineRandom == kind) ? "random" : "runs", width, got, want);
+            ++failures;
+        }
+    }
+
+    if (failures) {
+        fprintf(stderr, "compresslinetest: %d failures\n", failures);
+        return EXIT_FAILURE;
+    }
+    fprintf(stdout, "compresslinetest: %u lines passed\n", lines);
+    return EXIT_SUCCESS;
+}
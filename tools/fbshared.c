@@ -150,6 +150,13 @@ int main(int argc, char * argv[])
 		    index, time, delta, usecs, deltaReal, usecsReal, shmem[index]->vblCount,
 		    shmem[index]->vblDeltaMeasured, ((shmem[index]->vblDeltaMeasured * 100.0) / delta),
 		    shmem[index]->vblDrift, ((shmem[index]->vblDrift * 100) / delta));
+
+	    uint64_t phase = (((uint64_t) shmem[index]->vblPhase.hi) << 32 | shmem[index]->vblPhase.lo);
+	    if (shmem[index]->vblPeriod)
+		printf("[%d] estimated VBL 0x%qx, period %f us\n", index, phase,
+		    (shmem[index]->vblPeriod / 65536.0) * timebase.numer / timebase.denom / 1e3);
+	    else
+		printf("[%d] VBL estimate not locked\n", index);
 	}
 	for (index = 0; index < maxIndex; index++)
 	{
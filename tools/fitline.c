@@ -1,5 +1,5 @@
 /*
-cc -o /tmp/fitline fitline.c
+cc -I../IOGraphicsFamily -o /tmp/fitline fitline.c
 */
 
 #include <stdlib.h>
@@ -9,6 +9,7 @@ cc -o /tmp/fitline fitline.c
 #include <strings.h>
 #include <assert.h>
 #include <IOKit/graphics/IOGraphicsTypesPrivate.h>
+#include "IOFBGammaFit.h"
 
 #define SRCDATACOUNT	1024
 
@@ -450,207 +451,38 @@ end
 #endif
 
 
-enum { kIOFBGammaPointCountMax = 256 };
-enum { kIOFBGammaDesiredError = 127 };
-
-struct IOFBLineSeg
-{
-	// [start end]
-    uint16_t start;
-    uint16_t end;
-    uint16_t dist;
-    uint16_t split;
-};
-typedef struct IOFBLineSeg IOFBLineSeg;
-
-static void IOFBSegDist(const uint16_t data[], IOFBLineSeg * seg)
-{
-	uint16_t start;
-	uint16_t end;
-	uint16_t idx;
-	uint16_t interp;
-	int16_t  dist;
-
-	seg->dist  = 0;
-	start = seg->start;
-	end   = seg->end;
-	for (idx = start + 1; idx < end; idx++)
-	{
-		interp = data[start] + ((data[end] - data[start]) * (idx - start)) / (end - start);
-		dist = data[idx] - interp;
-		if (dist < 0) dist = -dist;
-		if (dist > seg->dist)
-		{
-			seg->dist = dist;
-			seg->split = idx;
-		}
-	}
-}
-
-static void IOFBSegInit(const uint16_t data[],
-					IOFBLineSeg * seg, uint16_t start, uint16_t end)
-{
-	seg->start = start;
-	seg->end   = end;
-	IOFBSegDist(data, seg);
-}
-
-static void
-IOFBSimplifySegs(const uint16_t data[], uint16_t srcDataCount,
-				uint16_t desiredError, uint16_t * maxError, 
-				IOFBLineSeg * segs, uint16_t count, uint16_t maxCount,
-				IOFBBootGamma * bootGamma)
-{
-	IOFBGamma * channelGamma;
-	uint16_t    idx;
-	uint16_t    furthest;
-	uint16_t    start;
-
-	while (count < maxCount)
-	{
-		furthest = 0;
-		for (idx = 1; idx < count; idx++)
-		{
-			if (segs[idx].dist > segs[furthest].dist) furthest = idx;
-		}
-		if (segs[furthest].dist <= desiredError) break;
-		bcopy(&segs[furthest+1], &segs[furthest+2], (count - furthest - 1) * sizeof(IOFBLineSeg));
-		count++;
-		assert ((furthest+1) < maxCount);
-		IOFBSegInit(data, &segs[furthest+1], segs[furthest].split, segs[furthest].end);
-		segs[furthest].end = segs[furthest].split;
-		IOFBSegDist(data, &segs[furthest]);
-	}
-
-	*maxError = 0;
-	channelGamma = &bootGamma->gamma.red;
-	for (idx = 0; idx < count; idx++)
-	{
-		if (segs[idx].dist > *maxError) 
-		{
-			*maxError = segs[idx].dist;
-//printf("max error seg 0x%x, 0x%x count %d, target %d\n", segs[idx].start, segs[idx].end, count, maxCount);
-		}
-		start = segs[idx].start % srcDataCount;
-		if (!start)
-		{
-			if (segs[idx].start)
-			{
-				channelGamma = (typeof(channelGamma)) &channelGamma->points[channelGamma->pointCount];
-			}
-			channelGamma->pointCount = 0;
-			continue;
-		}
-		channelGamma->points[channelGamma->pointCount].in = 
-						(start * 65536 / srcDataCount)
-						 | (start * 65536 / srcDataCount / srcDataCount);
-		channelGamma->points[channelGamma->pointCount].out = data[segs[idx].start];
-		channelGamma->pointCount++;
-	}
-}
-
-static bool 
-IOFBCompressGamma(
-	IOFBBootGamma * bootGamma,
-    uint16_t channelCount, uint16_t srcDataCount,
-    uint16_t dataWidth, const void * _data,
-    uint16_t desiredError, uint16_t maxCount,
-    uint16_t * maxError)
-{
-	IOFBGamma * channelGamma;
-	const uint16_t * data = (typeof(data)) _data;
-	uint16_t idx;
-
-	if ((3 != channelCount) || (16 != dataWidth)) return (false);
-
-	data = (typeof(data)) _data;
-
-	IOFBLineSeg * segs;
-	maxCount += 3;
-	segs = malloc(maxCount * sizeof(IOFBLineSeg));
-	memset(segs, 0xee, maxCount * sizeof(IOFBLineSeg));
-
-	for (idx = 0; idx < 3; idx++) IOFBSegInit(data, &segs[idx], idx * srcDataCount, ((idx + 1) * srcDataCount) - 1);
-
-	IOFBSimplifySegs(data, srcDataCount, desiredError, maxError,
-					segs, 3, maxCount,
-					bootGamma);
-	free(segs);
-
-	channelGamma = &bootGamma->gamma.red;
-	for (idx = 0; idx < channelCount; idx++)
-	{
-		channelGamma = (typeof(channelGamma)) &channelGamma->points[channelGamma->pointCount];
-	}
-	bootGamma->length = ((uintptr_t) channelGamma) - ((uintptr_t) bootGamma);
-	return (true);
-}
-
-void IOFBDecompressGamma(const IOFBBootGamma * bootGamma, uint16_t * data, uint16_t count)
-{
-	const IOFBGamma * channelGamma;
-	uint16_t channel, idx, maxIdx, seg;
-	uint16_t startIn, startOut;
-	uint16_t endIn, endOut;
-
-	maxIdx = count - 1;
-	channelGamma = &bootGamma->gamma.red;
-	for (channel = 0; channel < 3; channel++)
-	{
-		seg = 0;
-		startIn = 0;
-		startOut = 0x0000;
-		endIn = 0;
-		endOut = 0;
-		for (idx = 0; idx <= maxIdx; idx++)
-		{
-			if ((idx == endIn) && (idx != maxIdx))
-			{
-				startIn = endIn;
-				startOut = endOut;
-				if (seg < channelGamma->pointCount)
-				{
-					endIn = (channelGamma->points[seg].in * count) >> 16;
-					endOut = channelGamma->points[seg].out;
-					seg++;
-				}
-				else
-				{
-					endIn = maxIdx;
-					endOut = 0xFFFF;
-				}
-			}
-			data[channel * count + idx] = startOut + ((endOut - startOut) * (idx - startIn)) / (endIn - startIn);
-		}
-		channelGamma = (typeof(channelGamma)) &channelGamma->points[channelGamma->pointCount];
-	}
-}
-
-
 int main(int argc, char * argv[])
 {
 	IOFBBootGamma * bootGamma;
+	void * scratch;
 	uint16_t desiredError = kIOFBGammaDesiredError;
 	uint16_t maxCount = kIOFBGammaPointCountMax;
+	uint32_t options = 0;
 	uint16_t maxError;
 	uint32_t srcDataCount = SRCDATACOUNT;
+	bool     fits;
 
 	if (argc > 2)
 	{
 		desiredError = strtol(argv[1], 0, 0);
 		maxCount = strtol(argv[2], 0, 0);
 	}
+	if (argc > 3) options = strtol(argv[3], 0, 0);
 
-	bootGamma = (typeof(bootGamma)) malloc(sizeof(IOFBBootGamma) 
-					+ (maxCount * sizeof(IOFBGammaPoint)));
-	memset(bootGamma, 0xee, sizeof(IOFBBootGamma) + (maxCount * sizeof(IOFBGammaPoint)));
+	bootGamma = (typeof(bootGamma)) malloc(IOFBGammaFitSize(maxCount));
+	memset(bootGamma, 0xee, IOFBGammaFitSize(maxCount));
+	scratch = malloc(IOFBGammaFitScratchSize(srcDataCount, maxCount));
 
 	bootGamma->vendor  = 0;
 	bootGamma->product = 0;
 	bootGamma->serial  = 0;
-	if (IOFBCompressGamma(bootGamma, 3, srcDataCount, 16, &data[0][0], desiredError, maxCount, &maxError))
+	fits = IOFBCompressGamma(bootGamma, 3, srcDataCount, 16, &data[0][0],
+							 desiredError, maxCount, options, scratch, &maxError);
+	free(scratch);
+	if (0xFFFF != maxError)
 	{
-		fprintf(stderr, "compressed gamma to 0x%x bytes, maxError 0x%04x\n", bootGamma->length, maxError);
+		fprintf(stderr, "compressed gamma to 0x%x bytes, maxError 0x%04x%s\n", bootGamma->length, maxError,
+				fits ? "" : ", over kIOFBGammaMaxError");
 
 		IOFBGamma * channelGamma;
 		uint16_t idx, j, channel;
@@ -659,41 +491,42 @@ int main(int argc, char * argv[])
 		for (idx = 0; idx < 3; idx++)
 		{
 			for (j = 0; j < channelGamma->pointCount; j++) fprintf(stderr, "[%d,%02d] 0x%04x 0x%04x\n", idx, j, channelGamma->points[j].in, channelGamma->points[j].out);
-			channelGamma = (typeof(channelGamma)) &channelGamma->points[channelGamma->pointCount];
+			channelGamma = IOFBGammaNextChannel(channelGamma);
 		}
 
-		uint16_t * deco;
-		uint16_t count = 1024;
-		deco = (typeof(deco)) malloc(sizeof(uint16_t) * 3 * count);
-		IOFBDecompressGamma(bootGamma, deco, count);
-
-		uint16_t maxError = 0;
-		uint16_t maxErrorIdx;
-		for (channel = 0; channel < 3; channel++)
+		// Round trip at the table's size, and at the 256 entries of the preview
+		uint16_t counts[] = { SRCDATACOUNT, 256 };
+		for (j = 0; j < 2; j++)
 		{
-			for (idx = 0; idx < count; idx++)
+			uint16_t * deco;
+			uint16_t count = counts[j];
+			deco = (typeof(deco)) malloc(sizeof(uint16_t) * 3 * count);
+			IOFBDecompressGamma(bootGamma, deco, count);
+
+			uint16_t maxError = 0;
+			uint16_t maxErrorIdx = 0;
+			for (channel = 0; channel < 3; channel++)
 			{
-				printf("0x%04x 0x%04x\n",
-					deco[channel * count + idx], data[channel][idx * srcDataCount / 1024]);
-
-				if (idx & 3) continue;
-
-				int16_t error = (deco[channel * count + idx] - data[channel][idx * srcDataCount / 1024]);
-				if (error < 0) error = -error;
-				if (error > maxError)
+				for (idx = 0; idx < count; idx++)
 				{
-					maxErrorIdx = idx;
-					maxError = error;
+					uint32_t src = (idx * (srcDataCount - 1) + (count - 1) / 2) / (count - 1);
+					if (count == srcDataCount) printf("0x%04x 0x%04x\n",
+						deco[channel * count + idx], data[channel][src]);
+
+					int32_t error = (deco[channel * count + idx] - data[channel][src]);
+					if (error < 0) error = -error;
+					if (error > maxError)
+					{
+						maxErrorIdx = idx;
+						maxError = error;
+					}
 				}
 			}
+			free(deco);
+			fprintf(stderr, "%d entries maxError 0x%04x @ 0x%x\n", count, maxError, maxErrorIdx);
 		}
-		free(deco);
-		fprintf(stderr, "maxError 0x%04x @ 0x%x\n", maxError, maxErrorIdx);
-
 	}
 	free(bootGamma);
 
-	return (0);
+	return (fits ? 0 : 1);
 }
-
-
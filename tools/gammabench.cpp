@@ -0,0 +1,139 @@
+//
+//  gammabench.cpp
+//  IOGraphics
+//
+//  Host benchmarks of updateGammaTable()'s table build, the resample plan
+//  and scale pass in IOFBGammaResample.h against the loop before them in
+//  gammav0.h. A set is a new client ramp, resampled and scaled, a fade step
+//  only changes the scale and reuses the resampled ramp. Client ramps of 256
+//  and 1024 entries onto driver tables of 256, 1024 and 4096 10 bit entries.
+//
+//  gammabench [--benchmark_filter=<regex>]
+//
+
+#include <stdint.h>
+#include <string.h>
+
+#include <random>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include <IOKit/IOLib.h>
+
+#include "IOFBGammaResample.h"
+#include "gammav0.h"
+
+namespace {
+
+constexpr uint32_t kWidth = 10;
+
+struct Gamma
+{
+    uint32_t              srcCount;
+    uint32_t              dstCount;
+    std::vector<uint16_t> data;
+    std::vector<UInt8>    table;
+    uintptr_t             scale[4];
+
+    Gamma(const benchmark::State & state)
+        : srcCount((uint32_t) state.range(0)), dstCount((uint32_t) state.range(1)),
+          data(3 * srcCount), table(3 * dstCount * sizeof(UInt16)),
+          scale{ 1 << 16, 1 << 16, 1 << 16, 1 << 16 }
+    {
+        std::mt19937 rng(1);
+        for (uint32_t i = 0; i < data.size(); i++)
+        {
+            const uint32_t idx = i % srcCount;
+            data[i] = (uint16_t) ((idx * 65535ULL) / (srcCount - 1));
+            data[i] ^= (uint16_t) (rng() & 0xff);
+        }
+    }
+
+    // A backlight fade, each step dims all channels a little more
+    void fadeStep(uint64_t step)
+    {
+        scale[3] = (1 << 16) - (uint32_t) ((step * 97) & 0x7fff);
+    }
+};
+
+bool sameTable(Gamma & gamma, IOFBGammaResample * resample)
+{
+    std::vector<UInt8> expect(gamma.table.size());
+    updateGammaTable_v0(3, gamma.srcCount, 16, gamma.data.data(), gamma.dstCount,
+                        kWidth, gamma.scale, true, NULL, expect.data());
+    IOFBGammaResampleRamp(resample, gamma.data.data());
+    IOFBGammaScaleTable(resample->ramp, 3, gamma.dstCount, 16, kWidth,
+                        gamma.scale, true, NULL, gamma.table.data());
+    return (expect == gamma.table);
+}
+
+void BM_GammaSetV0(benchmark::State & state)
+{
+    Gamma gamma(state);
+    uint64_t step = 0;
+    for (auto _ : state)
+    {
+        gamma.fadeStep(step++);
+        updateGammaTable_v0(3, gamma.srcCount, 16, gamma.data.data(), gamma.dstCount,
+                            kWidth, gamma.scale, true, NULL, gamma.table.data());
+        benchmark::DoNotOptimize(gamma.table.data());
+    }
+    state.SetItemsProcessed(state.iterations() * 3 * gamma.dstCount);
+}
+
+// The plan is cached, as the counts don't change, the ramp is not
+void BM_GammaSet(benchmark::State & state)
+{
+    Gamma gamma(state);
+    IOFBGammaResample * resample = IOFBGammaResampleCreate(gamma.srcCount, gamma.dstCount);
+    gamma.fadeStep(1);
+    if (!sameTable(gamma, resample))
+        state.SkipWithError("tables differ");
+    uint64_t step = 0;
+    for (auto _ : state)
+    {
+        gamma.fadeStep(step++);
+        IOFBGammaResampleRamp(resample, gamma.data.data());
+        IOFBGammaScaleTable(resample->ramp, 3, gamma.dstCount, 16, kWidth,
+                            gamma.scale, true, NULL, gamma.table.data());
+        benchmark::DoNotOptimize(gamma.table.data());
+    }
+    state.SetItemsProcessed(state.iterations() * 3 * gamma.dstCount);
+    IOFBGammaResampleFree(resample);
+}
+
+// Only the scale pass, the ramp is still valid
+void BM_GammaFade(benchmark::State & state)
+{
+    Gamma gamma(state);
+    IOFBGammaResample * resample = IOFBGammaResampleCreate(gamma.srcCount, gamma.dstCount);
+    gamma.fadeStep(1);
+    if (!sameTable(gamma, resample))
+        state.SkipWithError("tables differ");
+    uint64_t step = 0;
+    for (auto _ : state)
+    {
+        gamma.fadeStep(step++);
+        IOFBGammaScaleTable(resample->ramp, 3, gamma.dstCount, 16, kWidth,
+                            gamma.scale, true, NULL, gamma.table.data());
+        benchmark::DoNotOptimize(gamma.table.data());
+    }
+    state.SetItemsProcessed(state.iterations() * 3 * gamma.dstCount);
+    IOFBGammaResampleFree(resample);
+}
+
+void GammaSizes(benchmark::internal::Benchmark * b)
+{
+    for (int src : { 256, 1024 })
+        for (int dst : { 256, 1024, 4096 })
+            b->Args({ src, dst });
+}
+
+};  // namespace
+
+BENCHMARK(BM_GammaSetV0)->Apply(GammaSizes);
+BENCHMARK(BM_GammaSet)->Apply(GammaSizes);
+BENCHMARK(BM_GammaFade)->Apply(GammaSizes);
+
+BENCHMARK_MAIN();
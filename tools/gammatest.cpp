@@ -0,0 +1,152 @@
+//
+//  gammatest.cpp
+//  IOGraphics
+//
+//  Bit exactness test of the gamma resample plan and scale pass in
+//  IOFBGammaResample.h against updateGammaTable()'s loop before them, kept
+//  in gammav0.h. Random, monotonic, reversed and extreme client ramps are
+//  resampled onto fewer, as many and more driver entries at several widths,
+//  with and without a gamma scale, then rescaled as a fade step does,
+//  reusing the resampled ramp.
+//
+//  gammatest [<seed>]
+//
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <random>
+#include <vector>
+
+#include <IOKit/IOLib.h>
+
+#include "IOFBGammaResample.h"
+#include "gammav0.h"
+
+namespace {
+
+const uint32_t kSrcCounts[] = { 1, 2, 3, 17, 255, 256, 257, 1000, 1024 };
+const uint32_t kDstCounts[] = { 2, 3, 256, 1024, 1023, 2048, 4096, 65536 };
+const uint32_t kWidths[]    = { 8, 10, 12, 16 };
+enum { kRampRandom, kRampUp, kRampDown, kRampExtreme, kRampCount };
+const char * const kRampNames[] = { "random", "up", "down", "extreme" };
+
+// GAMMA_ADJ's parameters, only used with 8 bit tables
+const uint32_t kAdjustParams[] = { 138, 3, 256, 4 };
+
+std::vector<uint16_t> makeRamp(int kind, uint32_t count, std::mt19937 & rng)
+{
+    std::vector<uint16_t> ramp(3 * count);
+    for (uint32_t i = 0; i < ramp.size(); i++)
+    {
+        const uint32_t idx = i % count;
+        const uint32_t max = count > 1 ? count - 1 : 1;
+        switch (kind)
+        {
+            case kRampRandom:  ramp[i] = (uint16_t) rng(); break;
+            case kRampUp:      ramp[i] = (uint16_t) ((idx * 65535ULL) / max); break;
+            case kRampDown:    ramp[i] = (uint16_t) (65535 - (idx * 65535ULL) / max); break;
+            case kRampExtreme: ramp[i] = (idx & 1) ? 0 : 65535; break;
+        }
+    }
+    return ramp;
+}
+
+size_t tableSize(uint32_t count, uint32_t width)
+{
+    return 3 * count * ((width <= 8) ? 1 : 2);
+}
+
+};  // namespace
+
+int main(int argc, char * argv[])
+{
+    const unsigned seed = (argc > 1) ? (unsigned) strtoul(argv[1], NULL, 0) : 1;
+    std::mt19937 rng(seed);
+    uint32_t cases = 0, failures = 0;
+
+    for (uint32_t srcCount : kSrcCounts)
+    for (uint32_t dstCount : kDstCounts)
+    for (uint32_t width : kWidths)
+    for (int kind = 0; kind < kRampCount; kind++)
+    for (int scaled = 0; scaled < 2; scaled++)
+    {
+        const std::vector<uint16_t> data = makeRamp(kind, srcCount, rng);
+        const uint32_t * adjust = (width <= 8 && (rng() & 1)) ? kAdjustParams : NULL;
+        uintptr_t scale[4] = { 1 << 16, 1 << 16, 1 << 16, 1 << 16 };
+        std::vector<UInt8> expect(tableSize(dstCount, width));
+        std::vector<UInt8> actual(expect.size());
+
+        IOFBGammaResample * resample = IOFBGammaResampleCreate(srcCount, dstCount);
+        if (!resample)
+        {
+            fprintf(stderr, "gammatest: no memory\n");
+            return EXIT_FAILURE;
+        }
+        IOFBGammaResampleRamp(resample, data.data());
+
+        // The first pass sets the table, the next ones are fade steps
+        for (int step = 0; step < (scaled ? 4 : 1); step++)
+        {
+            if (scaled)
+            {
+                for (int c = 0; c < 3; c++)
+                    scale[c] = rng() % ((1 << 16) + 1);
+                scale[3] = (step & 1) ? (1 << 16) : rng() % ((1 << 16) + 1);
+            }
+            const bool haveScale = ((1 << 16) != scale[0]) || ((1 << 16) != scale[1])
+                                || ((1 << 16) != scale[2]) || ((1 << 16) != scale[3]);
+
+            memset(expect.data(), 0xee, expect.size());
+            memset(actual.data(), 0x11, actual.size());
+            updateGammaTable_v0(3, srcCount, 16, data.data(), dstCount, width,
+                                scale, haveScale, adjust, expect.data());
+            IOFBGammaScaleTable(resample->ramp, 3, dstCount, 16, width,
+                                scale, haveScale, adjust, actual.data());
+            cases++;
+            if (expect != actual)
+            {
+                size_t i = 0;
+                while (expect[i] == actual[i]) i++;
+                fprintf(stderr, "gammatest: %u -> %u entries, %u bits, %s ramp, "
+                        "scale %lu %lu %lu %lu, differs at byte %zu\n",
+                        srcCount, dstCount, width, kRampNames[kind],
+                        (unsigned long) scale[0], (unsigned long) scale[1],
+                        (unsigned long) scale[2], (unsigned long) scale[3], i);
+                failures++;
+            }
+        }
+        IOFBGammaResampleFree(resample);
+    }
+
+    // No client ramp, the linear default, which can't be scaled
+    for (uint32_t dstCount : kDstCounts)
+    for (uint32_t width : kWidths)
+    {
+        const uintptr_t scale[4] = { 1 << 16, 1 << 16, 1 << 16, 1 << 16 };
+        std::vector<UInt8> expect(tableSize(dstCount, width), 0xee);
+        std::vector<UInt8> actual(expect.size(), 0x11);
+        updateGammaTable_v0(3, dstCount, 16, NULL, dstCount, width,
+                            scale, false, NULL, expect.data());
+        IOFBGammaScaleTable(NULL, 3, dstCount, 16, width,
+                            scale, false, NULL, actual.data());
+        cases++;
+        if (expect != actual)
+        {
+            fprintf(stderr, "gammatest: linear %u entries, %u bits differs\n",
+                    dstCount, width);
+            failures++;
+        }
+    }
+
+    if (failures)
+    {
+        fprintf(stderr, "gammatest: %u of %u cases failed, seed %u\n",
+                failures, cases, seed);
+        return EXIT_FAILURE;
+    }
+    fprintf(stdout, "gammatest: %u cases passed\n", cases);
+    return EXIT_SUCCESS;
+}
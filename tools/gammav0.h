@@ -0,0 +1,93 @@
+//
+//  gammav0.h
+//  IOGraphics
+//
+//  IOFramebuffer::updateGammaTable()'s resample and scale loop from before
+//  IOFBGammaResample.h, kept as it was, for gammatest and gammabench. The
+//  framebuffer state it read is passed in.
+//
+
+#ifndef GAMMAV0_H
+#define GAMMAV0_H
+
+#include <stdint.h>
+
+#include <IOKit/IOTypes.h>
+
+static inline void
+updateGammaTable_v0(UInt32 channelCount, UInt32 srcDataCount, UInt32 dataWidth,
+                    const void * data, UInt32 desiredGammaDataCount,
+                    UInt32 tryWidth, const uintptr_t * gammaScale,
+                    bool gammaHaveScale, const uint32_t * adjustParams,
+                    UInt8 * table)
+{
+    UInt16 *    channelData;
+    const uint32_t * adjustNext   = NULL;
+    uint32_t         gammaThresh  = -1U;
+    uint32_t         gammaAdjust  = 0;
+
+            uint32_t pin, pt5, in, out, channel, idx, maxSrc, maxDst, interpCount;
+            int64_t value, value2;
+
+            pin = (1 << tryWidth) - 1;
+            pt5 = 0; //(1 << (tryWidth - 1));               // truncate not round
+            if (gammaHaveScale)
+                dataWidth += 32;
+
+            channelData = (UInt16 *) data;
+            maxSrc = (srcDataCount - 1);
+            maxDst = (desiredGammaDataCount - 1);
+            if ((srcDataCount < desiredGammaDataCount)
+            &&  (0 == (desiredGammaDataCount % srcDataCount)))
+                interpCount = desiredGammaDataCount / srcDataCount;
+            else
+                interpCount = 0;
+
+            for (out = 0, channel = 0; channel < channelCount; channel++)
+            {
+                if (adjustParams)
+                {
+                    gammaThresh = 0;
+                    adjustNext = adjustParams;
+                }
+                for (idx = 0; idx <= maxDst; idx++)
+                {
+                    if (idx >= gammaThresh)
+                    {
+                        gammaThresh = *adjustNext++;
+                        gammaAdjust = *adjustNext++;
+                    }
+                    if (channelData)
+                    {
+                        in = ((idx * maxSrc) + (idx ? (idx - 1) : 0)) / maxDst;
+                        value = (channelData[in] /*+ pt5*/);
+                        if (interpCount && (in < maxSrc))
+                        {
+                            value2 = (channelData[in+1] /*+ pt5*/);
+                            value += ((value2 - value) * (idx % interpCount) + (interpCount - 1)) / interpCount;
+                        }
+                    }
+                    else
+                        value = (idx * ((1 << dataWidth) - 1)) / maxDst;
+                    if (gammaHaveScale)
+                    {
+                        value = ((value * gammaScale[channel] * gammaScale[3]) + (1U << 31));
+                    }
+                    value = (value >> (dataWidth - tryWidth));
+                    if (value)
+                        value += gammaAdjust;
+                    if (value > pin)
+                        value = pin;
+
+                    if (tryWidth <= 8)
+                        ((UInt8 *) table)[out] = (value & 0xff);
+                    else
+                        ((UInt16 *) table)[out] = value;
+                    out++;
+                }
+                if (channelData) channelData += srcDataCount;
+            }
+    (void) pt5;
+}
+
+#endif // GAMMAV0_H
@@ -0,0 +1,152 @@
+//
+//  gmetricstress.cpp
+//  IOGraphics
+//
+//  Stress test of GMetricsRecorder replacement. Writer threads record
+//  continuously while this thread cycles the recorder through prepare, at
+//  alternating sizes so the old one is released, reset, fetch and disable,
+//  each of which quiesces the writers. Freed memory is poisoned, so a writer
+//  still in a released recorder crashes or shows up as a bad fetched entry.
+//
+//  gmetricstress [<seconds> [<writers>]]
+//
+
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if __GLIBC__
+#include <malloc.h>
+#endif
+
+#include <thread>
+#include <vector>
+
+#include <mach/mach_time.h>
+#include <IOKit/IOMemoryDescriptor.h>
+
+#include "GMetric.hpp"
+
+// Test access to the user client interfaces, see the friend declarations
+class IOGDiagnosticUserClient {
+public:
+    static IOReturn prepare(const uint64_t lines)
+        { return GMetricsRecorder::prepareForRecording(lines); }
+    static IOReturn enable() { return GMetricsRecorder::enable(); }
+    static IOReturn start(const uint64_t domains)
+        { return GMetricsRecorder::start(domains); }
+    static IOReturn reset() { return GMetricsRecorder::reset(); }
+    static IOReturn disable() { return GMetricsRecorder::disable(); }
+    static IOReturn fetch(IOMemoryDescriptor* outDesc)
+        { return GMetricsRecorder::fetch(outDesc); }
+};
+
+namespace {
+
+constexpr uint16_t kStressFID = 0x5a;
+constexpr uint64_t kSizes[] = { 1024, 4096 };
+
+int gFailures = 0;
+
+#define CHECK(cond, ...) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "gmetricstress: " __VA_ARGS__); \
+        fputc('\n', stderr); \
+        ++gFailures; \
+    } \
+} while (0)
+
+// Every published entry must be one of the writers' own
+void checkEntries(const gmetric_buffer_t* out, const uint32_t lines)
+{
+    const uint32_t copied = out->fHeader.fCopiedCount;
+    CHECK(copied <= lines, "copied %u of %u lines", copied, lines);
+    for (uint32_t i = 0; i < copied && i < lines; ++i) {
+        const gmetric_entry_t& entry = out->fEntries[i];
+        unsigned long long headerBits;
+        memcpy(&headerBits, &entry.header, sizeof(headerBits));
+        CHECK(entry.header.type == kGMETRICS_EVENT_SIGNAL
+           && entry.header.domain == kGMETRICS_DOMAIN_FRAMEBUFFER
+           && GMETRIC_FUNC_FROM_DATA(entry.data) == kStressFID,
+              "bad entry %u: header %llx data %llx", i,
+              headerBits,
+              static_cast<unsigned long long>(entry.data));
+    }
+}
+
+};  // namespace
+
+int main(int argc, char* argv[])
+{
+    const double seconds = (argc > 1) ? atof(argv[1]) : 2.0;
+    const int writerCount = (argc > 2) ? atoi(argv[2]) : 4;
+#if __GLIBC__
+    mallopt(M_PERTURB, 0xa5);
+#endif
+
+    _Atomic(bool) stop = false;
+    _Atomic(uint64_t) recorded = 0;
+    std::vector<std::thread> writers;
+    for (int t = 0; t < writerCount; ++t) {
+        writers.emplace_back([&] {
+            uint64_t i = 0;
+            while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+                GMETRIC(GMETRIC_DATA_FROM_FUNC(kStressFID) | (i & 0xffff),
+                        kGMETRICS_EVENT_SIGNAL, kGMETRICS_DOMAIN_FRAMEBUFFER);
+                ++i;
+            }
+            atomic_fetch_add(&recorded, i);
+        });
+    }
+
+    const size_t outSize = sizeof(gmetric_buffer_t)
+                         + kSizes[1] * sizeof(gmetric_entry_t);
+    std::vector<uint8_t> out(outSize);
+    IOMemoryDescriptor* md = IOMemoryDescriptor::withAddress(
+            out.data(), out.size(), kIODirectionIn);
+    const auto* outBuf = reinterpret_cast<const gmetric_buffer_t*>(out.data());
+    const uint32_t lines = static_cast<uint32_t>(kSizes[1]);
+
+    uint64_t cycles = 0;
+    const uint64_t end = mach_continuous_time()
+                       + static_cast<uint64_t>(seconds * 1e9);
+    while (mach_continuous_time() < end) {
+        // Two sizes so each prepare replaces, and frees, the recorder
+        CHECK(kIOReturnSuccess == IOGDiagnosticUserClient::prepare(
+                kSizes[cycles & 1]), "prepare failed");
+        CHECK(kIOReturnSuccess == IOGDiagnosticUserClient::enable(),
+              "enable failed");
+        CHECK(kIOReturnSuccess == IOGDiagnosticUserClient::start(
+                kGMETRICS_DOMAIN_ALL), "start failed");
+        for (int r = 0; r < 4; ++r) {
+            std::this_thread::yield();
+            CHECK(kIOReturnSuccess == IOGDiagnosticUserClient::fetch(md),
+                  "fetch failed");
+            checkEntries(outBuf, lines);
+            CHECK(kIOReturnSuccess == IOGDiagnosticUserClient::reset(),
+                  "reset failed");
+        }
+        CHECK(kIOReturnSuccess == IOGDiagnosticUserClient::disable(),
+              "disable failed");
+        ++cycles;
+        if (gFailures > 10)
+            break;
+    }
+
+    atomic_store(&stop, true);
+    for (auto& thread : writers)
+        thread.join();
+    md->release();
+
+    if (gFailures) {
+        fprintf(stderr, "gmetricstress: %d failures\n", gFailures);
+        return EXIT_FAILURE;
+    }
+    printf("gmetricstress: passed, %llu cycles, %llu records, %d writers\n",
+           static_cast<unsigned long long>(cycles),
+           static_cast<unsigned long long>(atomic_load(&recorded)),
+           writerCount);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,325 @@
+//
+//  gtracebench.cpp
+//  IOGraphics
+//
+//  Host benchmarks of the GTrace and GMetric recorders, built from the kernel
+//  sources by tools/CMakeLists.txt. Covers recording, fetching and recording
+//  while another thread fetches, the iogdiagnose case. Recording is measured
+//  from one thread up to the larger of 8 and the host's CPU count, against
+//  the single shared line index recordToken() used before per-CPU slices.
+//
+//  gtracebench [--benchmark_filter=<regex>]
+//
+
+#include <stdatomic.h>
+#include <string.h>
+
+#include <thread>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include <IOKit/IOMemoryDescriptor.h>
+
+#include "GTrace.hpp"
+#include "GMetric.hpp"
+
+// Test access to the user client interfaces, see the friend declarations
+class IOGDiagnosticGTraceClient {
+public:
+    static IOReturn fetch(const uint32_t index, IOMemoryDescriptor* outDesc)
+        { return GTraceBuffer::fetch(index, outDesc); }
+    static uint16_t index(const GTraceBuffer* buffer)
+        { return buffer->fHeader.fBufferIndex; }
+};
+
+class IOGDiagnosticUserClient {
+public:
+    static IOReturn prepare(const uint64_t lines)
+        { return GMetricsRecorder::prepareForRecording(lines); }
+    static IOReturn enable() { return GMetricsRecorder::enable(); }
+    static IOReturn start(const uint64_t domains)
+        { return GMetricsRecorder::start(domains); }
+    static IOReturn reset() { return GMetricsRecorder::reset(); }
+    static IOReturn disable() { return GMetricsRecorder::disable(); }
+    static IOReturn fetch(IOMemoryDescriptor* outDesc)
+        { return GMetricsRecorder::fetch(outDesc); }
+};
+
+namespace {
+
+constexpr uint16_t kBenchFID = 1;
+constexpr uint32_t kLines = kGTraceMaximumLineCount;
+constexpr size_t kFetchSize
+    = sizeof(IOGTraceBuffer) + kLines * sizeof(GTraceEntry);
+
+// Buffer kinds, the benchmark argument
+constexpr uint32_t kOptions[] = {
+    0, kGTraceOptionPerCPU, kGTraceOptionCompact, kGTraceOptionStream,
+};
+const char* const kOptionNames[] = { "shared", "percpu", "compact", "stream" };
+
+// One buffer per benchmark run, made by thread 0 and shared by the others
+GTraceBuffer::shared_type gBuffer;
+
+void makeBuffer(const benchmark::State& state)
+{
+    gBuffer = GTraceBuffer::make("gtracebench", kOptionNames[state.range(0)],
+                                 kLines, nullptr, nullptr,
+                                 kOptions[state.range(0)]);
+}
+
+void destroyBuffer()
+{
+    // A fetch of the last reference drops the cached buffer
+    std::vector<uint8_t> out(kFetchSize);
+    IOMemoryDescriptor* md = IOMemoryDescriptor::withAddress(
+            out.data(), out.size(), kIODirectionIn);
+    const uint16_t index = IOGDiagnosticGTraceClient::index(gBuffer.get());
+    GTraceBuffer::destroy(iog::move(gBuffer));
+    (void) IOGDiagnosticGTraceClient::fetch(index, md);
+    md->release();
+}
+
+inline void recordOne(GTraceBuffer* buffer, const uint64_t i)
+{
+    GTRACE(buffer, kBenchFID, 0, 0, i, 0, i >> 8, 0, 0, 0, 0);
+}
+
+int maxThreads()
+{
+    const int cpus = static_cast<int>(std::thread::hardware_concurrency());
+    return (cpus > 8) ? cpus : 8;
+}
+
+// recordToken() before per-CPU slices and sequence words, every CPU bumps one
+// line index and stores its token unguarded.
+struct RingV0 {
+    alignas(64) _Atomic(uint32_t) fNextLine;
+    alignas(64) GTraceEntry fBuffer[kLines];
+};
+RingV0 gRingV0;
+
+// Tokens are formatted by the real buffer, only the store differs
+void BM_GTraceRecordV0(benchmark::State& state)
+{
+    if (0 == state.thread_index()) {
+        makeBuffer(state);
+        atomic_init(&gRingV0.fNextLine, 0);
+    }
+    GTraceBuffer* buffer = nullptr;
+    uint64_t i = 0;
+    for (auto _ : state) {
+        if (!buffer)
+            buffer = gBuffer.get();
+        const GTraceEntry entry = buffer->formatToken(__LINE__,
+                GTFuncTag(kBenchFID, 0, 0), i, 0, i >> 8, 0, 0, 0, 0);
+        gRingV0.fBuffer[atomic_fetch_add(&gRingV0.fNextLine, 1)
+                        & (kLines - 1)] = entry;
+        ++i;
+    }
+    benchmark::DoNotOptimize(gRingV0.fBuffer);
+    state.SetItemsProcessed(state.iterations());
+    if (0 == state.thread_index())
+        destroyBuffer();
+}
+
+void BM_GTraceRecord(benchmark::State& state)
+{
+    if (0 == state.thread_index())
+        makeBuffer(state);
+    // Google Benchmark starts every thread's loop together
+    GTraceBuffer* buffer = nullptr;
+    uint64_t i = 0;
+    for (auto _ : state) {
+        if (!buffer)
+            buffer = gBuffer.get();
+        recordOne(buffer, i++);
+    }
+    state.SetItemsProcessed(state.iterations());
+    if (0 == state.thread_index())
+        destroyBuffer();
+}
+
+void BM_GTraceRecordFiltered(benchmark::State& state)
+{
+    if (0 == state.thread_index()) {
+        makeBuffer(state);
+        GTraceFilter filter;
+        memset(&filter, 0, sizeof(filter));
+        filter.fDropFunctions[kBenchFID / 64] = UINT64_C(1) << (kBenchFID % 64);
+        gBuffer->setFilter(filter);
+    }
+    GTraceBuffer* buffer = nullptr;
+    uint64_t i = 0;
+    for (auto _ : state) {
+        if (!buffer)
+            buffer = gBuffer.get();
+        recordOne(buffer, i++);
+    }
+    state.SetItemsProcessed(state.iterations());
+    if (0 == state.thread_index())
+        destroyBuffer();
+}
+
+// The GTRACE macros with no buffer, what a filtered token is compared to
+void BM_GTraceRecordNull(benchmark::State& state)
+{
+    GTraceBuffer* buffer = nullptr;
+    benchmark::DoNotOptimize(buffer);
+    uint64_t i = 0;
+    for (auto _ : state)
+        recordOne(buffer, i++);
+    state.SetItemsProcessed(state.iterations());
+}
+
+// A filtered token formatted by its caller, only recordToken() drops it
+void BM_GTraceRecordFilteredLate(benchmark::State& state)
+{
+    makeBuffer(state);
+    GTraceFilter filter;
+    memset(&filter, 0, sizeof(filter));
+    filter.fDropFunctions[kBenchFID / 64] = UINT64_C(1) << (kBenchFID % 64);
+    gBuffer->setFilter(filter);
+    GTraceBuffer* buffer = gBuffer.get();
+    uint64_t i = 0;
+    for (auto _ : state) {
+        buffer->recordToken(__LINE__, GTFuncTag(kBenchFID, 0, 0), i,
+                            0, i >> 8, 0, 0, 0, 0);
+        ++i;
+    }
+    state.SetItemsProcessed(state.iterations());
+    destroyBuffer();
+}
+
+// Full ring copied out per iteration, as iogdiagnose does
+void BM_GTraceFetch(benchmark::State& state)
+{
+    makeBuffer(state);
+    for (uint64_t i = 0; i < 2 * kLines; ++i)
+        recordOne(gBuffer.get(), i);
+    std::vector<uint8_t> out(kFetchSize);
+    IOMemoryDescriptor* md = IOMemoryDescriptor::withAddress(
+            out.data(), out.size(), kIODirectionIn);
+
+    for (auto _ : state) {
+        const IOReturn err = GTraceBuffer::fetch(gBuffer, md);
+        if (err) {
+            state.SkipWithError("fetch failed");
+            break;
+        }
+        benchmark::DoNotOptimize(out.data());
+    }
+    const auto* outBuf = reinterpret_cast<IOGTraceBuffer*>(out.data());
+    state.counters["tokens"] = outBuf->fHeader.fTokensCopied;
+    state.SetBytesProcessed(state.iterations() * kFetchSize);
+    md->release();
+    destroyBuffer();
+}
+
+// Recorders on range(1) threads while this thread fetches, reports both rates
+void BM_GTraceRecordWhileFetch(benchmark::State& state)
+{
+    makeBuffer(state);
+    GTraceBuffer* buffer = gBuffer.get();
+    std::vector<uint8_t> out(kFetchSize);
+    IOMemoryDescriptor* md = IOMemoryDescriptor::withAddress(
+            out.data(), out.size(), kIODirectionIn);
+
+    _Atomic(bool) stop = false;
+    _Atomic(uint64_t) recorded = 0;
+    std::vector<std::thread> recorders;
+    for (int t = 0; t < state.range(1); ++t) {
+        recorders.emplace_back([&] {
+            uint64_t i = 0;
+            while (!atomic_load_explicit(&stop, memory_order_relaxed))
+                recordOne(buffer, i++);
+            atomic_fetch_add(&recorded, i);
+        });
+    }
+
+    uint64_t copied = 0;
+    const uint64_t begin = mach_continuous_time();
+    for (auto _ : state) {
+        (void) GTraceBuffer::fetch(gBuffer, md);
+        copied += reinterpret_cast<IOGTraceBuffer*>(out.data())
+                      ->fHeader.fTokensCopied;
+    }
+    const uint64_t elapsed = mach_continuous_time() - begin;
+    atomic_store(&stop, true);
+    for (auto& thread : recorders)
+        thread.join();
+
+    state.counters["records/s"] = benchmark::Counter(
+            static_cast<double>(atomic_load(&recorded)) * 1e9 / elapsed);
+    state.counters["tokens/fetch"] = benchmark::Counter(
+            static_cast<double>(copied) / state.iterations());
+    state.SetItemsProcessed(state.iterations());
+    md->release();
+    destroyBuffer();
+}
+
+// The recorder is reset, untimed, by thread 0 each time it has filled
+void BM_GMetricRecord(benchmark::State& state)
+{
+    if (0 == state.thread_index()) {
+        (void) IOGDiagnosticUserClient::prepare(kGMetricMaximumLineCount);
+        (void) IOGDiagnosticUserClient::enable();
+        (void) IOGDiagnosticUserClient::start(kGMETRICS_DOMAIN_ALL);
+    }
+    const uint64_t perReset = kGMetricMaximumLineCount / state.threads();
+    uint64_t i = 0;
+    for (auto _ : state) {
+        GMETRIC(GMETRIC_DATA_FROM_FUNC(kBenchFID) | (i & 0xffff),
+                kGMETRICS_EVENT_SIGNAL, kGMETRICS_DOMAIN_FRAMEBUFFER);
+        if (0 == state.thread_index() && 0 == (++i % perReset)) {
+            state.PauseTiming();
+            (void) IOGDiagnosticUserClient::reset();
+            state.ResumeTiming();
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+    if (0 == state.thread_index())
+        (void) IOGDiagnosticUserClient::disable();
+}
+
+// Fetch of a full recorder, no concurrent writers
+void BM_GMetricFetch(benchmark::State& state)
+{
+    (void) IOGDiagnosticUserClient::prepare(kGMetricMaximumLineCount);
+    (void) IOGDiagnosticUserClient::enable();
+    (void) IOGDiagnosticUserClient::start(kGMETRICS_DOMAIN_ALL);
+    for (uint64_t i = 0; i < kGMetricMaximumLineCount; ++i)
+        GMETRIC(GMETRIC_DATA_FROM_FUNC(kBenchFID) | (i & 0xffff),
+                kGMETRICS_EVENT_SIGNAL, kGMETRICS_DOMAIN_FRAMEBUFFER);
+
+    const size_t size = sizeof(gmetric_buffer_t)
+                      + kGMetricMaximumLineCount * sizeof(gmetric_entry_t);
+    std::vector<uint8_t> out(size);
+    IOMemoryDescriptor* md = IOMemoryDescriptor::withAddress(
+            out.data(), out.size(), kIODirectionIn);
+    for (auto _ : state) {
+        (void) IOGDiagnosticUserClient::fetch(md);
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.SetBytesProcessed(state.iterations() * size);
+    md->release();
+    (void) IOGDiagnosticUserClient::disable();
+}
+
+};  // namespace
+
+BENCHMARK(BM_GTraceRecordV0)->Arg(0)->ThreadRange(1, maxThreads())
+    ->UseRealTime();
+BENCHMARK(BM_GTraceRecord)->DenseRange(0, 3)->ThreadRange(1, maxThreads())
+    ->UseRealTime();
+BENCHMARK(BM_GTraceRecordFiltered)->Arg(0)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK(BM_GTraceRecordFilteredLate)->Arg(0);
+BENCHMARK(BM_GTraceRecordNull);
+BENCHMARK(BM_GTraceFetch)->DenseRange(0, 3);
+BENCHMARK(BM_GTraceRecordWhileFetch)
+    ->ArgsProduct({{0, 1, 2, 3}, {1, 3}})->UseRealTime();
+BENCHMARK(BM_GMetricRecord)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK(BM_GMetricFetch);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,225 @@
+//
+//  gtracestress.cpp
+//  IOGraphics
+//
+//  Stress test of GTraceBuffer copy out while recording. Writer threads record
+//  continuously into a minimum size ring, so it laps many times per fetch,
+//  while this thread fetches it, for each kind of buffer. Every argument of a
+//  token is derived from the writer, its sequence number and the timestamp, so
+//  a torn slot that survives storeToken(), copySlot() or copyOut() shows up as
+//  an inconsistent token. Tokens of a writer in a single slice ring must also
+//  come out oldest to newest, and no token may come out twice.
+//
+//  gtracestress [<seconds> [<writers>]]
+//
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#include <mach/mach_time.h>
+#include <IOKit/IOMemoryDescriptor.h>
+
+#include "GTrace.hpp"
+
+// Test access to the user client interfaces, see the friend declarations
+class IOGDiagnosticGTraceClient {
+public:
+    static IOReturn fetch(const uint32_t index, IOMemoryDescriptor* outDesc)
+        { return GTraceBuffer::fetch(index, outDesc); }
+    static uint16_t index(const GTraceBuffer* buffer)
+        { return buffer->fHeader.fBufferIndex; }
+};
+
+namespace {
+
+constexpr uint16_t kStressFID = 0x5a;
+constexpr uint16_t kStressLine = 0x100;  // + writer
+constexpr uint64_t kSeqMask = (UINT64_C(1) << 40) - 1;
+constexpr uint64_t kGolden = UINT64_C(0x9e3779b97f4a7c15);
+constexpr uint32_t kLines = kGTraceMinimumLineCount;
+constexpr size_t kFetchSize
+    = sizeof(IOGTraceBuffer) + kLines * sizeof(GTraceEntry);
+
+// Buffer kinds, slices are only ordered among themselves by timestamp
+constexpr uint32_t kOptions[] = {
+    0, kGTraceOptionPerCPU, kGTraceOptionCompact, kGTraceOptionStream,
+};
+const char* const kOptionNames[] = { "shared", "percpu", "compact", "stream" };
+
+int gFailures = 0;
+
+#define CHECK(cond, ...) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "gtracestress: " __VA_ARGS__); \
+        fputc('\n', stderr); \
+        ++gFailures; \
+    } \
+} while (0)
+
+struct Counts {
+    uint64_t fFetches = 0;
+    uint64_t fTokens = 0;
+    uint64_t fInversions = 0;  // Timestamp order across writers, not checked
+};
+
+// Checks the tokens of one fetch. published[w] is the sequence number of the
+// token writer w was recording once the fetch returned, the only one of its
+// tokens that may be in the ring but not yet published.
+void checkTokens(const char* name, const IOGTraceBuffer* out,
+                 const std::vector<uint64_t>& published, const bool ordered,
+                 Counts* countsP)
+{
+    const GTraceEntry* tokens = &out->fTokens[out->fHeader.fBreadcrumbTokens];
+    const uint32_t copied = out->fHeader.fTokensCopied;
+    const size_t writers = published.size();
+    std::vector<uint64_t> last(writers, 0);
+    std::vector<uint64_t> seen;
+    seen.reserve(copied);
+
+    CHECK(copied <= kLines, "%s: copied %u of %u lines", name, copied, kLines);
+    for (uint32_t i = 0; i < copied && i < kLines; ++i) {
+        const GTraceEntry& token = tokens[i];
+        const uint64_t a0 = token.arg64(0);
+        const uint64_t w = a0 >> 40;
+        const uint64_t seq = a0 & kSeqMask;
+        const bool consistent = w < writers
+            && token.line() == kStressLine + w
+            && GUNPACKFUNCCODE(token.tag(0)) == kStressFID
+            && token.tag(1) == 0 && token.tag(2) == 0 && token.tag(3) == 0
+            && token.arg64(1) == ~a0
+            && token.arg64(2) == a0 * kGolden
+            && token.arg64(3) == (token.timestamp() ^ a0);
+        CHECK(consistent, "%s: torn token %u of %u: line %#x tags %#llx "
+              "args %#llx %#llx %#llx %#llx time %#llx", name, i, copied,
+              token.line(), static_cast<unsigned long long>(token.tag()),
+              static_cast<unsigned long long>(a0),
+              static_cast<unsigned long long>(token.arg64(1)),
+              static_cast<unsigned long long>(token.arg64(2)),
+              static_cast<unsigned long long>(token.arg64(3)),
+              static_cast<unsigned long long>(token.timestamp()));
+        if (!consistent)
+            continue;
+
+        CHECK(seq <= published[w], "%s: writer %llu token %llu fetched, "
+              "still recording %llu", name, static_cast<unsigned long long>(w),
+              static_cast<unsigned long long>(seq),
+              static_cast<unsigned long long>(published[w]));
+        if (ordered) {
+            // Sequence numbers start at 1, see writer()
+            CHECK(seq > last[w], "%s: writer %llu token %llu after %llu",
+                  name, static_cast<unsigned long long>(w),
+                  static_cast<unsigned long long>(seq),
+                  static_cast<unsigned long long>(last[w]));
+            last[w] = seq;
+        }
+        if (i && token.timestamp() < tokens[i - 1].timestamp())
+            ++countsP->fInversions;
+        seen.push_back(a0);
+    }
+
+    std::sort(seen.begin(), seen.end());
+    const auto dup = std::adjacent_find(seen.begin(), seen.end());
+    CHECK(dup == seen.end(), "%s: token %#llx fetched twice", name,
+          static_cast<unsigned long long>(dup == seen.end() ? 0 : *dup));
+
+    ++countsP->fFetches;
+    countsP->fTokens += copied;
+}
+
+void writer(GTraceBuffer* buffer, const uint64_t w, _Atomic(bool)* stopP,
+            _Atomic(uint64_t)* publishedP)
+{
+    const uint16_t tag0 = GTFuncTag(kStressFID, 0, 0);
+    uint64_t seq = 1;
+    while (!atomic_load_explicit(stopP, memory_order_relaxed)) {
+        const uint64_t a0 = (w << 40) | (seq & kSeqMask);
+        const uint64_t now = mach_continuous_time();
+        buffer->recordToken(kStressLine + w, tag0, a0, 0, ~a0,
+                            0, a0 * kGolden, 0, now ^ a0, now);
+        atomic_store_explicit(publishedP, ++seq, memory_order_release);
+    }
+}
+
+void stress(const int kind, const double seconds, const int writerCount)
+{
+    const char* const name = kOptionNames[kind];
+    GTraceBuffer::shared_type buffer = GTraceBuffer::make(
+            "gtracestress", name, kLines, nullptr, nullptr, kOptions[kind]);
+    CHECK(static_cast<bool>(buffer), "%s: make failed", name);
+    if (!static_cast<bool>(buffer))
+        return;
+
+    _Atomic(bool) stop = false;
+    std::vector<_Atomic(uint64_t)> published(writerCount);
+    for (auto& count : published)
+        atomic_init(&count, 1);
+    std::vector<std::thread> writers;
+    for (int w = 0; w < writerCount; ++w)
+        writers.emplace_back(writer, buffer.get(), static_cast<uint64_t>(w),
+                             &stop, &published[w]);
+
+    std::vector<uint8_t> out(kFetchSize);
+    IOMemoryDescriptor* md = IOMemoryDescriptor::withAddress(
+            out.data(), out.size(), kIODirectionIn);
+    const auto* outBuf = reinterpret_cast<const IOGTraceBuffer*>(out.data());
+    const bool ordered = !(kOptions[kind] & kGTraceOptionPerCPU);
+    std::vector<uint64_t> counts(writerCount);
+    Counts total;
+
+    const uint64_t end = mach_continuous_time()
+                       + static_cast<uint64_t>(seconds * 1e9);
+    while (mach_continuous_time() < end && gFailures <= 10) {
+        std::this_thread::yield();
+        CHECK(kIOReturnSuccess == GTraceBuffer::fetch(buffer, md),
+              "%s: fetch failed", name);
+        for (int w = 0; w < writerCount; ++w)
+            counts[w] = atomic_load_explicit(&published[w],
+                                             memory_order_acquire);
+        checkTokens(name, outBuf, counts, ordered, &total);
+    }
+
+    atomic_store(&stop, true);
+    for (auto& thread : writers)
+        thread.join();
+    uint64_t recorded = 0;
+    for (auto& count : published)
+        recorded += atomic_load(&count) - 1;
+
+    // A fetch of the last reference drops the cached buffer
+    const uint16_t index = IOGDiagnosticGTraceClient::index(buffer.get());
+    GTraceBuffer::destroy(iog::move(buffer));
+    (void) IOGDiagnosticGTraceClient::fetch(index, md);
+    md->release();
+
+    printf("gtracestress: %s, %llu fetches, %llu tokens of %llu recorded, "
+           "%llu timestamp inversions\n", name,
+           static_cast<unsigned long long>(total.fFetches),
+           static_cast<unsigned long long>(total.fTokens),
+           static_cast<unsigned long long>(recorded),
+           static_cast<unsigned long long>(total.fInversions));
+}
+
+};  // namespace
+
+int main(int argc, char* argv[])
+{
+    const double seconds = (argc > 1) ? atof(argv[1]) : 2.0;
+    const int writerCount = (argc > 2) ? atoi(argv[2]) : 4;
+    const int kinds = static_cast<int>(sizeof(kOptions) / sizeof(kOptions[0]));
+
+    for (int kind = 0; kind < kinds && gFailures <= 10; ++kind)
+        stress(kind, seconds / kinds, writerCount);
+
+    if (gFailures) {
+        fprintf(stderr, "gtracestress: %d failures\n", gFailures);
+        return EXIT_FAILURE;
+    }
+    printf("gtracestress: passed, %d writers\n", writerCount);
+    return EXIT_SUCCESS;
+}
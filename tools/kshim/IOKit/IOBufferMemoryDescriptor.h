@@ -0,0 +1,43 @@
+//
+//  IOKit/IOBufferMemoryDescriptor.h
+//  kshim, see README
+//
+
+#ifndef KSHIM_IOKIT_IOBUFFERMEMORYDESCRIPTOR_H
+#define KSHIM_IOKIT_IOBUFFERMEMORYDESCRIPTOR_H
+
+#include <stdlib.h>
+
+#include <IOKit/IOMemoryDescriptor.h>
+
+class IOBufferMemoryDescriptor : public IOMemoryDescriptor
+{
+    OSDeclareDefaultStructors(IOBufferMemoryDescriptor);
+
+public:
+    static IOBufferMemoryDescriptor* withOptions(
+            IOOptionBits options, vm_size_t capacity, vm_offset_t alignment)
+    {
+        void* mem = nullptr;
+        if (alignment < sizeof(void*))
+            alignment = sizeof(void*);
+        if (posix_memalign(&mem, alignment, capacity ? capacity : 1))
+            return nullptr;
+        IOBufferMemoryDescriptor* me = new IOBufferMemoryDescriptor;
+        me->fAddress = static_cast<uint8_t*>(mem);
+        me->fLength = capacity;
+        me->fDirection = options & kIODirectionInOut;
+        return me;
+    }
+
+    void* getBytesNoCopy() { return fAddress; }
+
+protected:
+    void free() override
+    {
+        ::free(fAddress);
+        IOMemoryDescriptor::free();
+    }
+};
+
+#endif // KSHIM_IOKIT_IOBUFFERMEMORYDESCRIPTOR_H
@@ -0,0 +1,25 @@
+//
+//  IOKit/IOHibernatePrivate.h
+//  kshim, see README
+//
+
+#ifndef KSHIM_IOKIT_IOHIBERNATEPRIVATE_H
+#define KSHIM_IOKIT_IOHIBERNATEPRIVATE_H
+
+#include <stdint.h>
+
+enum { kIOPreviewImageCount = 2 };
+
+struct hibernate_preview_t
+{
+    uint32_t  imageCount;   // Number of images
+    uint32_t  width;        // Width
+    uint32_t  height;       // Height
+    uint32_t  depth;        // Pixel Depth
+    uint64_t  lockTime;     // Lock time
+    uint64_t  reservedG[7]; // reserved
+    uint64_t  reservedK[8]; // reserved
+};
+typedef struct hibernate_preview_t hibernate_preview_t;
+
+#endif // KSHIM_IOKIT_IOHIBERNATEPRIVATE_H
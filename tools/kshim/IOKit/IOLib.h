@@ -0,0 +1,73 @@
+//
+//  IOKit/IOLib.h
+//  kshim, see README
+//
+
+#ifndef KSHIM_IOKIT_IOLIB_H
+#define KSHIM_IOKIT_IOLIB_H
+
+#include <assert.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include <new>
+
+#include <IOKit/IOTypes.h>
+#include <IOKit/IOLocks.h>
+#include <kern/clock.h>
+#include <kern/debug.h>
+#include <kern/thread.h>
+#include <libkern/c++/OSData.h>
+#include <mach/mach_time.h>
+#include <mach/mach_types.h>
+#include <mach/vm_param.h>
+
+// Like the kernel, IONew doesn't zero and returns null on overflow
+#define IONew(type, count) \
+    ((0 != (count) && (size_t)(count) <= SIZE_MAX / sizeof(type)) \
+        ? static_cast<type*>(malloc(sizeof(type) * (size_t)(count))) \
+        : nullptr)
+#define IODelete(ptr, type, count) ::free(ptr)
+#define IOMallocType(type) static_cast<type*>(calloc(1, sizeof(type)))
+#define IOFreeType(ptr, type) ::free(ptr)
+
+static inline void* IOMalloc(vm_size_t size) { return malloc(size); }
+static inline void IOFree(void* p, vm_size_t) { ::free(p); }
+static inline void* IOMallocData(vm_size_t size) { return malloc(size); }
+static inline void IOFreeData(void* p, vm_size_t) { ::free(p); }
+static inline void* IOMallocPageable(vm_size_t size, vm_size_t alignment)
+{
+    void* mem = nullptr;
+    return posix_memalign(&mem, alignment < sizeof(void*)
+                                ? sizeof(void*) : alignment, size)
+         ? nullptr : mem;
+}
+static inline void IOFreePageable(void* p, vm_size_t) { ::free(p); }
+static const vm_size_t page_size = PAGE_SIZE;
+
+static inline void IOSleep(unsigned milliseconds) { usleep(milliseconds * 1000); }
+static inline void IODelay(unsigned microseconds) { usleep(microseconds); }
+
+__attribute__((format(printf, 1, 2)))
+static inline void IOLog(const char* format, ...)
+{
+    va_list ap;
+    va_start(ap, format);
+    vfprintf(stderr, format, ap);
+    va_end(ap);
+}
+
+// Pointers leave the kernel obfuscated, any reversible scramble will do
+static inline void vm_kernel_addrperm_external(vm_offset_t addr,
+                                               vm_offset_t* perm_addr)
+{
+    *perm_addr = addr ? addr ^ static_cast<vm_offset_t>(0xfeedfacecafebeefULL)
+                      : 0;
+}
+
+#endif // KSHIM_IOKIT_IOLIB_H
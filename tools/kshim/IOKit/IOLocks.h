@@ -0,0 +1,131 @@
+//
+//  IOKit/IOLocks.h
+//  kshim, see README
+//
+
+#ifndef KSHIM_IOKIT_IOLOCKS_H
+#define KSHIM_IOKIT_IOLOCKS_H
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <atomic>
+#include <new>
+
+#include <IOKit/IOTypes.h>
+
+typedef int IOInterruptState;
+typedef int wait_result_t;
+
+#define THREAD_UNINT         0
+#define THREAD_INTERRUPTIBLE 1
+#define THREAD_AWAKENED      0
+#define THREAD_TIMED_OUT     1
+
+// The owner is tracked so that the tl/iolocks lock assertions are real.
+struct _IOLock {
+    pthread_mutex_t          fMutex;
+    pthread_cond_t           fCond;  // One for all events, wakeups broadcast
+    std::atomic<pthread_t>   fOwner;
+    std::atomic<bool>        fOwned;
+};
+typedef _IOLock IOLock;
+typedef _IOLock lck_mtx_t;
+
+// A distinct type, tl/iolocks overloads on it
+struct _IOSimpleLock : _IOLock {};
+typedef _IOSimpleLock IOSimpleLock;
+typedef _IOSimpleLock lck_spin_t;
+
+static inline IOLock* IOLockAlloc()
+{
+    IOLock* lock = new (std::nothrow) IOLock;
+    if (lock) {
+        pthread_mutex_init(&lock->fMutex, nullptr);
+        pthread_cond_init(&lock->fCond, nullptr);
+        lock->fOwned = false;
+    }
+    return lock;
+}
+static inline void IOLockFree(IOLock* lock)
+{
+    pthread_cond_destroy(&lock->fCond);
+    pthread_mutex_destroy(&lock->fMutex);
+    delete lock;
+}
+static inline void IOLockLock(IOLock* lock)
+{
+    pthread_mutex_lock(&lock->fMutex);
+    lock->fOwner.store(pthread_self(), std::memory_order_relaxed);
+    lock->fOwned.store(true, std::memory_order_relaxed);
+}
+static inline void IOLockUnlock(IOLock* lock)
+{
+    lock->fOwned.store(false, std::memory_order_relaxed);
+    pthread_mutex_unlock(&lock->fMutex);
+}
+static inline bool IOLockHeld(IOLock* lock)
+{
+    return lock->fOwned.load(std::memory_order_relaxed)
+        && pthread_equal(lock->fOwner.load(std::memory_order_relaxed),
+                         pthread_self());
+}
+
+// Events aren't tracked, every sleeper wakes and rechecks its condition,
+// which the kernel's callers must do anyway.
+static inline int IOLockSleep(IOLock* lock, void* /* event */, UInt32)
+{
+    assert(IOLockHeld(lock));
+    lock->fOwned.store(false, std::memory_order_relaxed);
+    pthread_cond_wait(&lock->fCond, &lock->fMutex);
+    lock->fOwner.store(pthread_self(), std::memory_order_relaxed);
+    lock->fOwned.store(true, std::memory_order_relaxed);
+    return THREAD_AWAKENED;
+}
+static inline void IOLockWakeup(IOLock* lock, void* /* event */, bool)
+{
+    assert(IOLockHeld(lock));
+    pthread_cond_broadcast(&lock->fCond);
+}
+
+static inline IOSimpleLock* IOSimpleLockAlloc()
+{
+    IOSimpleLock* lock = new (std::nothrow) IOSimpleLock;
+    if (lock) {
+        pthread_mutex_init(&lock->fMutex, nullptr);
+        pthread_cond_init(&lock->fCond, nullptr);
+        lock->fOwned = false;
+    }
+    return lock;
+}
+static inline void IOSimpleLockFree(IOSimpleLock* l)
+{
+    pthread_cond_destroy(&l->fCond);
+    pthread_mutex_destroy(&l->fMutex);
+    delete l;
+}
+static inline void IOSimpleLockLock(IOSimpleLock* l) { IOLockLock(l); }
+static inline void IOSimpleLockUnlock(IOSimpleLock* l) { IOLockUnlock(l); }
+static inline IOInterruptState
+IOSimpleLockLockDisableInterrupt(IOSimpleLock* l)
+    { IOLockLock(l); return 0; }
+static inline void
+IOSimpleLockUnlockEnableInterrupt(IOSimpleLock* l, IOInterruptState)
+    { IOLockUnlock(l); }
+
+// Recursive locks aren't used by these sources, only declared for tl/iolocks
+struct _IORecursiveLock;
+typedef _IORecursiveLock IORecursiveLock;
+void IORecursiveLockLock(IORecursiveLock*);
+void IORecursiveLockUnlock(IORecursiveLock*);
+bool IORecursiveLockHaveLock(const IORecursiveLock*);
+
+#define LCK_ASSERT_OWNED    1
+#define LCK_ASSERT_NOTOWNED 2
+#define LCK_MTX_ASSERT(lck, type) \
+    assert(((type) == LCK_ASSERT_OWNED) == IOLockHeld(lck))
+#define LCK_SPIN_ASSERT(lck, type) LCK_MTX_ASSERT(lck, type)
+
+#endif // KSHIM_IOKIT_IOLOCKS_H
@@ -0,0 +1,102 @@
+//
+//  IOKit/IOMemoryDescriptor.h
+//  kshim, see README
+//
+
+#ifndef KSHIM_IOKIT_IOMEMORYDESCRIPTOR_H
+#define KSHIM_IOKIT_IOMEMORYDESCRIPTOR_H
+
+#include <string.h>
+
+#include <IOKit/IOTypes.h>
+#include <libkern/c++/OSObject.h>
+
+#define kIOMemoryKernelUserShared 0x00000200
+
+class IOMemoryDescriptor;
+
+class IOMemoryMap : public OSObject
+{
+    OSDeclareDefaultStructors(IOMemoryMap);
+    friend class IOMemoryDescriptor;
+
+public:
+    IOVirtualAddress getVirtualAddress() const { return fAddress; }
+    IOByteCount getLength() const { return fLength; }
+
+protected:
+    void free() override;
+
+private:
+    IOMemoryDescriptor* fMemory;
+    IOVirtualAddress    fAddress;
+    IOByteCount         fLength;
+};
+
+// Describes a host buffer, mapping it returns the same addresses.
+class IOMemoryDescriptor : public OSObject
+{
+    OSDeclareDefaultStructors(IOMemoryDescriptor);
+
+public:
+    static IOMemoryDescriptor* withAddress(void* address, IOByteCount length,
+                                           IODirection direction)
+    {
+        IOMemoryDescriptor* me = new IOMemoryDescriptor;
+        me->fAddress = static_cast<uint8_t*>(address);
+        me->fLength = length;
+        me->fDirection = direction;
+        return me;
+    }
+
+    IOReturn prepare(IODirection = kIODirectionNone)
+        { return kIOReturnSuccess; }
+    IOReturn complete(IODirection = kIODirectionNone)
+        { return kIOReturnSuccess; }
+
+    IOByteCount getLength() const { return fLength; }
+    IODirection getDirection() const { return fDirection; }
+
+    IOByteCount writeBytes(IOByteCount offset,
+                           const void* bytes, IOByteCount length)
+    {
+        if (offset >= fLength)
+            return 0;
+        if (length > fLength - offset)
+            length = fLength - offset;
+        memcpy(fAddress + offset, bytes, length);
+        return length;
+    }
+    IOByteCount readBytes(IOByteCount offset, void* bytes, IOByteCount length)
+    {
+        if (offset >= fLength)
+            return 0;
+        if (length > fLength - offset)
+            length = fLength - offset;
+        memcpy(bytes, fAddress + offset, length);
+        return length;
+    }
+
+    IOMemoryMap* map(IOOptionBits = 0)
+    {
+        IOMemoryMap* map = new IOMemoryMap;
+        retain();
+        map->fMemory = this;
+        map->fAddress = reinterpret_cast<IOVirtualAddress>(fAddress);
+        map->fLength = fLength;
+        return map;
+    }
+
+protected:
+    uint8_t*    fAddress;
+    IOByteCount fLength;
+    IODirection fDirection;
+};
+
+inline void IOMemoryMap::free()
+{
+    OSSafeReleaseNULL(fMemory);
+    OSObject::free();
+}
+
+#endif // KSHIM_IOKIT_IOMEMORYDESCRIPTOR_H
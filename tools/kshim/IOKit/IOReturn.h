@@ -0,0 +1,26 @@
+//
+//  IOKit/IOReturn.h
+//  kshim, see README
+//
+
+#ifndef KSHIM_IOKIT_IORETURN_H
+#define KSHIM_IOKIT_IORETURN_H
+
+typedef int IOReturn;
+
+#define iokit_common_err(return) (0xe0000000 | (return))
+
+#define kIOReturnSuccess        0
+#define kIOReturnError          iokit_common_err(0x2bc)
+#define kIOReturnNoMemory       iokit_common_err(0x2bd)
+#define kIOReturnNoResources    iokit_common_err(0x2be)
+#define kIOReturnBadArgument    iokit_common_err(0x2c2)
+#define kIOReturnUnsupported    iokit_common_err(0x2c7)
+#define kIOReturnInternalError  iokit_common_err(0x2c9)
+#define kIOReturnNotOpen        iokit_common_err(0x2cd)
+#define kIOReturnVMError        iokit_common_err(0x2d0)
+#define kIOReturnNotReady       iokit_common_err(0x2d8)
+#define kIOReturnNotPermitted   iokit_common_err(0x2e2)
+#define kIOReturnNotFound       iokit_common_err(0x2f0)
+
+#endif // KSHIM_IOKIT_IORETURN_H
@@ -0,0 +1,55 @@
+//
+//  IOKit/IOTypes.h
+//  kshim, see README
+//
+
+#ifndef KSHIM_IOKIT_IOTYPES_H
+#define KSHIM_IOKIT_IOTYPES_H
+
+#include <sys/cdefs.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <IOKit/IOReturn.h>
+
+// libkern's string.h has strlcpy, glibc only from 2.38
+#if defined(__GLIBC__) && !defined(__APPLE__) \
+    && (__GLIBC__ < 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ < 38))
+static inline size_t strlcpy(char* dst, const char* src, size_t size)
+{
+    const size_t len = strlen(src);
+    if (size) {
+        const size_t copy = (len < size) ? len : size - 1;
+        memcpy(dst, src, copy);
+        dst[copy] = '\0';
+    }
+    return len;
+}
+#endif
+
+#ifndef __unused
+#define __unused __attribute__((unused))
+#endif
+
+#define APPLE_KEXT_OVERRIDE override
+
+typedef uint8_t   UInt8;
+typedef uint16_t  UInt16;
+typedef uint32_t  UInt32;
+typedef uint64_t  UInt64;
+typedef uint32_t  IOOptionBits;
+typedef uint64_t  IOByteCount;
+typedef uintptr_t IOVirtualAddress;
+typedef uintptr_t vm_offset_t;
+typedef size_t    vm_size_t;
+
+enum {
+    kIODirectionNone  = 0x0,
+    kIODirectionIn    = 0x1,
+    kIODirectionOut   = 0x2,
+    kIODirectionInOut = kIODirectionIn | kIODirectionOut,
+};
+typedef IOOptionBits IODirection;
+
+#endif // KSHIM_IOKIT_IOTYPES_H
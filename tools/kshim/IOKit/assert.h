@@ -0,0 +1,6 @@
+//
+//  IOKit/assert.h
+//  kshim, see README
+//
+
+#include <kern/assert.h>
@@ -0,0 +1,29 @@
+//
+//  IOKit/graphics/IOGraphicsPrivate.h
+//  kshim, see README
+//
+//  Shadows IOGraphicsFamily/IOKit/graphics/IOGraphicsPrivate.h, which needs
+//  most of IOKit. Only the debug logging and helpers that GTrace, GMetric and
+//  bmcompress.h use.
+//
+
+#ifndef KSHIM_IOKIT_IOGRAPHICSPRIVATE_H
+#define KSHIM_IOKIT_IOGRAPHICSPRIVATE_H
+
+#include <IOKit/IOLib.h>
+
+#define D(categ, name, args...) do {} while (0)
+#define DEBG(name, fmt, args...) do {} while (0)
+#define DEBG1(name, fmt, args...) do {} while (0)
+
+#define IOGRAPHICS_TYPEOF(_t_) decltype(_t_)
+
+#define STOREINC(_ptr_, _data_, _type_) {   \
+        *((_type_ *)(_ptr_)) = _data_;                                  \
+        _ptr_ = (IOGRAPHICS_TYPEOF(_ptr_)) (((char *) (_ptr_)) + sizeof(_type_));  \
+    }
+
+inline void bcopy_nc(void* from, void* to, uint32_t l) { memmove(to, from, l); }
+inline void bzero_nc(void* p, uint32_t l) { memset(p, 0, l); }
+
+#endif // KSHIM_IOKIT_IOGRAPHICSPRIVATE_H
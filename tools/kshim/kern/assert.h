@@ -0,0 +1,6 @@
+//
+//  kern/assert.h
+//  kshim, see README
+//
+
+#include <assert.h>
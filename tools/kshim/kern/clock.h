@@ -0,0 +1,41 @@
+//
+//  kern/clock.h
+//  kshim, see README
+//
+
+#ifndef KSHIM_KERN_CLOCK_H
+#define KSHIM_KERN_CLOCK_H
+
+#include <stdint.h>
+
+#include <mach/mach_time.h>
+
+// Absolute time is in nanoseconds, see mach/mach_time.h
+typedef uint64_t AbsoluteTime;
+#define __OSAbsoluteTime(t) (t)
+
+enum {
+    kNanosecondScale  = 1,
+    kMicrosecondScale = 1000,
+    kMillisecondScale = 1000 * 1000,
+    kSecondScale      = 1000 * 1000 * 1000,
+};
+
+static inline void clock_interval_to_deadline(uint32_t interval,
+                                              uint32_t scale_factor,
+                                              uint64_t* result)
+{
+    *result = mach_absolute_time()
+            + static_cast<uint64_t>(interval) * scale_factor;
+}
+static inline void nanoseconds_to_absolutetime(uint64_t nanoseconds,
+                                               uint64_t* result)
+{
+    *result = nanoseconds;
+}
+static inline void clock_delay_until(uint64_t deadline)
+{
+    while (mach_absolute_time() < deadline) {}
+}
+
+#endif // KSHIM_KERN_CLOCK_H
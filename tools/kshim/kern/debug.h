@@ -0,0 +1,15 @@
+//
+//  kern/debug.h
+//  kshim, see README
+//
+
+#ifndef KSHIM_KERN_DEBUG_H
+#define KSHIM_KERN_DEBUG_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define panic(format, args...) \
+    do { fprintf(stderr, "panic: " format "\n", ## args); abort(); } while (0)
+
+#endif // KSHIM_KERN_DEBUG_H
@@ -0,0 +1,80 @@
+//
+//  kern/thread.h
+//  kshim, see README
+//
+
+#ifndef KSHIM_KERN_THREAD_H
+#define KSHIM_KERN_THREAD_H
+
+#include <pthread.h>
+#include <time.h>
+
+#include <new>
+
+#include <mach/mach_time.h>
+#include <mach/mach_types.h>
+#include <IOKit/IOLocks.h>
+
+typedef int kern_return_t;
+#define KERN_SUCCESS         0
+#define KERN_FAILURE         5
+#define KERN_RESOURCE_SHORTAGE 6
+
+typedef void (*thread_continue_t)(void* parameter, wait_result_t wresult);
+typedef void* event_t;
+
+struct _kshim_thread_start {
+    thread_continue_t fContinuation;
+    void*             fParameter;
+};
+
+static inline void* _kshim_thread_main(void* arg)
+{
+    const _kshim_thread_start start = *static_cast<_kshim_thread_start*>(arg);
+    delete static_cast<_kshim_thread_start*>(arg);
+    start.fContinuation(start.fParameter, THREAD_AWAKENED);
+    return nullptr;
+}
+
+// The new thread is joinable until thread_deallocate() detaches it
+static inline kern_return_t kernel_thread_start(
+        thread_continue_t continuation, void* parameter, thread_t* new_thread)
+{
+    auto* start = new (std::nothrow) _kshim_thread_start{continuation, parameter};
+    if (!start)
+        return KERN_RESOURCE_SHORTAGE;
+    if (pthread_create(new_thread, nullptr, &_kshim_thread_main, start)) {
+        delete start;
+        return KERN_RESOURCE_SHORTAGE;
+    }
+    return KERN_SUCCESS;
+}
+static inline void thread_deallocate(thread_t thread) { pthread_detach(thread); }
+static inline kern_return_t thread_terminate(thread_t thread)
+{
+    if (pthread_equal(thread, pthread_self()))
+        pthread_exit(nullptr);
+    return KERN_FAILURE;  // Only self termination is modelled
+}
+
+// Waits are only ever timeouts here, the event is never posted
+static thread_local uint64_t _kshim_wait_deadline;
+static inline wait_result_t assert_wait_deadline(event_t, int, uint64_t deadline)
+{
+    _kshim_wait_deadline = deadline;
+    return THREAD_AWAKENED;
+}
+static inline wait_result_t thread_block(thread_continue_t)
+{
+    const uint64_t now = mach_absolute_time();
+    if (_kshim_wait_deadline > now) {
+        const uint64_t ns = _kshim_wait_deadline - now;
+        struct timespec ts = { static_cast<time_t>(ns / 1000000000ULL),
+                               static_cast<long>(ns % 1000000000ULL) };
+        nanosleep(&ts, nullptr);
+    }
+    _kshim_wait_deadline = 0;
+    return THREAD_TIMED_OUT;
+}
+
+#endif // KSHIM_KERN_THREAD_H
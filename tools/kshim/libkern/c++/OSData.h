@@ -0,0 +1,44 @@
+//
+//  libkern/c++/OSData.h
+//  kshim, see README
+//
+
+#ifndef KSHIM_LIBKERN_OSDATA_H
+#define KSHIM_LIBKERN_OSDATA_H
+
+#include <libkern/c++/OSObject.h>
+
+class OSData : public OSObject
+{
+    OSDeclareDefaultStructors(OSData);
+
+public:
+    static OSData* withBytes(const void* bytes, unsigned int numBytes)
+    {
+        OSData* me = new OSData;
+        me->fData = malloc(numBytes ? numBytes : 1);
+        if (!me->fData) {
+            me->release();
+            return nullptr;
+        }
+        memcpy(me->fData, bytes, numBytes);
+        me->fLength = numBytes;
+        return me;
+    }
+
+    unsigned int getLength() const { return fLength; }
+    const void* getBytesNoCopy() const { return fData; }
+
+protected:
+    void free() override
+    {
+        ::free(fData);
+        OSObject::free();
+    }
+
+private:
+    void*        fData;
+    unsigned int fLength;
+};
+
+#endif // KSHIM_LIBKERN_OSDATA_H
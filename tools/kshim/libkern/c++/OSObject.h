@@ -0,0 +1,65 @@
+//
+//  libkern/c++/OSObject.h
+//  kshim, see README
+//
+
+#ifndef KSHIM_LIBKERN_OSOBJECT_H
+#define KSHIM_LIBKERN_OSOBJECT_H
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <new>
+
+#include <IOKit/IOTypes.h>
+
+// No meta classes, subclasses only get the kernel's zero filled allocation
+// and a protected destructor, objects are deleted by free().
+#define OSDeclareDefaultStructors(className) \
+    public: className() {} \
+    protected: virtual ~className() {} \
+    private:
+#define OSDeclareFinalStructors(className) OSDeclareDefaultStructors(className)
+#define OSDefineMetaClassAndStructors(className, superclassName)
+#define OSDefineMetaClassAndFinalStructors(className, superclassName)
+
+#define OSDynamicCast(type, inst) dynamic_cast<type*>(inst)
+
+#define OSSafeReleaseNULL(inst) \
+    do { if (inst) (inst)->release(); (inst) = nullptr; } while (0)
+
+class OSObject
+{
+public:
+    static void* operator new(size_t size)
+    {
+        void* mem = calloc(1, size);
+        if (!mem)
+            throw std::bad_alloc();
+        return mem;
+    }
+    static void operator delete(void* mem) { ::free(mem); }
+
+    OSObject() : fRetainCount(1) {}
+
+    void retain() const
+        { fRetainCount.fetch_add(1, std::memory_order_relaxed); }
+    void release() const
+    {
+        if (1 == fRetainCount.fetch_sub(1, std::memory_order_acq_rel))
+            const_cast<OSObject*>(this)->free();
+    }
+    int getRetainCount() const
+        { return fRetainCount.load(std::memory_order_relaxed); }
+
+protected:
+    virtual ~OSObject() {}
+    virtual bool init() { return true; }
+    virtual void free() { delete this; }
+
+private:
+    mutable std::atomic<int> fRetainCount;
+};
+
+#endif // KSHIM_LIBKERN_OSOBJECT_H
@@ -0,0 +1,22 @@
+//
+//  mach/mach_time.h
+//  kshim, see README
+//
+
+#ifndef KSHIM_MACH_MACH_TIME_H
+#define KSHIM_MACH_MACH_TIME_H
+
+#include <stdint.h>
+#include <time.h>
+
+// Nanosecond time base, mach_timebase_info() is always 1/1
+static inline uint64_t mach_continuous_time()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL
+         + static_cast<uint64_t>(ts.tv_nsec);
+}
+static inline uint64_t mach_absolute_time() { return mach_continuous_time(); }
+
+#endif // KSHIM_MACH_MACH_TIME_H
@@ -0,0 +1,20 @@
+//
+//  mach/mach_types.h
+//  kshim, see README
+//
+
+#ifndef KSHIM_MACH_MACH_TYPES_H
+#define KSHIM_MACH_MACH_TYPES_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <unistd.h>
+
+// Threads are pthreads, the thread id is the host's tid
+typedef pthread_t thread_t;
+
+static inline thread_t current_thread() { return pthread_self(); }
+static inline uint64_t thread_tid(thread_t)
+    { return static_cast<uint64_t>(gettid()); }
+
+#endif // KSHIM_MACH_MACH_TYPES_H
@@ -0,0 +1,20 @@
+//
+//  mach/vm_param.h
+//  kshim, see README
+//
+
+#ifndef KSHIM_MACH_VM_PARAM_H
+#define KSHIM_MACH_VM_PARAM_H
+
+#include <stdint.h>
+
+#ifndef PAGE_SIZE
+#define PAGE_SIZE 4096
+#endif
+#define PAGE_MASK (PAGE_SIZE - 1)
+#define round_page(x) \
+    ((static_cast<uintptr_t>(x) + PAGE_MASK) & ~static_cast<uintptr_t>(PAGE_MASK))
+#define trunc_page(x) \
+    (static_cast<uintptr_t>(x) & ~static_cast<uintptr_t>(PAGE_MASK))
+
+#endif // KSHIM_MACH_VM_PARAM_H
@@ -0,0 +1,19 @@
+//
+//  machine/cpu_number.h
+//  kshim, see README
+//
+
+#ifndef KSHIM_MACHINE_CPU_NUMBER_H
+#define KSHIM_MACHINE_CPU_NUMBER_H
+
+#include <sched.h>
+
+// The CPU can change under a running thread, as it can't in the kernel with
+// preemption disabled. The recorders only use it to pick a slice.
+static inline int cpu_number()
+{
+    const int cpu = sched_getcpu();
+    return (cpu < 0) ? 0 : cpu;
+}
+
+#endif // KSHIM_MACHINE_CPU_NUMBER_H
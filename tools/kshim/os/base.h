@@ -0,0 +1,18 @@
+//
+//  os/base.h
+//  kshim, see README
+//
+
+#ifndef KSHIM_OS_BASE_H
+#define KSHIM_OS_BASE_H
+
+#define OS_ENUM(_name, _type, ...) \
+    typedef enum : _type { __VA_ARGS__ } _name ## _t
+
+#ifdef __cplusplus
+#ifndef _Static_assert
+#define _Static_assert static_assert
+#endif
+#endif
+
+#endif // KSHIM_OS_BASE_H
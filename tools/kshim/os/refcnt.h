@@ -0,0 +1,54 @@
+//
+//  os/refcnt.h
+//  kshim, see README
+//
+
+#ifndef KSHIM_OS_REFCNT_H
+#define KSHIM_OS_REFCNT_H
+
+#include <assert.h>
+#include <stdint.h>
+
+#include <atomic>
+
+typedef uint32_t os_ref_count_t;
+struct os_refgrp;
+
+struct os_refcnt {
+    std::atomic<os_ref_count_t> ref_count;
+};
+
+static inline void os_ref_init(os_refcnt* rc, os_refgrp*)
+    { rc->ref_count.store(1, std::memory_order_relaxed); }
+
+static inline void os_ref_retain(os_refcnt* rc)
+{
+    const os_ref_count_t old
+        = rc->ref_count.fetch_add(1, std::memory_order_relaxed);
+    assert(old > 0);  // Resurrection
+    (void) old;
+}
+
+static inline bool os_ref_retain_try(os_refcnt* rc)
+{
+    os_ref_count_t cur = rc->ref_count.load(std::memory_order_relaxed);
+    do {
+        if (!cur)
+            return false;
+    } while (!rc->ref_count.compare_exchange_weak(
+                cur, cur + 1, std::memory_order_relaxed));
+    return true;
+}
+
+static inline os_ref_count_t os_ref_release(os_refcnt* rc)
+{
+    const os_ref_count_t old
+        = rc->ref_count.fetch_sub(1, std::memory_order_acq_rel);
+    assert(old > 0);  // Over release
+    return old - 1;
+}
+
+static inline os_ref_count_t os_ref_get_count(os_refcnt* rc)
+    { return rc->ref_count.load(std::memory_order_relaxed); }
+
+#endif // KSHIM_OS_REFCNT_H
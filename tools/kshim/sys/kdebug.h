@@ -0,0 +1,13 @@
+//
+//  sys/kdebug.h
+//  kshim, see README
+//
+
+#ifndef KSHIM_SYS_KDEBUG_H
+#define KSHIM_SYS_KDEBUG_H
+
+#define DBG_FUNC_START 1U
+#define DBG_FUNC_END   2U
+#define DBG_FUNC_NONE  0U
+
+#endif // KSHIM_SYS_KDEBUG_H
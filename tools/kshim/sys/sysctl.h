@@ -0,0 +1,26 @@
+//
+//  sys/sysctl.h
+//  kshim, see README
+//
+
+#ifndef KSHIM_SYS_SYSCTL_H
+#define KSHIM_SYS_SYSCTL_H
+
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+
+// Only hw.logicalcpu_max, the host's configured CPUs
+static inline int sysctlbyname(const char* name, void* oldp, size_t* oldlenp,
+                               void* newp, size_t newlen)
+{
+    if (strcmp(name, "hw.logicalcpu_max") || !oldp || !oldlenp
+    ||  *oldlenp < sizeof(int) || newp || newlen)
+        return EINVAL;
+    *static_cast<int*>(oldp) = static_cast<int>(sysconf(_SC_NPROCESSORS_CONF));
+    *oldlenp = sizeof(int);
+    return 0;
+}
+
+#endif // KSHIM_SYS_SYSCTL_H
@@ -0,0 +1,594 @@
+//
+//  previewbench.cpp
+//  IOGraphics
+//
+//  Host benchmarks of the hibernate preview compressor in bmcompress.h, built
+//  by tools/CMakeLists.txt against kshim/. Images are synthetic desktops: a
+//  gradient background, flat windows with text like runs and a noisy photo,
+//  and the same desktop under a lock screen panel. The blur is compared with
+//  the one tools/gaussblur.c prototyped, as the kernel had it before the
+//  luminance row rewrite.
+//
+//  previewbench [--benchmark_filter=<regex>]
+//
+
+#include <stdint.h>
+#include <string.h>
+
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include <IOKit/IOLib.h>
+#include <IOKit/IOHibernatePrivate.h>
+#include <IOKit/graphics/IOGraphicsPrivate.h>
+
+#include "bmcompress.h"
+
+namespace {
+
+constexpr uint32_t kImageCount = kIOPreviewImageCount;
+
+struct Desktop {
+    uint32_t width;
+    uint32_t height;
+    uint32_t rowbytes;
+    std::vector<uint32_t> pixels[kImageCount];
+    uint8_t* bits[kImageCount];
+};
+
+// xorshift, the images are the same on every run
+struct Random {
+    uint32_t fState;
+    explicit Random(uint32_t seed) : fState(seed ? seed : 1) {}
+    uint32_t next()
+    {
+        fState ^= fState << 13;
+        fState ^= fState >> 17;
+        fState ^= fState << 5;
+        return fState;
+    }
+    uint32_t below(uint32_t n) { return next() % n; }
+};
+
+void fillRect(Desktop& d, uint32_t image, uint32_t x, uint32_t y,
+              uint32_t w, uint32_t h, uint32_t color)
+{
+    for (uint32_t j = y; j < y + h && j < d.height; ++j)
+        for (uint32_t i = x; i < x + w && i < d.width; ++i)
+            d.pixels[image][j * d.width + i] = color;
+}
+
+void makeDesktop(Desktop& d, uint32_t width, uint32_t height)
+{
+    d.width = width;
+    d.height = height;
+    d.rowbytes = width * sizeof(uint32_t);
+
+    Random r(0x10de);
+    auto& px = d.pixels[0];
+    px.resize(static_cast<size_t>(width) * height);
+
+    for (uint32_t y = 0; y < height; ++y) {
+        const uint32_t c = (y * 255) / height;
+        fillRect(d, 0, 0, y, width, 1, (c << 16) | (0x40 << 8) | (255 - c));
+    }
+    fillRect(d, 0, 0, 0, width, height / 40, 0x00f0f0f0);  // menu bar
+
+    for (int win = 0; win < 4; ++win) {
+        const uint32_t w = width / 4 + r.below(width / 4);
+        const uint32_t h = height / 4 + r.below(height / 4);
+        const uint32_t x = r.below(width - w);
+        const uint32_t y = height / 40 + r.below(height - h - height / 40);
+        fillRect(d, 0, x, y, w, h, 0x00c0c0c0);
+        fillRect(d, 0, x + 1, y + 1, w - 2, h - 2, 0x00ffffff);
+        // text, short dark runs on every other line of a row of glyphs
+        for (uint32_t ty = y + 24; ty + 12 < y + h; ty += 16) {
+            for (uint32_t gy = ty; gy < ty + 10; gy += 2) {
+                uint32_t tx = x + 8;
+                while (tx + 8 < x + w - 8) {
+                    const uint32_t run = 1 + r.below(4);
+                    fillRect(d, 0, tx, gy, run, 1, 0x00202020 + r.below(0x40));
+                    tx += run + 1 + r.below(6);
+                }
+            }
+        }
+    }
+
+    // photo
+    const uint32_t pw = width / 5, ph = height / 5;
+    const uint32_t px0 = width - pw - width / 20, py0 = height - ph - height / 20;
+    for (uint32_t y = py0; y < py0 + ph; ++y)
+        for (uint32_t x = px0; x < px0 + pw; ++x)
+            px[y * width + x] = ((x & 0xff) << 16) | ((y & 0xff) << 8) | (r.next() & 0x1f);
+
+    // The other images are the same desktop under a lock screen panel
+    for (uint32_t image = 1; image < kImageCount; ++image) {
+        d.pixels[image] = px;
+        fillRect(d, image, width / 3, height / 3, width / 3, height / 4, 0x00303030);
+    }
+    for (uint32_t image = 0; image < kImageCount; ++image)
+        d.bits[image] = reinterpret_cast<uint8_t*>(d.pixels[image].data());
+}
+
+const Desktop& desktop(const benchmark::State& state)
+{
+    static Desktop cache;
+    const auto width = static_cast<uint32_t>(state.range(0));
+    const auto height = static_cast<uint32_t>(state.range(1));
+    if (cache.width != width || cache.height != height)
+        makeDesktop(cache, width, height);
+    return cache;
+}
+
+// The worst case the serial path reserved before streaming, see saveFramebuffer
+vm_size_t serialLength(const Desktop& d)
+{
+    const vm_size_t sLen = d.height * d.rowbytes;
+    vm_size_t dLen = 5 + sLen + ((sLen + 7) >> 3) + (d.height * 3) + d.rowbytes;
+    dLen = round_page(dLen * (kImageCount + 1));
+    if (dLen >= 96*1024*1024) dLen = 95*1024*1024;
+    return dLen;
+}
+
+int compressSerial(const Desktop& d, uint8_t* out, vm_size_t outLen)
+{
+    return CompressData(const_cast<uint8_t**>(d.bits), kImageCount,
+                        sizeof(uint32_t), 32, d.width, d.height, d.rowbytes,
+                        out, static_cast<uint32_t>(outLen), 3, 256, 8, nullptr);
+}
+
+uint8_t* compressBanded(const Desktop& d, vm_size_t* dataLength,
+                        vm_size_t* allocLength, bool dedupLines = false)
+{
+    vm_size_t skipOffset;
+    return CompressDataStream(const_cast<uint8_t**>(d.bits), kImageCount,
+                              sizeof(uint32_t), 32, d.width, d.height,
+                              d.rowbytes, 3, 256, 8, nullptr, dedupLines, false,
+                              &skipOffset, dataLength, allocLength);
+}
+
+// Every image of the deduped preview must decode back to the desktop
+bool decodesBack(const Desktop& d, uint8_t* preview)
+{
+    std::vector<uint32_t> out(static_cast<size_t>(d.width) * d.height);
+    for (uint32_t image = 0; image < kImageCount; ++image) {
+        DecompressState state;
+        if (!DecompressDataBegin(&state, preview, nullptr, image,
+                                 reinterpret_cast<uint8_t*>(out.data()),
+                                 d.rowbytes, 0, 0, d.width, d.height)
+         || !DecompressDataContinue(&state, d.height)
+         || out != d.pixels[image])
+            return false;
+    }
+    return true;
+}
+
+// The banded output must be byte identical to the serial one
+bool sameOutput(const Desktop& d)
+{
+    const vm_size_t serialLen = serialLength(d);
+    auto* serial = static_cast<uint8_t*>(IOMallocPageable(serialLen, page_size));
+    const int len = compressSerial(d, serial, serialLen);
+    vm_size_t dataLength, allocLength;
+    uint8_t* banded = compressBanded(d, &dataLength, &allocLength);
+    const bool same = banded && len && (static_cast<vm_size_t>(len) == dataLength)
+                   && !memcmp(serial, banded, dataLength);
+    if (banded)
+        IOFreePageable(banded, allocLength);
+    IOFreePageable(serial, serialLen);
+    return same;
+}
+
+void BM_PreviewCompressSerial(benchmark::State& state)
+{
+    const Desktop& d = desktop(state);
+    if (!sameOutput(d)) {
+        state.SkipWithError("banded output differs");
+        return;
+    }
+    int len = 0;
+    for (auto _ : state) {
+        const vm_size_t outLen = serialLength(d);
+        auto* out = static_cast<uint8_t*>(IOMallocPageable(outLen, page_size));
+        len = compressSerial(d, out, outLen);
+        benchmark::DoNotOptimize(out);
+        IOFreePageable(out, outLen);
+    }
+    state.counters["reserved"] = serialLength(d);
+    state.counters["compressed"] = len;
+    state.SetBytesProcessed(state.iterations() * kImageCount * d.height * d.rowbytes);
+}
+
+void BM_PreviewCompressBanded(benchmark::State& state)
+{
+    const Desktop& d = desktop(state);
+    if (!sameOutput(d)) {
+        state.SkipWithError("banded output differs");
+        return;
+    }
+    vm_size_t dataLength = 0, allocLength = 0;
+    for (auto _ : state) {
+        uint8_t* out = compressBanded(d, &dataLength, &allocLength);
+        benchmark::DoNotOptimize(out);
+        if (out)
+            IOFreePageable(out, allocLength);
+    }
+    state.counters["reserved"] = allocLength;
+    state.counters["compressed"] = dataLength;
+    state.SetBytesProcessed(state.iterations() * kImageCount * d.height * d.rowbytes);
+}
+
+// Line dedup across the whole preview, reports the size it saves
+void BM_PreviewCompressDedup(benchmark::State& state)
+{
+    const Desktop& d = desktop(state);
+    vm_size_t plainLength, dataLength = 0, allocLength = 0;
+    uint8_t* out = compressBanded(d, &plainLength, &allocLength);
+    if (out)
+        IOFreePageable(out, allocLength);
+    out = compressBanded(d, &dataLength, &allocLength, true);
+    const bool ok = out && decodesBack(d, out);
+    if (out)
+        IOFreePageable(out, allocLength);
+    if (!ok) {
+        state.SkipWithError("deduped preview doesn't decode");
+        return;
+    }
+
+    for (auto _ : state) {
+        out = compressBanded(d, &dataLength, &allocLength, true);
+        benchmark::DoNotOptimize(out);
+        if (out)
+            IOFreePageable(out, allocLength);
+    }
+    state.counters["undeduped"] = plainLength;
+    state.counters["compressed"] = dataLength;
+    state.counters["saved%"] = 100.0 * (plainLength - dataLength) / plainLength;
+    state.SetBytesProcessed(state.iterations() * kImageCount * d.height * d.rowbytes);
+}
+
+// The blur as it was, unchanged, the reference for the ±1 LSB check
+
+
+static void 
+PreviewDecompress16_v0(const hibernate_preview_t * src, uint32_t image,
+                        uint32_t width, uint32_t height, uint32_t row, 
+                        uint16_t * output)
+{
+    uint32_t i, j;
+    uint32_t * input;
+    
+    uint16_t * sc0 = IONew(uint16_t, (width+2));
+    uint16_t * sc1 = IONew(uint16_t, (width+2));
+    uint16_t * sc2 = IONew(uint16_t, (width+2));
+    uint16_t * sc3 = IONew(uint16_t, (width+2));
+    uint32_t   sr0, sr1, sr2, sr3;
+
+    bzero(sc0, (width+2) * sizeof(uint16_t));
+    bzero(sc1, (width+2) * sizeof(uint16_t));
+    bzero(sc2, (width+2) * sizeof(uint16_t));
+    bzero(sc3, (width+2) * sizeof(uint16_t));
+
+    uint32_t tmp1, tmp2, out;
+    for (j = 0; j < (height + 2); j++)
+    {
+    	input = (IOGRAPHICS_TYPEOF(input)) (src + 1);
+    	input += image * height;
+        if (j < height)
+            input += j;
+        else
+            input += height - 1;
+        input = (uint32_t *)(input[0] + ((uint8_t *)src));
+
+        uint32_t data = 0, repeat = 0, fetch, count = 0;
+        sr0 = sr1 = sr2 = sr3 = 0;
+
+        for (i = 0; i < (width + 2); i++)
+        {
+            if (i < width)
+            {
+                if (!count)
+                {
+                    count = *input++;
+                    repeat = (count & 0xff000000);
+                    count ^= repeat;
+                    fetch = true;
+                }
+                else
+                    fetch = (0 == repeat);
+    
+                count--;
+    
+                if (fetch)
+                {
+                    data = *((uint16_t *)input);
+                    input = (uint32_t *)(((uint8_t *) input) + sizeof(uint16_t));
+    
+                    // grayscale
+                    // srgb 13933, 46871, 4732
+                    // ntsc 19595, 38470, 7471
+                    data = 13933 * (0x1f & (data >> 10))
+                         + 46871 * (0x1f & (data >> 5))
+                         +  4732 * (0x1f & data);
+                    data >>= 13;
+        
+                    // 70% white, 30 % black
+                    data *= 19661;
+                    data += (103 << 16);
+                    data >>= 16;
+                }
+            }
+
+            // gauss blur
+            tmp2 = sr0 + data;
+            sr0 = data;
+            tmp1 = sr1 + tmp2;
+            sr1 = tmp2;
+            tmp2 = sr2 + tmp1;
+            sr2 = tmp1;
+            tmp1 = sr3 + tmp2;
+            sr3 = tmp2;
+            
+            tmp2 = sc0[i] + tmp1;
+            sc0[i] = tmp1;
+            tmp1 = sc1[i] + tmp2;
+            sc1[i] = tmp2;
+            tmp2 = sc2[i] + tmp1;
+            sc2[i] = tmp1;
+            out = (128 + sc3[i] + tmp2) >> 11;
+            sc3[i] = tmp2;
+
+            out &= 0x1f;
+            if ((i > 1) && (j > 1))
+                output[i-2] = out | (out << 5) | (out << 10);
+        }
+
+        if (j > 1)
+            output += row;
+    }
+    IODelete(sc3, uint16_t, (width+2));
+    IODelete(sc2, uint16_t, (width+2));
+    IODelete(sc1, uint16_t, (width+2));
+    IODelete(sc0, uint16_t, (width+2));
+}
+
+static void 
+PreviewDecompress32_v0(const hibernate_preview_t * src, uint32_t image,
+                        uint32_t width, uint32_t height, uint32_t row, 
+                        uint32_t * output)
+{
+    uint32_t i, j;
+    uint32_t * input;
+    
+    uint16_t * sc0 = IONew(uint16_t, (width+2));
+    uint16_t * sc1 = IONew(uint16_t, (width+2));
+    uint16_t * sc2 = IONew(uint16_t, (width+2));
+    uint16_t * sc3 = IONew(uint16_t, (width+2));
+    uint32_t   sr0, sr1, sr2, sr3;
+
+    bzero(sc0, (width+2) * sizeof(uint16_t));
+    bzero(sc1, (width+2) * sizeof(uint16_t));
+    bzero(sc2, (width+2) * sizeof(uint16_t));
+    bzero(sc3, (width+2) * sizeof(uint16_t));
+
+    uint32_t tmp1, tmp2, out;
+    for (j = 0; j < (height + 2); j++)
+    {
+    	input = (IOGRAPHICS_TYPEOF(input)) (src + 1);
+    	input += image * height;
+        if (j < height)
+            input += j;
+        else
+            input += height - 1;
+        input = (uint32_t *)(input[0] + ((uint8_t *)src));
+
+        uint32_t data = 0, repeat = 0, fetch, count = 0;
+        sr0 = sr1 = sr2 = sr3 = 0;
+
+        for (i = 0; i < (width + 2); i++)
+        {
+            if (i < width)
+            {
+                if (!count)
+                {
+                    count = *input++;
+                    repeat = (count & 0xff000000);
+                    count ^= repeat;
+                    fetch = true;
+                }
+                else
+                    fetch = (0 == repeat);
+    
+                count--;
+    
+                if (fetch)
+                {
+                    data = *input++;
+    
+                    // grayscale
+                    // srgb 13933, 46871, 4732
+                    // ntsc 19595, 38470, 7471
+                    data = 13933 * (0xff & (data >> 24))
+                         + 46871 * (0xff & (data >> 16))
+                         +  4732 * (0xff & data);
+                    data >>= 16;
+        
+                    // 70% white, 30 % black
+                    data *= 19661;
+                    data += (103 << 16);
+                    data >>= 16;
+                }
+            }
+
+            // gauss blur
+            tmp2 = sr0 + data;
+            sr0 = data;
+            tmp1 = sr1 + tmp2;
+            sr1 = tmp2;
+            tmp2 = sr2 + tmp1;
+            sr2 = tmp1;
+            tmp1 = sr3 + tmp2;
+            sr3 = tmp2;
+            
+            tmp2 = sc0[i] + tmp1;
+            sc0[i] = tmp1;
+            tmp1 = sc1[i] + tmp2;
+            sc1[i] = tmp2;
+            tmp2 = sc2[i] + tmp1;
+            sc2[i] = tmp1;
+            out = (128 + sc3[i] + tmp2) >> 8;
+            sc3[i] = tmp2;
+
+            out &= 0xff;
+            if ((i > 1) && (j > 1))
+                output[i-2] = out | (out << 8) | (out << 16);
+        }
+
+        if (j > 1)
+            output += row;
+    }
+
+    IODelete(sc3, uint16_t, (width+2));
+    IODelete(sc2, uint16_t, (width+2));
+    IODelete(sc1, uint16_t, (width+2));
+    IODelete(sc0, uint16_t, (width+2));
+}
+
+// The desktop at 16 or 32 bpp, compressed as saveFramebuffer() does
+struct Preview {
+    std::vector<uint16_t> pixels16[kImageCount];
+    uint8_t* bits[kImageCount];
+    uint8_t* data = nullptr;
+    vm_size_t allocLength = 0;
+
+    Preview(const Desktop& d, uint32_t pixelBits)
+    {
+        const uint32_t pixelBytes = pixelBits / 8;
+        for (uint32_t image = 0; image < kImageCount; ++image) {
+            bits[image] = d.bits[image];
+            if (16 != pixelBits)
+                continue;
+            auto& px = pixels16[image];
+            px.resize(d.pixels[image].size());
+            for (size_t i = 0; i < px.size(); ++i) {
+                const uint32_t c = d.pixels[image][i];
+                px[i] = static_cast<uint16_t>(((c >> 9) & 0x7c00)
+                                            | ((c >> 6) & 0x03e0)
+                                            | ((c >> 3) & 0x001f));
+            }
+            bits[image] = reinterpret_cast<uint8_t*>(px.data());
+        }
+        vm_size_t skipOffset, dataLength;
+        data = CompressDataStream(bits, kImageCount, pixelBytes, pixelBits,
+                                  d.width, d.height, d.width * pixelBytes,
+                                  3, 256, 8, nullptr, true, true,
+                                  &skipOffset, &dataLength, &allocLength);
+    }
+    ~Preview()
+    {
+        if (data)
+            IOFreePageable(data, allocLength);
+    }
+};
+
+void blurReference(const Preview& p, uint32_t width, uint32_t height,
+                   uint32_t pixelBits, void* out)
+{
+    const auto* src = reinterpret_cast<const hibernate_preview_t*>(p.data);
+    if (16 == pixelBits)
+        PreviewDecompress16_v0(src, 0, width, height, width, static_cast<uint16_t*>(out));
+    else
+        PreviewDecompress32_v0(src, 0, width, height, width, static_cast<uint32_t*>(out));
+}
+
+bool blur(const Preview& p, uint32_t width, uint32_t height,
+          uint32_t pixelBits, void* out)
+{
+    const uint32_t pixelBytes = pixelBits / 8;
+    return PreviewDecompressData(p.data, 0, out, width, height, pixelBytes,
+                                 width * pixelBytes);
+}
+
+// Every channel of every pixel within 1 of the reference
+bool withinOneLSB(const Preview& p, uint32_t width, uint32_t height,
+                  uint32_t pixelBits)
+{
+    const size_t count = static_cast<size_t>(width) * height;
+    std::vector<uint32_t> want(count), got(count);
+    blurReference(p, width, height, pixelBits, want.data());
+    if (!blur(p, width, height, pixelBits, got.data()))
+        return false;
+
+    const uint32_t channelBits = (16 == pixelBits) ? 5 : 8;
+    const uint32_t channels = (16 == pixelBits) ? 2 * 3 : 3;  // Two per word
+    const uint32_t mask = (1U << channelBits) - 1;
+    for (size_t i = 0; i < count * pixelBits / 32; ++i) {
+        for (uint32_t c = 0; c < channels; ++c) {
+            const uint32_t shift = c * channelBits + ((c >= 3) ? 1 : 0);
+            const int a = (want[i] >> shift) & mask;
+            const int b = (got[i] >> shift) & mask;
+            if (a - b > 1 || b - a > 1)
+                return false;
+        }
+    }
+    return true;
+}
+
+void BM_PreviewBlurReference(benchmark::State& state)
+{
+    const Desktop& d = desktop(state);
+    const auto pixelBits = static_cast<uint32_t>(state.range(2));
+    const Preview p(d, pixelBits);
+    if (!p.data) {
+        state.SkipWithError("compress failed");
+        return;
+    }
+    std::vector<uint32_t> out(static_cast<size_t>(d.width) * d.height);
+    for (auto _ : state) {
+        blurReference(p, d.width, d.height, pixelBits, out.data());
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.SetItemsProcessed(state.iterations() * d.width * d.height);
+}
+
+void BM_PreviewBlur(benchmark::State& state)
+{
+    const Desktop& d = desktop(state);
+    const auto pixelBits = static_cast<uint32_t>(state.range(2));
+    const Preview p(d, pixelBits);
+    if (!p.data || !withinOneLSB(p, d.width, d.height, pixelBits)) {
+        state.SkipWithError("blur differs from the reference by more than 1");
+        return;
+    }
+    std::vector<uint32_t> out(static_cast<size_t>(d.width) * d.height);
+    for (auto _ : state) {
+        blur(p, d.width, d.height, pixelBits, out.data());
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.SetItemsProcessed(state.iterations() * d.width * d.height);
+}
+
+void Sizes(benchmark::internal::Benchmark* b)
+{
+    b->Args({1440, 900})->Args({2880, 1800})->Args({5120, 2880});
+}
+
+// Sizes at 16 and 32 bpp
+void BlurSizes(benchmark::internal::Benchmark* b)
+{
+    for (const int64_t bits : { 16, 32 })
+        b->Args({1440, 900, bits})->Args({2880, 1800, bits})->Args({5120, 2880, bits});
+}
+
+};  // namespace
+
+BENCHMARK(BM_PreviewCompressSerial)->Apply(Sizes)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_PreviewCompressBanded)->Apply(Sizes)->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+BENCHMARK(BM_PreviewCompressDedup)->Apply(Sizes)->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+BENCHMARK(BM_PreviewBlurReference)->Apply(BlurSizes)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_PreviewBlur)->Apply(BlurSizes)->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,121 @@
+//
+//  renderbench.cpp
+//  IOGraphics
+//
+//  Host benchmarks of iogdiagnose's token rendering, writeEntries() in
+//  iogdiagnose/IOGDiagnoseRender.hpp against the line at a time path before it
+//  in renderv0.h. The capture is synthetic and full, 32 buffers of 8192
+//  tokens, written to /dev/null. Both must render it to the same text, which
+//  is checked first. The argument is the number of formatting threads besides
+//  the writer.
+//
+//  renderbench [--benchmark_filter=<regex>]
+//
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "IOGDiagnoseRender.hpp"
+#include "renderv0.h"
+
+namespace {
+
+constexpr size_t kBuffers = 32;
+constexpr size_t kLines = 8192;
+
+// Tokens of every width, from small args and line numbers to full pointers
+struct Capture
+{
+    std::vector<GTraceEntry>        fTokens;
+    std::vector<const GTraceEntry*> fEntries;
+
+    Capture() : fTokens(kBuffers * kLines)
+    {
+        std::mt19937_64 rng(1);
+        uint64_t timestamp = 1000000000;
+        for (size_t i = 0; i < fTokens.size(); ++i) {
+            const uint64_t bits = rng();
+            const int shift = static_cast<int>(bits & 63);
+            timestamp += bits >> 52;
+            fTokens[i] = GTraceEntry(timestamp,
+                    static_cast<uint16_t>(bits >> 8), i / kLines,
+                    static_cast<uint8_t>(bits >> 24), bits >> 32,
+                    static_cast<uint32_t>(bits >> 16),
+                    rng(), rng() >> shift, rng() >> (shift / 2),
+                    (i & 1) ? rng() : 0, rng() & 0xffff);
+            fEntries.push_back(&fTokens[i]);
+        }
+    }
+};
+
+const Capture& capture()
+{
+    static const Capture sCapture;
+    return sCapture;
+}
+
+std::string render(void (*writer)(FILE*, const Capture&))
+{
+    char* text = nullptr;
+    size_t len = 0;
+    FILE* out = open_memstream(&text, &len);
+    writer(out, capture());
+    fclose(out);
+    std::string ret(text, len);
+    free(text);
+    return ret;
+}
+
+void writeV0(FILE* out, const Capture& c)  { writeEntries_v0(out, c.fEntries, 1); }
+void writeNew(FILE* out, const Capture& c) { writeEntries(out, c.fEntries, 1, 3); }
+
+void BM_RenderV0(benchmark::State& state)
+{
+    const Capture& c = capture();
+    FILE* out = fopen("/dev/null", "w");
+    for (auto _ : state)
+        writeEntries_v0(out, c.fEntries, 1);
+    fclose(out);
+    state.SetItemsProcessed(state.iterations() * c.fEntries.size());
+}
+
+void BM_Render(benchmark::State& state)
+{
+    if (render(writeV0) != render(writeNew)) {
+        state.SkipWithError("text differs");
+        return;
+    }
+    const Capture& c = capture();
+    const size_t workers = static_cast<size_t>(state.range(0));
+    FILE* out = fopen("/dev/null", "w");
+    for (auto _ : state)
+        writeEntries(out, c.fEntries, 1, workers);
+    fclose(out);
+    state.SetItemsProcessed(state.iterations() * c.fEntries.size());
+}
+
+void Workers(benchmark::internal::Benchmark* b)
+{
+    const int cpus = static_cast<int>(std::thread::hardware_concurrency());
+    b->Arg(0);
+    for (int workers = 1; workers < cpus; workers *= 2)
+        b->Arg(workers);
+    if (cpus > 1)
+        b->Arg(cpus - 1);  // As iogdiagnose runs
+}
+
+};  // namespace
+
+BENCHMARK(BM_RenderV0)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK(BM_Render)->Apply(Workers)->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -0,0 +1,57 @@
+//
+//  renderv0.h
+//  IOGraphics
+//
+//  iogdiagnose's token rendering from before IOGDiagnoseRender.hpp, kept as it
+//  was, for renderbench. Every line goes through vsnprintf into a std::string
+//  and is written with its own fputs().
+//
+
+#ifndef RENDERV0_H
+#define RENDERV0_H
+
+#include <assert.h>
+#include <stdarg.h>
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include "IOKit/graphics/GTraceTypes.hpp"
+
+inline std::string stringf_v0(const char *fmt, ...)
+{
+    va_list args;
+    char buffer[1024]; // pretty big, but userland stacks are big
+
+    va_start(args, fmt);
+    const auto len = vsnprintf(buffer, sizeof(buffer), fmt, args);
+    va_end(args);
+    assert(len < static_cast<int>(sizeof(buffer))); (void) len;
+    return buffer;
+}
+
+inline std::string formatEntry_v0(const int currentLine, const GTraceEntry& entry)
+{
+    return stringf_v0(
+            "\t\tTkn: %06u\tTS: %llu\tLn: %u\tC: %#llx\tCTID: %u-%#llx\t"
+            "OID: %#llx\tTag: %#llx\tA: %#llx-%#llx-%#llx-%#llx\n",
+            currentLine, entry.timestamp(), entry.line(), entry.component(),
+            entry.cpu(), entry.threadID(), entry.registryID(),
+            entry.tag(), entry.arg64(0), entry.arg64(1),
+            entry.arg64(2), entry.arg64(3));
+}
+
+// dumpTokenBuffer()'s loop over the buffers' entries
+inline void writeEntries_v0(FILE* outfile,
+                            const std::vector<const GTraceEntry*>& entries,
+                            unsigned currentLine)
+{
+    std::string line;
+    for (const GTraceEntry* entry : entries) {
+        line = formatEntry_v0(currentLine++, *entry);
+        fputs(line.c_str(), outfile);
+    }
+}
+
+#endif // RENDERV0_H
@@ -0,0 +1,133 @@
+/*
+cc -I../IOGraphicsFamily -o /tmp/vblsim vblsim.c -Wall
+*/
+
+/*
+** Feeds IOFBVBLEstimate with simulated VBL interrupts and measures how far
+** the predicted next VBL is from the real one, against the prediction
+** getTimeOfVBL() made from vblTime and vblDeltaReal alone. Times are ns.
+**
+** vblsim [period ppm latency jitter throttle]
+**   period    real VBL interval (16683350, 59.94Hz)
+**   ppm       error of the timing derived period (200)
+**   latency   mean interrupt latency (20000)
+**   jitter    interrupt latency spread, +- (15000)
+**   throttle  frames between interrupts seen, 0 for every VBL (30)
+*/
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "IOFBVBLEstimate.h"
+
+#define VBLANKNS    500000      // deadlines this close after a VBL land inside vblank
+#define TRIALS      20000
+#define MAXFRAMES   (TRIALS * 1000ULL)   // gives up on an estimate that never locks
+
+static uint64_t seed = 0x9e3779b97f4a7c15ULL;
+
+static uint64_t rnd(void)
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return (seed);
+}
+
+struct Stats
+{
+    uint64_t count;
+    uint64_t inside;
+    double   sum;
+    int64_t  max;
+};
+
+static void account(struct Stats * stats, int64_t error)
+{
+    int64_t mag = (error < 0) ? -error : error;
+
+    stats->count++;
+    stats->sum += mag;
+    if (mag > stats->max) stats->max = mag;
+    if ((error >= 0) && (error < VBLANKNS)) stats->inside++;
+}
+
+static void report(const char * name, const struct Stats * stats)
+{
+    printf("%-9s mean %8.0f ns  max %8lld ns  inside vblank %5.1f%%\n", name,
+           stats->count ? stats->sum / stats->count : 0.0,
+           (long long) stats->max,
+           stats->count ? (stats->inside * 100.0) / stats->count : 0.0);
+}
+
+int main(int argc, char * argv[])
+{
+    uint64_t period   = 16683350;
+    int64_t  ppm      = 200;
+    uint64_t latency  = 20000;
+    uint64_t jitter   = 15000;
+    uint64_t throttle = 30;
+    IOFBVBLEstimate est = { 0 };
+    struct Stats oldStats = { 0 }, newStats = { 0 };
+    uint64_t vbl, seen, lastSeen, nominal, deltaReal;
+    uint64_t frame, trial, unlocked;
+
+    if (argc > 1) period   = strtoull(argv[1], 0, 0);
+    if (argc > 2) ppm      = strtoll(argv[2], 0, 0);
+    if (argc > 3) latency  = strtoull(argv[3], 0, 0);
+    if (argc > 4) jitter   = strtoull(argv[4], 0, 0);
+    if (argc > 5) throttle = strtoull(argv[5], 0, 0);
+    if (jitter > latency) jitter = latency;
+
+    // Throttled, the period comes from the timing, otherwise the last interval
+    nominal   = throttle ? (uint64_t) (period + (int64_t) period * ppm / 1000000) : 0;
+    deltaReal = nominal;
+    vbl       = 1000000000ULL;
+    lastSeen  = 0;
+    unlocked  = 0;
+
+    for (frame = 0, trial = 0; (trial < TRIALS) && (frame < MAXFRAMES); frame++)
+    {
+        vbl += period;
+        // throttled interrupts are enabled by a timer, so gaps vary
+        if (throttle && (frame % throttle) && (rnd() % 8)) continue;
+
+        seen = vbl + latency - jitter + (jitter ? rnd() % (2 * jitter + 1) : 0);
+        if (!throttle && lastSeen) deltaReal = seen - lastSeen;
+        lastSeen = seen;
+        IOFBVBLEstimateUpdate(&est, seen, nominal);
+
+        // A deadline is asked for at some point before the next interrupt
+        uint64_t gap = throttle ? throttle : 1;
+        uint64_t now = seen + rnd() % (gap * period);
+        uint64_t next = vbl + ((now - vbl) / period + 1) * period;
+        if (now < vbl) continue;
+
+        if (deltaReal)
+        {
+            uint64_t deadline = now + deltaReal - ((now - lastSeen) % deltaReal);
+            account(&oldStats, (int64_t) (deadline - next));
+        }
+        if (!IOFBVBLEstimateLocked(&est, now))
+        {
+            unlocked++;
+            continue;
+        }
+        // Both lock onto the interrupts, so are late by the latency
+        account(&newStats, (int64_t) (IOFBVBLEstimateNext(&est, now, 1) - next));
+        trial++;
+    }
+
+    printf("period %llu ns, timing error %lld ppm, latency %llu +- %llu ns, %s\n",
+           (unsigned long long) period, (long long) ppm,
+           (unsigned long long) latency, (unsigned long long) jitter,
+           throttle ? "throttled" : "every VBL");
+    printf("estimated period %.1f ns, %u restarts, %llu deadlines before lock\n",
+           (double) est.period / (1 << kIOFBVBLPeriodFrac), est.resets,
+           (unsigned long long) unlocked);
+    report("vblTime", &oldStats);
+    report("estimate", &newStats);
+
+    return (0);
+}